@@ -0,0 +1,369 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// One entry per material in the bindless material buffer. Mirrors Material in bindless.frag; the
+// texture members are indices into the bindless texture array.
+struct BindlessMaterial {
+    glm::vec4 baseColorFactor;
+    uint32_t baseColorTexture;
+    uint32_t normalTexture;
+    uint32_t padding[2];
+};
+
+struct BindlessSupport {
+    bool supported = false;
+    uint32_t maxTextures = 0;
+    uint32_t maxStorageBuffers = 0;
+};
+
+// Descriptor indexing is core in Vulkan 1.2 and VK_EXT_descriptor_indexing before that. The features
+// checked here have to be enabled in createLogicalDevice() through VkPhysicalDeviceVulkan12Features,
+// or on a 1.1 device through VkPhysicalDeviceDescriptorIndexingFeaturesEXT with the extension added to
+// deviceExtensions.
+inline BindlessSupport queryBindlessSupport(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    BindlessSupport support;
+    bool core = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_2;
+    if (!core && !hasDeviceExtension(physicalDevice, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+        return support;
+    }
+
+    // The Vulkan 1.2 structs are only valid on a 1.2 device; the extension structs carry the same
+    // members under the same names.
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = core ? static_cast<void*>(&vulkan12Features) : static_cast<void*>(&indexingFeatures);
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+
+    VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+    vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = core ? static_cast<void*>(&vulkan12Properties) : static_cast<void*>(&indexingProperties);
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    if (core) {
+        support.supported = vulkan12Features.descriptorIndexing == VK_TRUE
+            && vulkan12Features.shaderSampledImageArrayNonUniformIndexing == VK_TRUE
+            && vulkan12Features.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE
+            && vulkan12Features.descriptorBindingUpdateUnusedWhilePending == VK_TRUE
+            && vulkan12Features.descriptorBindingPartiallyBound == VK_TRUE
+            && vulkan12Features.descriptorBindingVariableDescriptorCount == VK_TRUE
+            && vulkan12Features.runtimeDescriptorArray == VK_TRUE;
+        support.maxTextures = std::min(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages, vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages);
+        support.maxStorageBuffers = std::min(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers, vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers);
+    } else {
+        support.supported = indexingFeatures.shaderSampledImageArrayNonUniformIndexing == VK_TRUE
+            && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE
+            && indexingFeatures.descriptorBindingUpdateUnusedWhilePending == VK_TRUE
+            && indexingFeatures.descriptorBindingPartiallyBound == VK_TRUE
+            && indexingFeatures.descriptorBindingVariableDescriptorCount == VK_TRUE
+            && indexingFeatures.runtimeDescriptorArray == VK_TRUE;
+        support.maxTextures = std::min(indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages);
+        support.maxStorageBuffers = std::min(indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers, indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers);
+    }
+    return support;
+}
+
+// A descriptor set holding every texture and material of the scene, replacing one combined image
+// sampler set per texture. Materials refer to textures by their slot in the array, so draws no longer
+// have to be split or sorted by texture: the set is bound once per command buffer and the fragment
+// shader picks the texture with nonuniformEXT(material.baseColorTexture).
+//
+// Binding 0 is the material storage buffer, binding 1 the texture array. The array is partially bound,
+// update after bind and update unused while pending, so textures can be added to free slots while
+// earlier frames are still in flight. A slot that a pending command buffer may sample must not be
+// rewritten; with one set per frame in flight, writeFrameTexture() changes a slot in the set of a frame
+// whose fence has been waited on while the other frames keep sampling what their own sets hold.
+class BindlessDescriptors {
+public:
+    static const uint32_t MATERIAL_BINDING = 0;
+    static const uint32_t TEXTURE_BINDING = 1;
+
+    // frameCount sets share the textures and the material buffer; bind() takes the frame's set.
+    void create(const VulkanContext& context, uint32_t maxTextures, uint32_t maxMaterials, uint32_t frameCount = 1) {
+        this->context = context;
+        this->maxMaterials = maxMaterials;
+        dispatch = &getDeviceTable(context.device);
+
+        BindlessSupport support = queryBindlessSupport(context.physicalDevice);
+        if (!support.supported) {
+            throw std::runtime_error("descriptor indexing is not supported!");
+        }
+        this->maxTextures = std::min(maxTextures, support.maxTextures);
+
+        freeTextureSlots.clear();
+        for (uint32_t i = this->maxTextures; i > 0; i--) {
+            freeTextureSlots.push_back(i - 1);
+        }
+        materialCount = 0;
+
+        createBuffer(context, sizeof(BindlessMaterial) * maxMaterials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialBuffer, materialMemory);
+
+        createDescriptorSetLayout();
+        createDescriptorPool(frameCount);
+        createDescriptorSets(frameCount);
+    }
+
+    void cleanup() {
+        descriptorPool.reset();
+        descriptorSets.clear();
+        descriptorSetLayout.reset();
+        materialBuffer.reset();
+        materialMemory.reset();
+    }
+
+    // Returns the slot that materials use to refer to the texture.
+    uint32_t addTexture(VkImageView imageView, VkSampler sampler) {
+        if (freeTextureSlots.empty()) {
+            throw std::runtime_error("bindless texture array is full!");
+        }
+
+        uint32_t slot = freeTextureSlots.back();
+        freeTextureSlots.pop_back();
+        for (uint32_t frame = 0; frame < descriptorSets.size(); frame++) {
+            writeFrameTexture(frame, slot, imageView, sampler);
+        }
+        return slot;
+    }
+
+    // Points a slot of one frame's set at another image, e.g. when a streamed texture gains mip
+    // levels. Only once the frame's fence has been waited on, since its set may be in use until then.
+    void writeFrameTexture(uint32_t frame, uint32_t slot, VkImageView imageView, VkSampler sampler) {
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = imageView;
+        imageInfo.sampler = sampler;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSets[frame];
+        descriptorWrite.dstBinding = TEXTURE_BINDING;
+        descriptorWrite.dstArrayElement = slot;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    // The slot is handed out again by the next addTexture(), so only remove textures that no frame in
+    // flight samples any more.
+    void removeTexture(uint32_t slot) {
+        freeTextureSlots.push_back(slot);
+    }
+
+    uint32_t addMaterial(const BindlessMaterial& material) {
+        if (materialCount == maxMaterials) {
+            throw std::runtime_error("bindless material buffer is full!");
+        }
+
+        uint32_t index = materialCount++;
+        updateMaterial(index, material);
+        return index;
+    }
+
+    void updateMaterial(uint32_t index, const BindlessMaterial& material) {
+        uploadToBuffer(context, materialBuffer, &material, sizeof(BindlessMaterial), sizeof(BindlessMaterial) * index);
+    }
+
+    // Once per command buffer, for every pipeline whose layout has the bindless set at index set.
+    void bind(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t set, uint32_t frame = 0) const {
+        dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, set, 1, &descriptorSets[frame], 0, nullptr);
+    }
+
+    VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    uint32_t getFrameCount() const { return static_cast<uint32_t>(descriptorSets.size()); }
+    uint32_t getMaxTextures() const { return maxTextures; }
+    uint32_t getTextureCount() const { return maxTextures - static_cast<uint32_t>(freeTextureSlots.size()); }
+    uint32_t getMaterialCount() const { return materialCount; }
+
+private:
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t maxTextures = 0;
+    uint32_t maxMaterials = 0;
+    uint32_t materialCount = 0;
+    std::vector<uint32_t> freeTextureSlots;
+
+    UniqueDeviceMemory materialMemory;
+    UniqueBuffer materialBuffer;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+    std::vector<VkDescriptorSet> descriptorSets;
+
+    void createDescriptorSetLayout() {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[MATERIAL_BINDING].binding = MATERIAL_BINDING;
+        bindings[MATERIAL_BINDING].descriptorCount = 1;
+        bindings[MATERIAL_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[MATERIAL_BINDING].pImmutableSamplers = nullptr;
+        bindings[MATERIAL_BINDING].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        bindings[TEXTURE_BINDING].binding = TEXTURE_BINDING;
+        bindings[TEXTURE_BINDING].descriptorCount = maxTextures;
+        bindings[TEXTURE_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[TEXTURE_BINDING].pImmutableSamplers = nullptr;
+        bindings[TEXTURE_BINDING].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        // Only the last binding of a set may have a variable descriptor count.
+        std::array<VkDescriptorBindingFlags, 2> bindingFlags{};
+        bindingFlags[MATERIAL_BINDING] = 0;
+        bindingFlags[TEXTURE_BINDING] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+            | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+        bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+        bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext = &bindingFlagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create bindless descriptor set layout!");
+        }
+    }
+
+    void createDescriptorPool(uint32_t frameCount) {
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[0].descriptorCount = frameCount;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[1].descriptorCount = maxTextures * frameCount;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = frameCount;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create bindless descriptor pool!");
+        }
+    }
+
+    void createDescriptorSets(uint32_t frameCount) {
+        std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+        std::vector<uint32_t> descriptorCounts(frameCount, maxTextures);
+
+        VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+        countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+        countInfo.descriptorSetCount = frameCount;
+        countInfo.pDescriptorCounts = descriptorCounts.data();
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.pNext = &countInfo;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = frameCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        descriptorSets.resize(frameCount);
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate bindless descriptor set!");
+        }
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = materialBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(BindlessMaterial) * maxMaterials;
+
+        for (VkDescriptorSet descriptorSet : descriptorSets) {
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = descriptorSet;
+            descriptorWrite.dstBinding = MATERIAL_BINDING;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+};
+
+// One draw as the renderer submits it, for counting the state changes of a frame.
+struct StateChangeDraw {
+    uint32_t pipeline;
+    uint32_t texture;
+};
+
+struct StateChangeStats {
+    uint32_t draws = 0;
+    uint32_t pipelineBinds = 0;
+    uint32_t descriptorSetBinds = 0;
+    uint32_t indirectBatches = 0; // runs of draws one vkCmdDrawIndexedIndirect call can cover
+};
+
+// Counts the binds a frame needs after sorting the draws to minimise them. With a set per texture
+// every texture change costs a descriptor set bind and ends the indirect batch; bindless binds its set
+// once and only pipeline changes split batches.
+inline StateChangeStats countStateChanges(std::vector<StateChangeDraw> draws, bool bindless) {
+    std::stable_sort(draws.begin(), draws.end(), [bindless](const StateChangeDraw& a, const StateChangeDraw& b) {
+        if (a.pipeline != b.pipeline || bindless) {
+            return a.pipeline < b.pipeline;
+        }
+        return a.texture < b.texture;
+    });
+
+    StateChangeStats stats;
+    stats.draws = static_cast<uint32_t>(draws.size());
+    stats.descriptorSetBinds = bindless && !draws.empty() ? 1 : 0;
+
+    for (size_t i = 0; i < draws.size(); i++) {
+        bool pipelineChanged = i == 0 || draws[i].pipeline != draws[i - 1].pipeline;
+        bool textureChanged = i == 0 || draws[i].texture != draws[i - 1].texture;
+
+        if (pipelineChanged) {
+            stats.pipelineBinds++;
+        }
+        if (!bindless && (pipelineChanged || textureChanged)) {
+            stats.descriptorSetBinds++;
+        }
+        if (pipelineChanged || (!bindless && textureChanged)) {
+            stats.indirectBatches++;
+        }
+    }
+
+    return stats;
+}
+
+inline void printStateChangeComparison(const std::vector<StateChangeDraw>& draws) {
+    const char* names[] = {"descriptor set per texture", "bindless"};
+    for (int bindless = 0; bindless < 2; bindless++) {
+        StateChangeStats stats = countStateChanges(draws, bindless == 1);
+        std::cout << names[bindless] << ": " << stats.draws << " draws, " << stats.pipelineBinds << " pipeline binds, "
+            << stats.descriptorSetBinds << " descriptor set binds, " << stats.indirectBatches << " indirect batches per frame" << std::endl;
+    }
+}
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "IndirectDraw.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+inline VkFormat findSupportedFormat(VkPhysicalDevice physicalDevice, const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+    for (VkFormat format : candidates) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+        if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
+            return format;
+        } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
+            return format;
+        }
+    }
+
+    throw std::runtime_error("failed to find supported format!");
+}
+
+// D32_SFLOAT gives the most precision and needs no stencil; the others are fallbacks for devices
+// without it.
+inline VkFormat findDepthFormat(VkPhysicalDevice physicalDevice) {
+    return findSupportedFormat(physicalDevice,
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+    );
+}
+
+inline bool hasStencilComponent(VkFormat format) {
+    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+}
+
+inline bool isDepthFormat(VkFormat format) {
+    return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM_S8_UINT || hasStencilComponent(format);
+}
+
+// How opaque geometry is drawn against the depth buffer.
+enum class DepthMode {
+    Unsorted,     // submission order, the baseline
+    FrontToBack,  // nearest objects first so early depth tests reject what they hide
+    Prepass,      // depth only subpass first, then shading with an EQUAL test: one fragment per pixel
+};
+
+inline const char* depthModeName(DepthMode mode) {
+    switch (mode) {
+    case DepthMode::Unsorted: return "unsorted";
+    case DepthMode::FrontToBack: return "front to back";
+    case DepthMode::Prepass: return "depth prepass";
+    }
+    return "";
+}
+
+// Depth attachment sized like the swap chain; recreate it together with the swap chain. Add
+// VK_IMAGE_USAGE_SAMPLED_BIT to extraUsage when a DepthPyramid reads it.
+class DepthBuffer {
+public:
+    void create(const VulkanContext& context, VkExtent2D extent, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, VkImageUsageFlags extraUsage = 0) {
+        this->context = context;
+        format = findDepthFormat(context.physicalDevice);
+
+        createImage(context, extent.width, extent.height, 1, samples, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | extraUsage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+        imageView = createUniqueImageView(context.device, image, format, VK_IMAGE_ASPECT_DEPTH_BIT);
+    }
+
+    void cleanup() {
+        imageView.reset();
+        image.reset();
+        imageMemory.reset();
+    }
+
+    VkFormat getFormat() const { return format; }
+    VkImage getImage() const { return image; }
+    VkImageView getImageView() const { return imageView; }
+
+private:
+    VulkanContext context;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    UniqueDeviceMemory imageMemory;
+    UniqueImage image;
+    UniqueImageView imageView;
+};
+
+// createRenderPass() with a depth attachment. The depth contents are not needed after the pass, so
+// they are cleared on load and never stored. With DepthMode::Prepass, subpass 0 only writes depth
+// and subpass 1 shades, so colour pipelines use getColorSubpass(mode). The framebuffer attachments are
+// {swap chain image view, depth image view} and the clear values {color, {1.0f, 0}}.
+//
+// With more than one sample, the colour and depth attachments are multisampled (a DepthBuffer created
+// with the same samples) and the colour is resolved into the swap chain image at the end of the
+// shading subpass. The attachments are then {colour image view, depth image view, swap chain image view}
+// and the clear values {color, {1.0f, 0}, {}}, as in the tutorial's multisampling chapter.
+inline VkRenderPass createDepthRenderPass(VkDevice device, VkFormat colorFormat, VkFormat depthFormat, DepthMode mode, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT) {
+    bool resolve = samples != VK_SAMPLE_COUNT_1_BIT;
+
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.format = colorFormat;
+    colorAttachment.samples = samples;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = resolve ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = depthFormat;
+    depthAttachment.samples = samples;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentRef{};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription colorAttachmentResolve{};
+    colorAttachmentResolve.format = colorFormat;
+    colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentReference colorAttachmentResolveRef{};
+    colorAttachmentResolveRef.attachment = 2;
+    colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    std::vector<VkSubpassDescription> subpasses;
+    std::vector<VkSubpassDependency> dependencies;
+
+    VkSubpassDependency dependency{};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    if (mode == DepthMode::Prepass) {
+        VkSubpassDescription depthSubpass{};
+        depthSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        depthSubpass.colorAttachmentCount = 0;
+        depthSubpass.pDepthStencilAttachment = &depthAttachmentRef;
+        subpasses.push_back(depthSubpass);
+
+        dependencies.push_back(dependency);
+
+        // The shading subpass tests against the finished prepass depth.
+        VkSubpassDependency prepassDependency{};
+        prepassDependency.srcSubpass = 0;
+        prepassDependency.dstSubpass = 1;
+        prepassDependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        prepassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        prepassDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        prepassDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+        prepassDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        dependencies.push_back(prepassDependency);
+
+        // Colour is only written by subpass 1, so the swap chain image has to be acquired before it.
+        VkSubpassDependency colorDependency{};
+        colorDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        colorDependency.dstSubpass = 1;
+        colorDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        colorDependency.srcAccessMask = 0;
+        colorDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        colorDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies.push_back(colorDependency);
+    } else {
+        dependencies.push_back(dependency);
+    }
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pResolveAttachments = resolve ? &colorAttachmentResolveRef : nullptr;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+    subpasses.push_back(subpass);
+
+    std::vector<VkAttachmentDescription> attachments = {colorAttachment, depthAttachment};
+    if (resolve) {
+        attachments.push_back(colorAttachmentResolve);
+    }
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+    renderPassInfo.pSubpasses = subpasses.data();
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+    return renderPass;
+}
+
+inline uint32_t getColorSubpass(DepthMode mode) {
+    return mode == DepthMode::Prepass ? 1 : 0;
+}
+
+// Depth state of the opaque pipelines. depthOnly selects the prepass pipeline, which has no fragment
+// shader and no colour attachments. The shading pipeline after a prepass only passes fragments that
+// produced the stored depth, which needs `invariant gl_Position` in the vertex shader (see depth.vert).
+inline VkPipelineDepthStencilStateCreateInfo makeDepthStencilState(DepthMode mode, bool depthOnly = false) {
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.minDepthBounds = 0.0f;
+    depthStencil.maxDepthBounds = 1.0f;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    if (mode == DepthMode::Prepass && !depthOnly) {
+        depthStencil.depthWriteEnable = VK_FALSE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
+    return depthStencil;
+}
+
+// Non-negative floats order like their bits, so distances sort as 32 bit integers.
+inline uint32_t depthSortKey(float distance) {
+    distance = std::max(distance, 0.0f);
+    uint32_t key;
+    memcpy(&key, &distance, sizeof(key));
+    return key;
+}
+
+// Orders opaque draws nearest first by the view space depth of their origin. Ties keep their order,
+// which keeps draws of one mesh together.
+inline void sortFrontToBack(std::vector<DrawData>& draws, const glm::mat4& view) {
+    std::vector<std::pair<uint32_t, uint32_t>> keys(draws.size());
+    for (size_t i = 0; i < draws.size(); i++) {
+        glm::vec4 center = view * draws[i].model[3];
+        keys[i] = {depthSortKey(-center.z), static_cast<uint32_t>(i)};
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<DrawData> sorted(draws.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        sorted[i] = draws[keys[i].second];
+    }
+    draws.swap(sorted);
+}
+
+// Counts fragment shader invocations of the opaque pass, which is what early depth rejection saves.
+// Like VertexFetchQuery it needs the pipelineStatisticsQuery feature.
+class FragmentInvocationQuery {
+public:
+    void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t frameCount) {
+        this->device = device;
+        dispatch = &getDeviceTable(device);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo statisticsInfo{};
+        statisticsInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        statisticsInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statisticsInfo.queryCount = frameCount;
+        statisticsInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+        if (vkCreateQueryPool(device, &statisticsInfo, nullptr, statisticsPool.put(device)) != VK_SUCCESS) {
+            statisticsPool.release();
+            throw std::runtime_error("failed to create query pool!");
+        }
+
+        VkQueryPoolCreateInfo timestampInfo{};
+        timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount = frameCount * 2;
+
+        if (vkCreateQueryPool(device, &timestampInfo, nullptr, timestampPool.put(device)) != VK_SUCCESS) {
+            timestampPool.release();
+            throw std::runtime_error("failed to create query pool!");
+        }
+    }
+
+    void cleanup() {
+        timestampPool.reset();
+        statisticsPool.reset();
+    }
+
+    // Outside a render pass, before vkCmdBeginRenderPass.
+    void reset(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdResetQueryPool(commandBuffer, statisticsPool, frame, 1);
+        dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, frame * 2, 2);
+    }
+
+    // Around the whole render pass, so a prepass and the shading subpass are measured together.
+    void begin(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, frame * 2);
+        dispatch->vkCmdBeginQuery(commandBuffer, statisticsPool, frame, 0);
+    }
+
+    void end(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdEndQuery(commandBuffer, statisticsPool, frame);
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, frame * 2 + 1);
+    }
+
+    struct Result {
+        uint64_t fragmentShaderInvocations = 0;
+        double milliseconds = 0.0;
+    };
+
+    // Call after the frame's fence has signaled.
+    Result getResult(uint32_t frame) const {
+        uint64_t invocations = 0;
+        vkGetQueryPoolResults(device, statisticsPool, frame, 1, sizeof(invocations), &invocations, sizeof(invocations), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        uint64_t timestamps[2] = {};
+        vkGetQueryPoolResults(device, timestampPool, frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        Result result;
+        result.fragmentShaderInvocations = invocations;
+        result.milliseconds = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+        return result;
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    const VulkanDeviceTable* dispatch = nullptr;
+    float timestampPeriod = 1.0f;
+    UniqueQueryPool statisticsPool;
+    UniqueQueryPool timestampPool;
+};
+
+// Averages FragmentInvocationQuery results per DepthMode over however many frames each mode ran.
+class DepthModeComparison {
+public:
+    void add(DepthMode mode, const FragmentInvocationQuery::Result& result) {
+        Entry& entry = entries[static_cast<size_t>(mode)];
+        entry.fragmentShaderInvocations += result.fragmentShaderInvocations;
+        entry.milliseconds += result.milliseconds;
+        entry.frames++;
+    }
+
+    // Invocations per pixel is the overdraw; a prepass brings the shading subpass close to 1.
+    void print(VkExtent2D extent) const {
+        double pixels = static_cast<double>(extent.width) * extent.height;
+        for (size_t i = 0; i < entries.size(); i++) {
+            const Entry& entry = entries[i];
+            if (entry.frames == 0) {
+                continue;
+            }
+
+            double invocations = static_cast<double>(entry.fragmentShaderInvocations) / entry.frames;
+            std::cout << depthModeName(static_cast<DepthMode>(i)) << ": " << static_cast<uint64_t>(invocations) << " fragment invocations ("
+                << invocations / pixels << " per pixel), " << entry.milliseconds / entry.frames << " ms" << std::endl;
+        }
+    }
+
+private:
+    struct Entry {
+        uint64_t fragmentShaderInvocations = 0;
+        double milliseconds = 0.0;
+        uint32_t frames = 0;
+    };
+
+    std::array<Entry, 3> entries{};
+};
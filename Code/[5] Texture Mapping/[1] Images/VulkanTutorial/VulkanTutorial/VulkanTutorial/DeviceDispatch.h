@@ -0,0 +1,288 @@
+#pragma once
+
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// The functions exported by vulkan-1.lib / libvulkan are loader trampolines: every call looks up the
+// device's dispatch table and jumps through it, and with layers enabled through each layer as well.
+// vkGetDeviceProcAddr returns the driver's (or first layer's) entry point for one device directly,
+// so calls through VulkanDeviceTable skip the trampoline.
+//
+// Every module records through the one table of its device, from getDeviceTable(). The lists below
+// generate the table; add a command to one of them to have it loaded.
+
+// Core commands of the per-frame recording and submission path. Vulkan 1.2 and 1.3 commands stay
+// null on devices created with a lower apiVersion, unless an alias below fills them in.
+#define VULKAN_DEVICE_COMMANDS(X)               \
+    X(vkBeginCommandBuffer)                     \
+    X(vkEndCommandBuffer)                       \
+    X(vkResetCommandBuffer)                     \
+    X(vkQueueSubmit)                            \
+    X(vkWaitForFences)                          \
+    X(vkResetFences)                            \
+    X(vkCmdBeginRenderPass)                     \
+    X(vkCmdNextSubpass)                         \
+    X(vkCmdEndRenderPass)                       \
+    X(vkCmdBeginRendering)                      \
+    X(vkCmdEndRendering)                        \
+    X(vkCmdPipelineBarrier)                     \
+    X(vkCmdPipelineBarrier2)                    \
+    X(vkCmdBindPipeline)                        \
+    X(vkCmdBindDescriptorSets)                  \
+    X(vkCmdBindVertexBuffers)                   \
+    X(vkCmdBindIndexBuffer)                     \
+    X(vkCmdPushConstants)                       \
+    X(vkCmdSetViewport)                         \
+    X(vkCmdSetScissor)                          \
+    X(vkCmdSetCullMode)                         \
+    X(vkCmdSetFrontFace)                        \
+    X(vkCmdSetPrimitiveTopology)                \
+    X(vkCmdSetDepthTestEnable)                  \
+    X(vkCmdSetDepthWriteEnable)                 \
+    X(vkCmdSetDepthCompareOp)                   \
+    X(vkCmdSetPrimitiveRestartEnable)           \
+    X(vkCmdDraw)                                \
+    X(vkCmdDrawIndexed)                         \
+    X(vkCmdDrawIndexedIndirect)                 \
+    X(vkCmdDrawIndexedIndirectCount)            \
+    X(vkCmdDispatch)                            \
+    X(vkCmdCopyBuffer)                          \
+    X(vkCmdCopyBufferToImage)                   \
+    X(vkCmdCopyImage)                           \
+    X(vkCmdCopyImageToBuffer)                   \
+    X(vkCmdClearColorImage)                     \
+    X(vkCmdUpdateBuffer)                        \
+    X(vkCmdFillBuffer)                          \
+    X(vkCmdResetQueryPool)                      \
+    X(vkCmdBeginQuery)                          \
+    X(vkCmdEndQuery)                            \
+    X(vkCmdWriteTimestamp)                      \
+    X(vkCmdExecuteCommands)
+
+// Extension commands, which the loader does not export at all; null unless the extension is enabled.
+#define VULKAN_DEVICE_EXTENSION_COMMANDS(X)     \
+    X(vkCmdSetColorBlendEnableEXT)              \
+    X(vkCmdSetColorBlendEquationEXT)            \
+    X(vkCmdSetPolygonModeEXT)
+
+// Extension commands promoted to core with the same signature. On a device created below the core
+// version the extension entry point is loaded into the core slot, so callers only check that one.
+#define VULKAN_DEVICE_COMMAND_ALIASES(X)                                    \
+    X(vkCmdBeginRendering, vkCmdBeginRenderingKHR)                          \
+    X(vkCmdEndRendering, vkCmdEndRenderingKHR)                              \
+    X(vkCmdPipelineBarrier2, vkCmdPipelineBarrier2KHR)                      \
+    X(vkCmdDrawIndexedIndirectCount, vkCmdDrawIndexedIndirectCountKHR)
+
+struct VulkanDeviceTable {
+#define VULKAN_DEVICE_TABLE_MEMBER(name) PFN_##name name = nullptr;
+    VULKAN_DEVICE_COMMANDS(VULKAN_DEVICE_TABLE_MEMBER)
+    VULKAN_DEVICE_EXTENSION_COMMANDS(VULKAN_DEVICE_TABLE_MEMBER)
+#undef VULKAN_DEVICE_TABLE_MEMBER
+
+    void load(VkDevice device) {
+#define VULKAN_DEVICE_TABLE_LOAD(name) name = (PFN_##name) vkGetDeviceProcAddr(device, #name);
+        VULKAN_DEVICE_COMMANDS(VULKAN_DEVICE_TABLE_LOAD)
+        VULKAN_DEVICE_EXTENSION_COMMANDS(VULKAN_DEVICE_TABLE_LOAD)
+#undef VULKAN_DEVICE_TABLE_LOAD
+
+#define VULKAN_DEVICE_TABLE_LOAD_ALIAS(name, alias) if (name == nullptr) name = (PFN_##name) vkGetDeviceProcAddr(device, #alias);
+        VULKAN_DEVICE_COMMAND_ALIASES(VULKAN_DEVICE_TABLE_LOAD_ALIAS)
+#undef VULKAN_DEVICE_TABLE_LOAD_ALIAS
+
+        if (vkBeginCommandBuffer == nullptr || vkCmdDraw == nullptr) {
+            throw std::runtime_error("failed to load device functions!");
+        }
+    }
+};
+
+// The tables loaded so far, one per device.
+struct VulkanDeviceTables {
+    std::mutex mutex;
+    std::map<VkDevice, std::unique_ptr<VulkanDeviceTable>> tables;
+
+    static VulkanDeviceTables& get() {
+        static VulkanDeviceTables instance;
+        return instance;
+    }
+};
+
+// Loads the device's table on first use and returns the same one to every later caller, so modules
+// keep a pointer to it from create(). Call releaseDeviceTable() after vkDestroyDevice(): a device
+// created later may get the same handle.
+inline const VulkanDeviceTable& getDeviceTable(VkDevice device) {
+    VulkanDeviceTables& registry = VulkanDeviceTables::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::unique_ptr<VulkanDeviceTable>& table = registry.tables[device];
+    if (!table) {
+        std::unique_ptr<VulkanDeviceTable> loaded = std::make_unique<VulkanDeviceTable>();
+        loaded->load(device);
+        table = std::move(loaded);
+    }
+    return *table;
+}
+
+inline void releaseDeviceTable(VkDevice device) {
+    VulkanDeviceTables& registry = VulkanDeviceTables::get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.tables.erase(device);
+}
+
+// What the draw mix of runDispatchBenchmark() binds and draws, e.g. the tutorial's renderPass,
+// swapChainFramebuffers[0], graphicsPipeline, pipelineLayout, descriptorSets[0], vertexBuffer and
+// indexBuffer. descriptorSet may be VK_NULL_HANDLE for a pipeline without one. clearValues needs an
+// entry for every attachment up to the last one with LOAD_OP_CLEAR, e.g. {{0.0f, 0.0f, 0.0f, 1.0f}}
+// for the tutorial's render pass. Nothing is submitted, so the objects only need to be valid, not idle.
+struct DispatchBenchmarkScene {
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+    std::vector<VkClearValue> clearValues;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t indexCount = 3;
+};
+
+struct DispatchBenchmarkResult {
+    // Viewport and scissor only: the cost of the call itself.
+    double loaderStateCallsPerSecond = 0.0;
+    double tableStateCallsPerSecond = 0.0;
+    // What a frame records per draw: pipeline, descriptor set, vertex and index buffer binds, viewport,
+    // scissor and the draw.
+    double loaderDrawMixCallsPerSecond = 0.0;
+    double tableDrawMixCallsPerSecond = 0.0;
+};
+
+// Calls record(commandBuffer) iterations times into throwaway command buffers, inside the scene's
+// render pass when there is a scene, and returns the seconds spent in record alone. Command buffers
+// grow with every command, so they are replaced every batchSize iterations.
+template <typename Record>
+inline double timeDispatchRecording(const VulkanContext& context, const DispatchBenchmarkScene* scene, uint32_t iterations, uint32_t batchSize, Record record) {
+    double seconds = 0.0;
+    for (uint32_t first = 0; first < iterations; first += batchSize) {
+        uint32_t count = std::min(batchSize, iterations - first);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = context.commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(context.device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        if (scene != nullptr) {
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = scene->renderPass;
+            renderPassInfo.framebuffer = scene->framebuffer;
+            renderPassInfo.renderArea.extent = scene->extent;
+            renderPassInfo.clearValueCount = static_cast<uint32_t>(scene->clearValues.size());
+            renderPassInfo.pClearValues = scene->clearValues.data();
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            record(commandBuffer);
+        }
+        seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        if (scene != nullptr) {
+            vkCmdEndRenderPass(commandBuffer);
+        }
+        vkEndCommandBuffer(commandBuffer);
+        vkFreeCommandBuffers(context.device, context.commandPool, 1, &commandBuffer);
+    }
+    return seconds;
+}
+
+// Records about callCount calls of each kind once through the loader's exports and once through the
+// device's table, and times only the calls. Nothing is submitted. The draw mix rebinds the same
+// objects every draw, which drivers do not skip when recording.
+inline DispatchBenchmarkResult runDispatchBenchmark(const VulkanContext& context, const DispatchBenchmarkScene& scene, uint32_t callCount) {
+    const VulkanDeviceTable& table = getDeviceTable(context.device);
+
+    VkViewport viewport{};
+    viewport.width = static_cast<float>(std::max(scene.extent.width, 1u));
+    viewport.height = static_cast<float>(std::max(scene.extent.height, 1u));
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor{};
+    scissor.extent = {std::max(scene.extent.width, 1u), std::max(scene.extent.height, 1u)};
+
+    const uint32_t stateCalls = 2;
+    uint32_t stateIterations = (callCount + stateCalls - 1) / stateCalls;
+    double loaderState = timeDispatchRecording(context, nullptr, stateIterations, 1 << 15, [&](VkCommandBuffer commandBuffer) {
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    });
+    double tableState = timeDispatchRecording(context, nullptr, stateIterations, 1 << 15, [&](VkCommandBuffer commandBuffer) {
+        table.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        table.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    });
+
+    bool bindSet = scene.descriptorSet != VK_NULL_HANDLE;
+    const uint32_t drawCalls = bindSet ? 7 : 6;
+    uint32_t drawIterations = (callCount + drawCalls - 1) / drawCalls;
+    VkDeviceSize offset = 0;
+    double loaderDrawMix = timeDispatchRecording(context, &scene, drawIterations, 1 << 13, [&](VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene.pipeline);
+        if (bindSet) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene.pipelineLayout, 0, 1, &scene.descriptorSet, 0, nullptr);
+        }
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &scene.vertexBuffer, &offset);
+        vkCmdBindIndexBuffer(commandBuffer, scene.indexBuffer, 0, scene.indexType);
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        vkCmdDrawIndexed(commandBuffer, scene.indexCount, 1, 0, 0, 0);
+    });
+    double tableDrawMix = timeDispatchRecording(context, &scene, drawIterations, 1 << 13, [&](VkCommandBuffer commandBuffer) {
+        table.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene.pipeline);
+        if (bindSet) {
+            table.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scene.pipelineLayout, 0, 1, &scene.descriptorSet, 0, nullptr);
+        }
+        table.vkCmdBindVertexBuffers(commandBuffer, 0, 1, &scene.vertexBuffer, &offset);
+        table.vkCmdBindIndexBuffer(commandBuffer, scene.indexBuffer, 0, scene.indexType);
+        table.vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        table.vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        table.vkCmdDrawIndexed(commandBuffer, scene.indexCount, 1, 0, 0, 0);
+    });
+
+    double stateCount = static_cast<double>(stateIterations) * stateCalls;
+    double drawCount = static_cast<double>(drawIterations) * drawCalls;
+    DispatchBenchmarkResult result;
+    result.loaderStateCallsPerSecond = loaderState > 0.0 ? stateCount / loaderState : 0.0;
+    result.tableStateCallsPerSecond = tableState > 0.0 ? stateCount / tableState : 0.0;
+    result.loaderDrawMixCallsPerSecond = loaderDrawMix > 0.0 ? drawCount / loaderDrawMix : 0.0;
+    result.tableDrawMixCallsPerSecond = tableDrawMix > 0.0 ? drawCount / tableDrawMix : 0.0;
+    return result;
+}
+
+inline void printDispatchBenchmark(const DispatchBenchmarkResult& result) {
+    auto printLine = [](const char* name, double loader, double table) {
+        std::cout << name << ": loader " << loader / 1e6 << " M calls/s, device table " << table / 1e6 << " M calls/s ("
+            << (loader > 0.0 ? table / loader : 0.0) << "x)" << std::endl;
+    };
+    printLine("viewport/scissor", result.loaderStateCallsPerSecond, result.tableStateCallsPerSecond);
+    printLine("bind/draw mix", result.loaderDrawMixCallsPerSecond, result.tableDrawMixCallsPerSecond);
+}
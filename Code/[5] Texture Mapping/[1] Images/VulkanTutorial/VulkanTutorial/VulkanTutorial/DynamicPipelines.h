@@ -0,0 +1,562 @@
+#pragma once
+
+#include "DepthBuffer.h"
+#include "DeviceDispatch.h"
+#include "Msaa.h"
+#include "PipelineLibrary.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Without dynamic state every combination of cull mode, topology, depth test and blending used by the
+// scene is a separate VkPipeline, compiled the first time a draw needs it. Extended dynamic state moves
+// these into the command buffer so one pipeline covers them all:
+//
+//     VK_EXT_extended_dynamic_state   cull mode, front face, topology (within its class), depth test,
+//                                     depth write and depth compare op; core in Vulkan 1.3
+//     VK_EXT_extended_dynamic_state2  primitive restart; core in Vulkan 1.3
+//     VK_EXT_extended_dynamic_state3  blend enable and equation, polygon mode; an optional extension
+//
+// PipelineVariants keys its pipelines on the part of PipelineState the device cannot set dynamically,
+// so the same code bakes one pipeline per state on old devices and a handful on new ones.
+
+struct DynamicStateSupport {
+    bool extendedDynamicState = false;
+    bool extendedDynamicState2 = false;
+    bool colorBlend = false;            // blend enable and equation
+    bool polygonMode = false;
+    bool unrestrictedTopology = false;  // any topology at draw time, not only one of the pipeline's class;
+                                        // a VK_EXT_extended_dynamic_state3 property, so it needs that extension loaded
+};
+
+// The first two are core in Vulkan 1.3 and need nothing enabled beyond creating the instance and
+// device with apiVersion 1.3. VK_EXT_extended_dynamic_state3 has to be added to deviceExtensions and
+// the features checked here enabled in createLogicalDevice() through
+// VkPhysicalDeviceExtendedDynamicState3FeaturesEXT.
+inline DynamicStateSupport queryDynamicStateSupport(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    DynamicStateSupport support;
+    support.extendedDynamicState = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_3;
+    support.extendedDynamicState2 = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_3;
+
+    if (!hasDeviceExtension(physicalDevice, VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        return support;
+    }
+
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3Features{};
+    extendedDynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = &extendedDynamicState3Features;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+
+    VkPhysicalDeviceExtendedDynamicState3PropertiesEXT extendedDynamicState3Properties{};
+    extendedDynamicState3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &extendedDynamicState3Properties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    support.colorBlend = extendedDynamicState3Features.extendedDynamicState3ColorBlendEnable == VK_TRUE
+        && extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation == VK_TRUE;
+    support.polygonMode = extendedDynamicState3Features.extendedDynamicState3PolygonMode == VK_TRUE;
+    support.unrestrictedTopology = support.extendedDynamicState && extendedDynamicState3Properties.dynamicPrimitiveTopologyUnrestricted == VK_TRUE;
+    return support;
+}
+
+enum class BlendMode {
+    Opaque,
+    AlphaBlend,
+    Additive
+};
+
+inline VkColorBlendEquationEXT getBlendEquation(BlendMode mode) {
+    VkColorBlendEquationEXT equation{};
+    equation.colorBlendOp = VK_BLEND_OP_ADD;
+    equation.alphaBlendOp = VK_BLEND_OP_ADD;
+    switch (mode) {
+    case BlendMode::Opaque:
+        equation.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+        equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        break;
+    case BlendMode::AlphaBlend:
+        equation.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        equation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        break;
+    case BlendMode::Additive:
+        equation.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        equation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        break;
+    }
+    return equation;
+}
+
+inline VkPipelineColorBlendAttachmentState getBlendAttachment(BlendMode mode) {
+    VkColorBlendEquationEXT equation = getBlendEquation(mode);
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = mode == BlendMode::Opaque ? VK_FALSE : VK_TRUE;
+    colorBlendAttachment.srcColorBlendFactor = equation.srcColorBlendFactor;
+    colorBlendAttachment.dstColorBlendFactor = equation.dstColorBlendFactor;
+    colorBlendAttachment.colorBlendOp = equation.colorBlendOp;
+    colorBlendAttachment.srcAlphaBlendFactor = equation.srcAlphaBlendFactor;
+    colorBlendAttachment.dstAlphaBlendFactor = equation.dstAlphaBlendFactor;
+    colorBlendAttachment.alphaBlendOp = equation.alphaBlendOp;
+    return colorBlendAttachment;
+}
+
+// A pipeline created with dynamic topology still fixes the topology class (points, lines, triangles
+// or patches); only dynamicPrimitiveTopologyUnrestricted lifts that. Returns the first of the class.
+inline VkPrimitiveTopology getTopologyClass(VkPrimitiveTopology topology) {
+    switch (topology) {
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+        return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+        return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+    case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+        return VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+    default:
+        return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    }
+}
+
+// Everything that used to be a separate createGraphicsPipeline() variant.
+struct PipelineState {
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    bool primitiveRestart = false;
+    bool depthTest = true;
+    bool depthWrite = true;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+    BlendMode blendMode = BlendMode::Opaque;
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;  // anything but fill needs fillModeNonSolid
+
+    uint64_t getKey() const {
+        return static_cast<uint64_t>(cullMode)
+            | static_cast<uint64_t>(frontFace) << 2
+            | static_cast<uint64_t>(topology) << 3
+            | static_cast<uint64_t>(primitiveRestart) << 7
+            | static_cast<uint64_t>(depthTest) << 8
+            | static_cast<uint64_t>(depthWrite) << 9
+            | static_cast<uint64_t>(depthCompareOp) << 10
+            | static_cast<uint64_t>(blendMode) << 13
+            | static_cast<uint64_t>(polygonMode) << 15;
+    }
+};
+
+// What stays fixed across the variants. With the render graph in dynamic rendering mode set
+// colorFormats and depthFormat from RenderGraphPass::getPipelineRenderingInfo() and leave renderPass
+// null. Shader modules and specialization info are owned by the caller and have to outlive the
+// PipelineVariants.
+struct GraphicsPipelineDesc {
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    std::vector<VkVertexInputBindingDescription> vertexBindings;
+    std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    std::vector<VkFormat> colorFormats;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    uint32_t colorAttachmentCount = 1;
+    MsaaSettings msaa;  // from createMsaaSettings(), matching the pass the pipelines draw into
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;  // unused when linking through a PipelineLibrary
+};
+
+struct PipelineVariantStats {
+    uint32_t stateCount = 0;     // distinct PipelineStates drawn with
+    uint32_t pipelineCount = 0;  // pipelines compiled for them
+    uint32_t bindCount = 0;
+    uint32_t pipelineBindCount = 0;
+    uint32_t dynamicStateCount = 0;  // vkCmdSet* calls
+    double compileMilliseconds = 0.0;
+    double worstCompileMilliseconds = 0.0;  // the longest hitch a single draw caused
+};
+
+// Pipelines are compiled the first time bind() sees a state whose key has none yet, which is where
+// the stutter of on-demand compilation comes from; prepare() compiles known states up front instead.
+//
+//     pipelines.create(context, queryDynamicStateSupport(physicalDevice), desc);
+//     ...
+//     pipelines.begin(commandBuffer);                  // after vkBeginCommandBuffer, every recording
+//     pipelines.bind(commandBuffer, opaqueState);      // binds the pipeline and sets dynamic state
+//     vkCmdDrawIndexed(...);
+//     pipelines.bind(commandBuffer, transparentState); // only the state that changed
+//     vkCmdDrawIndexed(...);
+//
+// Viewport and scissor are always dynamic and stay the caller's to set.
+//
+// Given a PipelineLibrary that the device supports, pipelines are linked from cached parts instead
+// of compiled whole. One library can be shared by the PipelineVariants of every material, so a new
+// material only compiles its fragment shader and links.
+class PipelineVariants {
+public:
+    void create(const VulkanContext& context, const DynamicStateSupport& support, const GraphicsPipelineDesc& desc, PipelineLibrary* library = nullptr) {
+        this->context = context;
+        this->support = support;
+        this->desc = desc;
+        this->library = library != nullptr && library->isSupported() ? library : nullptr;
+
+        // bind() records through the device table rather than the loader's exports, which do not
+        // include the VK_EXT_extended_dynamic_state3 commands anyway.
+        dispatch = &getDeviceTable(context.device);
+        if (dispatch->vkCmdSetCullMode == nullptr) {
+            this->support.extendedDynamicState = false;  // device created with an apiVersion below 1.3
+        }
+        if (dispatch->vkCmdSetPrimitiveRestartEnable == nullptr) {
+            this->support.extendedDynamicState2 = false;
+        }
+        if (dispatch->vkCmdSetColorBlendEnableEXT == nullptr || dispatch->vkCmdSetColorBlendEquationEXT == nullptr) {
+            this->support.colorBlend = false;
+        }
+        if (dispatch->vkCmdSetPolygonModeEXT == nullptr) {
+            this->support.polygonMode = false;
+        }
+        // The unrestricted topology property only applies with VK_EXT_extended_dynamic_state3 enabled on
+        // the device, which is what a missing command means here.
+        if (!this->support.extendedDynamicState || (dispatch->vkCmdSetColorBlendEnableEXT == nullptr && dispatch->vkCmdSetPolygonModeEXT == nullptr)) {
+            this->support.unrestrictedTopology = false;
+        }
+
+        dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        if (this->support.extendedDynamicState) {
+            dynamicStates.insert(dynamicStates.end(), {VK_DYNAMIC_STATE_CULL_MODE, VK_DYNAMIC_STATE_FRONT_FACE, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY,
+                VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE, VK_DYNAMIC_STATE_DEPTH_COMPARE_OP});
+        }
+        if (this->support.extendedDynamicState2) {
+            dynamicStates.push_back(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE);
+        }
+        if (this->support.colorBlend) {
+            dynamicStates.insert(dynamicStates.end(), {VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT, VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT});
+        }
+        if (this->support.polygonMode) {
+            dynamicStates.push_back(VK_DYNAMIC_STATE_POLYGON_MODE_EXT);
+        }
+    }
+
+    void cleanup() {
+        pipelines.clear();
+        linkedPipelines.clear();  // owned by the library
+        seenStates.clear();
+        invalidate();
+        boundCommandBuffer = VK_NULL_HANDLE;
+    }
+
+    // The state with everything that is set dynamically reset to a fixed value, so states that only
+    // differ there share a pipeline.
+    PipelineState getBakedState(const PipelineState& state) const {
+        PipelineState baked = state;
+        if (!baked.depthTest) {
+            // Depth writes and the compare op do nothing without the test.
+            baked.depthWrite = false;
+            baked.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+        }
+        if (support.extendedDynamicState) {
+            baked.cullMode = VK_CULL_MODE_NONE;
+            baked.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+            baked.topology = support.unrestrictedTopology ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST : getTopologyClass(state.topology);
+            baked.depthTest = false;
+            baked.depthWrite = false;
+            baked.depthCompareOp = VK_COMPARE_OP_NEVER;
+        }
+        if (support.extendedDynamicState2) {
+            baked.primitiveRestart = false;
+        }
+        if (support.colorBlend) {
+            baked.blendMode = BlendMode::Opaque;
+        }
+        if (support.polygonMode) {
+            baked.polygonMode = VK_POLYGON_MODE_FILL;
+        }
+        return baked;
+    }
+
+    uint64_t getPipelineKey(const PipelineState& state) const {
+        return getBakedState(state).getKey();
+    }
+
+    VkPipeline getPipeline(const PipelineState& state) {
+        if (seenStates.insert(state.getKey()).second) {
+            stats.stateCount++;
+        }
+
+        uint64_t key = getPipelineKey(state);
+        auto linked = linkedPipelines.find(key);
+        if (linked != linkedPipelines.end()) {
+            return library->getPipeline(linked->second);
+        }
+        auto it = pipelines.find(key);
+        if (it != pipelines.end()) {
+            return it->second;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        createPipeline(key, getBakedState(state));
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        stats.pipelineCount++;
+        stats.compileMilliseconds += milliseconds;
+        stats.worstCompileMilliseconds = std::max(stats.worstCompileMilliseconds, milliseconds);
+        return library != nullptr ? library->getPipeline(linkedPipelines[key]) : pipelines[key];
+    }
+
+    // Compiles the pipelines for states known in advance, e.g. every material at load time.
+    void prepare(const std::vector<PipelineState>& states) {
+        for (const PipelineState& state : states) {
+            getPipeline(state);
+        }
+    }
+
+    // Starts tracking a command buffer that is being recorded from scratch. A command buffer that is
+    // reset and recorded again keeps its handle, so the handle alone cannot tell bind() that nothing
+    // is bound any more.
+    void begin(VkCommandBuffer commandBuffer) {
+        invalidate();
+        boundCommandBuffer = commandBuffer;
+    }
+
+    void bind(VkCommandBuffer commandBuffer, const PipelineState& state) {
+        if (commandBuffer != boundCommandBuffer) {
+            throw std::runtime_error("pipeline variants bound without begin() on this command buffer!");
+        }
+        stats.bindCount++;
+
+        VkPipeline pipeline = getPipeline(state);
+        if (pipeline != boundPipeline) {
+            dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+            stats.pipelineBindCount++;
+        }
+
+        // Dynamic state outlives pipeline binds as long as every pipeline bound declares it dynamic,
+        // which all of these do, so only what changed since the last bind is set.
+        bool all = !hasBoundState;
+        const PipelineState& last = boundState;
+        if (support.extendedDynamicState) {
+            if (all || state.cullMode != last.cullMode) {
+                dispatch->vkCmdSetCullMode(commandBuffer, state.cullMode);
+                stats.dynamicStateCount++;
+            }
+            if (all || state.frontFace != last.frontFace) {
+                dispatch->vkCmdSetFrontFace(commandBuffer, state.frontFace);
+                stats.dynamicStateCount++;
+            }
+            if (all || state.topology != last.topology) {
+                dispatch->vkCmdSetPrimitiveTopology(commandBuffer, state.topology);
+                stats.dynamicStateCount++;
+            }
+            if (all || state.depthTest != last.depthTest) {
+                dispatch->vkCmdSetDepthTestEnable(commandBuffer, state.depthTest ? VK_TRUE : VK_FALSE);
+                stats.dynamicStateCount++;
+            }
+            if (all || state.depthWrite != last.depthWrite) {
+                dispatch->vkCmdSetDepthWriteEnable(commandBuffer, state.depthWrite ? VK_TRUE : VK_FALSE);
+                stats.dynamicStateCount++;
+            }
+            if (all || state.depthCompareOp != last.depthCompareOp) {
+                dispatch->vkCmdSetDepthCompareOp(commandBuffer, state.depthCompareOp);
+                stats.dynamicStateCount++;
+            }
+        }
+        if (support.extendedDynamicState2 && (all || state.primitiveRestart != last.primitiveRestart)) {
+            dispatch->vkCmdSetPrimitiveRestartEnable(commandBuffer, state.primitiveRestart ? VK_TRUE : VK_FALSE);
+            stats.dynamicStateCount++;
+        }
+        if (support.colorBlend && (all || state.blendMode != last.blendMode)) {
+            std::vector<VkBool32> enables(desc.colorAttachmentCount, state.blendMode == BlendMode::Opaque ? VK_FALSE : VK_TRUE);
+            std::vector<VkColorBlendEquationEXT> equations(desc.colorAttachmentCount, getBlendEquation(state.blendMode));
+            dispatch->vkCmdSetColorBlendEnableEXT(commandBuffer, 0, desc.colorAttachmentCount, enables.data());
+            dispatch->vkCmdSetColorBlendEquationEXT(commandBuffer, 0, desc.colorAttachmentCount, equations.data());
+            stats.dynamicStateCount += 2;
+        }
+        if (support.polygonMode && (all || state.polygonMode != last.polygonMode)) {
+            dispatch->vkCmdSetPolygonModeEXT(commandBuffer, state.polygonMode);
+            stats.dynamicStateCount++;
+        }
+
+        boundState = state;
+        hasBoundState = true;
+    }
+
+    // Call when the command buffer bound another pipeline in between, since that resets dynamic
+    // state the other pipeline has static.
+    void invalidate() {
+        boundPipeline = VK_NULL_HANDLE;
+        hasBoundState = false;
+    }
+
+    const DynamicStateSupport& getSupport() const {
+        return support;
+    }
+
+    const PipelineVariantStats& getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        uint32_t stateCount = stats.stateCount;
+        uint32_t pipelineCount = stats.pipelineCount;
+        stats = {};
+        stats.stateCount = stateCount;
+        stats.pipelineCount = pipelineCount;
+    }
+
+    std::vector<std::string> getStatsLines() const {
+        std::vector<std::string> lines;
+        std::ostringstream line;
+        line << "pipelines: " << stats.pipelineCount << " compiled for " << stats.stateCount << " states (dynamic:"
+            << (support.extendedDynamicState ? " cull/topology/depth" : "") << (support.extendedDynamicState2 ? " restart" : "")
+            << (support.colorBlend ? " blend" : "") << (support.polygonMode ? " polygon" : "")
+            << (support.extendedDynamicState || support.colorBlend || support.polygonMode ? "" : " none") << ")";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "pipeline compiles: " << stats.compileMilliseconds << " ms total, " << stats.worstCompileMilliseconds << " ms worst";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "binds: " << stats.bindCount << ", " << stats.pipelineBindCount << " pipeline changes, " << stats.dynamicStateCount << " dynamic state sets";
+        lines.push_back(line.str());
+        return lines;
+    }
+
+    void printStats() const {
+        for (const std::string& line : getStatsLines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    VulkanContext context{};
+    DynamicStateSupport support{};
+    GraphicsPipelineDesc desc;
+    std::vector<VkDynamicState> dynamicStates;
+
+    const VulkanDeviceTable* dispatch = nullptr;
+
+    PipelineLibrary* library = nullptr;
+    std::unordered_map<uint64_t, UniquePipeline> pipelines;
+    std::unordered_map<uint64_t, uint32_t> linkedPipelines;  // index into the library
+    std::unordered_set<uint64_t> seenStates;
+    PipelineVariantStats stats;
+
+    VkCommandBuffer boundCommandBuffer = VK_NULL_HANDLE;
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    PipelineState boundState;
+    bool hasBoundState = false;
+
+    // Builds the pipeline from the baked state; whatever is dynamic is set at bind time anyway.
+    void createPipeline(uint64_t key, const PipelineState& state) {
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertexBindings.size());
+        vertexInputInfo.pVertexBindingDescriptions = desc.vertexBindings.data();
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexAttributes.size());
+        vertexInputInfo.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = state.topology;
+        inputAssembly.primitiveRestartEnable = state.primitiveRestart ? VK_TRUE : VK_FALSE;
+
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = state.polygonMode;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = state.cullMode;
+        rasterizer.frontFace = state.frontFace;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = makeMultisampleState(desc.msaa);
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = state.depthTest ? VK_TRUE : VK_FALSE;
+        depthStencil.depthWriteEnable = state.depthWrite ? VK_TRUE : VK_FALSE;
+        depthStencil.depthCompareOp = state.depthCompareOp;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(desc.colorAttachmentCount, getBlendAttachment(state.blendMode));
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = static_cast<uint32_t>(colorBlendAttachments.size());
+        colorBlending.pAttachments = colorBlendAttachments.data();
+
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkPipelineRenderingCreateInfo renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        renderingInfo.colorAttachmentCount = static_cast<uint32_t>(desc.colorFormats.size());
+        renderingInfo.pColorAttachmentFormats = desc.colorFormats.data();
+        renderingInfo.depthAttachmentFormat = desc.depthFormat;
+        renderingInfo.stencilAttachmentFormat = hasStencilComponent(desc.depthFormat) ? desc.depthFormat : VK_FORMAT_UNDEFINED;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = desc.renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+        pipelineInfo.stageCount = static_cast<uint32_t>(desc.shaderStages.size());
+        pipelineInfo.pStages = desc.shaderStages.data();
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = desc.layout;
+        pipelineInfo.renderPass = desc.renderPass;
+        pipelineInfo.subpass = desc.subpass;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        if (library != nullptr) {
+            linkedPipelines[key] = library->link(pipelineInfo);
+            return;
+        }
+
+        UniquePipeline pipeline;
+        if (vkCreateGraphicsPipelines(context.device, desc.pipelineCache, 1, &pipelineInfo, nullptr, pipeline.put(context.device)) != VK_SUCCESS) {
+            pipeline.release();
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+        pipelines[key] = std::move(pipeline);
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "IndexBuffer.h"
+#include "IndirectDraw.h"
+#include "MeshFile.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// Hands out ranges of a fixed size heap, counted in elements rather than bytes. Free ranges are kept
+// sorted by offset, so neighbours merge back together on free(), and by size for best fit allocation.
+class OffsetAllocator {
+public:
+    static const uint32_t INVALID_OFFSET = UINT32_MAX;
+
+    struct Allocation {
+        uint32_t offset = INVALID_OFFSET;
+        uint32_t size = 0;
+    };
+
+    void create(uint32_t capacity) {
+        this->capacity = capacity;
+        freeByOffset.clear();
+        freeBySize.clear();
+        usedSize = 0;
+        if (capacity > 0) {
+            insertFreeRange(0, capacity);
+        }
+    }
+
+    // Returns an allocation with offset INVALID_OFFSET when no free range is large enough.
+    Allocation allocate(uint32_t size) {
+        Allocation allocation;
+        if (size == 0) {
+            allocation.offset = 0;
+            return allocation;
+        }
+
+        auto it = freeBySize.lower_bound(size);
+        if (it == freeBySize.end()) {
+            return allocation;
+        }
+
+        uint32_t rangeOffset = it->second;
+        uint32_t rangeSize = it->first;
+        eraseFreeRange(rangeOffset, rangeSize);
+        if (rangeSize > size) {
+            insertFreeRange(rangeOffset + size, rangeSize - size);
+        }
+
+        allocation.offset = rangeOffset;
+        allocation.size = size;
+        usedSize += size;
+        return allocation;
+    }
+
+    void free(const Allocation& allocation) {
+        if (allocation.offset == INVALID_OFFSET || allocation.size == 0) {
+            return;
+        }
+
+        uint32_t offset = allocation.offset;
+        uint32_t size = allocation.size;
+        usedSize -= size;
+
+        auto next = freeByOffset.lower_bound(offset);
+        if (next != freeByOffset.end() && next->first == offset + size) {
+            size += next->second;
+            eraseFreeRange(next->first, next->second);
+        }
+
+        auto previous = freeByOffset.lower_bound(offset);
+        if (previous != freeByOffset.begin()) {
+            --previous;
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                eraseFreeRange(previous->first, previous->second);
+            }
+        }
+
+        insertFreeRange(offset, size);
+    }
+
+    uint32_t getCapacity() const { return capacity; }
+    uint32_t getUsedSize() const { return usedSize; }
+    uint32_t getFreeRangeCount() const { return static_cast<uint32_t>(freeByOffset.size()); }
+
+    uint32_t getLargestFreeRange() const {
+        return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+    }
+
+private:
+    uint32_t capacity = 0;
+    uint32_t usedSize = 0;
+    std::map<uint32_t, uint32_t> freeByOffset;
+    std::multimap<uint32_t, uint32_t> freeBySize;
+
+    void insertFreeRange(uint32_t offset, uint32_t size) {
+        freeByOffset[offset] = size;
+        freeBySize.emplace(size, offset);
+    }
+
+    void eraseFreeRange(uint32_t offset, uint32_t size) {
+        freeByOffset.erase(offset);
+        auto range = freeBySize.equal_range(size);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == offset) {
+                freeBySize.erase(it);
+                break;
+            }
+        }
+    }
+};
+
+// Where a mesh lives in the geometry buffer. Draw it with firstIndex and vertexOffset.
+struct GeometryAllocation {
+    OffsetAllocator::Allocation vertices;
+    OffsetAllocator::Allocation indices;
+
+    int32_t getVertexOffset() const { return static_cast<int32_t>(vertices.offset); }
+    uint32_t getFirstIndex() const { return indices.offset; }
+    uint32_t getIndexCount() const { return indices.size; }
+
+    MeshDraw getMeshDraw() const {
+        MeshDraw draw{};
+        draw.indexCount = indices.size;
+        draw.firstIndex = indices.offset;
+        draw.vertexOffset = static_cast<int32_t>(vertices.offset);
+        return draw;
+    }
+
+    VkDrawIndexedIndirectCommand getDrawCommand(uint32_t instanceCount = 1, uint32_t firstInstance = 0) const {
+        VkDrawIndexedIndirectCommand command{};
+        command.indexCount = indices.size;
+        command.instanceCount = instanceCount;
+        command.firstIndex = indices.offset;
+        command.vertexOffset = static_cast<int32_t>(vertices.offset);
+        command.firstInstance = firstInstance;
+        return command;
+    }
+};
+
+// One vertex buffer and one index buffer shared by every mesh in the scene, replacing the dedicated
+// buffers of createVertexBuffer() and createIndexBuffer(). The whole scene is bound once per command
+// buffer and every mesh is drawn through its firstIndex and vertexOffset, which is also exactly what
+// the MeshDraw table of IndirectDrawPath expects.
+//
+// All meshes share one vertex layout, since vertexOffset counts vertices of a single stride.
+class GeometryBuffer {
+public:
+    void create(const VulkanContext& context, uint32_t vertexStride, uint32_t maxVertices, VkIndexType indexType, uint32_t maxIndices) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->vertexStride = vertexStride;
+        this->indexType = indexType;
+        indexSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+
+        vertexAllocator.create(maxVertices);
+        indexAllocator.create(maxIndices);
+
+        // Storage usage lets compute and mesh shaders read the geometry as well.
+        createBuffer(context, static_cast<VkDeviceSize>(vertexStride) * maxVertices,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+        createBuffer(context, static_cast<VkDeviceSize>(indexSize) * maxIndices,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+    }
+
+    void cleanup() {
+        indexBuffer.reset();
+        indexBufferMemory.reset();
+        vertexBuffer.reset();
+        vertexBufferMemory.reset();
+    }
+
+    // Copies vertexCount vertices of the buffer's stride and indexCount indices, relative to the first
+    // vertex of the mesh, into a new allocation.
+    GeometryAllocation addMesh(const void* vertices, uint32_t vertexCount, const std::vector<uint32_t>& indices) {
+        if (indexType == VK_INDEX_TYPE_UINT16 && vertexCount > MAX_SHORT_INDEX_VERTICES) {
+            throw std::runtime_error("mesh has too many vertices for 16-bit indices!");
+        }
+
+        GeometryAllocation allocation = allocate(vertexCount, static_cast<uint32_t>(indices.size()));
+        std::vector<uint8_t> indexData = packIndices(indices, indexSize);
+        upload(allocation, vertices, indexData.data());
+        return allocation;
+    }
+
+    // Adds every submesh of a mesh file with a single allocation. submeshDraws receives one MeshDraw per
+    // submesh, already offset into the shared buffers.
+    GeometryAllocation addMeshFile(const MeshFile& file, std::vector<MeshDraw>& submeshDraws) {
+        const MeshFileHeader& header = file.getHeader();
+        if (header.vertexStride != vertexStride) {
+            throw std::runtime_error("mesh file vertex format does not match geometry buffer!");
+        }
+        if (header.indexSize > indexSize) {
+            throw std::runtime_error("mesh file needs 32-bit indices but geometry buffer uses 16-bit!");
+        }
+
+        GeometryAllocation allocation = allocate(static_cast<uint32_t>(header.vertexCount), static_cast<uint32_t>(header.indexCount));
+
+        std::vector<uint8_t> indexData(static_cast<size_t>(header.indexCount) * indexSize);
+        if (header.indexSize == indexSize) {
+            file.readIndices(indexData.data());
+        } else {
+            std::vector<uint16_t> shortIndices(header.indexCount);
+            file.readIndices(shortIndices.data());
+            uint32_t* wideIndices = reinterpret_cast<uint32_t*>(indexData.data());
+            for (size_t i = 0; i < shortIndices.size(); i++) {
+                wideIndices[i] = shortIndices[i];
+            }
+        }
+        upload(allocation, file.getVertexData(), indexData.data());
+
+        const MeshFileSubmesh* submeshes = file.getSubmeshes();
+        for (uint32_t i = 0; i < header.submeshCount; i++) {
+            MeshDraw draw{};
+            draw.indexCount = submeshes[i].indexCount;
+            draw.firstIndex = allocation.indices.offset + submeshes[i].firstIndex;
+            draw.vertexOffset = static_cast<int32_t>(allocation.vertices.offset + submeshes[i].vertexOffset);
+            submeshDraws.push_back(draw);
+        }
+
+        return allocation;
+    }
+
+    // The ranges can be handed out again right away, so only remove meshes that no command buffer in
+    // flight still draws, e.g. after vkDeviceWaitIdle or once the frame that last used them finished.
+    void removeMesh(const GeometryAllocation& allocation) {
+        vertexAllocator.free(allocation.vertices);
+        indexAllocator.free(allocation.indices);
+    }
+
+    // The only bind needed for every mesh in the buffer.
+    void bind(VkCommandBuffer commandBuffer) const {
+        VkDeviceSize offsets[] = {0};
+        dispatch->vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffer.address(), offsets);
+        dispatch->vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+    }
+
+    VkBuffer getVertexBuffer() const { return vertexBuffer; }
+    VkBuffer getIndexBuffer() const { return indexBuffer; }
+    VkIndexType getIndexType() const { return indexType; }
+    uint32_t getVertexStride() const { return vertexStride; }
+
+    void printStats() const {
+        std::cout << "geometry buffer: vertices " << vertexAllocator.getUsedSize() << "/" << vertexAllocator.getCapacity()
+            << " (" << vertexAllocator.getFreeRangeCount() << " free ranges, largest " << vertexAllocator.getLargestFreeRange() << ")"
+            << ", indices " << indexAllocator.getUsedSize() << "/" << indexAllocator.getCapacity()
+            << " (" << indexAllocator.getFreeRangeCount() << " free ranges, largest " << indexAllocator.getLargestFreeRange() << ")" << std::endl;
+    }
+
+private:
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t vertexStride = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t indexSize = sizeof(uint32_t);
+
+    OffsetAllocator vertexAllocator;
+    OffsetAllocator indexAllocator;
+
+    UniqueDeviceMemory vertexBufferMemory;
+    UniqueBuffer vertexBuffer;
+    UniqueDeviceMemory indexBufferMemory;
+    UniqueBuffer indexBuffer;
+
+    GeometryAllocation allocate(uint32_t vertexCount, uint32_t indexCount) {
+        GeometryAllocation allocation;
+        allocation.vertices = vertexAllocator.allocate(vertexCount);
+        if (allocation.vertices.offset == OffsetAllocator::INVALID_OFFSET) {
+            throw std::runtime_error("geometry buffer is out of vertex space!");
+        }
+
+        allocation.indices = indexAllocator.allocate(indexCount);
+        if (allocation.indices.offset == OffsetAllocator::INVALID_OFFSET) {
+            vertexAllocator.free(allocation.vertices);
+            throw std::runtime_error("geometry buffer is out of index space!");
+        }
+
+        return allocation;
+    }
+
+    void upload(const GeometryAllocation& allocation, const void* vertices, const void* indices) {
+        if (allocation.vertices.size > 0) {
+            uploadToBuffer(context, vertexBuffer, vertices, static_cast<VkDeviceSize>(allocation.vertices.size) * vertexStride,
+                static_cast<VkDeviceSize>(allocation.vertices.offset) * vertexStride);
+        }
+        if (allocation.indices.size > 0) {
+            uploadToBuffer(context, indexBuffer, indices, static_cast<VkDeviceSize>(allocation.indices.size) * indexSize,
+                static_cast<VkDeviceSize>(allocation.indices.offset) * indexSize);
+        }
+    }
+};
@@ -0,0 +1,765 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "IndirectDraw.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// Per-object bounds read by cull.comp. Both volumes share one world space center.
+struct ObjectBounds {
+    glm::vec4 sphere;  // center, radius
+    glm::vec4 extents; // AABB half extents, w unused
+};
+
+enum CullFlags : uint32_t {
+    CULL_FRUSTUM = 1,
+    CULL_OCCLUSION = 2,
+    CULL_USE_AABB = 4,
+    CULL_COMPACT = 8,
+    CULL_ZERO_FIRST_INSTANCE = 16  // set by updateUniforms() without drawIndirectFirstInstance
+};
+
+// Matches the std140 CullUniforms block in cull.comp.
+struct CullUniforms {
+    glm::vec4 frustumPlanes[6];
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::vec4 pyramidSize;
+    uint32_t objectCount;
+    uint32_t flags;
+    float znear;
+    uint32_t padding;
+};
+
+// Gribb/Hartmann plane extraction from the UniformBufferObject view and proj matrices. The near plane
+// is taken as w + z, which is exact for OpenGL style depth and slightly conservative for [0, 1] depth,
+// so it is safe whether or not GLM_FORCE_DEPTH_ZERO_TO_ONE is defined.
+inline std::array<glm::vec4, 6> extractFrustumPlanes(const glm::mat4& view, const glm::mat4& proj) {
+    glm::mat4 m = proj * view;
+
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    std::array<glm::vec4, 6> planes = {
+        row3 + row0,
+        row3 - row0,
+        row3 + row1,
+        row3 - row1,
+        row3 + row2,
+        row3 - row2
+    };
+
+    for (glm::vec4& plane : planes) {
+        plane = plane / glm::length(glm::vec3(plane));
+    }
+
+    return planes;
+}
+
+inline bool sphereInFrustum(const std::array<glm::vec4, 6>& planes, const glm::vec4& sphere) {
+    for (const glm::vec4& plane : planes) {
+        if (plane.x * sphere.x + plane.y * sphere.y + plane.z * sphere.z + plane.w < -sphere.w) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hierarchical depth buffer built from the scene depth with hiz.comp. Level 0 is half the depth
+// resolution and every texel stores the farthest depth it covers. The pyramid stays in
+// VK_IMAGE_LAYOUT_GENERAL; the culling pass of the next frame samples it.
+class DepthPyramid {
+public:
+    void create(const VulkanContext& context, VkImageView depthImageView, uint32_t depthWidth, uint32_t depthHeight) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        width = std::max(1u, depthWidth / 2);
+        height = std::max(1u, depthHeight / 2);
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+        createImage(context, width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+
+        imageView = createUniqueImageView(context.device, image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels);
+        mipViews.clear();
+        for (uint32_t i = 0; i < mipLevels; i++) {
+            mipViews.push_back(createUniqueImageView(context.device, image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, i, 1));
+        }
+
+        createSampler();
+        createDescriptorSetLayout();
+        createPipeline();
+        createDescriptorSets(depthImageView);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        VkImageMemoryBarrier barrier = makeBarrier(0, 0, mipLevels);
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        endSingleTimeCommands(context, commandBuffer);
+    }
+
+    void cleanup() {
+        pipeline.reset();
+        pipelineLayout.reset();
+        descriptorPool.reset();
+        descriptorSetLayout.reset();
+        sampler.reset();
+
+        mipViews.clear();
+        imageView.reset();
+        image.reset();
+        imageMemory.reset();
+    }
+
+    // The depth image must be readable by compute shaders, i.e. in
+    // VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL after the render pass that wrote it.
+    void record(VkCommandBuffer commandBuffer) {
+        dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+        for (uint32_t i = 0; i < mipLevels; i++) {
+            VkImageMemoryBarrier toWrite = makeBarrier(VK_ACCESS_SHADER_READ_BIT, i, 1);
+            toWrite.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toWrite);
+
+            uint32_t levelWidth = std::max(1u, width >> i);
+            uint32_t levelHeight = std::max(1u, height >> i);
+
+            dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+            dispatch->vkCmdDispatch(commandBuffer, (levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+
+            VkImageMemoryBarrier toRead = makeBarrier(VK_ACCESS_SHADER_WRITE_BIT, i, 1);
+            toRead.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toRead);
+        }
+    }
+
+    VkImageView getImageView() const {
+        return imageView;
+    }
+
+    VkSampler getSampler() const {
+        return sampler;
+    }
+
+    glm::vec4 getSize() const {
+        return glm::vec4(static_cast<float>(width), static_cast<float>(height), static_cast<float>(mipLevels), 0.0f);
+    }
+
+private:
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+
+    UniqueDeviceMemory imageMemory;
+    UniqueImage image;
+    UniqueImageView imageView;
+    std::vector<UniqueImageView> mipViews;
+    UniqueSampler sampler;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+    std::vector<VkDescriptorSet> descriptorSets;
+    UniquePipelineLayout pipelineLayout;
+    UniquePipeline pipeline;
+
+    VkImageMemoryBarrier makeBarrier(VkAccessFlags srcAccessMask, uint32_t baseMipLevel, uint32_t levelCount) const {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = baseMipLevel;
+        barrier.subresourceRange.levelCount = levelCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        return barrier;
+    }
+
+    void createSampler() {
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = static_cast<float>(mipLevels);
+        samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+        if (vkCreateSampler(context.device, &samplerInfo, nullptr, sampler.put(context.device)) != VK_SUCCESS) {
+            sampler.release();
+            throw std::runtime_error("failed to create depth pyramid sampler!");
+        }
+    }
+
+    void createDescriptorSetLayout() {
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0].binding = 0;
+        bindings[0].descriptorCount = 1;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorCount = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create depth pyramid descriptor set layout!");
+        }
+    }
+
+    void createPipeline() {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayout.address();
+
+        if (vkCreatePipelineLayout(context.device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(context.device)) != VK_SUCCESS) {
+            pipelineLayout.release();
+            throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+        }
+
+        pipeline = UniquePipeline(context.device, createComputePipeline(context.device, pipelineLayout, "res/shaders/hiz_comp.spv"));
+    }
+
+    void createDescriptorSets(VkImageView depthImageView) {
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = mipLevels;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        poolSizes[1].descriptorCount = mipLevels;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = mipLevels;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create depth pyramid descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(mipLevels, descriptorSetLayout);
+        descriptorSets.resize(mipLevels);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = mipLevels;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate depth pyramid descriptor sets!");
+        }
+
+        for (uint32_t i = 0; i < mipLevels; i++) {
+            VkDescriptorImageInfo sourceInfo{};
+            sourceInfo.sampler = sampler;
+            sourceInfo.imageView = i == 0 ? depthImageView : mipViews[i - 1];
+            sourceInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo destinationInfo{};
+            destinationInfo.imageView = mipViews[i];
+            destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[0].dstSet = descriptorSets[i];
+            descriptorWrites[0].dstBinding = 0;
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[0].descriptorCount = 1;
+            descriptorWrites[0].pImageInfo = &sourceInfo;
+            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[1].dstSet = descriptorSets[i];
+            descriptorWrites[1].dstBinding = 1;
+            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[1].descriptorCount = 1;
+            descriptorWrites[1].pImageInfo = &destinationInfo;
+
+            vkUpdateDescriptorSets(context.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+};
+
+// Frustum and optional Hi-Z occlusion culling on the GPU. cull.comp replaces the indirect.comp
+// pre-pass of IndirectDrawPath: it tests every object and writes the survivors into the same draw
+// command and count buffers, so recordDraws() is used unchanged afterwards.
+class GpuCulling {
+public:
+    void create(const VulkanContext& context, IndirectDrawPath& drawPath, uint32_t frameCount) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->drawPath = &drawPath;
+        maxObjects = drawPath.getMaxDraws();
+
+        createBuffer(context, sizeof(ObjectBounds) * maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, boundsBuffer, boundsMemory);
+
+        frames.resize(frameCount);
+        for (FrameResources& frame : frames) {
+            createBuffer(context, sizeof(CullUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.uniformBuffer, frame.uniformMemory);
+            vkMapMemory(context.device, frame.uniformMemory, 0, sizeof(CullUniforms), 0, &frame.uniforms);
+        }
+
+        createFallbackPyramid();
+        createDescriptorSetLayout();
+        createPipeline();
+        createDescriptorSets(frameCount);
+    }
+
+    void cleanup() {
+        pipeline.reset();
+        pipelineLayout.reset();
+        descriptorPool.reset();
+        descriptorSetLayout.reset();
+
+        // Freeing the uniform memory unmaps it.
+        frames.clear();
+
+        fallbackSampler.reset();
+        fallbackImageView.reset();
+        fallbackImage.reset();
+        fallbackImageMemory.reset();
+
+        boundsBuffer.reset();
+        boundsMemory.reset();
+    }
+
+    void setBounds(const std::vector<ObjectBounds>& bounds) {
+        if (bounds.size() > maxObjects) {
+            throw std::runtime_error("too many objects for gpu culling!");
+        }
+        uploadToBuffer(context, boundsBuffer, bounds.data(), sizeof(ObjectBounds) * bounds.size());
+    }
+
+    // Points the occlusion test at a depth pyramid, or back at the 1x1 far plane image when null.
+    // Rewrites the descriptor sets of every frame, so call it while the device is idle, e.g. from
+    // recreateSwapChain().
+    void setDepthPyramid(const DepthPyramid* pyramid) {
+        depthPyramid = pyramid;
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.sampler = pyramid ? pyramid->getSampler() : fallbackSampler.get();
+        imageInfo.imageView = pyramid ? pyramid->getImageView() : fallbackImageView.get();
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        for (FrameResources& frame : frames) {
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = frame.descriptorSet;
+            descriptorWrite.dstBinding = 6;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pImageInfo = &imageInfo;
+
+            vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    // Called next to updateUniformBuffer() with the same view and proj matrices.
+    void updateUniforms(uint32_t currentFrame, const glm::mat4& view, const glm::mat4& proj, float znear, uint32_t flags) {
+        std::array<glm::vec4, 6> planes = extractFrustumPlanes(view, proj);
+
+        CullUniforms uniforms{};
+        for (size_t i = 0; i < planes.size(); i++) {
+            uniforms.frustumPlanes[i] = planes[i];
+        }
+        uniforms.view = view;
+        uniforms.proj = proj;
+        uniforms.pyramidSize = depthPyramid ? depthPyramid->getSize() : glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+        uniforms.objectCount = drawPath->getDrawCount(currentFrame);
+        uniforms.flags = flags;
+        if (drawPath->getSupport().drawIndirectCount) {
+            uniforms.flags |= CULL_COMPACT;
+        }
+        if (!drawPath->getSupport().drawIndirectFirstInstance) {
+            uniforms.flags |= CULL_ZERO_FIRST_INSTANCE;
+        }
+        if (depthPyramid == nullptr) {
+            uniforms.flags &= ~CULL_OCCLUSION;
+        }
+        uniforms.znear = znear;
+
+        memcpy(frames[currentFrame].uniforms, &uniforms, sizeof(uniforms));
+    }
+
+    // Records the culling pass in place of IndirectDrawPath::recordCommandGeneration().
+    void record(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        VkBuffer countBuffer = drawPath->getCountBuffer(currentFrame);
+        uint32_t objectCount = drawPath->getDrawCount(currentFrame);
+
+        dispatch->vkCmdFillBuffer(commandBuffer, countBuffer, 0, sizeof(uint32_t), 0);
+
+        VkBufferMemoryBarrier clearBarrier = makeBufferBarrier(countBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &clearBarrier, 0, nullptr);
+
+        dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frames[currentFrame].descriptorSet, 0, nullptr);
+        dispatch->vkCmdDispatch(commandBuffer, (objectCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+        std::array<VkBufferMemoryBarrier, 2> barriers = {
+            makeBufferBarrier(drawPath->getCommandBuffer(currentFrame), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+            makeBufferBarrier(countBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT)
+        };
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    }
+
+private:
+    static const uint32_t WORKGROUP_SIZE = 64;
+
+    struct FrameResources {
+        UniqueDeviceMemory uniformMemory;
+        UniqueBuffer uniformBuffer;
+        void* uniforms = nullptr;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    };
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    IndirectDrawPath* drawPath = nullptr;
+    const DepthPyramid* depthPyramid = nullptr;
+    uint32_t maxObjects = 0;
+
+    UniqueDeviceMemory boundsMemory;
+    UniqueBuffer boundsBuffer;
+    std::vector<FrameResources> frames;
+
+    UniqueDeviceMemory fallbackImageMemory;
+    UniqueImage fallbackImage;
+    UniqueImageView fallbackImageView;
+    UniqueSampler fallbackSampler;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+    UniquePipelineLayout pipelineLayout;
+    UniquePipeline pipeline;
+
+    static VkBufferMemoryBarrier makeBufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        return barrier;
+    }
+
+    // A 1x1 pyramid at the far plane, bound while no real depth pyramid exists so the descriptor set
+    // is always complete. It never occludes anything.
+    void createFallbackPyramid() {
+        createImage(context, 1, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, fallbackImage, fallbackImageMemory);
+        fallbackImageView = createUniqueImageView(context.device, fallbackImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+        if (vkCreateSampler(context.device, &samplerInfo, nullptr, fallbackSampler.put(context.device)) != VK_SUCCESS) {
+            fallbackSampler.release();
+            throw std::runtime_error("failed to create culling sampler!");
+        }
+
+        VkImageSubresourceRange range{};
+        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.levelCount = 1;
+        range.layerCount = 1;
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = fallbackImage;
+        barrier.subresourceRange = range;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkClearColorValue farPlane{};
+        farPlane.float32[0] = 1.0f;
+        dispatch->vkCmdClearColorImage(commandBuffer, fallbackImage, VK_IMAGE_LAYOUT_GENERAL, &farPlane, 1, &range);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        endSingleTimeCommands(context, commandBuffer);
+    }
+
+    void createDescriptorSetLayout() {
+        std::array<VkDescriptorSetLayoutBinding, 7> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorCount = 1;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create culling descriptor set layout!");
+        }
+    }
+
+    void createPipeline() {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayout.address();
+
+        if (vkCreatePipelineLayout(context.device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(context.device)) != VK_SUCCESS) {
+            pipelineLayout.release();
+            throw std::runtime_error("failed to create culling pipeline layout!");
+        }
+
+        pipeline = UniquePipeline(context.device, createComputePipeline(context.device, pipelineLayout, "res/shaders/cull_comp.spv"));
+    }
+
+    void createDescriptorSets(uint32_t frameCount) {
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[0].descriptorCount = 5 * frameCount;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        poolSizes[1].descriptorCount = frameCount;
+        poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[2].descriptorCount = frameCount;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = frameCount;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create culling descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+        std::vector<VkDescriptorSet> descriptorSets(frameCount);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = frameCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate culling descriptor sets!");
+        }
+
+        for (uint32_t i = 0; i < frameCount; i++) {
+            frames[i].descriptorSet = descriptorSets[i];
+
+            std::array<VkDescriptorBufferInfo, 6> bufferInfos{};
+            bufferInfos[0] = { drawPath->getMeshBuffer(), 0, VK_WHOLE_SIZE };
+            bufferInfos[1] = drawPath->getDrawDataBufferInfo(i);
+            bufferInfos[2] = { drawPath->getCommandBuffer(i), 0, VK_WHOLE_SIZE };
+            bufferInfos[3] = { drawPath->getCountBuffer(i), 0, VK_WHOLE_SIZE };
+            bufferInfos[4] = { boundsBuffer, 0, VK_WHOLE_SIZE };
+            bufferInfos[5] = { frames[i].uniformBuffer, 0, sizeof(CullUniforms) };
+
+            std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+            for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+                descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[binding].dstSet = descriptorSets[i];
+                descriptorWrites[binding].dstBinding = binding;
+                descriptorWrites[binding].dstArrayElement = 0;
+                descriptorWrites[binding].descriptorType = binding == 5 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[binding].descriptorCount = 1;
+                descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+            }
+
+            vkUpdateDescriptorSets(context.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        setDepthPyramid(nullptr);
+    }
+};
+
+struct CullingBenchmarkResult {
+    uint32_t objectCount;
+    uint32_t gpuVisibleCount;
+    uint32_t cpuVisibleCount;
+    double gpuMilliseconds;
+    double cpuMilliseconds;
+};
+
+// Culls a random scene of objectCount spheres spread around the camera, once with cull.comp timed by
+// timestamp queries and once with a scalar CPU loop for reference. Both should agree on the visible
+// count; with the default scene roughly a sixth of the objects survive the frustum test. gpuMilliseconds
+// stays 0 on a graphics queue without timestamp support.
+inline CullingBenchmarkResult benchmarkCulling(const VulkanContext& context, uint32_t objectCount = 1000000, uint32_t iterations = 16) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+    const VulkanDeviceTable* dispatch = &getDeviceTable(context.device);
+
+    // beginSingleTimeCommands() submits to the graphics queue; timestamps there only count up to
+    // timestampValidBits bits, and not at all with 0.
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(context.physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(context.physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t timestampValidBits = 0;
+    for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
+        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+            timestampValidBits = queueFamily.timestampValidBits;
+            break;
+        }
+    }
+    const bool timestamps = timestampValidBits != 0;
+    const uint64_t timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+    std::mt19937 generator(1337);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.25f, 2.0f);
+
+    std::vector<ObjectBounds> bounds(objectCount);
+    std::vector<DrawData> draws(objectCount);
+    for (uint32_t i = 0; i < objectCount; i++) {
+        float radius = size(generator);
+        bounds[i].sphere = glm::vec4(position(generator), position(generator), position(generator), radius);
+        bounds[i].extents = glm::vec4(radius * 0.577f, radius * 0.577f, radius * 0.577f, 0.0f);
+        draws[i].model = glm::mat4(1.0f);
+        draws[i].meshIndex = 0;
+        draws[i].materialIndex = 0;
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+    proj[1][1] *= -1;
+
+    IndirectDrawPath drawPath;
+    drawPath.create(context, 1, objectCount, 1);
+    ScopeExit drawPathCleanup([&drawPath] { drawPath.cleanup(); });
+    drawPath.setMeshes({ { 6, 0, 0, 0 } });
+    drawPath.setDraws(0, draws.data(), objectCount);
+
+    GpuCulling culling;
+    culling.create(context, drawPath, 1);
+    ScopeExit cullingCleanup([&culling] { culling.cleanup(); });
+    culling.setBounds(bounds);
+    culling.updateUniforms(0, view, proj, 0.1f, CULL_FRUSTUM);
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2;
+
+    UniqueQueryPool queryPool;
+    if (vkCreateQueryPool(context.device, &queryPoolInfo, nullptr, queryPool.put(context.device)) != VK_SUCCESS) {
+        queryPool.release();
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    UniqueDeviceMemory readbackMemory;
+    UniqueBuffer readbackBuffer;
+    createBuffer(context, sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackMemory);
+
+    CullingBenchmarkResult result{};
+    result.objectCount = objectCount;
+
+    double gpuTotal = 0.0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        if (timestamps) {
+            dispatch->vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+        }
+        culling.record(commandBuffer, 0);
+        if (timestamps) {
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        }
+
+        VkBufferCopy copyRegion{};
+        copyRegion.size = sizeof(uint32_t);
+        dispatch->vkCmdCopyBuffer(commandBuffer, drawPath.getCountBuffer(0), readbackBuffer, 1, &copyRegion);
+        endSingleTimeCommands(context, commandBuffer);
+
+        if (timestamps) {
+            // Masking the difference also handles the counter wrapping around between the two writes.
+            uint64_t queryResults[2];
+            vkGetQueryPoolResults(context.device, queryPool, 0, 2, sizeof(queryResults), queryResults, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            gpuTotal += static_cast<double>((queryResults[1] - queryResults[0]) & timestampMask) * properties.limits.timestampPeriod * 1e-6;
+        }
+    }
+    result.gpuMilliseconds = gpuTotal / iterations;
+
+    void* data;
+    vkMapMemory(context.device, readbackMemory, 0, sizeof(uint32_t), 0, &data);
+    memcpy(&result.gpuVisibleCount, data, sizeof(uint32_t));
+    vkUnmapMemory(context.device, readbackMemory);
+
+    std::array<glm::vec4, 6> planes = extractFrustumPlanes(view, proj);
+    auto cpuStart = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t visible = 0;
+        for (const ObjectBounds& object : bounds) {
+            visible += sphereInFrustum(planes, object.sphere) ? 1 : 0;
+        }
+        result.cpuVisibleCount = visible;
+    }
+    auto cpuEnd = std::chrono::high_resolution_clock::now();
+    result.cpuMilliseconds = std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count() / iterations;
+
+    std::cout << "culling " << result.objectCount << " objects: gpu ";
+    if (timestamps) {
+        std::cout << result.gpuMilliseconds << " ms";
+    } else {
+        std::cout << "untimed";
+    }
+    std::cout << " (" << result.gpuVisibleCount << " visible), cpu "
+        << result.cpuMilliseconds << " ms (" << result.cpuVisibleCount << " visible)" << std::endl;
+
+    return result;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Index width selection and on-disk index compression. The tutorial binds a std::vector<uint16_t>
+// with VK_INDEX_TYPE_UINT16, which only addresses 65536 vertices; meshes pick the narrowest type that
+// fits instead (see splitMeshForShortIndices() in MeshFile.h for meshes that are just too large).
+
+const size_t MAX_SHORT_INDEX_VERTICES = 65536;
+
+enum class IndexEncoding : uint32_t {
+    Raw = 0,
+    // Every index stored as the zigzag LEB128 varint of its difference to the previous index. After
+    // optimizeVertexCache() and optimizeVertexFetch() most differences fit in one byte.
+    Delta = 1,
+};
+
+inline uint32_t chooseIndexSize(size_t vertexCount) {
+    return vertexCount <= MAX_SHORT_INDEX_VERTICES ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+inline VkIndexType indexTypeOf(uint32_t indexSize) {
+    return indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+// Narrows or copies indices to indexSize bytes each.
+inline std::vector<uint8_t> packIndices(const std::vector<uint32_t>& indices, uint32_t indexSize) {
+    std::vector<uint8_t> data(indices.size() * indexSize);
+    if (indexSize == sizeof(uint32_t)) {
+        memcpy(data.data(), indices.data(), data.size());
+        return data;
+    }
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (indices[i] > UINT16_MAX) {
+            throw std::runtime_error("index does not fit in 16 bits!");
+        }
+        uint16_t index = static_cast<uint16_t>(indices[i]);
+        memcpy(&data[i * sizeof(uint16_t)], &index, sizeof(uint16_t));
+    }
+    return data;
+}
+
+inline std::vector<uint8_t> encodeIndexDeltas(const std::vector<uint32_t>& indices) {
+    std::vector<uint8_t> data;
+    data.reserve(indices.size() + indices.size() / 4);
+
+    int64_t previous = 0;
+    for (uint32_t index : indices) {
+        int64_t delta = static_cast<int64_t>(index) - previous;
+        uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        previous = index;
+
+        while (zigzag >= 0x80) {
+            data.push_back(static_cast<uint8_t>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        data.push_back(static_cast<uint8_t>(zigzag));
+    }
+
+    return data;
+}
+
+// Decodes count indices straight into destination as indexSize byte integers, e.g. into a mapped
+// staging buffer.
+inline void decodeIndexDeltas(const uint8_t* data, size_t size, size_t count, void* destination, uint32_t indexSize) {
+    uint8_t* out = static_cast<uint8_t*>(destination);
+    const uint8_t* end = data + size;
+    int64_t previous = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t zigzag = 0;
+        int shift = 0;
+        while (true) {
+            if (data == end || shift > 35) {
+                throw std::runtime_error("corrupt index data!");
+            }
+            uint8_t byte = *data++;
+            zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+
+        int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        previous += delta;
+
+        if (indexSize == sizeof(uint16_t)) {
+            uint16_t index = static_cast<uint16_t>(previous);
+            memcpy(out + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+        } else {
+            uint32_t index = static_cast<uint32_t>(previous);
+            memcpy(out + i * sizeof(uint32_t), &index, sizeof(uint32_t));
+        }
+    }
+}
+
+struct IndexFormatStats {
+    size_t bytes32 = 0;
+    size_t bytes16 = 0;      // 0 when the indices don't fit 16 bits
+    size_t bytesDelta = 0;
+    double decodeMegabytesPerSecond = 0.0; // decoded output per second
+    double copyMegabytesPerSecond = 0.0;   // memcpy of the raw indices, for reference
+};
+
+// Compares the storage size of the three index encodings and times the load time cost of delta
+// decoding against a plain copy. What the bound index size costs on the GPU is measured by
+// benchmarkIndexFetch().
+inline IndexFormatStats benchmarkIndexFormats(const std::vector<uint32_t>& indices, size_t vertexCount, int iterations = 16) {
+    IndexFormatStats stats;
+    const uint32_t indexSize = chooseIndexSize(vertexCount);
+    stats.bytes32 = indices.size() * sizeof(uint32_t);
+    stats.bytes16 = indexSize == sizeof(uint16_t) ? indices.size() * sizeof(uint16_t) : 0;
+
+    std::vector<uint8_t> encoded = encodeIndexDeltas(indices);
+    stats.bytesDelta = encoded.size();
+
+    std::vector<uint8_t> raw = packIndices(indices, indexSize);
+    std::vector<uint8_t> decoded(raw.size());
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        decodeIndexDeltas(encoded.data(), encoded.size(), indices.size(), decoded.data(), indexSize);
+    }
+    auto decodeTime = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(decoded.data(), raw.data(), raw.size());
+    }
+    auto copyTime = std::chrono::high_resolution_clock::now();
+
+    if (decoded != raw) {
+        throw std::runtime_error("index delta round trip failed!");
+    }
+
+    double decodeSeconds = std::chrono::duration<double>(decodeTime - startTime).count();
+    double copySeconds = std::chrono::duration<double>(copyTime - decodeTime).count();
+    double megabytes = static_cast<double>(raw.size()) * iterations / 1e6;
+    stats.decodeMegabytesPerSecond = decodeSeconds > 0.0 ? megabytes / decodeSeconds : 0.0;
+    stats.copyMegabytesPerSecond = copySeconds > 0.0 ? megabytes / copySeconds : 0.0;
+
+    return stats;
+}
+
+inline void printIndexFormatStats(const IndexFormatStats& stats) {
+    std::cout << "indices: 32-bit " << stats.bytes32 << " bytes, 16-bit " << (stats.bytes16 != 0 ? std::to_string(stats.bytes16) : std::string("n/a"))
+        << " bytes, delta " << stats.bytesDelta << " bytes (" << 100.0 * stats.bytesDelta / stats.bytes32 << "% of 32-bit)" << std::endl;
+    std::cout << "delta decode " << stats.decodeMegabytesPerSecond << " MB/s, copy " << stats.copyMegabytesPerSecond << " MB/s" << std::endl;
+}
+
+struct IndexFetchResult {
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    double milliseconds = 0.0;          // GPU time of one frame of draws
+    double gigabytesPerSecond = 0.0;    // index bytes read by those draws over that time
+};
+
+// Draws the same indices from a 32-bit and, when vertexCount allows it, a 16-bit index buffer and
+// measures the GPU time of each with timestamps. Needs no window; each frame is submitted with
+// beginSingleTimeCommands(). pass records the frame: it begins a render pass, binds a pipeline and the
+// vertex buffers for vertexCount vertices, calls draw and ends the pass. draw binds the index buffer
+// under test and draws it drawsPerFrame times. The first frame of each index type is a warm-up and
+// not timed.
+inline std::vector<IndexFetchResult> benchmarkIndexFetch(const VulkanContext& context, const std::vector<uint32_t>& indices, size_t vertexCount,
+    uint32_t frames, uint32_t drawsPerFrame, const std::function<void(VkCommandBuffer, const std::function<void(VkCommandBuffer)>&)>& pass) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+    const VulkanDeviceTable* dispatch = &getDeviceTable(context.device);
+
+    VkQueryPoolCreateInfo timestampInfo{};
+    timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    timestampInfo.queryCount = 2;
+
+    UniqueQueryPool timestampPool;
+    if (vkCreateQueryPool(context.device, &timestampInfo, nullptr, timestampPool.put(context.device)) != VK_SUCCESS) {
+        timestampPool.release();
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    std::vector<uint32_t> indexSizes = {sizeof(uint32_t)};
+    if (chooseIndexSize(vertexCount) == sizeof(uint16_t)) {
+        indexSizes.push_back(sizeof(uint16_t));
+    }
+
+    std::vector<IndexFetchResult> results;
+    for (uint32_t indexSize : indexSizes) {
+        std::vector<uint8_t> data = packIndices(indices, indexSize);
+
+        UniqueDeviceMemory indexBufferMemory;
+        UniqueBuffer indexBuffer;
+        createBuffer(context, data.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        uploadToBuffer(context, indexBuffer, data.data(), data.size());
+
+        IndexFetchResult result;
+        result.indexType = indexTypeOf(indexSize);
+
+        auto draw = [&](VkCommandBuffer commandBuffer) {
+            dispatch->vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, result.indexType);
+            for (uint32_t i = 0; i < drawsPerFrame; i++) {
+                dispatch->vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            }
+        };
+
+        for (uint32_t frame = 0; frame <= frames; frame++) {
+            // endSingleTimeCommands() frees the command buffer; the guard only does when recording throws.
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+            ScopeExit commandBufferCleanup([&] { vkFreeCommandBuffers(context.device, context.commandPool, 1, &commandBuffer); });
+            dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, 0, 2);
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+            pass(commandBuffer, draw);
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 1);
+            commandBufferCleanup.dismiss();
+            endSingleTimeCommands(context, commandBuffer);
+
+            if (frame == 0) {
+                continue;
+            }
+            uint64_t timestamps[2] = {};
+            vkGetQueryPoolResults(context.device, timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            result.milliseconds += (timestamps[1] - timestamps[0]) * properties.limits.timestampPeriod / 1e6;
+        }
+
+        result.milliseconds /= std::max(frames, 1u);
+        double bytes = static_cast<double>(data.size()) * drawsPerFrame;
+        result.gigabytesPerSecond = result.milliseconds > 0.0 ? bytes / (result.milliseconds * 1e6) : 0.0;
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+inline void printIndexFetchResults(const std::vector<IndexFetchResult>& results) {
+    for (const IndexFetchResult& result : results) {
+        std::cout << (result.indexType == VK_INDEX_TYPE_UINT16 ? "16" : "32") << "-bit indices: " << result.milliseconds << " ms, "
+            << result.gigabytesPerSecond << " GB/s of indices" << std::endl;
+    }
+}
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// One entry per mesh living in the shared vertex/index buffers. Mirrors MeshDraw in indirect.comp.
+struct MeshDraw {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t padding;
+};
+
+// One entry per object. The vertex shader reads it with gl_InstanceIndex plus IndirectDrawConstants,
+// because every indirect command sets firstInstance to the index of the object it draws, or, without
+// drawIndirectFirstInstance, firstInstance is 0 and the index is pushed before each draw.
+struct DrawData {
+    glm::mat4 model;
+    uint32_t meshIndex;
+    uint32_t materialIndex;
+    uint32_t padding[2];
+};
+
+// Push constants of indirect.vert.
+struct IndirectDrawConstants {
+    uint32_t firstDraw;
+};
+
+struct IndirectDrawSupport {
+    bool multiDrawIndirect = false;
+    bool drawIndirectFirstInstance = false;
+    bool drawIndirectCount = false;
+    uint32_t maxDrawIndirectCount = 1;
+};
+
+inline IndirectDrawSupport queryIndirectDrawSupport(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    bool core = properties.apiVersion >= VK_API_VERSION_1_2;
+
+    // VkPhysicalDeviceVulkan12Features may only be chained on a 1.2 device.
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = core ? &vulkan12Features : nullptr;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+
+    IndirectDrawSupport support;
+    support.multiDrawIndirect = deviceFeatures.features.multiDrawIndirect == VK_TRUE;
+    support.drawIndirectFirstInstance = deviceFeatures.features.drawIndirectFirstInstance == VK_TRUE;
+    support.drawIndirectCount = core ? vulkan12Features.drawIndirectCount == VK_TRUE : hasDeviceExtension(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    support.maxDrawIndirectCount = properties.limits.maxDrawIndirectCount;
+    return support;
+}
+
+// Draws any number of objects with a single vkCmdDrawIndexedIndirect(Count) call. The draw command
+// buffer is either uploaded from the CPU or written on the GPU by the indirect.comp pre-pass, which
+// reads the mesh table and the per-draw data SSBO.
+//
+// The features used here have to be enabled in createLogicalDevice(): multiDrawIndirect and
+// drawIndirectFirstInstance in VkPhysicalDeviceFeatures, and drawIndirectCount in
+// VkPhysicalDeviceVulkan12Features when queryIndirectDrawSupport() reports them. Below Vulkan 1.2,
+// add VK_KHR_draw_indirect_count to deviceExtensions instead, which has no feature to enable. Without
+// drawIndirectFirstInstance every object keeps its command slot and is drawn by its own call.
+class IndirectDrawPath {
+public:
+    static const uint32_t WORKGROUP_SIZE = 64;
+
+    void create(const VulkanContext& context, uint32_t frameCount, uint32_t maxDraws, uint32_t maxMeshes) {
+        this->context = context;
+        this->maxDraws = maxDraws;
+        this->maxMeshes = maxMeshes;
+        support = queryIndirectDrawSupport(context.physicalDevice);
+        dispatch = &getDeviceTable(context.device);
+
+        if (support.drawIndirectCount) {
+            // The table falls back to vkCmdDrawIndexedIndirectCountKHR below Vulkan 1.2.
+            drawIndexedIndirectCount = dispatch->vkCmdDrawIndexedIndirectCount;
+            support.drawIndirectCount = drawIndexedIndirectCount != nullptr;
+        }
+
+        // Compacted commands only work when firstInstance carries the object index, and a counted draw
+        // can't be split into batches, so a single call has to cover maxDraws.
+        if (!support.drawIndirectFirstInstance || maxDraws > support.maxDrawIndirectCount) {
+            support.drawIndirectCount = false;
+        }
+
+        createBuffers(frameCount);
+        createDescriptorSetLayout();
+        createPipeline();
+        createDescriptorPool(frameCount);
+        createDescriptorSets(frameCount);
+    }
+
+    void cleanup() {
+        pipeline.reset();
+        pipelineLayout.reset();
+        descriptorPool.reset();
+        descriptorSetLayout.reset();
+
+        for (FrameResources& frame : frames) {
+            vkUnmapMemory(context.device, frame.drawDataMemory);
+        }
+        frames.clear();
+
+        meshBuffer.reset();
+        meshMemory.reset();
+    }
+
+    const IndirectDrawSupport& getSupport() const {
+        return support;
+    }
+
+    void setMeshes(const std::vector<MeshDraw>& meshes) {
+        if (meshes.size() > maxMeshes) {
+            throw std::runtime_error("too many meshes for indirect draw path!");
+        }
+        uploadToBuffer(context, meshBuffer, meshes.data(), sizeof(MeshDraw) * meshes.size());
+    }
+
+    // Written every frame through a persistently mapped buffer, so only the slot of the current frame
+    // in flight may be touched.
+    void setDraws(uint32_t currentFrame, const DrawData* draws, uint32_t count) {
+        if (count > maxDraws) {
+            throw std::runtime_error("too many draws for indirect draw path!");
+        }
+        memcpy(frames[currentFrame].drawData, draws, sizeof(DrawData) * count);
+        frames[currentFrame].drawCount = count;
+    }
+
+    // CPU path for static scenes: upload the commands once and skip the compute pre-pass. Every
+    // command is expected to carry its object index in firstInstance, or 0 in firstInstance and be at
+    // the slot of its object when drawIndirectFirstInstance is not supported.
+    void uploadCommands(uint32_t currentFrame, const std::vector<VkDrawIndexedIndirectCommand>& commands) {
+        if (commands.size() > maxDraws) {
+            throw std::runtime_error("too many draws for indirect draw path!");
+        }
+
+        FrameResources& frame = frames[currentFrame];
+        uint32_t count = static_cast<uint32_t>(commands.size());
+        uploadToBuffer(context, frame.commandBuffer, commands.data(), sizeof(VkDrawIndexedIndirectCommand) * commands.size());
+        uploadToBuffer(context, frame.countBuffer, &count, sizeof(uint32_t));
+        frame.drawCount = count;
+    }
+
+    // Records the compute pre-pass that writes one VkDrawIndexedIndirectCommand per object. Must be
+    // recorded outside of the render pass, before recordDraws().
+    void recordCommandGeneration(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        FrameResources& frame = frames[currentFrame];
+
+        dispatch->vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, sizeof(uint32_t), 0);
+
+        VkBufferMemoryBarrier clearBarrier{};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        clearBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        clearBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        clearBarrier.buffer = frame.countBuffer;
+        clearBarrier.offset = 0;
+        clearBarrier.size = VK_WHOLE_SIZE;
+
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &clearBarrier, 0, nullptr);
+
+        GenerationConstants constants{};
+        constants.drawCount = frame.drawCount;
+        constants.compact = support.drawIndirectCount ? 1 : 0;
+        constants.objectFirstInstance = support.drawIndirectFirstInstance ? 1 : 0;
+
+        dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+        dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GenerationConstants), &constants);
+        dispatch->vkCmdDispatch(commandBuffer, (frame.drawCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+        std::array<VkBufferMemoryBarrier, 2> barriers{};
+        for (VkBufferMemoryBarrier& barrier : barriers) {
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+        }
+        barriers[0].buffer = frame.commandBuffer;
+        barriers[1].buffer = frame.countBuffer;
+
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    }
+
+    // Records the draws inside the render pass. The vertex and index buffers holding every mesh must
+    // already be bound, along with a descriptor set containing getDrawDataBufferInfo(), and
+    // pipelineLayout has to include getPushConstantRange().
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t currentFrame, VkPipelineLayout pipelineLayout) {
+        FrameResources& frame = frames[currentFrame];
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+        IndirectDrawConstants constants{};
+        constants.firstDraw = 0;
+
+        if (!support.drawIndirectFirstInstance) {
+            // firstInstance is 0 in every command, so indirect.vert gets the object index from here.
+            for (uint32_t i = 0; i < frame.drawCount; i++) {
+                constants.firstDraw = i;
+                dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(IndirectDrawConstants), &constants);
+                dispatch->vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer, static_cast<VkDeviceSize>(i) * stride, 1, stride);
+            }
+            return;
+        }
+
+        dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(IndirectDrawConstants), &constants);
+
+        if (support.drawIndirectCount) {
+            uint32_t maxDrawCount = std::min(frame.drawCount, support.maxDrawIndirectCount);
+            drawIndexedIndirectCount(commandBuffer, frame.commandBuffer, 0, frame.countBuffer, 0, maxDrawCount, stride);
+        } else if (support.multiDrawIndirect) {
+            uint32_t remaining = frame.drawCount;
+            VkDeviceSize offset = 0;
+            while (remaining > 0) {
+                uint32_t batch = std::min(remaining, support.maxDrawIndirectCount);
+                dispatch->vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer, offset, batch, stride);
+                offset += static_cast<VkDeviceSize>(batch) * stride;
+                remaining -= batch;
+            }
+        } else {
+            for (uint32_t i = 0; i < frame.drawCount; i++) {
+                dispatch->vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer, static_cast<VkDeviceSize>(i) * stride, 1, stride);
+            }
+        }
+    }
+
+    // Binding for the per-draw data in the graphics descriptor set layout, read by indirect.vert.
+    static VkDescriptorSetLayoutBinding getDrawDataLayoutBinding(uint32_t binding) {
+        VkDescriptorSetLayoutBinding drawDataLayoutBinding{};
+        drawDataLayoutBinding.binding = binding;
+        drawDataLayoutBinding.descriptorCount = 1;
+        drawDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        drawDataLayoutBinding.pImmutableSamplers = nullptr;
+        drawDataLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        return drawDataLayoutBinding;
+    }
+
+    // Push constant range for IndirectDrawConstants in the graphics pipeline layout.
+    static VkPushConstantRange getPushConstantRange() {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(IndirectDrawConstants);
+        return pushConstantRange;
+    }
+
+    VkDescriptorBufferInfo getDrawDataBufferInfo(uint32_t currentFrame) const {
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = frames[currentFrame].drawDataBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(DrawData) * maxDraws;
+        return bufferInfo;
+    }
+
+    VkBuffer getMeshBuffer() const {
+        return meshBuffer;
+    }
+
+    VkBuffer getCommandBuffer(uint32_t currentFrame) const {
+        return frames[currentFrame].commandBuffer;
+    }
+
+    VkBuffer getCountBuffer(uint32_t currentFrame) const {
+        return frames[currentFrame].countBuffer;
+    }
+
+    uint32_t getDrawCount(uint32_t currentFrame) const {
+        return frames[currentFrame].drawCount;
+    }
+
+    void setDrawCount(uint32_t currentFrame, uint32_t count) {
+        frames[currentFrame].drawCount = count;
+    }
+
+    uint32_t getMaxDraws() const {
+        return maxDraws;
+    }
+
+private:
+    struct GenerationConstants {
+        uint32_t drawCount;
+        uint32_t compact;
+        uint32_t objectFirstInstance;
+    };
+
+    struct FrameResources {
+        UniqueDeviceMemory drawDataMemory;
+        UniqueBuffer drawDataBuffer;
+        void* drawData = nullptr;
+
+        UniqueDeviceMemory commandMemory;
+        UniqueBuffer commandBuffer;
+
+        UniqueDeviceMemory countMemory;
+        UniqueBuffer countBuffer;
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        uint32_t drawCount = 0;
+    };
+
+    VulkanContext context;
+    IndirectDrawSupport support;
+    const VulkanDeviceTable* dispatch = nullptr;
+    PFN_vkCmdDrawIndexedIndirectCount drawIndexedIndirectCount = nullptr;
+
+    uint32_t maxDraws = 0;
+    uint32_t maxMeshes = 0;
+
+    UniqueDeviceMemory meshMemory;
+    UniqueBuffer meshBuffer;
+    std::vector<FrameResources> frames;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+    UniquePipelineLayout pipelineLayout;
+    UniquePipeline pipeline;
+
+    void createBuffers(uint32_t frameCount) {
+        createBuffer(context, sizeof(MeshDraw) * maxMeshes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshBuffer, meshMemory);
+
+        frames.resize(frameCount);
+        for (FrameResources& frame : frames) {
+            VkDeviceSize drawDataSize = sizeof(DrawData) * maxDraws;
+            createBuffer(context, drawDataSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.drawDataBuffer, frame.drawDataMemory);
+            vkMapMemory(context.device, frame.drawDataMemory, 0, drawDataSize, 0, &frame.drawData);
+
+            createBuffer(context, sizeof(VkDrawIndexedIndirectCommand) * maxDraws, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.commandBuffer, frame.commandMemory);
+            createBuffer(context, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.countBuffer, frame.countMemory);
+        }
+    }
+
+    void createDescriptorSetLayout() {
+        std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorCount = 1;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].pImmutableSamplers = nullptr;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create indirect draw descriptor set layout!");
+        }
+    }
+
+    void createPipeline() {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(GenerationConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayout.address();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(context.device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(context.device)) != VK_SUCCESS) {
+            pipelineLayout.release();
+            throw std::runtime_error("failed to create indirect draw pipeline layout!");
+        }
+
+        pipeline = UniquePipeline(context.device, createComputePipeline(context.device, pipelineLayout, "res/shaders/indirect_comp.spv"));
+    }
+
+    void createDescriptorPool(uint32_t frameCount) {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = 4 * frameCount;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = frameCount;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create indirect draw descriptor pool!");
+        }
+    }
+
+    void createDescriptorSets(uint32_t frameCount) {
+        std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+        std::vector<VkDescriptorSet> descriptorSets(frameCount);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = frameCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate indirect draw descriptor sets!");
+        }
+
+        for (uint32_t i = 0; i < frameCount; i++) {
+            frames[i].descriptorSet = descriptorSets[i];
+
+            std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+            bufferInfos[0] = { meshBuffer, 0, sizeof(MeshDraw) * maxMeshes };
+            bufferInfos[1] = { frames[i].drawDataBuffer, 0, sizeof(DrawData) * maxDraws };
+            bufferInfos[2] = { frames[i].commandBuffer, 0, sizeof(VkDrawIndexedIndirectCommand) * maxDraws };
+            bufferInfos[3] = { frames[i].countBuffer, 0, sizeof(uint32_t) };
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+            for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+                descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[binding].dstSet = descriptorSets[i];
+                descriptorWrites[binding].dstBinding = binding;
+                descriptorWrites[binding].dstArrayElement = 0;
+                descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[binding].descriptorCount = 1;
+                descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+            }
+
+            vkUpdateDescriptorSets(context.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+};
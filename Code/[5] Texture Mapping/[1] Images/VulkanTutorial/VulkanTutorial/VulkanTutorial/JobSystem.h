@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// A unit of work for JobSystem. unfinished counts the job itself plus its children that have not
+// finished yet; dependencies counts the prerequisites that still have to finish before the job may
+// start, plus one that submit() releases. exception holds the first exception thrown by the job or
+// one of its children, for wait() to rethrow.
+struct Job {
+    std::function<void()> function;
+    std::shared_ptr<Job> parent;
+    std::atomic<uint32_t> unfinished{ 1 };
+    std::atomic<uint32_t> dependencies{ 1 };
+    std::atomic<bool> finished{ false };
+    std::exception_ptr exception;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Job>> continuations;
+};
+
+typedef std::shared_ptr<Job> JobHandle;
+
+struct WorkerStats {
+    uint64_t jobsExecuted = 0;
+    uint64_t steals = 0;
+    uint64_t failedSteals = 0;
+    double busySeconds = 0.0;
+    double utilization = 0.0;
+};
+
+// Work-stealing scheduler. Every thread owns a deque: it pushes and pops its own jobs at the back and
+// steals from the front of the other deques when it runs dry. Thread 0 is the thread that called
+// create(), normally the main thread, and it only runs jobs while it is inside wait(); threads 1..n
+// are the workers.
+class JobSystem {
+public:
+    void create(uint32_t workerCount = 0) {
+        if (workerCount == 0) {
+            workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        }
+
+        threadCount = workerCount + 1;
+        for (uint32_t i = 0; i < threadCount; i++) {
+            queues.push_back(std::make_unique<Queue>());
+            stats.push_back(std::make_unique<ThreadStats>());
+        }
+
+        currentThreadIndex() = 0;
+        running = true;
+        resetStats();
+
+        for (uint32_t i = 1; i < threadCount; i++) {
+            threads.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    void cleanup() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        sleepCondition.notify_all();
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        threads.clear();
+        queues.clear();
+        stats.clear();
+    }
+
+    // The job does not run before submit(). A child keeps its parent unfinished until the child itself
+    // finishes, so it has to be created before the parent finishes, typically from inside the parent.
+    JobHandle createJob(std::function<void()> function, const JobHandle& parent = nullptr) {
+        JobHandle job = std::make_shared<Job>();
+        job->function = std::move(function);
+        job->parent = parent;
+        if (parent) {
+            parent->unfinished.fetch_add(1);
+        }
+        return job;
+    }
+
+    // job will not start before prerequisite has finished. Call it before submit(job).
+    void addDependency(const JobHandle& job, const JobHandle& prerequisite) {
+        std::lock_guard<std::mutex> lock(prerequisite->mutex);
+        if (!prerequisite->finished) {
+            job->dependencies.fetch_add(1);
+            prerequisite->continuations.push_back(job);
+        }
+    }
+
+    void submit(const JobHandle& job) {
+        if (job->dependencies.fetch_sub(1) == 1) {
+            push(job);
+        }
+    }
+
+    JobHandle run(std::function<void()> function, const JobHandle& parent = nullptr) {
+        JobHandle job = createJob(std::move(function), parent);
+        submit(job);
+        return job;
+    }
+
+    // Runs other jobs on the calling thread until job has finished, so the main thread does its share
+    // of the work instead of blocking. Rethrows the first exception thrown by job or its children.
+    void wait(const JobHandle& job) {
+        uint32_t index = currentThreadIndex();
+
+        while (!job->finished) {
+            JobHandle next = (index < threadCount) ? pop(index) : nullptr;
+            if (next) {
+                execute(next, index);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        std::exception_ptr exception;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            exception = job->exception;
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    // Calls function(first, last) for batches of at most batchSize elements of [0, count) and returns a
+    // job that finishes once every batch has.
+    JobHandle parallelFor(size_t count, size_t batchSize, std::function<void(size_t, size_t)> function, const JobHandle& parent = nullptr) {
+        JobHandle root = createJob([] {}, parent);
+
+        for (size_t first = 0; first < count; first += batchSize) {
+            size_t last = std::min(first + batchSize, count);
+            run([function, first, last] { function(first, last); }, root);
+        }
+
+        submit(root);
+        return root;
+    }
+
+    uint32_t getThreadCount() const {
+        return threadCount;
+    }
+
+    // Index of the calling thread, 0 for the thread that called create(); use it to pick per thread
+    // resources such as command pools.
+    static uint32_t getThreadIndex() {
+        return currentThreadIndex();
+    }
+
+    std::vector<WorkerStats> getStats() const {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart).count();
+
+        std::vector<WorkerStats> result(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++) {
+            result[i].jobsExecuted = stats[i]->jobsExecuted;
+            result[i].steals = stats[i]->steals;
+            result[i].failedSteals = stats[i]->failedSteals;
+            result[i].busySeconds = stats[i]->busyNanoseconds * 1e-9;
+            result[i].utilization = elapsed > 0.0 ? result[i].busySeconds / elapsed : 0.0;
+        }
+        return result;
+    }
+
+    void resetStats() {
+        for (std::unique_ptr<ThreadStats>& threadStats : stats) {
+            threadStats->jobsExecuted = 0;
+            threadStats->steals = 0;
+            threadStats->failedSteals = 0;
+            threadStats->busyNanoseconds = 0;
+        }
+        statsStart = std::chrono::steady_clock::now();
+    }
+
+    void printStats() const {
+        std::vector<WorkerStats> result = getStats();
+        for (uint32_t i = 0; i < threadCount; i++) {
+            std::cout << "thread " << i << (i == 0 ? " (main)" : "") << ": " << result[i].jobsExecuted << " jobs, "
+                << result[i].steals << " steals, " << result[i].failedSteals << " failed steals, "
+                << result[i].utilization * 100.0 << "% busy" << std::endl;
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    struct ThreadStats {
+        std::atomic<uint64_t> jobsExecuted{ 0 };
+        std::atomic<uint64_t> steals{ 0 };
+        std::atomic<uint64_t> failedSteals{ 0 };
+        std::atomic<uint64_t> busyNanoseconds{ 0 };
+    };
+
+    uint32_t threadCount = 0;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::unique_ptr<ThreadStats>> stats;
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point statsStart;
+
+    std::atomic<bool> running{ false };
+    std::atomic<uint32_t> queuedJobs{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+
+    static uint32_t& currentThreadIndex() {
+        static thread_local uint32_t index = UINT32_MAX;
+        return index;
+    }
+
+    void push(const JobHandle& job) {
+        // Threads outside the system hand their jobs to the main thread's deque, where workers steal them.
+        uint32_t index = currentThreadIndex();
+        Queue& queue = *queues[index < threadCount ? index : 0];
+        {
+            // Counted under the queue lock, so a worker that pops or steals the job right away never
+            // decrements first and wraps the counter.
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queuedJobs.fetch_add(1);
+            queue.jobs.push_back(job);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleepCondition.notify_one();
+    }
+
+    JobHandle pop(uint32_t index) {
+        {
+            Queue& queue = *queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                JobHandle job = queue.jobs.back();
+                queue.jobs.pop_back();
+                queuedJobs.fetch_sub(1);
+                return job;
+            }
+        }
+
+        if (threadCount < 2) {
+            return nullptr;
+        }
+
+        static thread_local std::minstd_rand random(std::random_device{}());
+        uint32_t start = random() % threadCount;
+        for (uint32_t i = 0; i < threadCount; i++) {
+            uint32_t victim = (start + i) % threadCount;
+            if (victim == index) {
+                continue;
+            }
+
+            Queue& queue = *queues[victim];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                JobHandle job = queue.jobs.front();
+                queue.jobs.pop_front();
+                queuedJobs.fetch_sub(1);
+                stats[index]->steals.fetch_add(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+
+        stats[index]->failedSteals.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    void execute(const JobHandle& job, uint32_t index) {
+        auto startTime = std::chrono::steady_clock::now();
+
+        // An exception must not leave the worker thread; it is kept for wait() instead.
+        try {
+            job->function();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            if (!job->exception) {
+                job->exception = std::current_exception();
+            }
+        }
+        job->function = nullptr;
+
+        auto endTime = std::chrono::steady_clock::now();
+        stats[index]->busyNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count(), std::memory_order_relaxed);
+        stats[index]->jobsExecuted.fetch_add(1, std::memory_order_relaxed);
+
+        finish(job);
+    }
+
+    void finish(const JobHandle& job) {
+        if (job->unfinished.fetch_sub(1) != 1) {
+            return;
+        }
+
+        std::vector<JobHandle> continuations;
+        std::exception_ptr exception;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->finished = true;
+            continuations.swap(job->continuations);
+            exception = job->exception;
+        }
+
+        for (const JobHandle& continuation : continuations) {
+            submit(continuation);
+        }
+
+        if (job->parent) {
+            JobHandle parent = std::move(job->parent);
+            if (exception) {
+                std::lock_guard<std::mutex> lock(parent->mutex);
+                if (!parent->exception) {
+                    parent->exception = exception;
+                }
+            }
+            finish(parent);
+        }
+    }
+
+    void workerLoop(uint32_t index) {
+        currentThreadIndex() = index;
+
+        while (running) {
+            JobHandle job = pop(index);
+            if (job) {
+                execute(job, index);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [this] { return !running || queuedJobs > 0; });
+        }
+    }
+};
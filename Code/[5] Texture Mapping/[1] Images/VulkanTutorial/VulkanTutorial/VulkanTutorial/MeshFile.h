@@ -0,0 +1,721 @@
+#pragma once
+
+#include "IndexBuffer.h"
+#include "VertexQuantization.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Packed binary mesh format. A .mesh file is a MeshFileHeader followed by blobs that are uploaded as they
+// are: the vertex data in the VertexFormat stored in the header, the index data, the submesh table and
+// the meshlet tables. Every blob starts on a MESH_FILE_ALIGNMENT boundary. MeshImporter.h converts OBJ
+// and glTF files into it; at runtime MeshFile maps the file and hands out pointers, nothing is parsed.
+
+const uint32_t MESH_FILE_MAGIC = 0x534d5456; // "VTMS"
+const uint32_t MESH_FILE_VERSION = 2;
+const uint64_t MESH_FILE_ALIGNMENT = 16;
+
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+
+    // VertexFormat of the vertex blob, see VertexQuantization.h.
+    uint32_t positionEncoding;
+    uint32_t positionComponents;
+    uint32_t colorEncoding;
+    uint32_t texCoordEncoding;
+    uint32_t normalEncoding;
+    uint32_t vertexStride;
+    float positionOffset[3];
+    float positionScale[3];
+
+    uint32_t indexSize; // 2 or 4 bytes
+    uint32_t indexEncoding; // IndexEncoding
+    uint32_t submeshCount;
+    uint32_t meshletCount;
+
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t meshletVertexCount;
+    uint64_t meshletTriangleBytes;
+    uint64_t indexDataBytes; // size of the index blob as stored, see indexEncoding
+
+    uint64_t vertexDataOffset;
+    uint64_t indexDataOffset;
+    uint64_t submeshOffset;
+    uint64_t meshletOffset;
+    uint64_t meshletVertexOffset;
+    uint64_t meshletTriangleOffset;
+
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+// One draw: the same fields as MeshDraw in IndirectDraw.h plus the meshlets covering it.
+struct MeshFileSubmesh {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    uint32_t materialIndex;
+    uint32_t padding;
+};
+
+// Up to MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles. vertexOffset indexes the
+// meshlet vertex table (vertex buffer indices), triangleOffset the byte table of local triangle indices.
+// The cone follows the meshoptimizer convention, with coneCutoff the sine of the widest angle between
+// coneAxis and a triangle normal. No apex is stored, so test against the bounding sphere with
+// isMeshletBackFacing().
+struct MeshFileMeshlet {
+    uint32_t vertexOffset;
+    uint32_t triangleOffset;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff;
+};
+
+// True when every triangle of the meshlet faces away from cameraPosition, given in the same space as the
+// meshlet: dot(center - cameraPosition, coneAxis) >= coneCutoff * length(center - cameraPosition) + radius.
+// The radius term keeps the test conservative for a camera close to or inside the sphere, where the
+// direction to the center says little about the direction to the triangles.
+inline bool isMeshletBackFacing(const MeshFileMeshlet& meshlet, const glm::vec3& cameraPosition) {
+    glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+    glm::vec3 coneAxis(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+    glm::vec3 toCenter = center - cameraPosition;
+    return glm::dot(toCenter, coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
+
+static_assert(sizeof(MeshFileHeader) == 184, "MeshFileHeader layout changed");
+static_assert(sizeof(MeshFileSubmesh) == 32, "MeshFileSubmesh layout changed");
+static_assert(sizeof(MeshFileMeshlet) == 48, "MeshFileMeshlet layout changed");
+
+struct MeshSubmesh {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    uint32_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t materialIndex = 0;
+};
+
+// What the importers produce. Submesh indices are relative to firstVertex, so every submesh can be
+// optimized and drawn on its own.
+struct MeshData {
+    std::vector<SourceVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MeshSubmesh> submeshes;
+};
+
+struct MeshletData {
+    std::vector<MeshFileMeshlet> meshlets;
+    std::vector<uint32_t> vertices;
+    std::vector<uint8_t> triangles;
+};
+
+// Greedy meshlet builder: walks the triangles in index order, which after optimizeVertexCache() keeps
+// neighbouring triangles together, and starts a new meshlet when either limit would be exceeded.
+inline void buildMeshlets(const MeshData& mesh, const MeshSubmesh& submesh, MeshletData& result) {
+    std::unordered_map<uint32_t, uint8_t> localIndices;
+    MeshFileMeshlet meshlet{};
+    meshlet.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+    meshlet.triangleOffset = static_cast<uint32_t>(result.triangles.size());
+
+    auto finish = [&]() {
+        if (meshlet.triangleCount == 0) {
+            return;
+        }
+
+        const uint32_t* vertices = &result.vertices[meshlet.vertexOffset];
+        const uint8_t* triangles = &result.triangles[meshlet.triangleOffset];
+
+        glm::vec3 minimum = mesh.vertices[vertices[0]].pos;
+        glm::vec3 maximum = minimum;
+        for (uint32_t i = 1; i < meshlet.vertexCount; i++) {
+            minimum = glm::min(minimum, mesh.vertices[vertices[i]].pos);
+            maximum = glm::max(maximum, mesh.vertices[vertices[i]].pos);
+        }
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        float radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+            radius = std::max(radius, glm::length(mesh.vertices[vertices[i]].pos - center));
+        }
+
+        std::vector<glm::vec3> normals;
+        glm::vec3 axis(0.0f);
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+            glm::vec3 p0 = mesh.vertices[vertices[triangles[t * 3]]].pos;
+            glm::vec3 p1 = mesh.vertices[vertices[triangles[t * 3 + 1]]].pos;
+            glm::vec3 p2 = mesh.vertices[vertices[triangles[t * 3 + 2]]].pos;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) {
+                normals.push_back(normal / length);
+                axis += normal / length;
+            }
+        }
+
+        float minimumDot = -1.0f;
+        if (glm::length(axis) > 0.0f) {
+            axis = glm::normalize(axis);
+            minimumDot = 1.0f;
+            for (const glm::vec3& normal : normals) {
+                minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+            }
+        }
+
+        meshlet.center[0] = center.x;
+        meshlet.center[1] = center.y;
+        meshlet.center[2] = center.z;
+        meshlet.radius = radius;
+        meshlet.coneAxis[0] = axis.x;
+        meshlet.coneAxis[1] = axis.y;
+        meshlet.coneAxis[2] = axis.z;
+        // A cone wider than a hemisphere can never be culled.
+        meshlet.coneCutoff = minimumDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minimumDot * minimumDot);
+
+        result.meshlets.push_back(meshlet);
+
+        // Keep the triangle table of every meshlet 4 byte aligned for the shaders.
+        while (result.triangles.size() % 4 != 0) {
+            result.triangles.push_back(0);
+        }
+
+        localIndices.clear();
+        meshlet = MeshFileMeshlet{};
+        meshlet.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+        meshlet.triangleOffset = static_cast<uint32_t>(result.triangles.size());
+    };
+
+    for (uint32_t i = 0; i + 2 < submesh.indexCount; i += 3) {
+        uint32_t triangle[3];
+        uint32_t newVertices = 0;
+        for (int k = 0; k < 3; k++) {
+            triangle[k] = submesh.firstVertex + mesh.indices[submesh.firstIndex + i + k];
+            if (localIndices.count(triangle[k]) == 0 && (k == 0 || triangle[k] != triangle[0]) && (k < 2 || triangle[k] != triangle[1])) {
+                newVertices++;
+            }
+        }
+
+        if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.triangleCount + 1 > MESHLET_MAX_TRIANGLES) {
+            finish();
+        }
+
+        for (int k = 0; k < 3; k++) {
+            auto it = localIndices.find(triangle[k]);
+            if (it == localIndices.end()) {
+                it = localIndices.emplace(triangle[k], static_cast<uint8_t>(meshlet.vertexCount++)).first;
+                result.vertices.push_back(triangle[k]);
+            }
+            result.triangles.push_back(it->second);
+        }
+        meshlet.triangleCount++;
+    }
+
+    finish();
+}
+
+inline uint32_t getMaxSubmeshVertexCount(const MeshData& mesh) {
+    uint32_t vertexCount = 0;
+    for (const MeshSubmesh& submesh : mesh.submeshes) {
+        vertexCount = std::max(vertexCount, submesh.vertexCount);
+    }
+    return vertexCount;
+}
+
+// Splits every submesh with more than MAX_SHORT_INDEX_VERTICES vertices into chunks that 16-bit indices
+// can address, walking the triangles in order and duplicating the vertices shared across a chunk
+// boundary. Returns false and leaves result alone when the duplicated vertices would cost more memory
+// than 16-bit indices save.
+inline bool splitMeshForShortIndices(const MeshData& mesh, uint32_t vertexStride, MeshData& result) {
+    MeshData split;
+    std::vector<uint32_t> localIndices;
+    std::vector<uint32_t> chunkOf;
+
+    for (const MeshSubmesh& submesh : mesh.submeshes) {
+        if (submesh.vertexCount <= MAX_SHORT_INDEX_VERTICES) {
+            MeshSubmesh copy = submesh;
+            copy.firstIndex = static_cast<uint32_t>(split.indices.size());
+            copy.firstVertex = static_cast<uint32_t>(split.vertices.size());
+            split.vertices.insert(split.vertices.end(), mesh.vertices.begin() + submesh.firstVertex, mesh.vertices.begin() + submesh.firstVertex + submesh.vertexCount);
+            split.indices.insert(split.indices.end(), mesh.indices.begin() + submesh.firstIndex, mesh.indices.begin() + submesh.firstIndex + submesh.indexCount);
+            split.submeshes.push_back(copy);
+            continue;
+        }
+
+        localIndices.assign(submesh.vertexCount, 0);
+        chunkOf.assign(submesh.vertexCount, UINT32_MAX);
+        uint32_t chunk = 0;
+
+        MeshSubmesh current;
+        current.materialIndex = submesh.materialIndex;
+        current.firstIndex = static_cast<uint32_t>(split.indices.size());
+        current.firstVertex = static_cast<uint32_t>(split.vertices.size());
+
+        for (uint32_t i = 0; i + 2 < submesh.indexCount; i += 3) {
+            const uint32_t* triangle = &mesh.indices[submesh.firstIndex + i];
+
+            uint32_t newVertices = 0;
+            for (int k = 0; k < 3; k++) {
+                bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+                if (chunkOf[triangle[k]] != chunk && !repeated) {
+                    newVertices++;
+                }
+            }
+
+            if (current.vertexCount + newVertices > MAX_SHORT_INDEX_VERTICES) {
+                current.indexCount = static_cast<uint32_t>(split.indices.size()) - current.firstIndex;
+                split.submeshes.push_back(current);
+
+                chunk++;
+                current.firstIndex = static_cast<uint32_t>(split.indices.size());
+                current.firstVertex = static_cast<uint32_t>(split.vertices.size());
+                current.vertexCount = 0;
+            }
+
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = triangle[k];
+                if (chunkOf[v] != chunk) {
+                    chunkOf[v] = chunk;
+                    localIndices[v] = current.vertexCount++;
+                    split.vertices.push_back(mesh.vertices[submesh.firstVertex + v]);
+                }
+                split.indices.push_back(localIndices[v]);
+            }
+        }
+
+        current.indexCount = static_cast<uint32_t>(split.indices.size()) - current.firstIndex;
+        split.submeshes.push_back(current);
+    }
+
+    size_t duplicatedBytes = (split.vertices.size() > mesh.vertices.size() ? split.vertices.size() - mesh.vertices.size() : 0) * vertexStride;
+    size_t savedBytes = mesh.indices.size() * (sizeof(uint32_t) - sizeof(uint16_t));
+    if (duplicatedBytes >= savedBytes) {
+        return false;
+    }
+
+    result = std::move(split);
+    return true;
+}
+
+struct MeshFileOptions {
+    IndexEncoding indexEncoding = IndexEncoding::Delta;
+    // Split submeshes too large for 16-bit indices when splitMeshForShortIndices() finds it worth it.
+    bool splitForShortIndices = true;
+};
+
+// Encodes the vertices with format, picks the index width, builds meshlets for every submesh and writes
+// the .mesh file.
+inline void writeMeshFile(const std::string& filename, const MeshData& sourceMesh, const VertexFormat& format, const MeshFileOptions& options = MeshFileOptions{}) {
+    VertexLayout layout(format);
+
+    // Submesh indices are relative to their first vertex, so the largest submesh decides the width.
+    MeshData splitMesh;
+    const MeshData* selectedMesh = &sourceMesh;
+    if (getMaxSubmeshVertexCount(sourceMesh) > MAX_SHORT_INDEX_VERTICES && options.splitForShortIndices
+        && splitMeshForShortIndices(sourceMesh, layout.getStride(), splitMesh)) {
+        selectedMesh = &splitMesh;
+    }
+    const MeshData& mesh = *selectedMesh;
+    const uint32_t indexSize = chooseIndexSize(getMaxSubmeshVertexCount(mesh));
+
+    if (mesh.vertices.size() > UINT32_MAX || mesh.indices.size() > UINT32_MAX) {
+        throw std::runtime_error("mesh is too large for the mesh file format!");
+    }
+
+    std::vector<uint8_t> vertexData = encodeVertices(layout, mesh.vertices);
+    std::vector<uint8_t> indexData = options.indexEncoding == IndexEncoding::Delta ? encodeIndexDeltas(mesh.indices) : packIndices(mesh.indices, indexSize);
+
+    std::vector<MeshFileSubmesh> submeshes;
+    MeshletData meshlets;
+    for (const MeshSubmesh& submesh : mesh.submeshes) {
+        MeshFileSubmesh fileSubmesh{};
+        fileSubmesh.indexCount = submesh.indexCount;
+        fileSubmesh.firstIndex = submesh.firstIndex;
+        fileSubmesh.vertexOffset = static_cast<int32_t>(submesh.firstVertex);
+        fileSubmesh.vertexCount = submesh.vertexCount;
+        fileSubmesh.firstMeshlet = static_cast<uint32_t>(meshlets.meshlets.size());
+        fileSubmesh.materialIndex = submesh.materialIndex;
+
+        buildMeshlets(mesh, submesh, meshlets);
+        fileSubmesh.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size()) - fileSubmesh.firstMeshlet;
+        submeshes.push_back(fileSubmesh);
+    }
+
+    MeshFileHeader header{};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.positionEncoding = static_cast<uint32_t>(format.position);
+    header.positionComponents = format.positionComponents;
+    header.colorEncoding = static_cast<uint32_t>(format.color);
+    header.texCoordEncoding = static_cast<uint32_t>(format.texCoord);
+    header.normalEncoding = static_cast<uint32_t>(format.normal);
+    header.vertexStride = layout.getStride();
+    for (int i = 0; i < 3; i++) {
+        header.positionOffset[i] = layout.positionOffset[i];
+        header.positionScale[i] = layout.positionScale[i];
+    }
+
+    header.indexSize = indexSize;
+    header.indexEncoding = static_cast<uint32_t>(options.indexEncoding);
+    header.indexDataBytes = indexData.size();
+    header.submeshCount = static_cast<uint32_t>(submeshes.size());
+    header.meshletCount = static_cast<uint32_t>(meshlets.meshlets.size());
+    header.vertexCount = mesh.vertices.size();
+    header.indexCount = mesh.indices.size();
+    header.meshletVertexCount = meshlets.vertices.size();
+    header.meshletTriangleBytes = meshlets.triangles.size();
+
+    glm::vec3 minimum(0.0f), maximum(0.0f);
+    if (!mesh.vertices.empty()) {
+        minimum = maximum = mesh.vertices[0].pos;
+        for (const SourceVertex& vertex : mesh.vertices) {
+            minimum = glm::min(minimum, vertex.pos);
+            maximum = glm::max(maximum, vertex.pos);
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = minimum[i];
+        header.boundsMax[i] = maximum[i];
+    }
+
+    struct Blob {
+        const void* data;
+        uint64_t size;
+        uint64_t* offset;
+    };
+    Blob blobs[] = {
+        { vertexData.data(), vertexData.size(), &header.vertexDataOffset },
+        { indexData.data(), indexData.size(), &header.indexDataOffset },
+        { submeshes.data(), submeshes.size() * sizeof(MeshFileSubmesh), &header.submeshOffset },
+        { meshlets.meshlets.data(), meshlets.meshlets.size() * sizeof(MeshFileMeshlet), &header.meshletOffset },
+        { meshlets.vertices.data(), meshlets.vertices.size() * sizeof(uint32_t), &header.meshletVertexOffset },
+        { meshlets.triangles.data(), meshlets.triangles.size(), &header.meshletTriangleOffset },
+    };
+
+    uint64_t offset = sizeof(MeshFileHeader);
+    for (Blob& blob : blobs) {
+        offset = (offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT * MESH_FILE_ALIGNMENT;
+        *blob.offset = offset;
+        offset += blob.size;
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t written = sizeof(MeshFileHeader);
+    const char zeros[MESH_FILE_ALIGNMENT] = {};
+    for (const Blob& blob : blobs) {
+        file.write(zeros, static_cast<std::streamsize>(*blob.offset - written));
+        if (blob.size > 0) {
+            file.write(static_cast<const char*>(blob.data), static_cast<std::streamsize>(blob.size));
+        }
+        written = *blob.offset + blob.size;
+    }
+
+    if (!file) {
+        throw std::runtime_error("failed to write mesh file!");
+    }
+}
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    void open(const std::string& filename) {
+        close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("failed to open file!");
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            close();
+            throw std::runtime_error("failed to read file size!");
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            close();
+            throw std::runtime_error("failed to map file!");
+        }
+
+        data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr) {
+            close();
+            throw std::runtime_error("failed to map file!");
+        }
+#else
+        fileDescriptor = ::open(filename.c_str(), O_RDONLY);
+        if (fileDescriptor < 0) {
+            throw std::runtime_error("failed to open file!");
+        }
+
+        struct stat fileStat;
+        if (fstat(fileDescriptor, &fileStat) != 0) {
+            close();
+            throw std::runtime_error("failed to read file size!");
+        }
+        size = static_cast<size_t>(fileStat.st_size);
+
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close();
+            throw std::runtime_error("failed to map file!");
+        }
+        data = static_cast<const uint8_t*>(mapping);
+
+        // The blobs are read front to back once, straight into staging buffers.
+        madvise(mapping, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+        if (fileDescriptor >= 0) {
+            ::close(fileDescriptor);
+        }
+        fileDescriptor = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const uint8_t* getData() const {
+        return data;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+class MeshFile {
+public:
+    void load(const std::string& filename) {
+        file.open(filename);
+
+        if (file.getSize() < sizeof(MeshFileHeader)) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+
+        header = reinterpret_cast<const MeshFileHeader*>(file.getData());
+        if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+
+        // writeMeshFile() never stores more than UINT32_MAX vertices or indices, which also keeps the
+        // buffer sizes below from overflowing.
+        if ((header->indexSize != 2 && header->indexSize != 4) || header->vertexCount > UINT32_MAX || header->indexCount > UINT32_MAX) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+
+        // VertexLayout skips attribute encodings it does not know, so a value from a damaged or newer
+        // file would silently shift every attribute after it.
+        if (header->positionEncoding > static_cast<uint32_t>(PositionEncoding::Snorm16)
+            || header->positionComponents < 2 || header->positionComponents > 3
+            || header->colorEncoding > static_cast<uint32_t>(ColorEncoding::Unorm8)
+            || header->texCoordEncoding > static_cast<uint32_t>(TexCoordEncoding::Half)
+            || header->normalEncoding > static_cast<uint32_t>(NormalEncoding::Octahedral8)
+            || header->indexEncoding > static_cast<uint32_t>(IndexEncoding::Delta)) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+
+        if (header->indexEncoding == static_cast<uint32_t>(IndexEncoding::Raw) && header->indexDataBytes != header->indexCount * header->indexSize) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+
+        if (!contains(header->vertexDataOffset, header->vertexCount, header->vertexStride)
+            || !contains(header->indexDataOffset, header->indexDataBytes, 1)
+            || !contains(header->submeshOffset, header->submeshCount, sizeof(MeshFileSubmesh))
+            || !contains(header->meshletOffset, header->meshletCount, sizeof(MeshFileMeshlet))
+            || !contains(header->meshletVertexOffset, header->meshletVertexCount, sizeof(uint32_t))
+            || !contains(header->meshletTriangleOffset, header->meshletTriangleBytes, 1)) {
+            throw std::runtime_error("mesh file is truncated!");
+        }
+
+        layout = VertexLayout(getVertexFormat());
+        if (layout.getStride() != header->vertexStride) {
+            throw std::runtime_error("invalid mesh file!");
+        }
+        for (int i = 0; i < 3; i++) {
+            layout.positionOffset[i] = header->positionOffset[i];
+            layout.positionScale[i] = header->positionScale[i];
+        }
+
+        // Draws and meshlets read the buffers at these ranges on the GPU, where nothing checks them.
+        const MeshFileSubmesh* submeshes = getSubmeshes();
+        for (uint32_t i = 0; i < header->submeshCount; i++) {
+            const MeshFileSubmesh& submesh = submeshes[i];
+            if (static_cast<uint64_t>(submesh.firstIndex) + submesh.indexCount > header->indexCount
+                || submesh.vertexOffset < 0 || static_cast<uint64_t>(submesh.vertexOffset) + submesh.vertexCount > header->vertexCount
+                || static_cast<uint64_t>(submesh.firstMeshlet) + submesh.meshletCount > header->meshletCount) {
+                throw std::runtime_error("invalid mesh file!");
+            }
+        }
+
+        const MeshFileMeshlet* meshlets = getMeshlets();
+        for (uint32_t i = 0; i < header->meshletCount; i++) {
+            const MeshFileMeshlet& meshlet = meshlets[i];
+            if (meshlet.vertexCount > MESHLET_MAX_VERTICES || meshlet.triangleCount > MESHLET_MAX_TRIANGLES
+                || static_cast<uint64_t>(meshlet.vertexOffset) + meshlet.vertexCount > header->meshletVertexCount
+                || static_cast<uint64_t>(meshlet.triangleOffset) + meshlet.triangleCount * 3 > header->meshletTriangleBytes) {
+                throw std::runtime_error("invalid mesh file!");
+            }
+        }
+    }
+
+    void close() {
+        file.close();
+        header = nullptr;
+    }
+
+    const MeshFileHeader& getHeader() const {
+        return *header;
+    }
+
+    VertexFormat getVertexFormat() const {
+        VertexFormat format;
+        format.position = static_cast<PositionEncoding>(header->positionEncoding);
+        format.positionComponents = header->positionComponents;
+        format.color = static_cast<ColorEncoding>(header->colorEncoding);
+        format.texCoord = static_cast<TexCoordEncoding>(header->texCoordEncoding);
+        format.normal = static_cast<NormalEncoding>(header->normalEncoding);
+        return format;
+    }
+
+    // Attribute descriptions and dequantize matrix of the vertex data.
+    const VertexLayout& getVertexLayout() const {
+        return layout;
+    }
+
+    VkIndexType getIndexType() const {
+        return indexTypeOf(header->indexSize);
+    }
+
+    IndexEncoding getIndexEncoding() const {
+        return static_cast<IndexEncoding>(header->indexEncoding);
+    }
+
+    const void* getVertexData() const { return file.getData() + header->vertexDataOffset; }
+    VkDeviceSize getVertexDataSize() const { return header->vertexCount * header->vertexStride; }
+    // Size of the indices once decoded, i.e. of the index buffer.
+    VkDeviceSize getIndexDataSize() const { return header->indexCount * header->indexSize; }
+    const MeshFileSubmesh* getSubmeshes() const { return reinterpret_cast<const MeshFileSubmesh*>(file.getData() + header->submeshOffset); }
+    const MeshFileMeshlet* getMeshlets() const { return reinterpret_cast<const MeshFileMeshlet*>(file.getData() + header->meshletOffset); }
+    const uint32_t* getMeshletVertices() const { return reinterpret_cast<const uint32_t*>(file.getData() + header->meshletVertexOffset); }
+    const uint8_t* getMeshletTriangles() const { return file.getData() + header->meshletTriangleOffset; }
+
+    // Device local vertex and index buffers, filled straight from the mapping through a staging buffer.
+    void createBuffers(const VulkanContext& context, VkBuffer& vertexBuffer, VkDeviceMemory& vertexBufferMemory, VkBuffer& indexBuffer, VkDeviceMemory& indexBufferMemory) const {
+        createBuffer(context, getVertexDataSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+        uploadToBuffer(context, vertexBuffer, getVertexData(), getVertexDataSize());
+
+        // Delta encoded indices are decoded straight into the mapped staging buffer.
+        VkDeviceSize indexDataSize = getIndexDataSize();
+        UniqueDeviceMemory stagingBufferMemory;
+        UniqueBuffer stagingBuffer;
+        createBuffer(context, indexDataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkMapMemory(context.device, stagingBufferMemory, 0, indexDataSize, 0, &data);
+        readIndices(data);
+        vkUnmapMemory(context.device, stagingBufferMemory);
+
+        createBuffer(context, indexDataSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        copyBuffer(context, stagingBuffer, indexBuffer, indexDataSize);
+    }
+
+    // Writes getIndexDataSize() bytes of getIndexType() indices to destination.
+    void readIndices(void* destination) const {
+        const uint8_t* indexData = file.getData() + header->indexDataOffset;
+        if (getIndexEncoding() == IndexEncoding::Delta) {
+            decodeIndexDeltas(indexData, header->indexDataBytes, header->indexCount, destination, header->indexSize);
+        } else {
+            memcpy(destination, indexData, header->indexDataBytes);
+        }
+    }
+
+private:
+    MappedFile file;
+    const MeshFileHeader* header = nullptr;
+    VertexLayout layout;
+
+    // Whether count elements of elementSize bytes starting at offset lie inside the file, without
+    // multiplying count by elementSize.
+    bool contains(uint64_t offset, uint64_t count, uint64_t elementSize) const {
+        if (offset > file.getSize()) {
+            return false;
+        }
+        uint64_t available = file.getSize() - offset;
+        return elementSize == 0 || count <= available / elementSize;
+    }
+};
@@ -0,0 +1,703 @@
+#pragma once
+
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Offline conversion of OBJ and glTF 2.0 (.gltf with external or embedded buffers, .glb) files into
+// MeshData, and from there into .mesh files:
+//
+//     MeshData mesh = importMesh("models/scene.gltf");
+//     optimizeMeshData(mesh);
+//     writeMeshFile("models/scene.mesh", mesh, VertexFormat::compact());
+//
+// Only triangle geometry is imported; materials become the materialIndex of each submesh.
+
+// Just enough JSON for glTF.
+class JsonValue {
+public:
+    enum class Type {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    static JsonValue parse(const std::string& text) {
+        size_t position = 0;
+        JsonValue value = parseValue(text, position);
+        skipWhitespace(text, position);
+        if (position != text.size()) {
+            throw std::runtime_error("invalid JSON!");
+        }
+        return value;
+    }
+
+    const JsonValue* find(const std::string& key) const {
+        for (const auto& member : object) {
+            if (member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+    const JsonValue& operator[](const std::string& key) const {
+        const JsonValue* value = find(key);
+        if (value == nullptr) {
+            throw std::runtime_error("missing JSON member " + key + "!");
+        }
+        return *value;
+    }
+
+    const JsonValue& operator[](size_t index) const {
+        if (type != Type::Array || index >= array.size()) {
+            throw std::runtime_error("JSON array index out of range!");
+        }
+        return array[index];
+    }
+
+    size_t size() const {
+        return type == Type::Array ? array.size() : object.size();
+    }
+
+    double getNumber(const std::string& key, double defaultValue) const {
+        const JsonValue* value = find(key);
+        return value != nullptr && value->type == Type::Number ? value->number : defaultValue;
+    }
+
+private:
+    static void skipWhitespace(const std::string& text, size_t& position) {
+        while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) {
+            position++;
+        }
+    }
+
+    static void expect(const std::string& text, size_t& position, const char* token) {
+        size_t length = strlen(token);
+        if (text.compare(position, length, token) != 0) {
+            throw std::runtime_error("invalid JSON!");
+        }
+        position += length;
+    }
+
+    static void appendUtf8(std::string& out, uint32_t codePoint) {
+        if (codePoint < 0x80) {
+            out += static_cast<char>(codePoint);
+        } else if (codePoint < 0x800) {
+            out += static_cast<char>(0xc0 | (codePoint >> 6));
+            out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        } else if (codePoint < 0x10000) {
+            out += static_cast<char>(0xe0 | (codePoint >> 12));
+            out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (codePoint >> 18));
+            out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    static std::string parseString(const std::string& text, size_t& position) {
+        expect(text, position, "\"");
+        std::string result;
+        while (position < text.size() && text[position] != '"') {
+            char c = text[position++];
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (position >= text.size()) {
+                break;
+            }
+
+            char escape = text[position++];
+            switch (escape) {
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'u': {
+                if (position + 4 > text.size()) {
+                    throw std::runtime_error("invalid JSON!");
+                }
+                uint32_t codePoint = static_cast<uint32_t>(std::stoul(text.substr(position, 4), nullptr, 16));
+                position += 4;
+                if (codePoint >= 0xd800 && codePoint < 0xdc00 && text.compare(position, 2, "\\u") == 0 && position + 6 <= text.size()) {
+                    uint32_t low = static_cast<uint32_t>(std::stoul(text.substr(position + 2, 4), nullptr, 16));
+                    codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                    position += 6;
+                }
+                appendUtf8(result, codePoint);
+                break;
+            }
+            default: result += escape; break;
+            }
+        }
+        expect(text, position, "\"");
+        return result;
+    }
+
+    static JsonValue parseValue(const std::string& text, size_t& position) {
+        skipWhitespace(text, position);
+        if (position >= text.size()) {
+            throw std::runtime_error("invalid JSON!");
+        }
+
+        JsonValue value;
+        char c = text[position];
+        if (c == '{') {
+            value.type = Type::Object;
+            position++;
+            skipWhitespace(text, position);
+            if (position < text.size() && text[position] == '}') {
+                position++;
+                return value;
+            }
+            while (true) {
+                skipWhitespace(text, position);
+                std::string key = parseString(text, position);
+                skipWhitespace(text, position);
+                expect(text, position, ":");
+                value.object.emplace_back(key, parseValue(text, position));
+                skipWhitespace(text, position);
+                if (position < text.size() && text[position] == ',') {
+                    position++;
+                    continue;
+                }
+                expect(text, position, "}");
+                return value;
+            }
+        } else if (c == '[') {
+            value.type = Type::Array;
+            position++;
+            skipWhitespace(text, position);
+            if (position < text.size() && text[position] == ']') {
+                position++;
+                return value;
+            }
+            while (true) {
+                value.array.push_back(parseValue(text, position));
+                skipWhitespace(text, position);
+                if (position < text.size() && text[position] == ',') {
+                    position++;
+                    continue;
+                }
+                expect(text, position, "]");
+                return value;
+            }
+        } else if (c == '"') {
+            value.type = Type::String;
+            value.string = parseString(text, position);
+        } else if (c == 't') {
+            expect(text, position, "true");
+            value.type = Type::Bool;
+            value.boolean = true;
+        } else if (c == 'f') {
+            expect(text, position, "false");
+            value.type = Type::Bool;
+        } else if (c == 'n') {
+            expect(text, position, "null");
+        } else {
+            const char* begin = text.c_str() + position;
+            char* end = nullptr;
+            value.type = Type::Number;
+            value.number = std::strtod(begin, &end);
+            if (end == begin) {
+                throw std::runtime_error("invalid JSON!");
+            }
+            position += end - begin;
+        }
+        return value;
+    }
+};
+
+inline std::string directoryOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+inline bool hasExtension(const std::string& path, const std::string& extension) {
+    if (path.size() < extension.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < extension.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(path[path.size() - extension.size() + i])) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Wavefront OBJ: v (with optional vertex colors), vt, vn and polygonal f records; usemtl starts a new
+// submesh. Texture coordinates are flipped to Vulkan's top-left origin.
+inline MeshData importObj(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> colors;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::map<std::string, uint32_t> materials;
+
+    MeshData mesh;
+    MeshSubmesh submesh;
+    std::map<std::tuple<int, int, int>, uint32_t> uniqueVertices;
+
+    auto finishSubmesh = [&]() {
+        submesh.indexCount = static_cast<uint32_t>(mesh.indices.size()) - submesh.firstIndex;
+        submesh.vertexCount = static_cast<uint32_t>(mesh.vertices.size()) - submesh.firstVertex;
+        if (submesh.indexCount > 0) {
+            mesh.submeshes.push_back(submesh);
+        }
+        submesh.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+        submesh.firstVertex = static_cast<uint32_t>(mesh.vertices.size());
+        uniqueVertices.clear();
+    };
+
+    // OBJ indices are 1-based, negative ones count back from the end.
+    auto resolve = [](int index, size_t count) {
+        return index < 0 ? static_cast<int>(count) + index : index - 1;
+    };
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword == "v") {
+            glm::vec3 position(0.0f), color(1.0f);
+            stream >> position.x >> position.y >> position.z;
+            if (!(stream >> color.x >> color.y >> color.z)) {
+                color = glm::vec3(1.0f);
+            }
+            positions.push_back(position);
+            colors.push_back(color);
+        } else if (keyword == "vt") {
+            glm::vec2 texCoord(0.0f);
+            stream >> texCoord.x >> texCoord.y;
+            texCoords.push_back(glm::vec2(texCoord.x, 1.0f - texCoord.y));
+        } else if (keyword == "vn") {
+            glm::vec3 normal(0.0f);
+            stream >> normal.x >> normal.y >> normal.z;
+            normals.push_back(normal);
+        } else if (keyword == "usemtl") {
+            std::string name;
+            stream >> name;
+            finishSubmesh();
+            auto it = materials.emplace(name, static_cast<uint32_t>(materials.size())).first;
+            submesh.materialIndex = it->second;
+        } else if (keyword == "f") {
+            std::vector<uint32_t> polygon;
+            std::string corner;
+            while (stream >> corner) {
+                int v = 0, vt = 0, vn = 0;
+                size_t firstSlash = corner.find('/');
+                v = std::stoi(corner.substr(0, firstSlash));
+                if (firstSlash != std::string::npos) {
+                    size_t secondSlash = corner.find('/', firstSlash + 1);
+                    std::string texCoordIndex = corner.substr(firstSlash + 1, secondSlash == std::string::npos ? std::string::npos : secondSlash - firstSlash - 1);
+                    if (!texCoordIndex.empty()) {
+                        vt = std::stoi(texCoordIndex);
+                    }
+                    if (secondSlash != std::string::npos && secondSlash + 1 < corner.size()) {
+                        vn = std::stoi(corner.substr(secondSlash + 1));
+                    }
+                }
+
+                std::tuple<int, int, int> key(resolve(v, positions.size()), vt != 0 ? resolve(vt, texCoords.size()) : -1, vn != 0 ? resolve(vn, normals.size()) : -1);
+                if (std::get<0>(key) < 0 || std::get<0>(key) >= static_cast<int>(positions.size())
+                    || std::get<1>(key) >= static_cast<int>(texCoords.size()) || std::get<2>(key) >= static_cast<int>(normals.size())) {
+                    throw std::runtime_error("OBJ index out of range!");
+                }
+
+                auto it = uniqueVertices.find(key);
+                if (it == uniqueVertices.end()) {
+                    SourceVertex vertex{};
+                    vertex.pos = positions[std::get<0>(key)];
+                    vertex.color = colors[std::get<0>(key)];
+                    vertex.texCoord = std::get<1>(key) >= 0 ? texCoords[std::get<1>(key)] : glm::vec2(0.0f);
+                    vertex.normal = std::get<2>(key) >= 0 ? normals[std::get<2>(key)] : glm::vec3(0.0f, 0.0f, 1.0f);
+
+                    it = uniqueVertices.emplace(key, static_cast<uint32_t>(mesh.vertices.size()) - submesh.firstVertex).first;
+                    mesh.vertices.push_back(vertex);
+                }
+                polygon.push_back(it->second);
+            }
+
+            for (size_t i = 2; i < polygon.size(); i++) {
+                mesh.indices.push_back(polygon[0]);
+                mesh.indices.push_back(polygon[i - 1]);
+                mesh.indices.push_back(polygon[i]);
+            }
+        }
+    }
+
+    finishSubmesh();
+    return mesh;
+}
+
+class GltfImporter {
+public:
+    MeshData import(const std::string& filename) {
+        directory = directoryOf(filename);
+        std::vector<char> file = readFile(filename);
+
+        std::string jsonText;
+        if (file.size() >= 12 && memcmp(file.data(), "glTF", 4) == 0) {
+            // Binary container: a JSON chunk, optionally followed by the BIN chunk of buffer 0.
+            size_t offset = 12;
+            while (offset + 8 <= file.size()) {
+                uint32_t chunkLength, chunkType;
+                memcpy(&chunkLength, &file[offset], 4);
+                memcpy(&chunkType, &file[offset + 4], 4);
+                if (offset + 8 + chunkLength > file.size()) {
+                    throw std::runtime_error("invalid glb file!");
+                }
+
+                if (chunkType == 0x4e4f534a) {
+                    jsonText.assign(&file[offset + 8], chunkLength);
+                } else if (chunkType == 0x004e4942) {
+                    binaryChunk.assign(file.begin() + offset + 8, file.begin() + offset + 8 + chunkLength);
+                }
+                offset += 8 + ((chunkLength + 3) & ~3u);
+            }
+        } else {
+            jsonText.assign(file.begin(), file.end());
+        }
+
+        json = JsonValue::parse(jsonText);
+        loadBuffers();
+
+        MeshData mesh;
+        const JsonValue* scenes = json.find("scenes");
+        if (scenes != nullptr && scenes->size() > 0) {
+            const JsonValue& scene = (*scenes)[static_cast<size_t>(json.getNumber("scene", 0))];
+            if (const JsonValue* nodes = scene.find("nodes")) {
+                for (const JsonValue& node : nodes->array) {
+                    importNode(mesh, static_cast<size_t>(node.number), glm::mat4(1.0f));
+                }
+            }
+        } else if (const JsonValue* meshes = json.find("meshes")) {
+            for (size_t i = 0; i < meshes->size(); i++) {
+                importMesh(mesh, i, glm::mat4(1.0f));
+            }
+        }
+
+        return mesh;
+    }
+
+private:
+    std::string directory;
+    JsonValue json;
+    std::vector<char> binaryChunk;
+    std::vector<std::vector<char>> buffers;
+
+    static std::vector<char> decodeBase64(const std::string& text) {
+        std::vector<char> result;
+        uint32_t bits = 0;
+        int bitCount = 0;
+        for (char c : text) {
+            int value;
+            if (c >= 'A' && c <= 'Z') value = c - 'A';
+            else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') value = c - '0' + 52;
+            else if (c == '+') value = 62;
+            else if (c == '/') value = 63;
+            else continue;
+
+            bits = (bits << 6) | static_cast<uint32_t>(value);
+            bitCount += 6;
+            if (bitCount >= 8) {
+                bitCount -= 8;
+                result.push_back(static_cast<char>((bits >> bitCount) & 0xff));
+            }
+        }
+        return result;
+    }
+
+    void loadBuffers() {
+        const JsonValue* bufferList = json.find("buffers");
+        if (bufferList == nullptr) {
+            return;
+        }
+
+        for (size_t i = 0; i < bufferList->size(); i++) {
+            const JsonValue* uri = (*bufferList)[i].find("uri");
+            if (uri == nullptr) {
+                buffers.push_back(binaryChunk);
+            } else if (uri->string.compare(0, 5, "data:") == 0) {
+                size_t comma = uri->string.find(',');
+                buffers.push_back(decodeBase64(uri->string.substr(comma + 1)));
+            } else {
+                buffers.push_back(readFile(directory + uri->string));
+            }
+        }
+    }
+
+    static int componentCount(const std::string& type) {
+        if (type == "SCALAR") return 1;
+        if (type == "VEC2") return 2;
+        if (type == "VEC3") return 3;
+        if (type == "VEC4") return 4;
+        throw std::runtime_error("unsupported glTF accessor type!");
+    }
+
+    static size_t componentSize(int componentType) {
+        switch (componentType) {
+        case 5120: case 5121: return 1;
+        case 5122: case 5123: return 2;
+        case 5125: case 5126: return 4;
+        }
+        throw std::runtime_error("unsupported glTF component type!");
+    }
+
+    // Reads any accessor as floats, converting normalized integers the way the glTF spec defines.
+    std::vector<float> readAccessor(size_t index, int& components) const {
+        const JsonValue& accessor = json["accessors"][index];
+        const int componentType = static_cast<int>(accessor["componentType"].number);
+        const size_t count = static_cast<size_t>(accessor["count"].number);
+        const bool normalized = accessor.find("normalized") != nullptr && accessor["normalized"].boolean;
+        components = componentCount(accessor["type"].string);
+
+        std::vector<float> result(count * components, 0.0f);
+        const JsonValue* bufferViewIndex = accessor.find("bufferView");
+        if (bufferViewIndex == nullptr) {
+            return result;
+        }
+
+        const JsonValue& bufferView = json["bufferViews"][static_cast<size_t>(bufferViewIndex->number)];
+        const std::vector<char>& buffer = buffers.at(static_cast<size_t>(bufferView["buffer"].number));
+        const size_t elementSize = componentSize(componentType) * components;
+        const size_t stride = static_cast<size_t>(bufferView.getNumber("byteStride", static_cast<double>(elementSize)));
+        const size_t offset = static_cast<size_t>(bufferView.getNumber("byteOffset", 0) + accessor.getNumber("byteOffset", 0));
+
+        if (count > 0 && offset + (count - 1) * stride + elementSize > buffer.size()) {
+            throw std::runtime_error("glTF accessor out of range of its buffer!");
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const char* element = buffer.data() + offset + i * stride;
+            for (int c = 0; c < components; c++) {
+                float value = 0.0f;
+                switch (componentType) {
+                case 5120: { int8_t v; memcpy(&v, element + c, 1); value = normalized ? std::max(v / 127.0f, -1.0f) : v; break; }
+                case 5121: { uint8_t v; memcpy(&v, element + c, 1); value = normalized ? v / 255.0f : v; break; }
+                case 5122: { int16_t v; memcpy(&v, element + c * 2, 2); value = normalized ? std::max(v / 32767.0f, -1.0f) : v; break; }
+                case 5123: { uint16_t v; memcpy(&v, element + c * 2, 2); value = normalized ? v / 65535.0f : v; break; }
+                case 5125: { uint32_t v; memcpy(&v, element + c * 4, 4); value = static_cast<float>(v); break; }
+                case 5126: { memcpy(&value, element + c * 4, 4); break; }
+                }
+                result[i * components + c] = value;
+            }
+        }
+        return result;
+    }
+
+    std::vector<uint32_t> readIndices(size_t index) const {
+        // Integer indices above 2^24 don't survive the float conversion of readAccessor().
+        const JsonValue& accessor = json["accessors"][index];
+        const int componentType = static_cast<int>(accessor["componentType"].number);
+        const size_t count = static_cast<size_t>(accessor["count"].number);
+        const JsonValue& bufferView = json["bufferViews"][static_cast<size_t>(accessor["bufferView"].number)];
+        const std::vector<char>& buffer = buffers.at(static_cast<size_t>(bufferView["buffer"].number));
+        const size_t size = componentSize(componentType);
+        const size_t stride = static_cast<size_t>(bufferView.getNumber("byteStride", static_cast<double>(size)));
+        const size_t offset = static_cast<size_t>(bufferView.getNumber("byteOffset", 0) + accessor.getNumber("byteOffset", 0));
+
+        if (count > 0 && offset + (count - 1) * stride + size > buffer.size()) {
+            throw std::runtime_error("glTF accessor out of range of its buffer!");
+        }
+
+        std::vector<uint32_t> result(count);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t value = 0;
+            memcpy(&value, buffer.data() + offset + i * stride, size);
+            result[i] = value;
+        }
+        return result;
+    }
+
+    static glm::mat4 nodeTransform(const JsonValue& node) {
+        if (const JsonValue* matrix = node.find("matrix")) {
+            glm::mat4 result;
+            for (int i = 0; i < 16; i++) {
+                result[i / 4][i % 4] = static_cast<float>((*matrix)[i].number);
+            }
+            return result;
+        }
+
+        glm::mat4 result(1.0f);
+        if (const JsonValue* t = node.find("translation")) {
+            result = glm::translate(result, glm::vec3((*t)[0].number, (*t)[1].number, (*t)[2].number));
+        }
+        if (const JsonValue* r = node.find("rotation")) {
+            float x = static_cast<float>((*r)[0].number), y = static_cast<float>((*r)[1].number);
+            float z = static_cast<float>((*r)[2].number), w = static_cast<float>((*r)[3].number);
+            glm::mat4 rotation(1.0f);
+            rotation[0][0] = 1 - 2 * (y * y + z * z); rotation[0][1] = 2 * (x * y + w * z); rotation[0][2] = 2 * (x * z - w * y);
+            rotation[1][0] = 2 * (x * y - w * z); rotation[1][1] = 1 - 2 * (x * x + z * z); rotation[1][2] = 2 * (y * z + w * x);
+            rotation[2][0] = 2 * (x * z + w * y); rotation[2][1] = 2 * (y * z - w * x); rotation[2][2] = 1 - 2 * (x * x + y * y);
+            result = result * rotation;
+        }
+        if (const JsonValue* s = node.find("scale")) {
+            result = glm::scale(result, glm::vec3((*s)[0].number, (*s)[1].number, (*s)[2].number));
+        }
+        return result;
+    }
+
+    void importNode(MeshData& mesh, size_t nodeIndex, const glm::mat4& parentTransform) {
+        const JsonValue& node = json["nodes"][nodeIndex];
+        glm::mat4 transform = parentTransform * nodeTransform(node);
+
+        if (const JsonValue* meshIndex = node.find("mesh")) {
+            importMesh(mesh, static_cast<size_t>(meshIndex->number), transform);
+        }
+        if (const JsonValue* children = node.find("children")) {
+            for (const JsonValue& child : children->array) {
+                importNode(mesh, static_cast<size_t>(child.number), transform);
+            }
+        }
+    }
+
+    void importMesh(MeshData& mesh, size_t meshIndex, const glm::mat4& transform) {
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+        for (const JsonValue& primitive : json["meshes"][meshIndex]["primitives"].array) {
+            if (primitive.getNumber("mode", 4) != 4) {
+                continue;
+            }
+
+            const JsonValue& attributes = primitive["attributes"];
+            int components = 0;
+            std::vector<float> positions = readAccessor(static_cast<size_t>(attributes["POSITION"].number), components);
+            const size_t vertexCount = positions.size() / components;
+
+            MeshSubmesh submesh;
+            submesh.firstIndex = static_cast<uint32_t>(mesh.indices.size());
+            submesh.firstVertex = static_cast<uint32_t>(mesh.vertices.size());
+            submesh.vertexCount = static_cast<uint32_t>(vertexCount);
+            submesh.materialIndex = static_cast<uint32_t>(primitive.getNumber("material", 0));
+
+            std::vector<SourceVertex> vertices(vertexCount);
+            for (size_t i = 0; i < vertexCount; i++) {
+                glm::vec4 position = transform * glm::vec4(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2], 1.0f);
+                vertices[i].pos = glm::vec3(position.x, position.y, position.z);
+                vertices[i].color = glm::vec3(1.0f);
+                vertices[i].normal = glm::vec3(0.0f, 0.0f, 1.0f);
+            }
+
+            if (const JsonValue* normal = attributes.find("NORMAL")) {
+                std::vector<float> values = readAccessor(static_cast<size_t>(normal->number), components);
+                for (size_t i = 0; i < vertexCount; i++) {
+                    vertices[i].normal = glm::normalize(normalMatrix * glm::vec3(values[i * 3], values[i * 3 + 1], values[i * 3 + 2]));
+                }
+            }
+            if (const JsonValue* texCoord = attributes.find("TEXCOORD_0")) {
+                std::vector<float> values = readAccessor(static_cast<size_t>(texCoord->number), components);
+                for (size_t i = 0; i < vertexCount; i++) {
+                    vertices[i].texCoord = glm::vec2(values[i * 2], values[i * 2 + 1]);
+                }
+            }
+            if (const JsonValue* color = attributes.find("COLOR_0")) {
+                std::vector<float> values = readAccessor(static_cast<size_t>(color->number), components);
+                for (size_t i = 0; i < vertexCount; i++) {
+                    vertices[i].color = glm::vec3(values[i * components], values[i * components + 1], values[i * components + 2]);
+                }
+            }
+
+            std::vector<uint32_t> indices;
+            if (const JsonValue* indexAccessor = primitive.find("indices")) {
+                indices = readIndices(static_cast<size_t>(indexAccessor->number));
+                for (uint32_t index : indices) {
+                    if (index >= vertexCount) {
+                        throw std::runtime_error("glTF index out of range!");
+                    }
+                }
+            } else {
+                indices.resize(vertexCount);
+                for (size_t i = 0; i < vertexCount; i++) {
+                    indices[i] = static_cast<uint32_t>(i);
+                }
+            }
+
+            // A mirroring transform flips the winding of every triangle.
+            if (glm::determinant(glm::mat3(transform)) < 0.0f) {
+                for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                    std::swap(indices[i + 1], indices[i + 2]);
+                }
+            }
+
+            mesh.vertices.insert(mesh.vertices.end(), vertices.begin(), vertices.end());
+            mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+            submesh.indexCount = static_cast<uint32_t>(indices.size());
+            mesh.submeshes.push_back(submesh);
+        }
+    }
+};
+
+// Picks the importer from the file extension.
+inline MeshData importMesh(const std::string& filename) {
+    if (hasExtension(filename, ".obj")) {
+        return importObj(filename);
+    }
+    if (hasExtension(filename, ".gltf") || hasExtension(filename, ".glb")) {
+        return GltfImporter().import(filename);
+    }
+    throw std::runtime_error("unsupported mesh file format!");
+}
+
+// Runs the MeshOptimizer.h passes on every submesh before the meshlets are built.
+inline void optimizeMeshData(MeshData& mesh) {
+    MeshData result;
+    for (const MeshSubmesh& submesh : mesh.submeshes) {
+        std::vector<SourceVertex> vertices(mesh.vertices.begin() + submesh.firstVertex, mesh.vertices.begin() + submesh.firstVertex + submesh.vertexCount);
+        std::vector<uint32_t> indices(mesh.indices.begin() + submesh.firstIndex, mesh.indices.begin() + submesh.firstIndex + submesh.indexCount);
+
+        std::vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            positions[i] = vertices[i].pos;
+        }
+        optimizeVertexCache(indices, vertices.size());
+        optimizeOverdraw(indices, positions);
+        optimizeVertexFetch(vertices, indices);
+
+        MeshSubmesh optimized = submesh;
+        optimized.firstIndex = static_cast<uint32_t>(result.indices.size());
+        optimized.firstVertex = static_cast<uint32_t>(result.vertices.size());
+        optimized.vertexCount = static_cast<uint32_t>(vertices.size());
+        result.vertices.insert(result.vertices.end(), vertices.begin(), vertices.end());
+        result.indices.insert(result.indices.end(), indices.begin(), indices.end());
+        result.submeshes.push_back(optimized);
+    }
+    mesh = std::move(result);
+}
@@ -0,0 +1,498 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// Load time mesh optimization, run on the vertices/indices vectors before createVertexBuffer() and
+// createIndexBuffer() upload them:
+//  1. optimizeVertexCache() reorders triangles for the post-transform vertex cache (Forsyth).
+//  2. optimizeOverdraw() reorders clusters of those triangles front to back (Tipsy, Sander et al.).
+//  3. optimizeVertexFetch() renumbers the vertices in first use order for vertex fetch locality.
+// The analyze functions measure the effect; optimizeMesh() runs everything and reports before/after.
+
+const uint32_t VERTEX_CACHE_SIZE = 32;
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation".
+inline float vertexCacheScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The three vertices of the last triangle get a fixed score so the next triangle does not
+        // just reuse them in a strip-like order.
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3), 1.5f);
+        }
+    }
+
+    // Favor vertices with few triangles left so they can leave the cache for good.
+    return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+}
+
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles of every vertex; the first remaining[v] entries are the ones not emitted yet.
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t index : indices) {
+        if (index >= vertexCount) {
+            throw std::runtime_error("index out of range of the vertex buffer!");
+        }
+        offsets[index + 1]++;
+    }
+    for (size_t i = 0; i < vertexCount; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    std::vector<uint32_t> vertexTriangles(indices.size());
+    for (size_t t = 0; t < triangleCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            vertexTriangles[offsets[v] + remaining[v]++] = static_cast<uint32_t>(t);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScores[v] = vertexCacheScore(-1, remaining[v]);
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> newCache;
+    size_t nextInputTriangle = 0;
+    size_t bestTriangle = SIZE_MAX;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+        // Nothing in the cache has triangles left: continue with the next triangle in input order.
+        if (bestTriangle == SIZE_MAX) {
+            while (emitted[nextInputTriangle]) {
+                nextInputTriangle++;
+            }
+            bestTriangle = nextInputTriangle;
+        }
+
+        const uint32_t triangle[3] = { indices[bestTriangle * 3], indices[bestTriangle * 3 + 1], indices[bestTriangle * 3 + 2] };
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+
+        for (uint32_t v : triangle) {
+            uint32_t* list = &vertexTriangles[offsets[v]];
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                if (list[i] == bestTriangle) {
+                    list[i] = list[--remaining[v]];
+                    break;
+                }
+            }
+        }
+
+        newCache.assign(triangle, triangle + 3);
+        for (uint32_t v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                newCache.push_back(v);
+            }
+        }
+
+        // Vertices pushed out of the cache still need their score lowered.
+        for (size_t i = 0; i < newCache.size(); i++) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < VERTEX_CACHE_SIZE ? static_cast<int>(i) : -1;
+            vertexScores[v] = vertexCacheScore(cachePosition[v], remaining[v]);
+        }
+        if (newCache.size() > VERTEX_CACHE_SIZE) {
+            newCache.resize(VERTEX_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+
+        bestTriangle = SIZE_MAX;
+        float bestScore = 0.0f;
+        for (uint32_t v : cache) {
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                uint32_t t = vertexTriangles[offsets[v] + i];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+    }
+
+    indices.swap(result);
+}
+
+// Tipsy style overdraw reduction. The vertex cache optimized index list is cut into clusters wherever a
+// triangle misses the cache on all three vertices, which keeps the cache efficiency, and the clusters are
+// sorted so that those facing away from the mesh center (likely in front of the rest) come first.
+inline void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, uint32_t cacheSize = 16) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    std::vector<size_t> clusterStarts;
+    std::vector<uint32_t> fifo(cacheSize, UINT32_MAX);
+    size_t fifoHead = 0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+                fifo[fifoHead] = v;
+                fifoHead = (fifoHead + 1) % cacheSize;
+                misses++;
+            }
+        }
+        if (misses == 3 || t == 0) {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++) {
+        glm::vec3 p0 = positions[indices[t * 3]], p1 = positions[indices[t * 3 + 1]], p2 = positions[indices[t * 3 + 2]];
+        float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+        meshCenter += (p0 + p1 + p2) * (area / 3.0f);
+        meshArea += area;
+    }
+    meshCenter = meshArea > 0.0f ? meshCenter / meshArea : positions[indices[0]];
+
+    struct Cluster {
+        size_t first;
+        size_t last;
+        float sortKey;
+    };
+
+    std::vector<Cluster> clusters;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); c++) {
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            glm::vec3 p0 = positions[indices[t * 3]], p1 = positions[indices[t * 3 + 1]], p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(areaNormal);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += areaNormal;
+            area += triangleArea;
+        }
+
+        float sortKey = 0.0f;
+        if (area > 0.0f && glm::length(normal) > 0.0f) {
+            sortKey = glm::dot(center / area - meshCenter, glm::normalize(normal));
+        }
+        clusters.push_back({ clusterStarts[c], clusterStarts[c + 1], sortKey });
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (const Cluster& cluster : clusters) {
+        result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+    }
+    indices.swap(result);
+}
+
+// Renumbers vertices in the order the index buffer first uses them and drops unused ones.
+template <typename Vertex, typename Index>
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (Index& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = static_cast<Index>(remap[index]);
+    }
+
+    vertices.swap(result);
+}
+
+struct VertexCacheStats {
+    size_t verticesTransformed = 0;
+    float acmr = 0.0f; // average cache miss ratio: transformed vertices per triangle, 0.5 at best, 3 at worst
+    float atvr = 0.0f; // average transformed vertex ratio: transformed per unique vertex, 1 at best
+};
+
+// Simulates a FIFO post-transform cache, the model most hardware is closest to.
+template <typename Index>
+VertexCacheStats analyzeVertexCache(const std::vector<Index>& indices, size_t vertexCount, uint32_t cacheSize = 16) {
+    VertexCacheStats stats;
+    std::vector<uint32_t> fifo(cacheSize, UINT32_MAX);
+    std::vector<bool> used(vertexCount, false);
+    size_t fifoHead = 0;
+    size_t uniqueVertices = 0;
+
+    for (Index index : indices) {
+        uint32_t v = static_cast<uint32_t>(index);
+        if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+            fifo[fifoHead] = v;
+            fifoHead = (fifoHead + 1) % cacheSize;
+            stats.verticesTransformed++;
+        }
+        if (!used[v]) {
+            used[v] = true;
+            uniqueVertices++;
+        }
+    }
+
+    size_t triangleCount = indices.size() / 3;
+    stats.acmr = triangleCount == 0 ? 0.0f : static_cast<float>(stats.verticesTransformed) / triangleCount;
+    stats.atvr = uniqueVertices == 0 ? 0.0f : static_cast<float>(stats.verticesTransformed) / uniqueVertices;
+    return stats;
+}
+
+// Simulates the LRU cache of VERTEX_CACHE_SIZE entries that optimizeVertexCache() scores against, so its
+// result is measured with the model it optimizes for; analyzeVertexCache() shows how that carries over
+// to a smaller FIFO.
+template <typename Index>
+VertexCacheStats analyzeVertexCacheLru(const std::vector<Index>& indices, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE) {
+    VertexCacheStats stats;
+    std::vector<uint32_t> cache;
+    cache.reserve(cacheSize + 1);
+    std::vector<bool> used(vertexCount, false);
+    size_t uniqueVertices = 0;
+
+    for (Index index : indices) {
+        uint32_t v = static_cast<uint32_t>(index);
+        auto it = std::find(cache.begin(), cache.end(), v);
+        if (it == cache.end()) {
+            cache.insert(cache.begin(), v);
+            if (cache.size() > cacheSize) {
+                cache.pop_back();
+            }
+            stats.verticesTransformed++;
+        } else {
+            std::rotate(cache.begin(), it, it + 1);
+        }
+        if (!used[v]) {
+            used[v] = true;
+            uniqueVertices++;
+        }
+    }
+
+    size_t triangleCount = indices.size() / 3;
+    stats.acmr = triangleCount == 0 ? 0.0f : static_cast<float>(stats.verticesTransformed) / triangleCount;
+    stats.atvr = uniqueVertices == 0 ? 0.0f : static_cast<float>(stats.verticesTransformed) / uniqueVertices;
+    return stats;
+}
+
+struct VertexFetchStats {
+    size_t bytesFetched = 0;
+    float overfetch = 0.0f; // bytes fetched / vertex buffer size, 1 at best
+};
+
+// Counts 64 byte memory transactions through a small LRU cache in front of the vertex buffer.
+template <typename Index>
+VertexFetchStats analyzeVertexFetch(const std::vector<Index>& indices, size_t vertexCount, size_t vertexStride, size_t cacheLines = 64) {
+    const size_t lineSize = 64;
+    VertexFetchStats stats;
+    std::vector<size_t> lines;
+
+    for (Index index : indices) {
+        size_t firstLine = static_cast<size_t>(index) * vertexStride / lineSize;
+        size_t lastLine = (static_cast<size_t>(index) * vertexStride + vertexStride - 1) / lineSize;
+        for (size_t line = firstLine; line <= lastLine; line++) {
+            auto it = std::find(lines.begin(), lines.end(), line);
+            if (it != lines.end()) {
+                lines.erase(it);
+            } else {
+                stats.bytesFetched += lineSize;
+                if (lines.size() == cacheLines) {
+                    lines.erase(lines.begin());
+                }
+            }
+            lines.push_back(line);
+        }
+    }
+
+    size_t bufferSize = vertexCount * vertexStride;
+    stats.overfetch = bufferSize == 0 ? 0.0f : static_cast<float>(stats.bytesFetched) / bufferSize;
+    return stats;
+}
+
+struct OverdrawStats {
+    size_t pixelsCovered = 0;
+    size_t pixelsShaded = 0;
+    float overdraw = 0.0f; // shaded per covered pixel, 1 at best
+    double seconds = 0.0;
+    double trianglesPerSecond = 0.0;
+};
+
+// Rasterizes the mesh in index buffer order with a depth test and back face culling from the six axis
+// directions into a resolution x resolution depth buffer, counting fragments that pass the depth test.
+// The time it takes gives the triangle throughput of the rasterizer.
+template <typename Index>
+OverdrawStats analyzeOverdraw(const std::vector<Index>& indices, const std::vector<glm::vec3>& positions, int resolution = 256) {
+    OverdrawStats stats;
+    if (indices.empty()) {
+        return stats;
+    }
+
+    glm::vec3 minimum(std::numeric_limits<float>::max());
+    glm::vec3 maximum(-std::numeric_limits<float>::max());
+    for (Index index : indices) {
+        minimum = glm::min(minimum, positions[index]);
+        maximum = glm::max(maximum, positions[index]);
+    }
+    glm::vec3 extent = maximum - minimum;
+    float scale = (resolution - 1) / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-8f));
+
+    std::vector<float> depthBuffer(resolution * resolution);
+    std::vector<glm::vec3> projected(positions.size());
+    const size_t triangleCount = indices.size() / 3;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    for (int view = 0; view < 6; view++) {
+        int axis = view / 2;
+        bool flip = (view % 2) == 1;
+
+        // Look down the axis: the other two coordinates become x and y, the axis itself depth.
+        for (size_t i = 0; i < positions.size(); i++) {
+            glm::vec3 p = (positions[i] - minimum) * scale;
+            float x = p[(axis + 1) % 3];
+            float y = p[(axis + 2) % 3];
+            float z = p[axis];
+            projected[i] = flip ? glm::vec3(resolution - 1 - x, y, -z) : glm::vec3(x, y, z);
+        }
+
+        std::fill(depthBuffer.begin(), depthBuffer.end(), std::numeric_limits<float>::max());
+
+        for (size_t t = 0; t < triangleCount; t++) {
+            glm::vec3 a = projected[indices[t * 3]], b = projected[indices[t * 3 + 1]], c = projected[indices[t * 3 + 2]];
+
+            float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            if (area <= 0.0f) {
+                continue;
+            }
+
+            int minX = std::max(0, static_cast<int>(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+            int maxX = std::min(resolution - 1, static_cast<int>(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+            int minY = std::max(0, static_cast<int>(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+            int maxY = std::min(resolution - 1, static_cast<int>(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+
+            for (int y = minY; y <= maxY; y++) {
+                for (int x = minX; x <= maxX; x++) {
+                    float px = x + 0.5f;
+                    float py = y + 0.5f;
+                    float w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+                    float w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+                    float w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                        continue;
+                    }
+
+                    float depth = (w0 * a.z + w1 * b.z + w2 * c.z) / area;
+                    float& stored = depthBuffer[y * resolution + x];
+                    if (depth < stored) {
+                        stored = depth;
+                        stats.pixelsShaded++;
+                    }
+                }
+            }
+        }
+
+        for (float depth : depthBuffer) {
+            if (depth != std::numeric_limits<float>::max()) {
+                stats.pixelsCovered++;
+            }
+        }
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    stats.seconds = std::chrono::duration<double>(endTime - startTime).count();
+    stats.trianglesPerSecond = stats.seconds > 0.0 ? triangleCount * 6 / stats.seconds : 0.0;
+    stats.overdraw = stats.pixelsCovered == 0 ? 0.0f : static_cast<float>(stats.pixelsShaded) / stats.pixelsCovered;
+    return stats;
+}
+
+struct MeshStats {
+    VertexCacheStats vertexCache;     // FIFO of 16
+    VertexCacheStats vertexCacheLru;  // LRU of VERTEX_CACHE_SIZE, what optimizeVertexCache() targets
+    VertexFetchStats vertexFetch;
+    OverdrawStats overdraw;
+};
+
+struct MeshOptimizationReport {
+    MeshStats before;
+    MeshStats after;
+};
+
+template <typename Index>
+MeshStats analyzeMesh(const std::vector<Index>& indices, const std::vector<glm::vec3>& positions, size_t vertexStride) {
+    MeshStats stats;
+    stats.vertexCache = analyzeVertexCache(indices, positions.size());
+    stats.vertexCacheLru = analyzeVertexCacheLru(indices, positions.size());
+    stats.vertexFetch = analyzeVertexFetch(indices, positions.size(), vertexStride);
+    stats.overdraw = analyzeOverdraw(indices, positions);
+    return stats;
+}
+
+// Runs the three passes on a mesh in place. position(vertex) returns the glm::vec3 position of a vertex,
+// e.g. [](const Vertex& v) { return glm::vec3(v.pos, 0.0f); } for the tutorial's 2D vertices.
+template <typename Vertex, typename Index, typename PositionFunction>
+MeshOptimizationReport optimizeMesh(std::vector<Vertex>& vertices, std::vector<Index>& indices, PositionFunction position) {
+    MeshOptimizationReport report;
+
+    std::vector<glm::vec3> positions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = position(vertices[i]);
+    }
+    report.before = analyzeMesh(indices, positions, sizeof(Vertex));
+
+    std::vector<uint32_t> optimized(indices.begin(), indices.end());
+    optimizeVertexCache(optimized, vertices.size());
+    optimizeOverdraw(optimized, positions);
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = static_cast<Index>(optimized[i]);
+    }
+
+    optimizeVertexFetch(vertices, indices);
+
+    positions.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = position(vertices[i]);
+    }
+    report.after = analyzeMesh(indices, positions, sizeof(Vertex));
+
+    return report;
+}
+
+inline void printMeshOptimizationReport(const MeshOptimizationReport& report) {
+    const MeshStats* stats[2] = { &report.before, &report.after };
+    const char* names[2] = { "before", "after" };
+
+    for (int i = 0; i < 2; i++) {
+        std::cout << names[i] << ": ACMR " << stats[i]->vertexCache.acmr << " (FIFO 16) / " << stats[i]->vertexCacheLru.acmr << " (LRU " << VERTEX_CACHE_SIZE << ")"
+            << ", ATVR " << stats[i]->vertexCache.atvr << " / " << stats[i]->vertexCacheLru.atvr
+            << ", overfetch " << stats[i]->vertexFetch.overfetch << ", overdraw " << stats[i]->overdraw.overdraw
+            << ", rasterizer " << stats[i]->overdraw.trianglesPerSecond / 1e6 << " Mtris/s" << std::endl;
+    }
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "DepthBuffer.h"
+#include "DeviceDispatch.h"
+#include "RenderGraph.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Highest sample count both colour and depth attachments support.
+inline VkSampleCountFlagBits getMaxUsableSampleCount(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
+    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
+    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
+    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
+    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
+    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
+// The largest of 2, 4 and 8 samples that is not above requested and that the framebuffer supports
+// for colour and depth, 1 when none is.
+inline VkSampleCountFlagBits chooseSampleCount(VkPhysicalDevice physicalDevice, uint32_t requested) {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+    for (VkSampleCountFlagBits samples : {VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT}) {
+        if (static_cast<uint32_t>(samples) <= requested && (counts & samples)) {
+            return samples;
+        }
+    }
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
+inline bool supportsSampleShading(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    return supportedFeatures.sampleRateShading == VK_TRUE;
+}
+
+struct MsaaSettings {
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    bool sampleShading = false;     // shade every sample instead of every pixel; smooths shader aliasing at a fill-rate cost
+    float minSampleShading = 1.0f;  // fraction of the samples shaded separately
+};
+
+// Sample shading needs VkPhysicalDeviceFeatures::sampleRateShading enabled at device creation; it is
+// turned off here when the device does not support it.
+inline MsaaSettings createMsaaSettings(VkPhysicalDevice physicalDevice, uint32_t requestedSamples, bool sampleShading, float minSampleShading = 1.0f) {
+    MsaaSettings settings;
+    settings.samples = chooseSampleCount(physicalDevice, requestedSamples);
+    settings.sampleShading = sampleShading && settings.samples != VK_SAMPLE_COUNT_1_BIT && supportsSampleShading(physicalDevice);
+    settings.minSampleShading = minSampleShading;
+    return settings;
+}
+
+// Replaces the multisampling block of createGraphicsPipeline(); every pipeline drawn into a pass has
+// to use the pass's sample count.
+inline VkPipelineMultisampleStateCreateInfo makeMultisampleState(const MsaaSettings& settings) {
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = settings.samples;
+    multisampling.sampleShadingEnable = settings.sampleShading ? VK_TRUE : VK_FALSE;
+    multisampling.minSampleShading = settings.minSampleShading;
+    return multisampling;
+}
+
+// Declares a graphics pass that draws into target, the swap chain image or an offscreen image, through
+// a multisampled colour attachment resolved into target when the render pass ends. The colour and
+// depth attachments only live inside the pass, so the render graph never stores them and makes them
+// lazily allocated where it can. With one sample the pass draws into target directly.
+inline RenderGraphPass& addMsaaPass(RenderGraph& graph, const std::string& name, RenderGraphResource target, VkFormat depthFormat,
+    VkSampleCountFlagBits samples, VkClearColorValue clearColor, std::function<void(VkCommandBuffer)> execute) {
+    RenderGraphImageDesc targetDesc = graph.getImageDesc(target);
+    RenderGraphResource depth = graph.createImage(name + " depth", {depthFormat, targetDesc.extent, samples});
+
+    RenderGraphPass& pass = graph.addPass(name, RenderGraphPassType::Graphics, std::move(execute));
+    if (samples == VK_SAMPLE_COUNT_1_BIT) {
+        pass.writeColor(target, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+    } else {
+        RenderGraphResource color = graph.createImage(name + " color", {targetDesc.format, targetDesc.extent, samples});
+        pass.writeColor(color, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor).resolveColor(color, target);
+    }
+    pass.writeDepth(depth);
+    return pass;
+}
+
+struct MsaaBenchmarkResult {
+    MsaaSettings settings;
+    double milliseconds = 0.0;
+    double gigasamplesPerSecond = 0.0;
+    VkDeviceSize attachmentBytes = 0;  // multisampled attachments as plain images
+    VkDeviceSize memoryBytes = 0;      // what they took, counting lazily allocated memory as committed
+};
+
+// Draws the same workload offscreen at 1, 2, 4 and 8 samples, as far as supported, and measures the GPU
+// time of the pass including its clears and resolve. Needs no window or swap chain; each frame is
+// submitted with beginSingleTimeCommands(). draw runs inside the pass and has to bind a pipeline made
+// for the render pass and settings it gets. layers is how many times the workload covers the target,
+// for the fill rate.
+inline std::vector<MsaaBenchmarkResult> runMsaaBenchmark(const VulkanContext& context, VkExtent2D extent, VkFormat colorFormat, bool sampleShading,
+    uint32_t frames, float layers, const std::function<void(VkCommandBuffer, VkRenderPass, const MsaaSettings&)>& draw) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+    VkFormat depthFormat = findDepthFormat(context.physicalDevice);
+    const VulkanDeviceTable* dispatch = &getDeviceTable(context.device);
+
+    // Everything below is owned by handles or scope guards, so a throwing draw or graph compile leaks
+    // nothing; it is destroyed in reverse order when the function returns.
+    UniqueDeviceMemory targetMemory;
+    UniqueImage targetImage;
+    createImage(context, extent.width, extent.height, 1, VK_SAMPLE_COUNT_1_BIT, colorFormat, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, targetImage, targetMemory);
+    UniqueImageView targetView = createUniqueImageView(context.device, targetImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkQueryPoolCreateInfo timestampInfo{};
+    timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    timestampInfo.queryCount = 2;
+
+    UniqueQueryPool timestampPool;
+    if (vkCreateQueryPool(context.device, &timestampInfo, nullptr, timestampPool.put(context.device)) != VK_SUCCESS) {
+        timestampPool.release();
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    RenderGraph graph;
+    graph.create(context, 1);
+    ScopeExit graphCleanup([&graph] { graph.cleanup(); });
+
+    std::vector<MsaaBenchmarkResult> results;
+    for (uint32_t requested : {1u, 2u, 4u, 8u}) {
+        MsaaSettings settings = createMsaaSettings(context.physicalDevice, requested, sampleShading);
+        if (static_cast<uint32_t>(settings.samples) != requested) {
+            continue;
+        }
+
+        MsaaBenchmarkResult result;
+        result.settings = settings;
+
+        // The first frame creates the render pass, images and pipelines and is not timed.
+        for (uint32_t frame = 0; frame <= frames; frame++) {
+            graph.reset();
+            RenderGraphResource target = graph.importImage("target", targetImage, targetView, {colorFormat, extent},
+                {VK_IMAGE_LAYOUT_UNDEFINED}, {VK_IMAGE_LAYOUT_UNDEFINED});
+
+            RenderGraphPass* pass = nullptr;
+            pass = &addMsaaPass(graph, "msaa", target, depthFormat, settings.samples, {}, [&](VkCommandBuffer commandBuffer) {
+                draw(commandBuffer, pass->getRenderPass(), settings);
+            });
+            graph.compile();
+
+            // endSingleTimeCommands() frees the command buffer; the guard only does when recording throws.
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+            ScopeExit commandBufferCleanup([&] { vkFreeCommandBuffers(context.device, context.commandPool, 1, &commandBuffer); });
+            dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, 0, 2);
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+            graph.execute(commandBuffer);
+            dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 1);
+            commandBufferCleanup.dismiss();
+            endSingleTimeCommands(context, commandBuffer);
+
+            if (frame == 0) {
+                continue;
+            }
+            uint64_t timestamps[2] = {};
+            vkGetQueryPoolResults(context.device, timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            result.milliseconds += (timestamps[1] - timestamps[0]) * properties.limits.timestampPeriod / 1e6;
+        }
+
+        const RenderGraphStats& stats = graph.getStats();
+        result.milliseconds /= std::max(frames, 1u);
+        double samples = static_cast<double>(extent.width) * extent.height * static_cast<uint32_t>(settings.samples) * layers;
+        result.gigasamplesPerSecond = result.milliseconds > 0.0 ? samples / (result.milliseconds * 1e6) : 0.0;
+        result.attachmentBytes = stats.transientBytes;
+        result.memoryBytes = stats.allocatedBytes - stats.lazyReservedBytes + stats.lazyCommittedBytes;
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+inline void printMsaaBenchmark(const std::vector<MsaaBenchmarkResult>& results) {
+    for (const MsaaBenchmarkResult& result : results) {
+        std::cout << static_cast<uint32_t>(result.settings.samples) << "x MSAA" << (result.settings.sampleShading ? " + sample shading" : "") << ": "
+            << result.milliseconds << " ms, " << result.gigasamplesPerSecond << " Gsamples/s, attachments " << result.attachmentBytes / (1024 * 1024)
+            << " MB (" << result.memoryBytes / (1024 * 1024) << " MB committed)" << std::endl;
+    }
+}
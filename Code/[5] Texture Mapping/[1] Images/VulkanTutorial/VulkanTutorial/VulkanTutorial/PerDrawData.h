@@ -0,0 +1,526 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Small per-draw data, pushed with vkCmdPushConstants. Mirrors the push_constant block of perdraw.vert.
+struct PerDrawConstants {
+    glm::mat4 model;
+    uint32_t materialIndex;
+    uint32_t padding[3];
+};
+
+// Finds the push constant block of a SPIR-V module and returns the byte range its members cover,
+// together with the stage of the module's entry point. Returns false when the shader has no push
+// constants.
+inline bool reflectPushConstantRange(const std::vector<char>& code, VkPushConstantRange& range) {
+    const uint32_t SPIRV_MAGIC = 0x07230203;
+    const uint32_t OP_ENTRY_POINT = 15;
+    const uint32_t OP_TYPE_BOOL = 20;
+    const uint32_t OP_TYPE_INT = 21;
+    const uint32_t OP_TYPE_FLOAT = 22;
+    const uint32_t OP_TYPE_VECTOR = 23;
+    const uint32_t OP_TYPE_MATRIX = 24;
+    const uint32_t OP_TYPE_ARRAY = 28;
+    const uint32_t OP_TYPE_STRUCT = 30;
+    const uint32_t OP_TYPE_POINTER = 32;
+    const uint32_t OP_CONSTANT = 43;
+    const uint32_t OP_VARIABLE = 59;
+    const uint32_t OP_DECORATE = 71;
+    const uint32_t OP_MEMBER_DECORATE = 72;
+    const uint32_t DECORATION_ARRAY_STRIDE = 6;
+    const uint32_t DECORATION_MATRIX_STRIDE = 7;
+    const uint32_t DECORATION_OFFSET = 35;
+    const uint32_t STORAGE_CLASS_PUSH_CONSTANT = 9;
+
+    if (code.size() < 5 * sizeof(uint32_t) || code.size() % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("invalid SPIR-V module!");
+    }
+
+    std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+    memcpy(words.data(), code.data(), code.size());
+    if (words[0] != SPIRV_MAGIC) {
+        throw std::runtime_error("invalid SPIR-V module!");
+    }
+
+    struct Type {
+        uint32_t opcode = 0;
+        std::vector<uint32_t> operands;
+    };
+    struct Member {
+        uint32_t offset = 0;
+        uint32_t matrixStride = 0;
+    };
+
+    std::unordered_map<uint32_t, Type> types;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::unordered_map<uint32_t, uint32_t> arrayStrides;
+    std::unordered_map<uint32_t, std::vector<Member>> members;
+    VkShaderStageFlags stage = 0;
+    uint32_t blockType = 0;
+
+    for (size_t i = 5; i < words.size();) {
+        uint32_t wordCount = words[i] >> 16;
+        uint32_t opcode = words[i] & 0xffff;
+        if (wordCount == 0 || i + wordCount > words.size()) {
+            throw std::runtime_error("invalid SPIR-V module!");
+        }
+        const uint32_t* operands = &words[i + 1];
+
+        switch (opcode) {
+        case OP_ENTRY_POINT: {
+            const VkShaderStageFlags stages[] = {VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+                VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, VK_SHADER_STAGE_COMPUTE_BIT};
+            if (operands[0] < 6) {
+                stage |= stages[operands[0]];
+            }
+            break;
+        }
+        case OP_TYPE_BOOL:
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+        case OP_TYPE_VECTOR:
+        case OP_TYPE_MATRIX:
+        case OP_TYPE_ARRAY:
+        case OP_TYPE_STRUCT:
+        case OP_TYPE_POINTER:
+            types[operands[0]] = Type{opcode, std::vector<uint32_t>(operands + 1, operands + wordCount - 1)};
+            break;
+        case OP_CONSTANT:
+            constants[operands[1]] = operands[2];
+            break;
+        case OP_VARIABLE:
+            if (operands[2] == STORAGE_CLASS_PUSH_CONSTANT) {
+                const Type& pointer = types[operands[0]];
+                blockType = pointer.operands.size() == 2 ? pointer.operands[1] : 0;
+            }
+            break;
+        case OP_DECORATE:
+            if (operands[1] == DECORATION_ARRAY_STRIDE) {
+                arrayStrides[operands[0]] = operands[2];
+            }
+            break;
+        case OP_MEMBER_DECORATE:
+            if (operands[2] == DECORATION_OFFSET || operands[2] == DECORATION_MATRIX_STRIDE) {
+                std::vector<Member>& structMembers = members[operands[0]];
+                structMembers.resize(std::max<size_t>(structMembers.size(), operands[1] + 1));
+                if (operands[2] == DECORATION_OFFSET) {
+                    structMembers[operands[1]].offset = operands[3];
+                } else {
+                    structMembers[operands[1]].matrixStride = operands[3];
+                }
+            }
+            break;
+        }
+
+        i += wordCount;
+    }
+
+    if (blockType == 0) {
+        return false;
+    }
+
+    // Sizes follow the explicit layout decorations, so std430 and scalar blocks come out right too.
+    std::function<uint32_t(uint32_t, uint32_t)> sizeOf = [&](uint32_t id, uint32_t matrixStride) -> uint32_t {
+        const Type& type = types[id];
+        switch (type.opcode) {
+        case OP_TYPE_BOOL:
+            return 4;
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+            return type.operands[0] / 8;
+        case OP_TYPE_VECTOR:
+            return sizeOf(type.operands[0], 0) * type.operands[1];
+        case OP_TYPE_MATRIX:
+            return matrixStride != 0 ? matrixStride * type.operands[1] : sizeOf(type.operands[0], 0) * type.operands[1];
+        case OP_TYPE_ARRAY:
+            return arrayStrides[id] * constants[type.operands[1]];
+        case OP_TYPE_STRUCT: {
+            const std::vector<Member>& structMembers = members[id];
+            uint32_t end = 0;
+            for (size_t m = 0; m < type.operands.size() && m < structMembers.size(); m++) {
+                end = std::max(end, structMembers[m].offset + sizeOf(type.operands[m], structMembers[m].matrixStride));
+            }
+            return end;
+        }
+        default:
+            throw std::runtime_error("unsupported type in push constant block!");
+        }
+    };
+
+    const Type& block = types[blockType];
+    const std::vector<Member>& blockMembers = members[blockType];
+    uint32_t begin = UINT32_MAX;
+    uint32_t end = 0;
+    for (size_t m = 0; m < block.operands.size() && m < blockMembers.size(); m++) {
+        begin = std::min(begin, blockMembers[m].offset);
+        end = std::max(end, blockMembers[m].offset + sizeOf(block.operands[m], blockMembers[m].matrixStride));
+    }
+    if (begin >= end) {
+        return false;
+    }
+
+    range.stageFlags = stage;
+    range.offset = begin;
+    range.size = end - begin;
+    return true;
+}
+
+// One range covering the push constants of every stage. vkCmdPushConstants then always uses the
+// combined stage flags, which keeps it valid however the blocks of the stages overlap.
+inline bool reflectPushConstantRange(const std::vector<std::vector<char>>& shaders, VkPushConstantRange& range) {
+    bool found = false;
+    uint32_t end = 0;
+    range = VkPushConstantRange{};
+
+    for (const std::vector<char>& code : shaders) {
+        VkPushConstantRange stageRange;
+        if (!reflectPushConstantRange(code, stageRange)) {
+            continue;
+        }
+
+        range.offset = found ? std::min(range.offset, stageRange.offset) : stageRange.offset;
+        range.stageFlags |= stageRange.stageFlags;
+        end = std::max(end, stageRange.offset + stageRange.size);
+        found = true;
+    }
+
+    if (found) {
+        range.size = end - range.offset;
+    }
+    return found;
+}
+
+// Per-frame host visible uniform buffer that per-draw data is appended to, bound as a dynamic uniform
+// buffer so every draw only changes the dynamic offset. This is the fallback for data that is larger
+// than maxPushConstantsSize.
+class UniformRing {
+public:
+    void create(const VulkanContext& context, uint32_t frameCount, VkDeviceSize bytesPerFrame, uint32_t maxElementSize) {
+        this->context = context;
+        this->bytesPerFrame = bytesPerFrame;
+        this->maxElementSize = maxElementSize;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+        alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+
+        frames.resize(frameCount);
+        for (FrameResources& frame : frames) {
+            createBuffer(context, bytesPerFrame, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.buffer, frame.memory);
+            vkMapMemory(context.device, frame.memory, 0, bytesPerFrame, 0, &frame.mapped);
+        }
+
+        createDescriptorSetLayout();
+        createDescriptorPool(frameCount);
+        createDescriptorSets(frameCount);
+    }
+
+    void cleanup() {
+        descriptorPool.reset();
+        descriptorSetLayout.reset();
+        frames.clear();
+    }
+
+    // Once the frame's fence has signaled, its part of the ring can be written again.
+    void beginFrame(uint32_t currentFrame) {
+        frames[currentFrame].head = 0;
+    }
+
+    // Copies data into the ring and returns the dynamic offset to bind it with.
+    uint32_t push(uint32_t currentFrame, const void* data, uint32_t size) {
+        FrameResources& frame = frames[currentFrame];
+        if (size > maxElementSize || frame.head + size > bytesPerFrame) {
+            throw std::runtime_error("uniform ring is full!");
+        }
+
+        VkDeviceSize offset = frame.head;
+        memcpy(static_cast<char*>(frame.mapped) + offset, data, size);
+        frame.head = (offset + size + alignment - 1) / alignment * alignment;
+        return static_cast<uint32_t>(offset);
+    }
+
+    VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+    VkDescriptorSet getDescriptorSet(uint32_t currentFrame) const { return frames[currentFrame].descriptorSet; }
+    VkDeviceSize getAlignment() const { return alignment; }
+
+private:
+    struct FrameResources {
+        UniqueDeviceMemory memory;
+        UniqueBuffer buffer;
+        void* mapped = nullptr;
+        VkDeviceSize head = 0;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    };
+
+    VulkanContext context;
+    VkDeviceSize bytesPerFrame = 0;
+    uint32_t maxElementSize = 0;
+    VkDeviceSize alignment = 1;
+    std::vector<FrameResources> frames;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+
+    void createDescriptorSetLayout() {
+        VkDescriptorSetLayoutBinding binding{};
+        binding.binding = 0;
+        binding.descriptorCount = 1;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        binding.pImmutableSamplers = nullptr;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create uniform ring descriptor set layout!");
+        }
+    }
+
+    void createDescriptorPool(uint32_t frameCount) {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        poolSize.descriptorCount = frameCount;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = frameCount;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create uniform ring descriptor pool!");
+        }
+    }
+
+    void createDescriptorSets(uint32_t frameCount) {
+        std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+        std::vector<VkDescriptorSet> descriptorSets(frameCount);
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = frameCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate uniform ring descriptor sets!");
+        }
+
+        for (uint32_t i = 0; i < frameCount; i++) {
+            frames[i].descriptorSet = descriptorSets[i];
+
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = frames[i].buffer;
+            bufferInfo.offset = 0;
+            bufferInfo.range = maxElementSize;
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = descriptorSets[i];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+
+            vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+};
+
+// Gets per-draw data to the shaders, through push constants when the range reflected from the shaders
+// fits in maxPushConstantsSize and through a UniformRing otherwise. The two paths read the data
+// differently, so pick the pipeline with usesPushConstants(): perdraw.vert for push constants and
+// perdraw_ubo.vert, which reads the ring from set ringSet, for the fallback.
+class PerDrawDataPath {
+public:
+    // shaders holds the SPIR-V of every stage of the push constant pipeline.
+    void create(const VulkanContext& context, uint32_t frameCount, const std::vector<std::vector<char>>& shaders, uint32_t ringSet, uint32_t maxDrawsPerFrame) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->ringSet = ringSet;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+        maxPushConstantsSize = properties.limits.maxPushConstantsSize;
+
+        if (!reflectPushConstantRange(shaders, pushConstantRange)) {
+            throw std::runtime_error("per-draw shaders have no push constant block!");
+        }
+        pushConstants = pushConstantRange.offset + pushConstantRange.size <= maxPushConstantsSize;
+
+        // The ring always exists, for the benchmark and for data that outgrows the push constant limit.
+        uint32_t elementSize = pushConstantRange.offset + pushConstantRange.size;
+        VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+        VkDeviceSize stride = (elementSize + alignment - 1) / alignment * alignment;
+        ring.create(context, frameCount, stride * maxDrawsPerFrame, elementSize);
+    }
+
+    void cleanup() {
+        ring.cleanup();
+    }
+
+    void beginFrame(uint32_t currentFrame) {
+        ring.beginFrame(currentFrame);
+    }
+
+    bool usesPushConstants() const {
+        return pushConstants;
+    }
+
+    // Pass to VkPipelineLayoutCreateInfo of the push constant pipeline.
+    const VkPushConstantRange& getPushConstantRange() const {
+        return pushConstantRange;
+    }
+
+    // Goes into set ringSet of the fallback pipeline layout.
+    VkDescriptorSetLayout getRingDescriptorSetLayout() const {
+        return ring.getDescriptorSetLayout();
+    }
+
+    // Records the per-draw data for the next draw. data has to cover the reflected range, i.e. be at
+    // least getPushConstantRange().offset + size bytes.
+    void setDrawData(VkCommandBuffer commandBuffer, uint32_t currentFrame, VkPipelineLayout pipelineLayout, const void* data) {
+        if (pushConstants) {
+            pushDrawData(commandBuffer, pipelineLayout, data);
+        } else {
+            bindDrawData(commandBuffer, currentFrame, pipelineLayout, data);
+        }
+    }
+
+    void pushDrawData(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, const void* data) {
+        dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, pushConstantRange.stageFlags, pushConstantRange.offset, pushConstantRange.size,
+            static_cast<const char*>(data) + pushConstantRange.offset);
+    }
+
+    void bindDrawData(VkCommandBuffer commandBuffer, uint32_t currentFrame, VkPipelineLayout pipelineLayout, const void* data) {
+        uint32_t dynamicOffset = ring.push(currentFrame, data, pushConstantRange.offset + pushConstantRange.size);
+        VkDescriptorSet descriptorSet = ring.getDescriptorSet(currentFrame);
+        dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, ringSet, 1, &descriptorSet, 1, &dynamicOffset);
+    }
+
+private:
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t ringSet = 0;
+    uint32_t maxPushConstantsSize = 128;
+    bool pushConstants = false;
+    VkPushConstantRange pushConstantRange{};
+    UniformRing ring;
+};
+
+// Compares per-draw descriptor rebinding against push constants, by default at 100k draws. Records
+// the same draws both ways, timing the CPU side of recording and the GPU side with timestamps.
+class PerDrawBenchmark {
+public:
+    enum Method {
+        PUSH_CONSTANTS = 0,
+        DESCRIPTOR_REBIND = 1,
+    };
+
+    void create(VkDevice device, VkPhysicalDevice physicalDevice) {
+        this->device = device;
+        dispatch = &getDeviceTable(device);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo timestampInfo{};
+        timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount = 4;
+
+        if (vkCreateQueryPool(device, &timestampInfo, nullptr, timestampPool.put(device)) != VK_SUCCESS) {
+            timestampPool.release();
+            throw std::runtime_error("failed to create query pool!");
+        }
+    }
+
+    void cleanup() {
+        timestampPool.reset();
+    }
+
+    // Outside a render pass, before vkCmdBeginRenderPass.
+    void reset(VkCommandBuffer commandBuffer) {
+        dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, 0, 4);
+    }
+
+    // Inside the render pass with the matching pipeline and the geometry bound. The ring of path needs
+    // room for drawCount elements when timing DESCRIPTOR_REBIND.
+    void record(VkCommandBuffer commandBuffer, uint32_t currentFrame, PerDrawDataPath& path, VkPipelineLayout pipelineLayout, Method method,
+        uint32_t drawCount = 100000, uint32_t indexCount = 6) {
+        std::vector<PerDrawConstants> draws(drawCount);
+        for (uint32_t i = 0; i < drawCount; i++) {
+            draws[i].model = glm::mat4(1.0f);
+            draws[i].materialIndex = i;
+        }
+
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, method * 2);
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t i = 0; i < drawCount; i++) {
+            if (method == PUSH_CONSTANTS) {
+                path.pushDrawData(commandBuffer, pipelineLayout, &draws[i]);
+            } else {
+                path.bindDrawData(commandBuffer, currentFrame, pipelineLayout, &draws[i]);
+            }
+            dispatch->vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+        }
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, method * 2 + 1);
+
+        results[method].drawCount = drawCount;
+        results[method].recordMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+    }
+
+    // Call after the command buffer has finished executing.
+    void printResults() {
+        const char* names[] = {"push constants", "descriptor rebind"};
+        for (int method = 0; method < 2; method++) {
+            Result& result = results[method];
+            if (result.drawCount == 0) {
+                continue;
+            }
+
+            uint64_t timestamps[2] = {};
+            vkGetQueryPoolResults(device, timestampPool, method * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            result.gpuMilliseconds = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+
+            std::cout << names[method] << ": " << result.drawCount << " draws, record " << result.recordMilliseconds << " ms ("
+                << result.recordMilliseconds * 1e6 / result.drawCount << " ns/draw), gpu " << result.gpuMilliseconds << " ms" << std::endl;
+        }
+    }
+
+private:
+    struct Result {
+        uint32_t drawCount = 0;
+        double recordMilliseconds = 0.0;
+        double gpuMilliseconds = 0.0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    const VulkanDeviceTable* dispatch = nullptr;
+    float timestampPeriod = 1.0f;
+    UniqueQueryPool timestampPool;
+    Result results[2];
+};
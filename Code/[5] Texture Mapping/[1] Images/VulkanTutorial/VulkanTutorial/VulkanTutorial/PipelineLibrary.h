@@ -0,0 +1,512 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// VK_EXT_graphics_pipeline_library splits a graphics pipeline into four parts that are compiled on
+// their own and linked together:
+//
+//     vertex input interface    vertex bindings and attributes, input assembly
+//     pre-rasterization shaders vertex (tessellation, geometry) shaders, viewport, rasterization
+//     fragment shader           fragment shader, depth/stencil, multisampling
+//     fragment output interface colour blending, multisampling, attachment formats
+//
+// Variants mostly differ in one part, so every part is compiled once and the rest of each new
+// pipeline is a fast link of parts that already exist. The fast-linked pipeline may run slower than
+// a monolithic one; an optimized link with link time optimization replaces it once a background job
+// has built it.
+
+struct GraphicsPipelineLibrarySupport {
+    bool supported = false;
+    bool fastLinking = false;  // linking without optimization is cheap enough to do at draw time
+};
+
+// VK_KHR_pipeline_library and VK_EXT_graphics_pipeline_library have to be added to deviceExtensions
+// and graphicsPipelineLibrary enabled in createLogicalDevice() through
+// VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT.
+inline GraphicsPipelineLibrarySupport queryGraphicsPipelineLibrarySupport(VkPhysicalDevice physicalDevice) {
+    GraphicsPipelineLibrarySupport support;
+    if (!hasDeviceExtension(physicalDevice, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+        || !hasDeviceExtension(physicalDevice, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+        return support;
+    }
+
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+    libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = &libraryFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+
+    VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties{};
+    libraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &libraryProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    support.supported = libraryFeatures.graphicsPipelineLibrary == VK_TRUE;
+    support.fastLinking = libraryProperties.graphicsPipelineLibraryFastLinking == VK_TRUE;
+    return support;
+}
+
+enum PipelineLibraryPart {
+    PIPELINE_LIBRARY_VERTEX_INPUT,
+    PIPELINE_LIBRARY_PRE_RASTERIZATION,
+    PIPELINE_LIBRARY_FRAGMENT_SHADER,
+    PIPELINE_LIBRARY_FRAGMENT_OUTPUT,
+    PIPELINE_LIBRARY_PART_COUNT
+};
+
+struct PipelineLibraryStats {
+    std::array<uint32_t, PIPELINE_LIBRARY_PART_COUNT> libraryCounts{};
+    double libraryMilliseconds = 0.0;
+    uint32_t linkCount = 0;
+    double linkMilliseconds = 0.0;
+    // From link() being called to the pipeline being usable: the parts that were missing plus the
+    // fast link. This is what a draw with a new material waits for.
+    double firstDrawMilliseconds = 0.0;
+    double worstFirstDrawMilliseconds = 0.0;
+    uint32_t optimizedCount = 0;
+    double optimizeMilliseconds = 0.0;  // background, roughly what a monolithic compile would have stalled
+};
+
+// Links graphics pipelines from cached parts. link() takes the same VkGraphicsPipelineCreateInfo
+// vkCreateGraphicsPipelines() would, so any pipeline of the tutorial can go through it, and returns
+// an index; getPipeline() returns the fast-linked pipeline until the optimized one is ready.
+// Without a job system no optimized link is made. Parts and links go through pipelineCache when one
+// is given; pipeline caches are internally synchronized, so the background links can share it.
+//
+// Call nextFrame() once a frame after waiting for its fence: a fast-linked pipeline replaced by its
+// optimized one is destroyed framesInFlight frames later, when no command buffer can still use it.
+class PipelineLibrary {
+public:
+    void create(const VulkanContext& context, const GraphicsPipelineLibrarySupport& support, uint32_t framesInFlight, JobSystem* jobSystem = nullptr,
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE) {
+        this->context = context;
+        this->support = support;
+        this->framesInFlight = framesInFlight;
+        this->jobSystem = jobSystem;
+        this->pipelineCache = pipelineCache;
+    }
+
+    // The linked pipelines go before the libraries they were linked from.
+    void cleanup() {
+        for (auto& linked : linkedPipelines) {
+            if (linked->optimizeJob) {
+                jobSystem->wait(linked->optimizeJob);
+            }
+        }
+        linkedPipelines.clear();
+        retiredPipelines.clear();
+
+        for (auto& libraries : partLibraries) {
+            libraries.clear();
+        }
+        frameIndex = 0;
+    }
+
+    bool isSupported() const {
+        return support.supported;
+    }
+
+    uint32_t link(const VkGraphicsPipelineCreateInfo& pipelineInfo) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        auto linked = std::make_unique<LinkedPipeline>();
+        linked->layout = pipelineInfo.layout;
+        for (uint32_t part = 0; part < PIPELINE_LIBRARY_PART_COUNT; part++) {
+            linked->libraries[part] = getLibrary(static_cast<PipelineLibraryPart>(part), pipelineInfo);
+        }
+
+        auto linkStart = std::chrono::high_resolution_clock::now();
+        if (linkLibraries(linked->libraries, linked->layout, false, linked->pipeline.put(context.device)) != VK_SUCCESS) {
+            throw std::runtime_error("failed to link graphics pipeline!");
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+        stats.linkCount++;
+        stats.linkMilliseconds += std::chrono::duration<double, std::milli>(end - linkStart).count();
+        stats.firstDrawMilliseconds += milliseconds;
+        stats.worstFirstDrawMilliseconds = std::max(stats.worstFirstDrawMilliseconds, milliseconds);
+
+        // The libraries outlive every linked pipeline, so the job only needs the entry itself. If the
+        // optimized link fails the fast-linked pipeline is simply kept.
+        if (jobSystem != nullptr) {
+            LinkedPipeline* entry = linked.get();
+            entry->optimizeJob = jobSystem->run([this, entry]() {
+                auto optimizeStart = std::chrono::high_resolution_clock::now();
+                if (linkLibraries(entry->libraries, entry->layout, true, entry->optimized.put(context.device)) != VK_SUCCESS) {
+                    entry->optimized.release();
+                }
+                entry->optimizeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - optimizeStart).count();
+            });
+        }
+
+        linkedPipelines.push_back(std::move(linked));
+        return static_cast<uint32_t>(linkedPipelines.size() - 1);
+    }
+
+    VkPipeline getPipeline(uint32_t index) {
+        LinkedPipeline& linked = *linkedPipelines[index];
+        if (linked.optimizeJob && linked.optimizeJob->finished) {
+            linked.optimizeJob = nullptr;
+            if (linked.optimized) {
+                retiredPipelines.push_back({std::move(linked.pipeline), frameIndex});
+                linked.pipeline = std::move(linked.optimized);
+                stats.optimizedCount++;
+                stats.optimizeMilliseconds += linked.optimizeMilliseconds;
+            }
+        }
+        return linked.pipeline;
+    }
+
+    void nextFrame() {
+        frameIndex++;
+        auto expired = std::remove_if(retiredPipelines.begin(), retiredPipelines.end(), [&](const std::pair<UniquePipeline, uint64_t>& retired) {
+            return retired.second + framesInFlight <= frameIndex;
+        });
+        retiredPipelines.erase(expired, retiredPipelines.end());
+    }
+
+    const PipelineLibraryStats& getStats() const {
+        return stats;
+    }
+
+    std::vector<std::string> getStatsLines() const {
+        std::vector<std::string> lines;
+        std::ostringstream line;
+        line << "pipeline library: " << stats.libraryCounts[PIPELINE_LIBRARY_VERTEX_INPUT] << " vertex input, "
+            << stats.libraryCounts[PIPELINE_LIBRARY_PRE_RASTERIZATION] << " pre-rasterization, "
+            << stats.libraryCounts[PIPELINE_LIBRARY_FRAGMENT_SHADER] << " fragment shader, "
+            << stats.libraryCounts[PIPELINE_LIBRARY_FRAGMENT_OUTPUT] << " fragment output parts in " << stats.libraryMilliseconds << " ms"
+            << (support.fastLinking ? "" : " (no fast linking)");
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "first draw: " << stats.linkCount << " pipelines, " << (stats.linkCount > 0 ? stats.firstDrawMilliseconds / stats.linkCount : 0.0)
+            << " ms average, " << stats.worstFirstDrawMilliseconds << " ms worst, " << (stats.linkCount > 0 ? stats.linkMilliseconds / stats.linkCount : 0.0)
+            << " ms linking";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "optimized: " << stats.optimizedCount << " of " << stats.linkCount << ", "
+            << (stats.optimizedCount > 0 ? stats.optimizeMilliseconds / stats.optimizedCount : 0.0) << " ms average in the background";
+        lines.push_back(line.str());
+        return lines;
+    }
+
+    void printStats() const {
+        for (const std::string& line : getStatsLines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    struct LinkedPipeline {
+        std::array<VkPipeline, PIPELINE_LIBRARY_PART_COUNT> libraries{};
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        UniquePipeline pipeline;
+        UniquePipeline optimized;
+        double optimizeMilliseconds = 0.0;
+        JobHandle optimizeJob;
+    };
+
+    VulkanContext context{};
+    GraphicsPipelineLibrarySupport support{};
+    uint32_t framesInFlight = 1;
+    JobSystem* jobSystem = nullptr;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+    std::array<std::map<std::vector<uint64_t>, UniquePipeline>, PIPELINE_LIBRARY_PART_COUNT> partLibraries;
+    std::vector<std::unique_ptr<LinkedPipeline>> linkedPipelines;
+    std::vector<std::pair<UniquePipeline, uint64_t>> retiredPipelines;
+    uint64_t frameIndex = 0;
+    PipelineLibraryStats stats;
+
+    static void appendFloat(std::vector<uint64_t>& key, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        key.push_back(bits);
+    }
+
+    static void appendShaderStage(std::vector<uint64_t>& key, const VkPipelineShaderStageCreateInfo& stage) {
+        key.push_back(static_cast<uint64_t>(stage.stage));
+        key.push_back((uint64_t) stage.module);
+        key.push_back(std::hash<std::string>()(stage.pName));
+
+        const VkSpecializationInfo* specialization = stage.pSpecializationInfo;
+        if (specialization == nullptr) {
+            key.push_back(0);
+            return;
+        }
+        key.push_back(specialization->mapEntryCount);
+        for (uint32_t i = 0; i < specialization->mapEntryCount; i++) {
+            const VkSpecializationMapEntry& entry = specialization->pMapEntries[i];
+            key.push_back(static_cast<uint64_t>(entry.constantID) << 32 | entry.offset);
+            key.push_back(entry.size);
+        }
+        key.push_back(specialization->dataSize);
+        for (size_t offset = 0; offset < specialization->dataSize; offset += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            std::memcpy(&word, static_cast<const uint8_t*>(specialization->pData) + offset, std::min(sizeof(uint64_t), specialization->dataSize - offset));
+            key.push_back(word);
+        }
+    }
+
+    static void appendMultisampleState(std::vector<uint64_t>& key, const VkPipelineMultisampleStateCreateInfo* multisampling) {
+        key.push_back(static_cast<uint64_t>(multisampling->rasterizationSamples));
+        key.push_back(multisampling->sampleShadingEnable);
+        appendFloat(key, multisampling->minSampleShading);
+        key.push_back(multisampling->pSampleMask != nullptr ? *multisampling->pSampleMask : ~0ull);
+        key.push_back(multisampling->alphaToCoverageEnable << 1 | multisampling->alphaToOneEnable);
+    }
+
+    // The VkPipelineRenderingCreateInfo of a dynamic rendering pipeline, wherever it is in the chain.
+    static const VkPipelineRenderingCreateInfo* findRenderingInfo(const VkGraphicsPipelineCreateInfo& pipelineInfo) {
+        for (const VkBaseInStructure* next = static_cast<const VkBaseInStructure*>(pipelineInfo.pNext); next != nullptr; next = next->pNext) {
+            if (next->sType == VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO) {
+                return reinterpret_cast<const VkPipelineRenderingCreateInfo*>(next);
+            }
+        }
+        return nullptr;
+    }
+
+    // What every part but the vertex input interface depends on: the render pass it is used in, or the
+    // attachment formats under dynamic rendering.
+    static void appendRenderTarget(std::vector<uint64_t>& key, const VkGraphicsPipelineCreateInfo& pipelineInfo) {
+        key.push_back((uint64_t) pipelineInfo.renderPass);
+        key.push_back(pipelineInfo.subpass);
+
+        const VkPipelineRenderingCreateInfo* renderingInfo = findRenderingInfo(pipelineInfo);
+        if (pipelineInfo.renderPass != VK_NULL_HANDLE || renderingInfo == nullptr) {
+            return;
+        }
+        key.push_back(renderingInfo->viewMask);
+        for (uint32_t i = 0; i < renderingInfo->colorAttachmentCount; i++) {
+            key.push_back(static_cast<uint64_t>(renderingInfo->pColorAttachmentFormats[i]));
+        }
+        key.push_back(static_cast<uint64_t>(renderingInfo->depthAttachmentFormat) << 32 | static_cast<uint64_t>(renderingInfo->stencilAttachmentFormat));
+    }
+
+    static std::vector<uint64_t> getPartKey(PipelineLibraryPart part, const VkGraphicsPipelineCreateInfo& pipelineInfo) {
+        std::vector<uint64_t> key;
+        if (pipelineInfo.pDynamicState != nullptr) {
+            for (uint32_t i = 0; i < pipelineInfo.pDynamicState->dynamicStateCount; i++) {
+                key.push_back(static_cast<uint64_t>(pipelineInfo.pDynamicState->pDynamicStates[i]));
+            }
+        }
+        key.push_back(~0ull);
+
+        switch (part) {
+        case PIPELINE_LIBRARY_VERTEX_INPUT: {
+            const VkPipelineVertexInputStateCreateInfo* vertexInput = pipelineInfo.pVertexInputState;
+            for (uint32_t i = 0; i < vertexInput->vertexBindingDescriptionCount; i++) {
+                const VkVertexInputBindingDescription& binding = vertexInput->pVertexBindingDescriptions[i];
+                key.push_back(static_cast<uint64_t>(binding.binding) << 32 | binding.stride);
+                key.push_back(static_cast<uint64_t>(binding.inputRate));
+            }
+            for (uint32_t i = 0; i < vertexInput->vertexAttributeDescriptionCount; i++) {
+                const VkVertexInputAttributeDescription& attribute = vertexInput->pVertexAttributeDescriptions[i];
+                key.push_back(static_cast<uint64_t>(attribute.location) << 32 | attribute.binding);
+                key.push_back(static_cast<uint64_t>(attribute.format) << 32 | attribute.offset);
+            }
+            key.push_back(static_cast<uint64_t>(pipelineInfo.pInputAssemblyState->topology));
+            key.push_back(pipelineInfo.pInputAssemblyState->primitiveRestartEnable);
+            break;
+        }
+        case PIPELINE_LIBRARY_PRE_RASTERIZATION: {
+            for (uint32_t i = 0; i < pipelineInfo.stageCount; i++) {
+                if (pipelineInfo.pStages[i].stage != VK_SHADER_STAGE_FRAGMENT_BIT) {
+                    appendShaderStage(key, pipelineInfo.pStages[i]);
+                }
+            }
+            const VkPipelineRasterizationStateCreateInfo* rasterizer = pipelineInfo.pRasterizationState;
+            key.push_back(rasterizer->depthClampEnable << 1 | rasterizer->rasterizerDiscardEnable);
+            key.push_back(static_cast<uint64_t>(rasterizer->polygonMode));
+            key.push_back(static_cast<uint64_t>(rasterizer->cullMode));
+            key.push_back(static_cast<uint64_t>(rasterizer->frontFace));
+            key.push_back(rasterizer->depthBiasEnable);
+            appendFloat(key, rasterizer->depthBiasConstantFactor);
+            appendFloat(key, rasterizer->depthBiasClamp);
+            appendFloat(key, rasterizer->depthBiasSlopeFactor);
+            appendFloat(key, rasterizer->lineWidth);
+            key.push_back(static_cast<uint64_t>(pipelineInfo.pViewportState->viewportCount) << 32 | pipelineInfo.pViewportState->scissorCount);
+            key.push_back(pipelineInfo.pTessellationState != nullptr ? pipelineInfo.pTessellationState->patchControlPoints : 0);
+            key.push_back((uint64_t) pipelineInfo.layout);
+            appendRenderTarget(key, pipelineInfo);
+            break;
+        }
+        case PIPELINE_LIBRARY_FRAGMENT_SHADER: {
+            for (uint32_t i = 0; i < pipelineInfo.stageCount; i++) {
+                if (pipelineInfo.pStages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+                    appendShaderStage(key, pipelineInfo.pStages[i]);
+                }
+            }
+            const VkPipelineDepthStencilStateCreateInfo* depthStencil = pipelineInfo.pDepthStencilState;
+            if (depthStencil != nullptr) {
+                key.push_back(depthStencil->depthTestEnable << 1 | depthStencil->depthWriteEnable);
+                key.push_back(static_cast<uint64_t>(depthStencil->depthCompareOp));
+                key.push_back(depthStencil->depthBoundsTestEnable << 1 | depthStencil->stencilTestEnable);
+                for (const VkStencilOpState& stencil : {depthStencil->front, depthStencil->back}) {
+                    key.push_back(static_cast<uint64_t>(stencil.failOp) << 48 | static_cast<uint64_t>(stencil.passOp) << 32
+                        | static_cast<uint64_t>(stencil.depthFailOp) << 16 | static_cast<uint64_t>(stencil.compareOp));
+                    key.push_back(static_cast<uint64_t>(stencil.compareMask) << 32 | stencil.writeMask);
+                    key.push_back(stencil.reference);
+                }
+                appendFloat(key, depthStencil->minDepthBounds);
+                appendFloat(key, depthStencil->maxDepthBounds);
+            }
+            appendMultisampleState(key, pipelineInfo.pMultisampleState);
+            key.push_back((uint64_t) pipelineInfo.layout);
+            appendRenderTarget(key, pipelineInfo);
+            break;
+        }
+        case PIPELINE_LIBRARY_FRAGMENT_OUTPUT: {
+            const VkPipelineColorBlendStateCreateInfo* colorBlending = pipelineInfo.pColorBlendState;
+            key.push_back(colorBlending->logicOpEnable);
+            key.push_back(static_cast<uint64_t>(colorBlending->logicOp));
+            for (uint32_t i = 0; i < colorBlending->attachmentCount; i++) {
+                const VkPipelineColorBlendAttachmentState& attachment = colorBlending->pAttachments[i];
+                key.push_back(attachment.blendEnable);
+                key.push_back(static_cast<uint64_t>(attachment.srcColorBlendFactor) << 48 | static_cast<uint64_t>(attachment.dstColorBlendFactor) << 32
+                    | static_cast<uint64_t>(attachment.srcAlphaBlendFactor) << 16 | static_cast<uint64_t>(attachment.dstAlphaBlendFactor));
+                key.push_back(static_cast<uint64_t>(attachment.colorBlendOp) << 32 | static_cast<uint64_t>(attachment.alphaBlendOp));
+                key.push_back(static_cast<uint64_t>(attachment.colorWriteMask));
+            }
+            for (float constant : colorBlending->blendConstants) {
+                appendFloat(key, constant);
+            }
+            appendMultisampleState(key, pipelineInfo.pMultisampleState);
+            appendRenderTarget(key, pipelineInfo);
+            break;
+        }
+        default:
+            break;
+        }
+        return key;
+    }
+
+    VkPipeline getLibrary(PipelineLibraryPart part, const VkGraphicsPipelineCreateInfo& pipelineInfo) {
+        std::vector<uint64_t> key = getPartKey(part, pipelineInfo);
+        auto cached = partLibraries[part].find(key);
+        if (cached != partLibraries[part].end()) {
+            return cached->second;
+        }
+
+        // Only the state of this part is passed; the rest of the create info stays null.
+        std::vector<VkPipelineShaderStageCreateInfo> stages;
+        VkGraphicsPipelineCreateInfo libraryPipelineInfo{};
+        libraryPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        libraryPipelineInfo.pDynamicState = pipelineInfo.pDynamicState;
+        libraryPipelineInfo.basePipelineIndex = -1;
+
+        VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+        libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+        VkPipelineRenderingCreateInfo renderingInfo{};
+
+        switch (part) {
+        case PIPELINE_LIBRARY_VERTEX_INPUT:
+            libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+            libraryPipelineInfo.pVertexInputState = pipelineInfo.pVertexInputState;
+            libraryPipelineInfo.pInputAssemblyState = pipelineInfo.pInputAssemblyState;
+            break;
+        case PIPELINE_LIBRARY_PRE_RASTERIZATION:
+            libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+            for (uint32_t i = 0; i < pipelineInfo.stageCount; i++) {
+                if (pipelineInfo.pStages[i].stage != VK_SHADER_STAGE_FRAGMENT_BIT) {
+                    stages.push_back(pipelineInfo.pStages[i]);
+                }
+            }
+            libraryPipelineInfo.pTessellationState = pipelineInfo.pTessellationState;
+            libraryPipelineInfo.pViewportState = pipelineInfo.pViewportState;
+            libraryPipelineInfo.pRasterizationState = pipelineInfo.pRasterizationState;
+            break;
+        case PIPELINE_LIBRARY_FRAGMENT_SHADER:
+            libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+            for (uint32_t i = 0; i < pipelineInfo.stageCount; i++) {
+                if (pipelineInfo.pStages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+                    stages.push_back(pipelineInfo.pStages[i]);
+                }
+            }
+            libraryPipelineInfo.pDepthStencilState = pipelineInfo.pDepthStencilState;
+            libraryPipelineInfo.pMultisampleState = pipelineInfo.pMultisampleState;
+            break;
+        case PIPELINE_LIBRARY_FRAGMENT_OUTPUT:
+            libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+            libraryPipelineInfo.pColorBlendState = pipelineInfo.pColorBlendState;
+            libraryPipelineInfo.pMultisampleState = pipelineInfo.pMultisampleState;
+            break;
+        default:
+            break;
+        }
+
+        if (part != PIPELINE_LIBRARY_VERTEX_INPUT) {
+            // Only the attachment formats under dynamic rendering are passed on, not the rest of the chain.
+            if (const VkPipelineRenderingCreateInfo* sourceRenderingInfo = findRenderingInfo(pipelineInfo)) {
+                renderingInfo = *sourceRenderingInfo;
+                renderingInfo.pNext = nullptr;
+                libraryInfo.pNext = &renderingInfo;
+            }
+            libraryPipelineInfo.renderPass = pipelineInfo.renderPass;
+            libraryPipelineInfo.subpass = pipelineInfo.subpass;
+        }
+        if (part == PIPELINE_LIBRARY_PRE_RASTERIZATION || part == PIPELINE_LIBRARY_FRAGMENT_SHADER) {
+            libraryPipelineInfo.layout = pipelineInfo.layout;
+        }
+        libraryPipelineInfo.pNext = &libraryInfo;
+        libraryPipelineInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+        if (jobSystem != nullptr) {
+            libraryPipelineInfo.flags |= VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+        }
+        libraryPipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+        libraryPipelineInfo.pStages = stages.data();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        UniquePipeline library;
+        if (vkCreateGraphicsPipelines(context.device, pipelineCache, 1, &libraryPipelineInfo, nullptr, library.put(context.device)) != VK_SUCCESS) {
+            library.release();
+            throw std::runtime_error("failed to create graphics pipeline library!");
+        }
+        stats.libraryMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        stats.libraryCounts[part]++;
+
+        VkPipeline handle = library;
+        partLibraries[part][key] = std::move(library);
+        return handle;
+    }
+
+    // Called from worker threads for the optimized link; touches nothing but the device.
+    VkResult linkLibraries(const std::array<VkPipeline, PIPELINE_LIBRARY_PART_COUNT>& libraries, VkPipelineLayout layout, bool optimize, VkPipeline* pipeline) const {
+        VkPipelineLibraryCreateInfoKHR linkInfo{};
+        linkInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+        linkInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+        linkInfo.pLibraries = libraries.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.pNext = &linkInfo;
+        pipelineInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+        pipelineInfo.layout = layout;
+        pipelineInfo.basePipelineIndex = -1;
+
+        return vkCreateGraphicsPipelines(context.device, pipelineCache, 1, &pipelineInfo, nullptr, pipeline);
+    }
+};
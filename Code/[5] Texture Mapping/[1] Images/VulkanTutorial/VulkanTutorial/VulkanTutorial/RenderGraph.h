@@ -0,0 +1,1315 @@
+#pragma once
+
+#include "DepthBuffer.h"
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Frame render graph. Every frame the passes are declared together with the images and buffers they
+// read and write; compile() then drops the passes nothing depends on, places the transient images
+// in shared memory wherever their lifetimes do not overlap, and works out the layout transitions and
+// the smallest set of barriers between the passes. execute() records one vkCmdPipelineBarrier2 batch
+// in front of each pass that needs one, so neither transitionImageLayout() calls nor subpass
+// dependencies are written by hand. The render passes created for graphics passes keep their
+// attachments in a single layout and have no dependencies of their own.
+//
+// Attachment load and store ops follow from the graph: a LOAD of contents nothing produced becomes
+// DONT_CARE, and contents no later pass uses are not stored. Intermediate attachments that live in a
+// single render pass (an MSAA colour target, a depth buffer nobody samples) are created with
+// VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT in lazily allocated memory where the device has it, so
+// tile-based GPUs keep them in tile memory and never back them with real memory.
+//
+// vkCmdPipelineBarrier2 needs Vulkan 1.3 with VkPhysicalDeviceVulkan13Features::synchronization2
+// enabled at device creation, or VK_KHR_synchronization2 with
+// VkPhysicalDeviceSynchronization2FeaturesKHR below 1.3.
+//
+// Created with dynamicRendering, graphics passes are recorded with vkCmdBeginRendering instead: no
+// VkRenderPass or VkFramebuffer objects exist, pipelines are created from getPipelineRenderingInfo(),
+// and recreating the swap chain no longer means recreating framebuffers. This needs
+// VkPhysicalDeviceVulkan13Features::dynamicRendering enabled as well, or VK_KHR_dynamic_rendering with
+// VkPhysicalDeviceDynamicRenderingFeaturesKHR below 1.3; supportsDynamicRendering() checks either.
+//
+//     renderGraph.reset();
+//     RenderGraphResource backBuffer = renderGraph.importImage("swap chain", swapChainImages[imageIndex], swapChainImageViews[imageIndex],
+//         {swapChainImageFormat, swapChainExtent}, {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT},
+//         {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR});
+//     RenderGraphResource depth = renderGraph.createImage("depth", {depthFormat, swapChainExtent});
+//     renderGraph.addPass("opaque", RenderGraphPassType::Graphics, [&](VkCommandBuffer cmd) { drawScene(cmd); })
+//         .writeColor(backBuffer)
+//         .writeDepth(depth);
+//     renderGraph.compile();
+//     renderGraph.execute(commandBuffer);
+//
+// Texture uploads fit the same model: a Transfer pass that copyTo()s an image imported with
+// {VK_IMAGE_LAYOUT_UNDEFINED} before and {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL} after, executed
+// into a beginSingleTimeCommands() command buffer.
+
+using RenderGraphResource = uint32_t;
+
+enum class RenderGraphPassType {
+    Graphics,  // runs inside a render pass built from its colour and depth attachments
+    Compute,
+    Transfer,
+};
+
+enum class RenderGraphAccess {
+    ColorAttachment,
+    ResolveAttachment,  // target of a multisampled colour attachment's resolve at the end of the pass
+    DepthAttachment,    // depth test and write
+    DepthReadOnly,      // depth test without writes
+    Sampled,
+    StorageRead,
+    StorageWrite,
+    TransferSrc,
+    TransferDst,
+    UniformBuffer,
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+};
+
+struct RenderGraphImageDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+// State of an imported resource outside the graph: what its first use has to wait for, and what the
+// graph leaves behind after its last use. An UNDEFINED layout after the graph keeps the last layout.
+struct RenderGraphExternalState {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+};
+
+struct RenderGraphAccessInfo {
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    VkImageUsageFlags imageUsage;
+    bool write;
+};
+
+// shaderStages only matters for the accesses made from shaders.
+inline RenderGraphAccessInfo getRenderGraphAccessInfo(RenderGraphAccess access, VkPipelineStageFlags2 shaderStages) {
+    switch (access) {
+    case RenderGraphAccess::ColorAttachment:
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+    case RenderGraphAccess::ResolveAttachment:
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+    case RenderGraphAccess::DepthAttachment:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true};
+    case RenderGraphAccess::DepthReadOnly:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false};
+    case RenderGraphAccess::Sampled:
+        return {shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+    case RenderGraphAccess::StorageRead:
+        return {shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false};
+    case RenderGraphAccess::StorageWrite:
+        return {shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true};
+    case RenderGraphAccess::TransferSrc:
+        return {VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+    case RenderGraphAccess::TransferDst:
+        return {VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true};
+    case RenderGraphAccess::UniformBuffer:
+        return {shaderStages, VK_ACCESS_2_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    case RenderGraphAccess::VertexBuffer:
+        return {VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    case RenderGraphAccess::IndexBuffer:
+        return {VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT, VK_ACCESS_2_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    case RenderGraphAccess::IndirectBuffer:
+        return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    }
+    throw std::runtime_error("unknown render graph access!");
+}
+
+inline VkAccessFlags2 renderGraphWriteAccessMask() {
+    return VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+}
+
+// Core in Vulkan 1.3, and VK_KHR_dynamic_rendering plus VK_KHR_synchronization2 before that. The
+// Vulkan 1.3 struct is only valid on a 1.3 device; below it the extension structs are queried.
+inline bool supportsDynamicRendering(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    bool core = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_3;
+    if (!core && (!hasDeviceExtension(physicalDevice, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)
+        || !hasDeviceExtension(physicalDevice, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))) {
+        return false;
+    }
+
+    VkPhysicalDeviceVulkan13Features vulkan13Features{};
+    vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+    synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    dynamicRenderingFeatures.pNext = &synchronization2Features;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = core ? static_cast<void*>(&vulkan13Features) : static_cast<void*>(&dynamicRenderingFeatures);
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+
+    if (core) {
+        return vulkan13Features.dynamicRendering == VK_TRUE && vulkan13Features.synchronization2 == VK_TRUE;
+    }
+    return dynamicRenderingFeatures.dynamicRendering == VK_TRUE && synchronization2Features.synchronization2 == VK_TRUE;
+}
+
+struct RenderGraphStats {
+    uint32_t passCount = 0;
+    uint32_t culledPassCount = 0;
+    uint32_t imageBarrierCount = 0;
+    uint32_t bufferBarrierCount = 0;
+    uint32_t barrierBatchCount = 0;      // vkCmdPipelineBarrier2 calls
+    uint32_t perUseTransitionCount = 0;  // barriers a transition in front of every use would have needed
+    uint32_t transientImageCount = 0;
+    VkDeviceSize transientBytes = 0;     // memory the transient images would take on their own
+    VkDeviceSize allocatedBytes = 0;     // memory they take aliased
+    uint32_t lazyImageCount = 0;         // transient attachments in lazily allocated memory
+    VkDeviceSize lazyReservedBytes = 0;
+    VkDeviceSize lazyCommittedBytes = 0; // what the driver actually backed them with
+    uint32_t clearCount = 0;             // attachment load ops
+    uint32_t loadCount = 0;
+    uint32_t dontCareLoadCount = 0;
+    uint32_t storeCount = 0;             // attachment store ops
+    uint32_t dontCareStoreCount = 0;
+};
+
+// findMemoryType() for a LAZILY_ALLOCATED type, which most desktop GPUs do not have.
+inline bool findLazyMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, uint32_t& memoryTypeIndex) {
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+            memoryTypeIndex = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+class RenderGraphPass {
+public:
+    RenderGraphPass& writeColor(RenderGraphResource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearColorValue clearColor = {}) {
+        VkClearValue clearValue{};
+        clearValue.color = clearColor;
+        return use(image, RenderGraphAccess::ColorAttachment, 0, loadOp, clearValue);
+    }
+
+    // Resolves the multisampled colour attachment source, written by this pass, into the single
+    // sampled target when the render pass ends.
+    RenderGraphPass& resolveColor(RenderGraphResource source, RenderGraphResource target) {
+        use(target, RenderGraphAccess::ResolveAttachment, 0, VK_ATTACHMENT_LOAD_OP_DONT_CARE, {});
+        uses.back().resolveSource = source;
+        return *this;
+    }
+
+    RenderGraphPass& writeDepth(RenderGraphResource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, float clearDepth = 1.0f) {
+        VkClearValue clearValue{};
+        clearValue.depthStencil = {clearDepth, 0};
+        return use(image, RenderGraphAccess::DepthAttachment, 0, loadOp, clearValue);
+    }
+
+    RenderGraphPass& readDepth(RenderGraphResource image) {
+        return use(image, RenderGraphAccess::DepthReadOnly, 0, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    // The shader stages default to the fragment shader in graphics passes and the compute shader
+    // otherwise.
+    RenderGraphPass& sample(RenderGraphResource image, VkPipelineStageFlags2 stages = 0) {
+        return use(image, RenderGraphAccess::Sampled, stages, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    RenderGraphPass& readStorage(RenderGraphResource resource, VkPipelineStageFlags2 stages = 0) {
+        return use(resource, RenderGraphAccess::StorageRead, stages, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    RenderGraphPass& writeStorage(RenderGraphResource resource, VkPipelineStageFlags2 stages = 0) {
+        return use(resource, RenderGraphAccess::StorageWrite, stages, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    // Uniform, vertex, index and indirect buffer reads.
+    RenderGraphPass& readBuffer(RenderGraphResource buffer, RenderGraphAccess access, VkPipelineStageFlags2 stages = 0) {
+        return use(buffer, access, stages, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    RenderGraphPass& copyFrom(RenderGraphResource resource) {
+        return use(resource, RenderGraphAccess::TransferSrc, 0, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    RenderGraphPass& copyTo(RenderGraphResource resource) {
+        return use(resource, RenderGraphAccess::TransferDst, 0, VK_ATTACHMENT_LOAD_OP_LOAD, {});
+    }
+
+    // Keeps the pass even when nothing reads what it writes, e.g. for readbacks and queries.
+    RenderGraphPass& setSideEffect() {
+        sideEffect = true;
+        return *this;
+    }
+
+    const std::string& getName() const { return name; }
+    bool isCulled() const { return culled; }
+
+    // Valid after compile(). Pipelines drawn in this pass are created against this render pass; it
+    // stays the same as long as the attachment formats, sample counts and layouts do.
+    VkRenderPass getRenderPass() const { return renderPass; }
+    VkExtent2D getExtent() const { return extent; }
+
+    // With dynamic rendering getRenderPass() is null; chain this into VkGraphicsPipelineCreateInfo::pNext
+    // instead. Valid after compile() until the next reset().
+    VkPipelineRenderingCreateInfo getPipelineRenderingInfo() const {
+        VkPipelineRenderingCreateInfo renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorFormats.size());
+        renderingInfo.pColorAttachmentFormats = colorFormats.data();
+        renderingInfo.depthAttachmentFormat = depthFormat;
+        renderingInfo.stencilAttachmentFormat = hasStencilComponent(depthFormat) ? depthFormat : VK_FORMAT_UNDEFINED;
+        return renderingInfo;
+    }
+
+private:
+    friend class RenderGraph;
+
+    struct Use {
+        RenderGraphResource resource;
+        RenderGraphAccess access;
+        VkPipelineStageFlags2 stages;
+        VkAttachmentLoadOp loadOp;
+        VkClearValue clearValue;
+        RenderGraphResource resolveSource;
+    };
+
+    RenderGraphPass& use(RenderGraphResource resource, RenderGraphAccess access, VkPipelineStageFlags2 stages, VkAttachmentLoadOp loadOp, VkClearValue clearValue) {
+        uses.push_back({resource, access, stages, loadOp, clearValue, 0});
+        return *this;
+    }
+
+    std::string name;
+    RenderGraphPassType type = RenderGraphPassType::Graphics;
+    std::function<void(VkCommandBuffer)> execute;
+    std::vector<Use> uses;
+    bool sideEffect = false;
+
+    // filled in by compile()
+    bool culled = false;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+    std::vector<RenderGraphResource> attachments;  // colour attachments, resolve targets, depth
+    std::vector<VkAttachmentDescription> attachmentDescriptions;
+    std::vector<VkClearValue> clearValues;
+    std::vector<int> resolveTargets;  // per colour attachment, the index of its resolve target or -1
+    int depthAttachment = -1;
+    std::vector<VkFormat> colorFormats;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+};
+
+class RenderGraph {
+public:
+    // compile() is expected once per frame: memory that a recompile stops using is released
+    // framesInFlight compiles later, when no command buffer can still reference it.
+    void create(const VulkanContext& context, uint32_t framesInFlight, bool dynamicRendering = false) {
+        this->context = context;
+        this->framesInFlight = framesInFlight;
+        this->dynamicRendering = dynamicRendering;
+        dispatch = &getDeviceTable(context.device);
+
+        // VK_ATTACHMENT_STORE_OP_NONE is core in 1.3; VK_KHR_dynamic_rendering only has it for
+        // vkCmdBeginRendering, VK_EXT_load_store_op_none for render passes as well.
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+        storeOpNone = properties.apiVersion >= VK_API_VERSION_1_3
+            || hasDeviceExtension(context.physicalDevice, VK_EXT_LOAD_STORE_OP_NONE_EXTENSION_NAME)
+            || (dynamicRendering && hasDeviceExtension(context.physicalDevice, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME));
+    }
+
+    void cleanup() {
+        releaseFramebuffers();
+        retireTransients();
+        retiredObjects.clear();
+        renderPassCache.clear();
+        passes.clear();
+        resources.clear();
+    }
+
+    // Starts the declaration of a new frame. Compiled render passes, transient images and
+    // framebuffers stay cached, so a frame declared like the previous one reuses all of them.
+    void reset() {
+        passes.clear();
+        resources.clear();
+    }
+
+    RenderGraphResource createImage(const std::string& name, const RenderGraphImageDesc& desc) {
+        Resource resource{};
+        resource.name = name;
+        resource.desc = desc;
+        resources.push_back(resource);
+        return static_cast<RenderGraphResource>(resources.size() - 1);
+    }
+
+    RenderGraphResource importImage(const std::string& name, VkImage image, VkImageView view, const RenderGraphImageDesc& desc,
+        const RenderGraphExternalState& before, const RenderGraphExternalState& after) {
+        Resource resource{};
+        resource.name = name;
+        resource.imported = true;
+        resource.desc = desc;
+        resource.image = image;
+        resource.view = view;
+        resource.before = before;
+        resource.after = after;
+        resources.push_back(resource);
+        return static_cast<RenderGraphResource>(resources.size() - 1);
+    }
+
+    RenderGraphResource importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize size,
+        const RenderGraphExternalState& before = {}, const RenderGraphExternalState& after = {}) {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = false;
+        resource.imported = true;
+        resource.buffer = buffer;
+        resource.size = size;
+        resource.before = before;
+        resource.after = after;
+        resources.push_back(resource);
+        return static_cast<RenderGraphResource>(resources.size() - 1);
+    }
+
+    // Passes run in the order they are added, so every pass has to come after the passes producing
+    // what it reads.
+    RenderGraphPass& addPass(const std::string& name, RenderGraphPassType type, std::function<void(VkCommandBuffer)> execute) {
+        passes.push_back(std::make_unique<RenderGraphPass>());
+        RenderGraphPass& pass = *passes.back();
+        pass.name = name;
+        pass.type = type;
+        pass.execute = std::move(execute);
+        return pass;
+    }
+
+    // Returns true when the transient images were (re)created, i.e. descriptors referencing
+    // getImageView() of a transient image have to be written again.
+    bool compile() {
+        compileCount++;
+        destroyRetiredObjects();
+
+        stats = {};
+        stats.passCount = static_cast<uint32_t>(passes.size());
+
+        cullPasses();
+        mergeUses();
+        bool reallocated = allocateTransients();
+        createRenderPasses();
+        buildBarriers();
+        return reallocated;
+    }
+
+    void execute(VkCommandBuffer commandBuffer) {
+        for (const auto& pass : passes) {
+            if (pass->culled) {
+                continue;
+            }
+
+            recordBarriers(commandBuffer, pass->imageBarriers, pass->bufferBarriers);
+
+            if (pass->type == RenderGraphPassType::Graphics && dynamicRendering) {
+                beginRendering(commandBuffer, *pass);
+            } else if (pass->type == RenderGraphPassType::Graphics) {
+                VkRenderPassBeginInfo renderPassInfo{};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                renderPassInfo.renderPass = pass->renderPass;
+                renderPassInfo.framebuffer = getFramebuffer(*pass);
+                renderPassInfo.renderArea.offset = {0, 0};
+                renderPassInfo.renderArea.extent = pass->extent;
+                renderPassInfo.clearValueCount = static_cast<uint32_t>(pass->clearValues.size());
+                renderPassInfo.pClearValues = pass->clearValues.data();
+
+                dispatch->vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            }
+
+            if (pass->execute) {
+                pass->execute(commandBuffer);
+            }
+
+            if (pass->type == RenderGraphPassType::Graphics && dynamicRendering) {
+                dispatch->vkCmdEndRendering(commandBuffer);
+            } else if (pass->type == RenderGraphPassType::Graphics) {
+                dispatch->vkCmdEndRenderPass(commandBuffer);
+            }
+        }
+
+        recordBarriers(commandBuffer, finalImageBarriers, finalBufferBarriers);
+    }
+
+    // Framebuffers are cached by image view; call this when the swap chain image views are destroyed.
+    // Nothing is cached with dynamic rendering.
+    void releaseFramebuffers() {
+        framebufferCache.clear();
+    }
+
+    VkImage getImage(RenderGraphResource resource) const { return resources[resource].image; }
+    VkImageView getImageView(RenderGraphResource resource) const { return resources[resource].view; }
+    VkBuffer getBuffer(RenderGraphResource resource) const { return resources[resource].buffer; }
+    const RenderGraphImageDesc& getImageDesc(RenderGraphResource resource) const { return resources[resource].desc; }
+
+    const RenderGraphStats& getStats() const { return stats; }
+
+    std::vector<std::string> getStatsLines() const {
+        // Alignment padding can make the heaps larger than the images when few lifetimes are disjoint.
+        VkDeviceSize savedBytes = stats.transientBytes > stats.allocatedBytes ? stats.transientBytes - stats.allocatedBytes : 0;
+
+        std::vector<std::string> lines;
+        std::ostringstream line;
+        line << "render graph: " << stats.passCount - stats.culledPassCount << " passes (" << stats.culledPassCount << " culled)";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "barriers: " << stats.imageBarrierCount << " image + " << stats.bufferBarrierCount << " buffer in " << stats.barrierBatchCount
+            << " batches (" << stats.perUseTransitionCount << " with one per use)";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "transient: " << stats.transientImageCount << " images, " << stats.transientBytes / (1024 * 1024) << " MB -> "
+            << stats.allocatedBytes / (1024 * 1024) << " MB aliased (saved " << savedBytes / (1024 * 1024) << " MB)";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "lazily allocated: " << stats.lazyImageCount << " images, " << stats.lazyReservedBytes / 1024 << " KB reserved, "
+            << stats.lazyCommittedBytes / 1024 << " KB committed";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "load ops: " << stats.clearCount << " clear, " << stats.loadCount << " load, " << stats.dontCareLoadCount << " don't care; store ops: "
+            << stats.storeCount << " store, " << stats.dontCareStoreCount << " don't care";
+        lines.push_back(line.str());
+        return lines;
+    }
+
+    void printStats() const {
+        for (const std::string& line : getStatsLines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    struct Resource {
+        std::string name;
+        bool isImage = true;
+        bool imported = false;
+        RenderGraphImageDesc desc{};
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        RenderGraphExternalState before{};
+        RenderGraphExternalState after{};
+
+        // filled in by compile()
+        VkImageUsageFlags usage = 0;
+        int firstPass = -1;
+        int lastPass = -1;
+        int transient = -1;
+    };
+
+    // All uses of one resource within a pass, merged.
+    struct Access {
+        RenderGraphResource resource;
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 access;
+        VkImageLayout layout;
+        bool write;
+    };
+
+    struct TransientImage {
+        RenderGraphImageDesc desc;
+        VkImageUsageFlags usage;
+        int firstPass;
+        int lastPass;
+        UniqueImage image;
+        UniqueImageView view;
+        VkMemoryRequirements requirements{};
+        uint32_t heap = 0;
+        VkDeviceSize offset = 0;
+        std::vector<uint32_t> aliasedAfter;  // transients that used the same memory earlier in the frame
+    };
+
+    struct TransientHeap {
+        uint32_t memoryTypeIndex;
+        VkDeviceSize size;
+        UniqueDeviceMemory memory;
+        bool lazy;
+        // Accesses of the previous frame to any image in the heap, which that frame may still be
+        // making when this one starts.
+        VkPipelineStageFlags2 lastStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 lastAccess = VK_ACCESS_2_NONE;
+    };
+
+    struct ResourceState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;  // last write or layout transition
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+        VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;   // reads since then
+        VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+        bool initialized = false;
+    };
+
+    // Destroyed with the entry: framebuffers, then views, images and the memory they were bound to.
+    struct Retired {
+        uint64_t compile;
+        std::vector<UniqueDeviceMemory> memory;
+        std::vector<UniqueImage> images;
+        std::vector<UniqueImageView> views;
+        std::vector<UniqueFramebuffer> framebuffers;
+    };
+
+    template <typename T>
+    static uint64_t handleKey(T handle) {
+        uint64_t key = 0;
+        std::memcpy(&key, &handle, sizeof(handle));
+        return key;
+    }
+
+    static bool overwritesAll(const RenderGraphPass::Use& use) {
+        bool attachment = use.access == RenderGraphAccess::ColorAttachment || use.access == RenderGraphAccess::ResolveAttachment || use.access == RenderGraphAccess::DepthAttachment;
+        return attachment && use.loadOp != VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+
+    // Walks the passes backwards and keeps the ones writing an imported resource, having side
+    // effects, or producing something a kept pass reads. A full overwrite (a cleared attachment)
+    // ends the need for earlier contents.
+    void cullPasses() {
+        std::vector<bool> needed(resources.size(), false);
+        for (size_t i = passes.size(); i-- > 0;) {
+            RenderGraphPass& pass = *passes[i];
+            bool keep = pass.sideEffect;
+            for (const RenderGraphPass::Use& use : pass.uses) {
+                if (use.resource >= resources.size()) {
+                    throw std::runtime_error("render graph pass uses an unknown resource!");
+                }
+                if (getRenderGraphAccessInfo(use.access, 0).write && (resources[use.resource].imported || needed[use.resource])) {
+                    keep = true;
+                }
+            }
+
+            pass.culled = !keep;
+            if (!keep) {
+                stats.culledPassCount++;
+                continue;
+            }
+
+            for (const RenderGraphPass::Use& use : pass.uses) {
+                if (overwritesAll(use)) {
+                    needed[use.resource] = false;
+                }
+            }
+            for (const RenderGraphPass::Use& use : pass.uses) {
+                if (!overwritesAll(use)) {
+                    needed[use.resource] = true;
+                }
+            }
+        }
+    }
+
+    void mergeUses() {
+        passAccesses.assign(passes.size(), {});
+        for (size_t i = 0; i < passes.size(); i++) {
+            const RenderGraphPass& pass = *passes[i];
+            if (pass.culled) {
+                continue;
+            }
+
+            VkPipelineStageFlags2 defaultStages = pass.type == RenderGraphPassType::Graphics ? VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            std::vector<Access>& accesses = passAccesses[i];
+            for (const RenderGraphPass::Use& use : pass.uses) {
+                RenderGraphAccessInfo info = getRenderGraphAccessInfo(use.access, use.stages ? use.stages : defaultStages);
+                Resource& resource = resources[use.resource];
+                if (!resource.isImage) {
+                    info.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                }
+                resource.usage |= info.imageUsage;
+                if (resource.firstPass < 0) {
+                    resource.firstPass = static_cast<int>(i);
+                }
+                resource.lastPass = static_cast<int>(i);
+
+                auto existing = std::find_if(accesses.begin(), accesses.end(), [&](const Access& access) { return access.resource == use.resource; });
+                if (existing == accesses.end()) {
+                    accesses.push_back({use.resource, info.stages, info.access, info.layout, info.write});
+                    continue;
+                }
+                if (existing->layout != info.layout) {
+                    throw std::runtime_error("render graph pass uses an image in two layouts!");
+                }
+                existing->stages |= info.stages;
+                existing->access |= info.access;
+                existing->write = existing->write || info.write;
+            }
+            stats.perUseTransitionCount += static_cast<uint32_t>(accesses.size());
+        }
+    }
+
+    // Every transient image gets its own VkImage, but images whose lifetimes do not overlap share
+    // memory: biggest first, each is placed at the lowest offset of its memory type's heap that does
+    // not collide with an image alive at the same time.
+    bool allocateTransients() {
+        std::vector<TransientImage> wanted;
+        std::vector<uint64_t> signature;
+        for (Resource& resource : resources) {
+            if (resource.imported || !resource.isImage || resource.firstPass < 0) {
+                continue;
+            }
+            resource.transient = static_cast<int>(wanted.size());
+
+            // Attachments whose contents never leave their render pass do not need memory behind them.
+            VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+            if ((resource.usage & ~attachmentUsage) == 0 && resource.firstPass == resource.lastPass) {
+                resource.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            }
+
+            TransientImage transient{};
+            transient.desc = resource.desc;
+            transient.usage = resource.usage;
+            transient.firstPass = resource.firstPass;
+            transient.lastPass = resource.lastPass;
+            wanted.push_back(std::move(transient));
+
+            signature.insert(signature.end(), {static_cast<uint64_t>(resource.desc.format), resource.desc.extent.width, resource.desc.extent.height,
+                static_cast<uint64_t>(resource.desc.samples), resource.usage, static_cast<uint64_t>(resource.firstPass), static_cast<uint64_t>(resource.lastPass)});
+        }
+
+        bool reallocated = signature != transientSignature;
+        if (reallocated) {
+            retireTransients();
+            transients = std::move(wanted);
+            transientSignature = signature;
+            createTransients();
+        }
+
+        for (Resource& resource : resources) {
+            if (resource.transient >= 0) {
+                resource.image = transients[resource.transient].image;
+                resource.view = transients[resource.transient].view;
+            }
+        }
+
+        stats.transientImageCount = static_cast<uint32_t>(transients.size());
+        for (const TransientImage& transient : transients) {
+            stats.transientBytes += transient.requirements.size;
+        }
+        for (const TransientHeap& heap : heaps) {
+            stats.allocatedBytes += heap.size;
+            if (heap.lazy) {
+                VkDeviceSize committed = 0;
+                vkGetDeviceMemoryCommitment(context.device, heap.memory, &committed);
+                stats.lazyReservedBytes += heap.size;
+                stats.lazyCommittedBytes += committed;
+            }
+        }
+        for (const TransientImage& transient : transients) {
+            if (heaps[transient.heap].lazy) {
+                stats.lazyImageCount++;
+            }
+        }
+        return reallocated;
+    }
+
+    void createTransients() {
+        for (TransientImage& transient : transients) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width = transient.desc.extent.width;
+            imageInfo.extent.height = transient.desc.extent.height;
+            imageInfo.extent.depth = 1;
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = transient.desc.format;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = transient.usage;
+            imageInfo.samples = transient.desc.samples;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(context.device, &imageInfo, nullptr, transient.image.put(context.device)) != VK_SUCCESS) {
+                transient.image.release();
+                throw std::runtime_error("failed to create transient image!");
+            }
+            vkGetImageMemoryRequirements(context.device, transient.image, &transient.requirements);
+        }
+
+        std::vector<uint32_t> order(transients.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return transients[a].requirements.size > transients[b].requirements.size; });
+
+        std::vector<uint32_t> placed;
+        for (uint32_t index : order) {
+            TransientImage& transient = transients[index];
+            uint32_t memoryTypeIndex = 0;
+            bool lazy = (transient.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+                && findLazyMemoryType(context.physicalDevice, transient.requirements.memoryTypeBits, memoryTypeIndex);
+            if (!lazy) {
+                memoryTypeIndex = findMemoryType(context.physicalDevice, transient.requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            }
+
+            auto heap = std::find_if(heaps.begin(), heaps.end(), [&](const TransientHeap& h) { return h.memoryTypeIndex == memoryTypeIndex && h.lazy == lazy; });
+            if (heap == heaps.end()) {
+                heaps.push_back({memoryTypeIndex, 0, UniqueDeviceMemory(), lazy});
+                heap = heaps.end() - 1;
+            }
+            transient.heap = static_cast<uint32_t>(heap - heaps.begin());
+
+            std::vector<std::pair<VkDeviceSize, VkDeviceSize>> occupied;
+            for (uint32_t other : placed) {
+                const TransientImage& placedImage = transients[other];
+                bool alive = placedImage.firstPass <= transient.lastPass && transient.firstPass <= placedImage.lastPass;
+                if (placedImage.heap == transient.heap && alive) {
+                    occupied.push_back({placedImage.offset, placedImage.offset + placedImage.requirements.size});
+                }
+            }
+            std::sort(occupied.begin(), occupied.end());
+
+            VkDeviceSize alignment = transient.requirements.alignment;
+            VkDeviceSize offset = 0;
+            for (const auto& range : occupied) {
+                if (offset + transient.requirements.size <= range.first) {
+                    break;
+                }
+                offset = std::max(offset, (range.second + alignment - 1) / alignment * alignment);
+            }
+            transient.offset = offset;
+            heap->size = std::max(heap->size, offset + transient.requirements.size);
+            placed.push_back(index);
+        }
+
+        for (TransientHeap& heap : heaps) {
+            VkMemoryAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = heap.size;
+            allocInfo.memoryTypeIndex = heap.memoryTypeIndex;
+
+            if (vkAllocateMemory(context.device, &allocInfo, nullptr, heap.memory.put(context.device)) != VK_SUCCESS) {
+                heap.memory.release();
+                throw std::runtime_error("failed to allocate transient image memory!");
+            }
+        }
+
+        for (uint32_t i = 0; i < transients.size(); i++) {
+            TransientImage& transient = transients[i];
+            vkBindImageMemory(context.device, transient.image, heaps[transient.heap].memory, transient.offset);
+
+            VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+            if (isDepthFormat(transient.desc.format)) {
+                aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+            }
+            transient.view = createUniqueImageView(context.device, transient.image, transient.desc.format, aspect);
+
+            for (uint32_t j = 0; j < transients.size(); j++) {
+                const TransientImage& other = transients[j];
+                bool sharesMemory = other.heap == transient.heap && other.offset < transient.offset + transient.requirements.size
+                    && transient.offset < other.offset + other.requirements.size;
+                if (j != i && sharesMemory && other.lastPass < transient.firstPass) {
+                    transient.aliasedAfter.push_back(j);
+                }
+            }
+        }
+    }
+
+    void retireTransients() {
+        Retired retired{};
+        retired.compile = compileCount;
+        for (TransientImage& transient : transients) {
+            retired.views.push_back(std::move(transient.view));
+            retired.images.push_back(std::move(transient.image));
+        }
+        for (TransientHeap& heap : heaps) {
+            retired.memory.push_back(std::move(heap.memory));
+        }
+        // Framebuffers may reference the retired views.
+        for (auto& entry : framebufferCache) {
+            retired.framebuffers.push_back(std::move(entry.second));
+        }
+        framebufferCache.clear();
+
+        transients.clear();
+        heaps.clear();
+        transientSignature.clear();
+        retiredObjects.push_back(std::move(retired));
+    }
+
+    void destroyRetiredObjects() {
+        auto expired = std::remove_if(retiredObjects.begin(), retiredObjects.end(), [&](const Retired& retired) {
+            return retired.compile + framesInFlight <= compileCount;
+        });
+        retiredObjects.erase(expired, retiredObjects.end());
+    }
+
+    void createRenderPasses() {
+        for (size_t i = 0; i < passes.size(); i++) {
+            RenderGraphPass& pass = *passes[i];
+            pass.renderPass = VK_NULL_HANDLE;
+            pass.attachments.clear();
+            pass.attachmentDescriptions.clear();
+            pass.clearValues.clear();
+            pass.resolveTargets.clear();
+            pass.depthAttachment = -1;
+            pass.colorFormats.clear();
+            pass.depthFormat = VK_FORMAT_UNDEFINED;
+            if (pass.culled || pass.type != RenderGraphPassType::Graphics) {
+                continue;
+            }
+
+            std::vector<VkAttachmentDescription> attachments;
+            std::vector<VkAttachmentReference> colorAttachmentRefs;
+            std::vector<VkAttachmentReference> resolveAttachmentRefs;
+            VkAttachmentReference depthAttachmentRef{};
+            bool hasDepth = false;
+
+            // Colour attachments first, then resolve targets, then depth.
+            const RenderGraphPass::Use* depthUse = nullptr;
+            std::vector<const RenderGraphPass::Use*> attachmentUses;
+            std::vector<const RenderGraphPass::Use*> resolveUses;
+            for (const RenderGraphPass::Use& use : pass.uses) {
+                if (use.access == RenderGraphAccess::ColorAttachment) {
+                    attachmentUses.push_back(&use);
+                } else if (use.access == RenderGraphAccess::ResolveAttachment) {
+                    resolveUses.push_back(&use);
+                } else if (use.access == RenderGraphAccess::DepthAttachment || use.access == RenderGraphAccess::DepthReadOnly) {
+                    depthUse = &use;
+                }
+            }
+            size_t colorCount = attachmentUses.size();
+            attachmentUses.insert(attachmentUses.end(), resolveUses.begin(), resolveUses.end());
+            if (!resolveUses.empty()) {
+                resolveAttachmentRefs.assign(colorCount, {VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED});
+            }
+            pass.resolveTargets.assign(colorCount, -1);
+            if (depthUse) {
+                attachmentUses.push_back(depthUse);
+            }
+            if (attachmentUses.empty()) {
+                throw std::runtime_error("render graph graphics pass has no attachments!");
+            }
+
+            std::vector<uint64_t> key;
+            pass.extent = resources[attachmentUses[0]->resource].desc.extent;
+            for (const RenderGraphPass::Use* use : attachmentUses) {
+                const Resource& resource = resources[use->resource];
+                if (resource.desc.extent.width != pass.extent.width || resource.desc.extent.height != pass.extent.height) {
+                    throw std::runtime_error("render graph pass has attachments of different sizes!");
+                }
+
+                RenderGraphAccessInfo info = getRenderGraphAccessInfo(use->access, 0);
+                bool depth = use->access == RenderGraphAccess::DepthAttachment || use->access == RenderGraphAccess::DepthReadOnly;
+
+                // Nothing to load before the first use of a transient or an imported image with
+                // undefined contents, and nothing to store after the last use of a transient. A
+                // read-only depth attachment is never written; STORE_OP_NONE keeps it that way where the
+                // device has it, otherwise it is stored like a written one.
+                bool hasContents = resource.imported ? resource.before.layout != VK_IMAGE_LAYOUT_UNDEFINED : resource.firstPass < static_cast<int>(i);
+                bool usedLater = resource.imported || resource.lastPass > static_cast<int>(i);
+
+                VkAttachmentDescription attachment{};
+                attachment.format = resource.desc.format;
+                attachment.samples = resource.desc.samples;
+                attachment.loadOp = use->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD && !hasContents ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : use->loadOp;
+                if (!info.write && storeOpNone) {
+                    attachment.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
+                } else {
+                    attachment.storeOp = usedLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                }
+                countAttachmentOps(attachment);
+                attachment.stencilLoadOp = depth && hasStencilComponent(resource.desc.format) ? attachment.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                attachment.stencilStoreOp = depth && hasStencilComponent(resource.desc.format) ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment.initialLayout = info.layout;
+                attachment.finalLayout = info.layout;
+
+                VkAttachmentReference reference{};
+                reference.attachment = static_cast<uint32_t>(attachments.size());
+                reference.layout = info.layout;
+                if (depth) {
+                    depthAttachmentRef = reference;
+                    hasDepth = true;
+                    pass.depthAttachment = static_cast<int>(reference.attachment);
+                    pass.depthFormat = attachment.format;
+                } else if (use->access == RenderGraphAccess::ResolveAttachment) {
+                    auto source = std::find_if(attachmentUses.begin(), attachmentUses.begin() + colorCount,
+                        [&](const RenderGraphPass::Use* color) { return color->resource == use->resolveSource; });
+                    if (source == attachmentUses.begin() + colorCount) {
+                        throw std::runtime_error("render graph pass resolves an image it does not write!");
+                    }
+                    if (resources[use->resolveSource].desc.samples == VK_SAMPLE_COUNT_1_BIT || resource.desc.samples != VK_SAMPLE_COUNT_1_BIT) {
+                        throw std::runtime_error("render graph resolve needs a multisampled source and a single sampled target!");
+                    }
+                    size_t colorIndex = source - attachmentUses.begin();
+                    resolveAttachmentRefs[colorIndex] = reference;
+                    pass.resolveTargets[colorIndex] = static_cast<int>(reference.attachment);
+                    key.push_back(colorIndex);
+                } else {
+                    colorAttachmentRefs.push_back(reference);
+                    pass.colorFormats.push_back(attachment.format);
+                }
+
+                attachments.push_back(attachment);
+                pass.attachments.push_back(use->resource);
+                pass.clearValues.push_back(use->clearValue);
+                key.insert(key.end(), {static_cast<uint64_t>(attachment.format), static_cast<uint64_t>(attachment.samples), static_cast<uint64_t>(attachment.loadOp),
+                    static_cast<uint64_t>(attachment.storeOp), static_cast<uint64_t>(attachment.initialLayout)});
+            }
+
+            pass.attachmentDescriptions = attachments;
+            if (dynamicRendering) {
+                continue;
+            }
+
+            auto cached = renderPassCache.find(key);
+            if (cached != renderPassCache.end()) {
+                pass.renderPass = cached->second;
+                continue;
+            }
+
+            // No subpass dependencies: the graph's barriers in front of the pass already did the
+            // transitions, and the attachments never change layout inside it.
+            VkSubpassDescription subpass{};
+            subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpass.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentRefs.size());
+            subpass.pColorAttachments = colorAttachmentRefs.data();
+            subpass.pResolveAttachments = resolveAttachmentRefs.empty() ? nullptr : resolveAttachmentRefs.data();
+            subpass.pDepthStencilAttachment = hasDepth ? &depthAttachmentRef : nullptr;
+
+            VkRenderPassCreateInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+            renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            renderPassInfo.pAttachments = attachments.data();
+            renderPassInfo.subpassCount = 1;
+            renderPassInfo.pSubpasses = &subpass;
+
+            UniqueRenderPass renderPass;
+            if (vkCreateRenderPass(context.device, &renderPassInfo, nullptr, renderPass.put(context.device)) != VK_SUCCESS) {
+                renderPass.release();
+                throw std::runtime_error("failed to create render pass!");
+            }
+            pass.renderPass = renderPass;
+            renderPassCache[key] = std::move(renderPass);
+        }
+    }
+
+    // The attachments, ops and clear values the render pass would have had. Resolves average the
+    // samples, which integer formats do not support.
+    void beginRendering(VkCommandBuffer commandBuffer, const RenderGraphPass& pass) {
+        auto makeAttachment = [&](size_t index) {
+            const VkAttachmentDescription& description = pass.attachmentDescriptions[index];
+
+            VkRenderingAttachmentInfo attachment{};
+            attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+            attachment.imageView = resources[pass.attachments[index]].view;
+            attachment.imageLayout = description.initialLayout;
+            attachment.loadOp = description.loadOp;
+            attachment.storeOp = description.storeOp;
+            attachment.clearValue = pass.clearValues[index];
+            return attachment;
+        };
+
+        std::vector<VkRenderingAttachmentInfo> colorAttachments;
+        for (size_t i = 0; i < pass.colorFormats.size(); i++) {
+            VkRenderingAttachmentInfo attachment = makeAttachment(i);
+            if (pass.resolveTargets[i] >= 0) {
+                attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+                attachment.resolveImageView = resources[pass.attachments[pass.resolveTargets[i]]].view;
+                attachment.resolveImageLayout = pass.attachmentDescriptions[pass.resolveTargets[i]].initialLayout;
+            }
+            colorAttachments.push_back(attachment);
+        }
+
+        VkRenderingAttachmentInfo depthAttachment{};
+        if (pass.depthAttachment >= 0) {
+            depthAttachment = makeAttachment(pass.depthAttachment);
+        }
+
+        VkRenderingInfo renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = pass.extent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
+        renderingInfo.pColorAttachments = colorAttachments.data();
+        renderingInfo.pDepthAttachment = pass.depthAttachment >= 0 ? &depthAttachment : nullptr;
+        renderingInfo.pStencilAttachment = hasStencilComponent(pass.depthFormat) ? &depthAttachment : nullptr;
+
+        dispatch->vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    }
+
+    void countAttachmentOps(const VkAttachmentDescription& attachment) {
+        switch (attachment.loadOp) {
+        case VK_ATTACHMENT_LOAD_OP_CLEAR: stats.clearCount++; break;
+        case VK_ATTACHMENT_LOAD_OP_LOAD: stats.loadCount++; break;
+        default: stats.dontCareLoadCount++; break;
+        }
+        if (attachment.storeOp == VK_ATTACHMENT_STORE_OP_STORE) {
+            stats.storeCount++;
+        } else if (attachment.storeOp == VK_ATTACHMENT_STORE_OP_DONT_CARE) {
+            stats.dontCareStoreCount++;
+        }
+    }
+
+    VkFramebuffer getFramebuffer(const RenderGraphPass& pass) {
+        std::vector<VkImageView> views;
+        std::vector<uint64_t> key = {handleKey(pass.renderPass), pass.extent.width, pass.extent.height};
+        for (RenderGraphResource attachment : pass.attachments) {
+            views.push_back(resources[attachment].view);
+            key.push_back(handleKey(resources[attachment].view));
+        }
+
+        auto cached = framebufferCache.find(key);
+        if (cached != framebufferCache.end()) {
+            return cached->second;
+        }
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = pass.renderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+        framebufferInfo.pAttachments = views.data();
+        framebufferInfo.width = pass.extent.width;
+        framebufferInfo.height = pass.extent.height;
+        framebufferInfo.layers = 1;
+
+        UniqueFramebuffer framebuffer;
+        if (vkCreateFramebuffer(context.device, &framebufferInfo, nullptr, framebuffer.put(context.device)) != VK_SUCCESS) {
+            framebuffer.release();
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+        VkFramebuffer handle = framebuffer;
+        framebufferCache[key] = std::move(framebuffer);
+        return handle;
+    }
+
+    ResourceState& getState(std::vector<ResourceState>& states, RenderGraphResource index) {
+        ResourceState& state = states[index];
+        if (state.initialized) {
+            return state;
+        }
+        state.initialized = true;
+
+        const Resource& resource = resources[index];
+        if (resource.imported) {
+            state.layout = resource.before.layout;
+            state.writeStages = resource.before.stages;
+            state.writeAccess = resource.before.access;
+        } else if (resource.transient >= 0) {
+            // The transients are shared by all frames in flight, so the previous frame may still be
+            // writing this memory, through this image or one aliasing it.
+            const TransientHeap& heap = heaps[transients[resource.transient].heap];
+            state.writeStages = heap.lastStages;
+            state.writeAccess = heap.lastAccess;
+
+            // The memory was used by other images earlier in the frame; their last accesses have to
+            // finish before this image takes it over.
+            for (uint32_t previous : transients[resource.transient].aliasedAfter) {
+                for (size_t other = 0; other < resources.size(); other++) {
+                    if (resources[other].transient == static_cast<int>(previous) && states[other].initialized) {
+                        state.writeStages |= states[other].writeStages | states[other].readStages;
+                        state.writeAccess |= states[other].writeAccess;
+                    }
+                }
+            }
+        }
+        return state;
+    }
+
+    void addBarrier(RenderGraphResource index, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages,
+        VkAccessFlags2 dstAccess, VkImageLayout oldLayout, VkImageLayout newLayout, std::vector<VkImageMemoryBarrier2>& imageBarriers,
+        std::vector<VkBufferMemoryBarrier2>& bufferBarriers) {
+        const Resource& resource = resources[index];
+        if (resource.isImage) {
+            VkImageMemoryBarrier2 barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            barrier.srcStageMask = srcStages;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstStageMask = dstStages;
+            barrier.dstAccessMask = dstAccess;
+            barrier.oldLayout = oldLayout;
+            barrier.newLayout = newLayout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = resource.image;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            if (isDepthFormat(resource.desc.format)) {
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                if (hasStencilComponent(resource.desc.format)) {
+                    barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+                }
+            }
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+            imageBarriers.push_back(barrier);
+            stats.imageBarrierCount++;
+        } else {
+            VkBufferMemoryBarrier2 barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+            barrier.srcStageMask = srcStages;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstStageMask = dstStages;
+            barrier.dstAccessMask = dstAccess;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = resource.buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+            bufferBarriers.push_back(barrier);
+            stats.bufferBarrierCount++;
+        }
+    }
+
+    // A barrier is only needed for a layout change, a write after earlier accesses, or a read of a
+    // write that has not been made visible to that stage yet. Reads in the same layout share one
+    // barrier after the write; later reads by stages it already covered need none.
+    void buildBarriers() {
+        std::vector<ResourceState> states(resources.size());
+        for (size_t i = 0; i < passes.size(); i++) {
+            RenderGraphPass& pass = *passes[i];
+            pass.imageBarriers.clear();
+            pass.bufferBarriers.clear();
+            if (pass.culled) {
+                continue;
+            }
+
+            for (const Access& access : passAccesses[i]) {
+                ResourceState& state = getState(states, access.resource);
+                bool layoutChange = resources[access.resource].isImage && access.layout != state.layout;
+
+                if (access.write || layoutChange) {
+                    VkPipelineStageFlags2 srcStages = state.writeStages | state.readStages;
+                    if (layoutChange || srcStages != VK_PIPELINE_STAGE_2_NONE) {
+                        addBarrier(access.resource, srcStages, state.writeAccess, access.stages, access.access, state.layout, access.layout,
+                            pass.imageBarriers, pass.bufferBarriers);
+                    }
+
+                    // A layout transition counts as a write with nothing left to make available.
+                    state.layout = access.layout;
+                    state.writeStages = access.stages;
+                    state.writeAccess = access.write ? access.access & renderGraphWriteAccessMask() : VK_ACCESS_2_NONE;
+                    state.readStages = access.write ? VK_PIPELINE_STAGE_2_NONE : access.stages;
+                    state.visibleStages = access.write ? VK_PIPELINE_STAGE_2_NONE : access.stages;
+                    state.visibleAccess = access.write ? VK_ACCESS_2_NONE : access.access;
+                    continue;
+                }
+
+                bool visible = (state.visibleStages & access.stages) == access.stages && (state.visibleAccess & access.access) == access.access;
+                if (state.writeStages != VK_PIPELINE_STAGE_2_NONE && !visible) {
+                    addBarrier(access.resource, state.writeStages, state.writeAccess, access.stages, access.access, state.layout, state.layout,
+                        pass.imageBarriers, pass.bufferBarriers);
+                    state.visibleStages |= access.stages;
+                    state.visibleAccess |= access.access;
+                }
+                state.readStages |= access.stages;
+            }
+
+            if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty()) {
+                stats.barrierBatchCount++;
+            }
+        }
+
+        finalImageBarriers.clear();
+        finalBufferBarriers.clear();
+        for (RenderGraphResource index = 0; index < resources.size(); index++) {
+            const Resource& resource = resources[index];
+            if (!resource.imported) {
+                continue;
+            }
+
+            ResourceState& state = getState(states, index);
+            VkImageLayout finalLayout = resource.after.layout == VK_IMAGE_LAYOUT_UNDEFINED ? state.layout : resource.after.layout;
+            bool layoutChange = resource.isImage && finalLayout != state.layout;
+            VkPipelineStageFlags2 srcStages = state.writeStages | state.readStages;
+            if (!layoutChange && (resource.after.stages == VK_PIPELINE_STAGE_2_NONE || srcStages == VK_PIPELINE_STAGE_2_NONE)) {
+                continue;
+            }
+
+            addBarrier(index, srcStages, state.writeAccess, resource.after.stages, resource.after.access, state.layout, finalLayout,
+                finalImageBarriers, finalBufferBarriers);
+            stats.perUseTransitionCount++;
+        }
+        if (!finalImageBarriers.empty() || !finalBufferBarriers.empty()) {
+            stats.barrierBatchCount++;
+        }
+
+        // What the next frame's first uses of the transients have to wait for.
+        std::vector<std::pair<VkPipelineStageFlags2, VkAccessFlags2>> heapAccesses(heaps.size(), {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE});
+        for (RenderGraphResource index = 0; index < resources.size(); index++) {
+            if (resources[index].transient >= 0 && states[index].initialized) {
+                auto& heapAccess = heapAccesses[transients[resources[index].transient].heap];
+                heapAccess.first |= states[index].writeStages | states[index].readStages;
+                heapAccess.second |= states[index].writeAccess;
+            }
+        }
+        for (size_t i = 0; i < heaps.size(); i++) {
+            heaps[i].lastStages = heapAccesses[i].first;
+            heaps[i].lastAccess = heapAccesses[i].second;
+        }
+    }
+
+    void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<VkImageMemoryBarrier2>& imageBarriers, const std::vector<VkBufferMemoryBarrier2>& bufferBarriers) {
+        if (imageBarriers.empty() && bufferBarriers.empty()) {
+            return;
+        }
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+        dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+        dispatch->vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t framesInFlight = 2;
+    bool dynamicRendering = false;
+    bool storeOpNone = false;
+    uint64_t compileCount = 0;
+
+    std::vector<std::unique_ptr<RenderGraphPass>> passes;
+    std::vector<Resource> resources;
+    std::vector<std::vector<Access>> passAccesses;
+    std::vector<VkImageMemoryBarrier2> finalImageBarriers;
+    std::vector<VkBufferMemoryBarrier2> finalBufferBarriers;
+
+    std::vector<TransientImage> transients;
+    std::vector<TransientHeap> heaps;
+    std::vector<uint64_t> transientSignature;
+    std::vector<Retired> retiredObjects;
+
+    std::map<std::vector<uint64_t>, UniqueRenderPass> renderPassCache;
+    std::map<std::vector<uint64_t>, UniqueFramebuffer> framebufferCache;
+
+    RenderGraphStats stats;
+};
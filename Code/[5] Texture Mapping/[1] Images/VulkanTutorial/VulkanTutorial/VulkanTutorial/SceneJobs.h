@@ -0,0 +1,170 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "JobSystem.h"
+#include "SimdTransforms.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Splits the per frame work of the scene over a JobSystem: transform update and culling run as
+// batches of the SoA kernels, draw recording goes into one secondary command buffer per batch, and
+// loadFilesParallel() reads asset files as jobs. Everything that goes through beginSingleTimeCommands()
+// shares context.commandPool and the graphics queue, so uploads of the loaded data stay on one thread or
+// have to be serialized with JobSystem::addDependency(). Exceptions thrown inside the jobs are rethrown
+// by JobSystem::wait().
+
+// One command pool per thread and frame in flight, since a VkCommandPool must only be used by one
+// thread at a time.
+class ThreadCommandPools {
+public:
+    void create(const VulkanContext& context, uint32_t queueFamilyIndex, uint32_t threadCount, uint32_t frameCount) {
+        device = context.device;
+        this->threadCount = threadCount;
+        pools.resize(threadCount * frameCount);
+
+        for (ThreadPool& pool : pools) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, pool.commandPool.put(device)) != VK_SUCCESS) {
+                pool.commandPool.release();
+                throw std::runtime_error("failed to create command pool!");
+            }
+        }
+    }
+
+    void cleanup() {
+        pools.clear();
+    }
+
+    // Call once the fence of the frame has been waited on, before recording into it again.
+    void reset(uint32_t frame) {
+        for (uint32_t i = 0; i < threadCount; i++) {
+            ThreadPool& pool = pools[frame * threadCount + i];
+            vkResetCommandPool(device, pool.commandPool, 0);
+            pool.used = 0;
+        }
+    }
+
+    // Returns a secondary command buffer from the calling thread's pool, already begun inside the render
+    // pass described by inheritanceInfo. Only threads of the JobSystem have a pool.
+    VkCommandBuffer begin(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritanceInfo) {
+        uint32_t threadIndex = JobSystem::getThreadIndex();
+        if (threadIndex >= threadCount) {
+            throw std::runtime_error("command pools are only available to job system threads!");
+        }
+        ThreadPool& pool = pools[frame * threadCount + threadIndex];
+
+        if (pool.used == pool.commandBuffers.size()) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pool.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            VkCommandBuffer commandBuffer;
+            if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+            pool.commandBuffers.push_back(commandBuffer);
+        }
+
+        VkCommandBuffer commandBuffer = pool.commandBuffers[pool.used++];
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+
+        return commandBuffer;
+    }
+
+    VkDevice getDevice() const { return device; }
+
+private:
+    struct ThreadPool {
+        UniqueCommandPool commandPool;
+        std::vector<VkCommandBuffer> commandBuffers;
+        size_t used = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t threadCount = 0;
+    std::vector<ThreadPool> pools;
+};
+
+// composeTransforms() and cullSpheres() over batches of batchSize objects. visibleIndices needs room
+// for transforms.size() entries; returns the number of visible objects, in ascending order.
+inline size_t updateAndCullParallel(JobSystem& jobSystem, const transforms::TransformSoA& transforms, transforms::MatrixSoA& world, transforms::SphereSoA& spheres,
+    const std::array<glm::vec4, 6>& planes, uint32_t* visibleIndices, size_t batchSize = 4096) {
+    batchSize = transforms::paddedCount(batchSize);
+    size_t batchCount = (transforms.size() + batchSize - 1) / batchSize;
+    std::vector<size_t> visibleCounts(batchCount);
+
+    JobHandle job = jobSystem.parallelFor(transforms.size(), batchSize, [&](size_t first, size_t last) {
+        transforms::composeTransforms(transforms, world, &spheres, first, last);
+        visibleCounts[first / batchSize] = transforms::cullSpheres(planes, spheres, visibleIndices + first, first, last);
+    });
+    jobSystem.wait(job);
+
+    // Every batch wrote its indices at its own offset; close the gaps.
+    size_t visibleCount = 0;
+    for (size_t i = 0; i < batchCount; i++) {
+        const uint32_t* batchIndices = visibleIndices + i * batchSize;
+        for (size_t j = 0; j < visibleCounts[i]; j++) {
+            visibleIndices[visibleCount++] = batchIndices[j];
+        }
+    }
+    return visibleCount;
+}
+
+// Records [0, drawCount) in batches of batchSize draws, each into its own secondary command buffer, then
+// executes them in batch order. The render pass on primaryCommandBuffer has to be begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS and match inheritanceInfo.
+inline void recordParallel(JobSystem& jobSystem, ThreadCommandPools& commandPools, uint32_t frame, VkCommandBuffer primaryCommandBuffer,
+    const VkCommandBufferInheritanceInfo& inheritanceInfo, size_t drawCount, size_t batchSize,
+    const std::function<void(VkCommandBuffer, size_t, size_t)>& recordDraws) {
+    std::vector<VkCommandBuffer> secondaryCommandBuffers((drawCount + batchSize - 1) / batchSize);
+
+    JobHandle job = jobSystem.parallelFor(drawCount, batchSize, [&](size_t first, size_t last) {
+        VkCommandBuffer commandBuffer = commandPools.begin(frame, inheritanceInfo);
+        recordDraws(commandBuffer, first, last);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+        secondaryCommandBuffers[first / batchSize] = commandBuffer;
+    });
+    jobSystem.wait(job);
+
+    if (!secondaryCommandBuffers.empty()) {
+        const VulkanDeviceTable* dispatch = &getDeviceTable(commandPools.getDevice());
+        dispatch->vkCmdExecuteCommands(primaryCommandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+    }
+}
+
+// Reads every file with readFile() in its own job, for shaders, images and other assets loaded at
+// startup. The first failure is rethrown once all reads have finished.
+inline std::vector<std::vector<char>> loadFilesParallel(JobSystem& jobSystem, const std::vector<std::string>& filenames) {
+    std::vector<std::vector<char>> contents(filenames.size());
+
+    JobHandle job = jobSystem.parallelFor(filenames.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            contents[i] = readFile(filenames[i]);
+        }
+    });
+    jobSystem.wait(job);
+
+    return contents;
+}
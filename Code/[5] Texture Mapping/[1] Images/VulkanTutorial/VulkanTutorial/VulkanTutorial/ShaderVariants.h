@@ -0,0 +1,330 @@
+#pragma once
+
+#include "DynamicPipelines.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// MAX_LIGHTS in variant.frag.
+const uint32_t MAX_SHADER_LIGHTS = 8;
+
+// The specialization constants of variant.frag, in the layout of the VkSpecializationInfo data.
+struct ShaderVariantConstants {
+    VkBool32 textured = VK_FALSE;
+    VkBool32 alphaTest = VK_FALSE;
+    uint32_t lightCount = 0;
+    float alphaCutoff = 0.5f;
+
+    static std::array<VkSpecializationMapEntry, 4> getMapEntries() {
+        std::array<VkSpecializationMapEntry, 4> mapEntries{};
+
+        mapEntries[0].constantID = 0;
+        mapEntries[0].offset = offsetof(ShaderVariantConstants, textured);
+        mapEntries[0].size = sizeof(VkBool32);
+
+        mapEntries[1].constantID = 1;
+        mapEntries[1].offset = offsetof(ShaderVariantConstants, alphaTest);
+        mapEntries[1].size = sizeof(VkBool32);
+
+        mapEntries[2].constantID = 2;
+        mapEntries[2].offset = offsetof(ShaderVariantConstants, lightCount);
+        mapEntries[2].size = sizeof(uint32_t);
+
+        mapEntries[3].constantID = 3;
+        mapEntries[3].offset = offsetof(ShaderVariantConstants, alphaCutoff);
+        mapEntries[3].size = sizeof(float);
+
+        return mapEntries;
+    }
+
+    // Values that compile to the same shader are made equal, so they share a variant: the cutoff
+    // only matters with alpha testing, and the shader never loops over more than MAX_LIGHTS.
+    ShaderVariantConstants normalized() const {
+        ShaderVariantConstants constants = *this;
+        constants.textured = textured ? VK_TRUE : VK_FALSE;
+        constants.alphaTest = alphaTest ? VK_TRUE : VK_FALSE;
+        constants.lightCount = std::min(lightCount, MAX_SHADER_LIGHTS);
+        if (!constants.alphaTest) {
+            constants.alphaCutoff = 0.5f;
+        }
+        return constants;
+    }
+
+    uint64_t getKey() const {
+        uint32_t cutoffBits;
+        std::memcpy(&cutoffBits, &alphaCutoff, sizeof(cutoffBits));
+        return static_cast<uint64_t>(textured) | static_cast<uint64_t>(alphaTest) << 1 | static_cast<uint64_t>(lightCount) << 2
+            | static_cast<uint64_t>(cutoffBits) << 32;
+    }
+};
+
+// LightBuffer in variant.frag (binding 2).
+struct ShaderLightBuffer {
+    glm::vec4 positions[MAX_SHADER_LIGHTS];  // xyz position, w range
+    glm::vec4 colors[MAX_SHADER_LIGHTS];     // rgb colour, a intensity
+    glm::vec4 ambient;
+};
+
+// The descriptor set of variant.vert and variant.frag: the uniform buffer of shader.vert at binding 0,
+// the texture at 1 and the ShaderLightBuffer at 2. Every variant declares all three and they stay
+// statically used even where TEXTURED or LIGHT_COUNT turns them off, so every binding needs a valid
+// descriptor, e.g. a 1x1 white texture for the untextured variants.
+inline UniqueDescriptorSetLayout createShaderVariantSetLayout(VkDevice device) {
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    bindings[2].binding = 2;
+    bindings[2].descriptorCount = 1;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    UniqueDescriptorSetLayout setLayout;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, setLayout.put(device)) != VK_SUCCESS) {
+        setLayout.release();
+        throw std::runtime_error("failed to create shader variant descriptor set layout!");
+    }
+    return setLayout;
+}
+
+// For GraphicsPipelineDesc::layout; shared by every variant.
+inline UniquePipelineLayout createShaderVariantPipelineLayout(VkDevice device, VkDescriptorSetLayout setLayout) {
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+
+    UniquePipelineLayout pipelineLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(device)) != VK_SUCCESS) {
+        pipelineLayout.release();
+        throw std::runtime_error("failed to create shader variant pipeline layout!");
+    }
+    return pipelineLayout;
+}
+
+// Starts the pipeline cache from the data a previous run saved to path, so pipelines it compiled are
+// found in the cache instead of compiled again. Data from another driver or GPU is dropped up front;
+// the driver would ignore it anyway.
+inline VkPipelineCache createPipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path) {
+    std::vector<char> data;
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+    }
+
+    // VkPipelineCacheHeaderVersionOne: header size, header version, vendor ID, device ID and the
+    // pipeline cache UUID.
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    uint32_t header[4] = {};
+    if (data.size() >= sizeof(header) + VK_UUID_SIZE) {
+        std::memcpy(header, data.data(), sizeof(header));
+    }
+    bool compatible = header[0] >= sizeof(header) + VK_UUID_SIZE && header[1] == 1
+        && header[2] == physicalDeviceProperties.vendorID && header[3] == physicalDeviceProperties.deviceID
+        && std::memcmp(data.data() + sizeof(header), physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = compatible ? data.size() : 0;
+    cacheInfo.pInitialData = compatible ? data.data() : nullptr;
+
+    VkPipelineCache pipelineCache;
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+    return pipelineCache;
+}
+
+inline void savePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const std::string& path) {
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+
+    std::vector<char> data(dataSize);
+    if (dataSize == 0 || vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), dataSize);
+}
+
+struct ShaderVariantStats {
+    uint32_t requestCount = 0;  // getVariant() calls
+    uint32_t variantCount = 0;  // distinct specializations
+};
+
+// Specializes one vertex and fragment shader pair per distinct ShaderVariantConstants. Each variant
+// has its own PipelineVariants for the fixed-function state, all created from the same
+// GraphicsPipelineDesc; set desc.pipelineCache, or give the library one, to have the compiled
+// variants found again on the next run.
+//
+//     setLayout = createShaderVariantSetLayout(device);
+//     pipelineLayout = createShaderVariantPipelineLayout(device, setLayout);
+//     desc.layout = pipelineLayout;
+//     shaderVariants.create(context, dynamicStateSupport, desc, "res/shaders/variant_vert.spv", "res/shaders/variant_frag.spv");
+//     ...
+//     ShaderVariantConstants constants;
+//     constants.textured = VK_TRUE;
+//     constants.lightCount = 2;
+//     shaderVariants.begin(commandBuffer);
+//     shaderVariants.getVariant(constants).bind(commandBuffer, state);
+//     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+class ShaderVariants {
+public:
+    void create(const VulkanContext& context, const DynamicStateSupport& support, const GraphicsPipelineDesc& desc,
+        const std::string& vertexShaderPath, const std::string& fragmentShaderPath, PipelineLibrary* library = nullptr) {
+        this->context = context;
+        this->support = support;
+        this->desc = desc;
+        this->library = library;
+
+        vertShaderModule = createUniqueShaderModule(context.device, readFile(vertexShaderPath));
+        fragShaderModule = createUniqueShaderModule(context.device, readFile(fragmentShaderPath));
+    }
+
+    void cleanup() {
+        for (auto& entry : variants) {
+            entry.second->pipelines.cleanup();
+        }
+        variants.clear();
+        recordingCommandBuffer = VK_NULL_HANDLE;
+
+        fragShaderModule.reset();
+        vertShaderModule.reset();
+    }
+
+    // Begins every variant on a command buffer being recorded, including those getVariant() creates
+    // while it is; see PipelineVariants::begin().
+    void begin(VkCommandBuffer commandBuffer) {
+        recordingCommandBuffer = commandBuffer;
+        for (auto& entry : variants) {
+            entry.second->pipelines.begin(commandBuffer);
+        }
+    }
+
+    PipelineVariants& getVariant(const ShaderVariantConstants& requested) {
+        stats.requestCount++;
+
+        ShaderVariantConstants constants = requested.normalized();
+        uint64_t key = constants.getKey();
+        auto it = variants.find(key);
+        if (it != variants.end()) {
+            return it->second->pipelines;
+        }
+
+        // The specialization info points into the variant, which stays where it is for its lifetime.
+        auto variant = std::make_unique<Variant>();
+        variant->constants = constants;
+        variant->mapEntries = ShaderVariantConstants::getMapEntries();
+        variant->specializationInfo.mapEntryCount = static_cast<uint32_t>(variant->mapEntries.size());
+        variant->specializationInfo.pMapEntries = variant->mapEntries.data();
+        variant->specializationInfo.dataSize = sizeof(ShaderVariantConstants);
+        variant->specializationInfo.pData = &variant->constants;
+
+        GraphicsPipelineDesc variantDesc = desc;
+        variantDesc.shaderStages.resize(2);
+        variantDesc.shaderStages[0] = {};
+        variantDesc.shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        variantDesc.shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        variantDesc.shaderStages[0].module = vertShaderModule;
+        variantDesc.shaderStages[0].pName = "main";
+        variantDesc.shaderStages[1] = {};
+        variantDesc.shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        variantDesc.shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        variantDesc.shaderStages[1].module = fragShaderModule;
+        variantDesc.shaderStages[1].pName = "main";
+        variantDesc.shaderStages[1].pSpecializationInfo = &variant->specializationInfo;
+
+        variant->pipelines.create(context, support, variantDesc, library);
+        variant->pipelines.begin(recordingCommandBuffer);
+        stats.variantCount++;
+
+        PipelineVariants& pipelines = variant->pipelines;
+        variants[key] = std::move(variant);
+        return pipelines;
+    }
+
+    // Compiles every combination of the given variants and states up front, e.g. at load time for the
+    // materials of the scene.
+    void prepare(const std::vector<ShaderVariantConstants>& constants, const std::vector<PipelineState>& states) {
+        for (const ShaderVariantConstants& variantConstants : constants) {
+            getVariant(variantConstants).prepare(states);
+        }
+    }
+
+    const ShaderVariantStats& getStats() const {
+        return stats;
+    }
+
+    std::vector<std::string> getStatsLines() const {
+        uint32_t pipelineCount = 0;
+        double compileMilliseconds = 0.0;
+        for (const auto& entry : variants) {
+            pipelineCount += entry.second->pipelines.getStats().pipelineCount;
+            compileMilliseconds += entry.second->pipelines.getStats().compileMilliseconds;
+        }
+
+        std::vector<std::string> lines;
+        std::ostringstream line;
+        line << "shader variants: " << stats.variantCount << " specialized for " << stats.requestCount << " requests, " << pipelineCount
+            << " pipelines in " << compileMilliseconds << " ms";
+        lines.push_back(line.str());
+        return lines;
+    }
+
+    void printStats() const {
+        for (const std::string& line : getStatsLines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    struct Variant {
+        ShaderVariantConstants constants;
+        std::array<VkSpecializationMapEntry, 4> mapEntries{};
+        VkSpecializationInfo specializationInfo{};
+        PipelineVariants pipelines;
+    };
+
+    VulkanContext context{};
+    DynamicStateSupport support{};
+    GraphicsPipelineDesc desc;
+    PipelineLibrary* library = nullptr;
+    VkCommandBuffer recordingCommandBuffer = VK_NULL_HANDLE;
+
+    UniqueShaderModule vertShaderModule;
+    UniqueShaderModule fragShaderModule;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Variant>> variants;
+    ShaderVariantStats stats;
+};
@@ -0,0 +1,586 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <new>
+#include <vector>
+
+// Batch transform update and sphere/frustum culling over structure-of-arrays storage. updateUniformBuffer()
+// builds one model matrix at a time with glm::rotate; these kernels do the same work for 4 (SSE2, NEON)
+// or 8 (AVX2) objects per instruction. Define TRANSFORMS_FORCE_PURE to get the scalar path, the same
+// way GLM_FORCE_PURE disables glm's own intrinsics.
+#if !defined(TRANSFORMS_FORCE_PURE) && defined(__AVX2__)
+#   define TRANSFORMS_ARCH_AVX2
+#   include <immintrin.h>
+#elif !defined(TRANSFORMS_FORCE_PURE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define TRANSFORMS_ARCH_SSE2
+#   include <emmintrin.h>
+#elif !defined(TRANSFORMS_FORCE_PURE) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#   define TRANSFORMS_ARCH_NEON
+#   include <arm_neon.h>
+#else
+#   define TRANSFORMS_ARCH_PURE
+#endif
+
+namespace transforms {
+
+// Every array is padded to this many elements and aligned to this many floats, so the kernels never
+// need a scalar tail loop whatever the instruction set.
+const size_t BATCH_ALIGNMENT = 8;
+
+inline size_t paddedCount(size_t count) {
+    return (count + BATCH_ALIGNMENT - 1) / BATCH_ALIGNMENT * BATCH_ALIGNMENT;
+}
+
+#if defined(TRANSFORMS_ARCH_AVX2)
+struct Lanes {
+    typedef __m256 Type;
+    static const size_t WIDTH = 8;
+
+    static Type load(const float* p) { return _mm256_load_ps(p); }
+    static void store(float* p, Type v) { _mm256_store_ps(p, v); }
+    static Type set1(float s) { return _mm256_set1_ps(s); }
+    static Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+    static Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+    static Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+#if defined(__FMA__)
+    static Type madd(Type a, Type b, Type c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    static Type madd(Type a, Type b, Type c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+    // Bit i is set when lane i of a >= b.
+    static uint32_t greaterEqualMask(Type a, Type b) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ))); }
+};
+#elif defined(TRANSFORMS_ARCH_SSE2)
+struct Lanes {
+    typedef __m128 Type;
+    static const size_t WIDTH = 4;
+
+    static Type load(const float* p) { return _mm_load_ps(p); }
+    static void store(float* p, Type v) { _mm_store_ps(p, v); }
+    static Type set1(float s) { return _mm_set1_ps(s); }
+    static Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+    static Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+    static Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+    static Type madd(Type a, Type b, Type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static uint32_t greaterEqualMask(Type a, Type b) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(a, b))); }
+};
+#elif defined(TRANSFORMS_ARCH_NEON)
+struct Lanes {
+    typedef float32x4_t Type;
+    static const size_t WIDTH = 4;
+
+    static Type load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, Type v) { vst1q_f32(p, v); }
+    static Type set1(float s) { return vdupq_n_f32(s); }
+    static Type add(Type a, Type b) { return vaddq_f32(a, b); }
+    static Type sub(Type a, Type b) { return vsubq_f32(a, b); }
+    static Type mul(Type a, Type b) { return vmulq_f32(a, b); }
+#if defined(__aarch64__) || defined(_M_ARM64)
+    static Type madd(Type a, Type b, Type c) { return vfmaq_f32(c, a, b); }
+#else
+    static Type madd(Type a, Type b, Type c) { return vmlaq_f32(c, a, b); }
+#endif
+    // NEON has no movemask; keep the sign bit of every lane and shift it into place.
+    static uint32_t greaterEqualMask(Type a, Type b) {
+        static const int32_t shifts[4] = { 0, 1, 2, 3 };
+        uint32x4_t bits = vshlq_u32(vshrq_n_u32(vcgeq_f32(a, b), 31), vld1q_s32(shifts));
+#if defined(__aarch64__) || defined(_M_ARM64)
+        return vaddvq_u32(bits);
+#else
+        uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+        return vget_lane_u32(vpadd_u32(sum, sum), 0);
+#endif
+    }
+};
+#else
+struct Lanes {
+    typedef float Type;
+    static const size_t WIDTH = 1;
+
+    static Type load(const float* p) { return *p; }
+    static void store(float* p, Type v) { *p = v; }
+    static Type set1(float s) { return s; }
+    static Type add(Type a, Type b) { return a + b; }
+    static Type sub(Type a, Type b) { return a - b; }
+    static Type mul(Type a, Type b) { return a * b; }
+    static Type madd(Type a, Type b, Type c) { return a * b + c; }
+    static uint32_t greaterEqualMask(Type a, Type b) { return a >= b ? 1u : 0u; }
+};
+#endif
+
+// Owns one aligned block holding several float streams of the same padded length.
+class FloatStreams {
+public:
+    FloatStreams() = default;
+    FloatStreams(const FloatStreams&) = delete;
+    FloatStreams& operator=(const FloatStreams&) = delete;
+
+    ~FloatStreams() {
+        release();
+    }
+
+    void allocate(size_t streamCount, size_t count) {
+        release();
+        this->streamCount = streamCount;
+        capacity = paddedCount(count);
+        data = static_cast<float*>(::operator new(sizeof(float) * streamCount * capacity, std::align_val_t(sizeof(float) * BATCH_ALIGNMENT)));
+        for (size_t i = 0; i < streamCount * capacity; i++) {
+            data[i] = 0.0f;
+        }
+    }
+
+    float* stream(size_t index) {
+        return data + index * capacity;
+    }
+
+    const float* stream(size_t index) const {
+        return data + index * capacity;
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+private:
+    float* data = nullptr;
+    size_t streamCount = 0;
+    size_t capacity = 0;
+
+    void release() {
+        if (data != nullptr) {
+            ::operator delete(data, std::align_val_t(sizeof(float) * BATCH_ALIGNMENT));
+            data = nullptr;
+        }
+    }
+};
+
+// Column-major mat4 per object, one stream per element: element (column c, row r) lives in stream c * 4 + r.
+class MatrixSoA {
+public:
+    void resize(size_t count) {
+        this->count = count;
+        streams.allocate(16, count);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    float* element(int column, int row) {
+        return streams.stream(column * 4 + row);
+    }
+
+    const float* element(int column, int row) const {
+        return streams.stream(column * 4 + row);
+    }
+
+    glm::mat4 get(size_t index) const {
+        glm::mat4 m;
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                m[c][r] = element(c, r)[index];
+            }
+        }
+        return m;
+    }
+
+    void set(size_t index, const glm::mat4& m) {
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                element(c, r)[index] = m[c][r];
+            }
+        }
+    }
+
+    // Scatters the matrices back to AoS, e.g. into the DrawData array of IndirectDrawPath. stride is the
+    // byte distance between two destination matrices.
+    void exportTo(void* destination, size_t stride) const {
+        char* bytes = static_cast<char*>(destination);
+        for (size_t i = 0; i < count; i++) {
+            float* m = reinterpret_cast<float*>(bytes + i * stride);
+            for (int e = 0; e < 16; e++) {
+                m[e] = streams.stream(e)[i];
+            }
+        }
+    }
+
+private:
+    FloatStreams streams;
+    size_t count = 0;
+};
+
+// Position, rotation (unit quaternion) and uniform scale of every object, plus its local bounding sphere.
+class TransformSoA {
+public:
+    enum Stream {
+        POSITION_X, POSITION_Y, POSITION_Z,
+        ROTATION_X, ROTATION_Y, ROTATION_Z, ROTATION_W,
+        SCALE,
+        BOUNDS_X, BOUNDS_Y, BOUNDS_Z, BOUNDS_RADIUS,
+        STREAM_COUNT
+    };
+
+    void resize(size_t count) {
+        this->count = count;
+        streams.allocate(STREAM_COUNT, count);
+        for (size_t i = 0; i < streams.getCapacity(); i++) {
+            streams.stream(ROTATION_W)[i] = 1.0f;
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    float* stream(Stream index) {
+        return streams.stream(index);
+    }
+
+    const float* stream(Stream index) const {
+        return streams.stream(index);
+    }
+
+    // Same parameters as glm::translate/glm::rotate/glm::scale; axis must be normalized.
+    void set(size_t index, const glm::vec3& position, const glm::vec3& axis, float angle, float scale) {
+        float s = std::sin(angle * 0.5f);
+        stream(POSITION_X)[index] = position.x;
+        stream(POSITION_Y)[index] = position.y;
+        stream(POSITION_Z)[index] = position.z;
+        stream(ROTATION_X)[index] = axis.x * s;
+        stream(ROTATION_Y)[index] = axis.y * s;
+        stream(ROTATION_Z)[index] = axis.z * s;
+        stream(ROTATION_W)[index] = std::cos(angle * 0.5f);
+        stream(SCALE)[index] = scale;
+    }
+
+    void setBounds(size_t index, const glm::vec3& center, float radius) {
+        stream(BOUNDS_X)[index] = center.x;
+        stream(BOUNDS_Y)[index] = center.y;
+        stream(BOUNDS_Z)[index] = center.z;
+        stream(BOUNDS_RADIUS)[index] = radius;
+    }
+
+private:
+    FloatStreams streams;
+    size_t count = 0;
+};
+
+// World space bounding spheres, the input of cullSpheres().
+class SphereSoA {
+public:
+    void resize(size_t count) {
+        this->count = count;
+        streams.allocate(4, count);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    float* x() { return streams.stream(0); }
+    float* y() { return streams.stream(1); }
+    float* z() { return streams.stream(2); }
+    float* radius() { return streams.stream(3); }
+    const float* x() const { return streams.stream(0); }
+    const float* y() const { return streams.stream(1); }
+    const float* z() const { return streams.stream(2); }
+    const float* radius() const { return streams.stream(3); }
+
+private:
+    FloatStreams streams;
+    size_t count = 0;
+};
+
+// Builds translate * rotate * scale for every object, the batch version of the glm::rotate call in
+// updateUniformBuffer(). Also moves the local bounding spheres to world space when spheres is not null.
+// [first, last) limits the work to a range of objects so it can be split into jobs; both ends must be
+// multiples of BATCH_ALIGNMENT, except that last may be the object count.
+inline void composeTransforms(const TransformSoA& transforms, MatrixSoA& world, SphereSoA* spheres = nullptr, size_t first = 0, size_t last = SIZE_MAX) {
+    typedef Lanes::Type V;
+    const V one = Lanes::set1(1.0f);
+    const V two = Lanes::set1(2.0f);
+    const V zero = Lanes::set1(0.0f);
+    const size_t count = paddedCount(std::min(last, transforms.size()));
+
+    for (size_t i = first; i < count; i += Lanes::WIDTH) {
+        V qx = Lanes::load(transforms.stream(TransformSoA::ROTATION_X) + i);
+        V qy = Lanes::load(transforms.stream(TransformSoA::ROTATION_Y) + i);
+        V qz = Lanes::load(transforms.stream(TransformSoA::ROTATION_Z) + i);
+        V qw = Lanes::load(transforms.stream(TransformSoA::ROTATION_W) + i);
+        V s = Lanes::load(transforms.stream(TransformSoA::SCALE) + i);
+        V tx = Lanes::load(transforms.stream(TransformSoA::POSITION_X) + i);
+        V ty = Lanes::load(transforms.stream(TransformSoA::POSITION_Y) + i);
+        V tz = Lanes::load(transforms.stream(TransformSoA::POSITION_Z) + i);
+
+        V xx = Lanes::mul(qx, qx), yy = Lanes::mul(qy, qy), zz = Lanes::mul(qz, qz);
+        V xy = Lanes::mul(qx, qy), xz = Lanes::mul(qx, qz), yz = Lanes::mul(qy, qz);
+        V wx = Lanes::mul(qw, qx), wy = Lanes::mul(qw, qy), wz = Lanes::mul(qw, qz);
+        V s2 = Lanes::mul(two, s);
+
+        V m00 = Lanes::mul(s, Lanes::sub(one, Lanes::mul(two, Lanes::add(yy, zz))));
+        V m01 = Lanes::mul(s2, Lanes::add(xy, wz));
+        V m02 = Lanes::mul(s2, Lanes::sub(xz, wy));
+        V m10 = Lanes::mul(s2, Lanes::sub(xy, wz));
+        V m11 = Lanes::mul(s, Lanes::sub(one, Lanes::mul(two, Lanes::add(xx, zz))));
+        V m12 = Lanes::mul(s2, Lanes::add(yz, wx));
+        V m20 = Lanes::mul(s2, Lanes::add(xz, wy));
+        V m21 = Lanes::mul(s2, Lanes::sub(yz, wx));
+        V m22 = Lanes::mul(s, Lanes::sub(one, Lanes::mul(two, Lanes::add(xx, yy))));
+
+        Lanes::store(world.element(0, 0) + i, m00);
+        Lanes::store(world.element(0, 1) + i, m01);
+        Lanes::store(world.element(0, 2) + i, m02);
+        Lanes::store(world.element(0, 3) + i, zero);
+        Lanes::store(world.element(1, 0) + i, m10);
+        Lanes::store(world.element(1, 1) + i, m11);
+        Lanes::store(world.element(1, 2) + i, m12);
+        Lanes::store(world.element(1, 3) + i, zero);
+        Lanes::store(world.element(2, 0) + i, m20);
+        Lanes::store(world.element(2, 1) + i, m21);
+        Lanes::store(world.element(2, 2) + i, m22);
+        Lanes::store(world.element(2, 3) + i, zero);
+        Lanes::store(world.element(3, 0) + i, tx);
+        Lanes::store(world.element(3, 1) + i, ty);
+        Lanes::store(world.element(3, 2) + i, tz);
+        Lanes::store(world.element(3, 3) + i, one);
+
+        if (spheres != nullptr) {
+            V bx = Lanes::load(transforms.stream(TransformSoA::BOUNDS_X) + i);
+            V by = Lanes::load(transforms.stream(TransformSoA::BOUNDS_Y) + i);
+            V bz = Lanes::load(transforms.stream(TransformSoA::BOUNDS_Z) + i);
+            V br = Lanes::load(transforms.stream(TransformSoA::BOUNDS_RADIUS) + i);
+
+            Lanes::store(spheres->x() + i, Lanes::madd(m00, bx, Lanes::madd(m10, by, Lanes::madd(m20, bz, tx))));
+            Lanes::store(spheres->y() + i, Lanes::madd(m01, bx, Lanes::madd(m11, by, Lanes::madd(m21, bz, ty))));
+            Lanes::store(spheres->z() + i, Lanes::madd(m02, bx, Lanes::madd(m12, by, Lanes::madd(m22, bz, tz))));
+            Lanes::store(spheres->radius() + i, Lanes::mul(br, s));
+        }
+    }
+}
+
+// result[i] = left * right[i], e.g. proj * view * model for every object.
+inline void multiplyMatrices(const glm::mat4& left, const MatrixSoA& right, MatrixSoA& result) {
+    typedef Lanes::Type V;
+    const size_t count = paddedCount(right.size());
+
+    V l[4][4];
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            l[c][r] = Lanes::set1(left[c][r]);
+        }
+    }
+
+    for (size_t i = 0; i < count; i += Lanes::WIDTH) {
+        for (int c = 0; c < 4; c++) {
+            V b0 = Lanes::load(right.element(c, 0) + i);
+            V b1 = Lanes::load(right.element(c, 1) + i);
+            V b2 = Lanes::load(right.element(c, 2) + i);
+            V b3 = Lanes::load(right.element(c, 3) + i);
+
+            for (int r = 0; r < 4; r++) {
+                V value = Lanes::madd(l[0][r], b0, Lanes::madd(l[1][r], b1, Lanes::madd(l[2][r], b2, Lanes::mul(l[3][r], b3))));
+                Lanes::store(result.element(c, r) + i, value);
+            }
+        }
+    }
+}
+
+// Normalized frustum planes (xyz normal pointing inwards, w distance) of proj * view, see
+// extractFrustumPlanes() in GpuCulling.h for the GPU side of the same test.
+inline std::array<glm::vec4, 6> frustumPlanes(const glm::mat4& viewProj) {
+    const glm::mat4& m = viewProj;
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    std::array<glm::vec4, 6> planes = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+    for (glm::vec4& plane : planes) {
+        plane = plane / glm::length(glm::vec3(plane.x, plane.y, plane.z));
+    }
+    return planes;
+}
+
+// Writes the indices of the spheres touching the frustum to visibleIndices (room for spheres.size()
+// entries) and returns how many there are. [first, last) works like in composeTransforms().
+inline size_t cullSpheres(const std::array<glm::vec4, 6>& planes, const SphereSoA& spheres, uint32_t* visibleIndices, size_t first = 0, size_t last = SIZE_MAX) {
+    typedef Lanes::Type V;
+    const size_t count = std::min(last, spheres.size());
+    const size_t padded = paddedCount(count);
+    const uint32_t allLanes = (1u << Lanes::WIDTH) - 1u;
+
+    V px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++) {
+        px[p] = Lanes::set1(planes[p].x);
+        py[p] = Lanes::set1(planes[p].y);
+        pz[p] = Lanes::set1(planes[p].z);
+        pw[p] = Lanes::set1(planes[p].w);
+    }
+    const V zero = Lanes::set1(0.0f);
+
+    size_t visibleCount = 0;
+    for (size_t i = first; i < padded; i += Lanes::WIDTH) {
+        V x = Lanes::load(spheres.x() + i);
+        V y = Lanes::load(spheres.y() + i);
+        V z = Lanes::load(spheres.z() + i);
+        V r = Lanes::load(spheres.radius() + i);
+
+        uint32_t mask = allLanes;
+        for (int p = 0; p < 6 && mask != 0; p++) {
+            // dot(plane.xyz, center) + plane.w + radius >= 0
+            V distance = Lanes::madd(px[p], x, Lanes::madd(py[p], y, Lanes::madd(pz[p], z, Lanes::add(pw[p], r))));
+            mask &= Lanes::greaterEqualMask(distance, zero);
+        }
+
+        while (mask != 0) {
+            uint32_t lane = 0;
+            while ((mask & (1u << lane)) == 0) {
+                lane++;
+            }
+            mask &= mask - 1;
+
+            size_t index = i + lane;
+            if (index < count) {
+                visibleIndices[visibleCount++] = static_cast<uint32_t>(index);
+            }
+        }
+    }
+
+    return visibleCount;
+}
+
+inline const char* archName() {
+#if defined(TRANSFORMS_ARCH_AVX2)
+    return "AVX2";
+#elif defined(TRANSFORMS_ARCH_SSE2)
+    return "SSE2";
+#elif defined(TRANSFORMS_ARCH_NEON)
+    return "NEON";
+#else
+    return "pure";
+#endif
+}
+
+// Scalar glm reference, structured like glm/test/perf/perf_matrix_mul.cpp.
+inline void test_mat_mul_mat(glm::mat4 const& M, std::vector<glm::mat4> const& I, std::vector<glm::mat4>& O) {
+    for (std::size_t i = 0, n = I.size(); i < n; ++i)
+        O[i] = M * I[i];
+}
+
+inline void test_sphere_cull(std::array<glm::vec4, 6> const& Planes, std::vector<glm::vec4> const& Spheres, std::vector<uint32_t>& Visible) {
+    Visible.clear();
+    for (std::size_t i = 0, n = Spheres.size(); i < n; ++i) {
+        bool Inside = true;
+        for (std::size_t p = 0; p < 6 && Inside; ++p)
+            Inside = glm::dot(glm::vec3(Planes[p].x, Planes[p].y, Planes[p].z), glm::vec3(Spheres[i].x, Spheres[i].y, Spheres[i].z)) + Planes[p].w >= -Spheres[i].w;
+        if (Inside)
+            Visible.push_back(static_cast<uint32_t>(i));
+    }
+}
+
+// Times the scalar glm path against the SoA kernels and returns the number of mismatching results,
+// which should be zero.
+inline int benchmarkSimdTransforms(std::size_t Samples = 100000) {
+    int Error = 0;
+
+    glm::mat4 const View = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 Proj = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 10.0f);
+    Proj[1][1] *= -1;
+    glm::mat4 const ViewProj = Proj * View;
+
+    TransformSoA Transforms;
+    Transforms.resize(Samples);
+    std::vector<glm::mat4> Models(Samples);
+    for (std::size_t i = 0; i < Samples; ++i) {
+        float const t = static_cast<float>(i) / static_cast<float>(Samples);
+        glm::vec3 const Position(std::cos(t * 97.0f) * 4.0f, std::sin(t * 61.0f) * 4.0f, std::cos(t * 13.0f) * 2.0f);
+        float const Angle = t * 10.0f;
+        float const Scale = 0.5f + t;
+        Transforms.set(i, Position, glm::vec3(0.0f, 0.0f, 1.0f), Angle, Scale);
+        Transforms.setBounds(i, glm::vec3(0.0f), 0.75f);
+        Models[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), Position), Angle, glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(Scale));
+    }
+
+    std::printf("%s, %d samples:\n", archName(), static_cast<int>(Samples));
+
+    // Model matrices: glm::translate/rotate/scale vs composeTransforms.
+    std::clock_t TimeStampBegin = std::clock();
+    for (std::size_t i = 0; i < Samples; ++i) {
+        float const t = static_cast<float>(i) / static_cast<float>(Samples);
+        Models[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(Transforms.stream(TransformSoA::POSITION_X)[i], Transforms.stream(TransformSoA::POSITION_Y)[i], Transforms.stream(TransformSoA::POSITION_Z)[i])), t * 10.0f, glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(Transforms.stream(TransformSoA::SCALE)[i]));
+    }
+    std::clock_t TimeStampEnd = std::clock();
+    std::printf("\tglm compose: %d clocks\n", static_cast<int>(TimeStampEnd - TimeStampBegin));
+
+    MatrixSoA World;
+    World.resize(Samples);
+    SphereSoA Spheres;
+    Spheres.resize(Samples);
+
+    TimeStampBegin = std::clock();
+    composeTransforms(Transforms, World, &Spheres);
+    TimeStampEnd = std::clock();
+    std::printf("\tsoa compose: %d clocks\n", static_cast<int>(TimeStampEnd - TimeStampBegin));
+
+    for (std::size_t i = 0; i < Samples; ++i) {
+        glm::mat4 const Result = World.get(i);
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                Error += std::fabs(Result[c][r] - Models[i][c][r]) > 1e-4f * (1.0f + std::fabs(Models[i][c][r])) ? 1 : 0;
+    }
+
+    // mat4 * mat4: glm vs multiplyMatrices.
+    std::vector<glm::mat4> Output(Samples);
+    TimeStampBegin = std::clock();
+    test_mat_mul_mat(ViewProj, Models, Output);
+    TimeStampEnd = std::clock();
+    std::printf("\tglm mat_mul_mat: %d clocks\n", static_cast<int>(TimeStampEnd - TimeStampBegin));
+
+    MatrixSoA Clip;
+    Clip.resize(Samples);
+    TimeStampBegin = std::clock();
+    multiplyMatrices(ViewProj, World, Clip);
+    TimeStampEnd = std::clock();
+    std::printf("\tsoa mat_mul_mat: %d clocks\n", static_cast<int>(TimeStampEnd - TimeStampBegin));
+
+    for (std::size_t i = 0; i < Samples; ++i) {
+        glm::mat4 const Result = Clip.get(i);
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                Error += std::fabs(Result[c][r] - Output[i][c][r]) > 1e-3f * (1.0f + std::fabs(Output[i][c][r])) ? 1 : 0;
+    }
+
+    // Sphere/frustum: glm vs cullSpheres.
+    std::array<glm::vec4, 6> const Planes = frustumPlanes(ViewProj);
+    std::vector<glm::vec4> SphereArray(Samples);
+    for (std::size_t i = 0; i < Samples; ++i)
+        SphereArray[i] = glm::vec4(Spheres.x()[i], Spheres.y()[i], Spheres.z()[i], Spheres.radius()[i]);
+
+    std::vector<uint32_t> VisibleScalar;
+    VisibleScalar.reserve(Samples);
+    TimeStampBegin = std::clock();
+    test_sphere_cull(Planes, SphereArray, VisibleScalar);
+    TimeStampEnd = std::clock();
+    std::printf("\tglm sphere_cull: %d clocks (%d visible)\n", static_cast<int>(TimeStampEnd - TimeStampBegin), static_cast<int>(VisibleScalar.size()));
+
+    std::vector<uint32_t> VisibleSimd(Samples);
+    TimeStampBegin = std::clock();
+    std::size_t const VisibleCount = cullSpheres(Planes, Spheres, VisibleSimd.data());
+    TimeStampEnd = std::clock();
+    std::printf("\tsoa sphere_cull: %d clocks (%d visible)\n", static_cast<int>(TimeStampEnd - TimeStampBegin), static_cast<int>(VisibleCount));
+
+    Error += VisibleCount == VisibleScalar.size() ? 0 : 1;
+
+    return Error;
+}
+
+} // namespace transforms
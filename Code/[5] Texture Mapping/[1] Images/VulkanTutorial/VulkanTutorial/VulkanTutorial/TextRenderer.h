@@ -0,0 +1,683 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+// Like stb_image.h, define STB_RECT_PACK_IMPLEMENTATION and STB_TRUETYPE_IMPLEMENTATION in exactly one
+// source file before including them. stb_rect_pack.h goes first so stb_truetype.h uses it too.
+#include <stb_rect_pack.h>
+#include <stb_truetype.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// One quad of text, drawn as an instance of a 4 vertex triangle strip by text.vert.
+struct GlyphInstance {
+    glm::vec2 position;  // top left, in pixels
+    glm::vec2 size;      // in pixels
+    glm::vec2 uvMin;
+    glm::vec2 uvMax;
+    uint32_t color;      // RGBA8, red in the low byte
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(GlyphInstance);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions{};
+        attributeDescriptions[0] = {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(GlyphInstance, position)};
+        attributeDescriptions[1] = {1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(GlyphInstance, size)};
+        attributeDescriptions[2] = {2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(GlyphInstance, uvMin)};
+        attributeDescriptions[3] = {3, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(GlyphInstance, uvMax)};
+        attributeDescriptions[4] = {4, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(GlyphInstance, color)};
+        return attributeDescriptions;
+    }
+};
+
+// Push constants of text.vert and text.frag.
+struct TextPushConstants {
+    glm::vec2 screenScale;  // 2 / framebuffer size
+    uint32_t distanceField;
+    uint32_t padding;
+};
+
+struct TextStats {
+    uint32_t glyphCount = 0;     // drawn last frame
+    uint32_t cachedGlyphs = 0;
+    uint32_t droppedGlyphs = 0;  // did not fit the cache atlas
+    double cpuMilliseconds = 0.0;
+    double gpuMilliseconds = 0.0;
+};
+
+// Next code point of a UTF-8 string; malformed bytes come back as U+FFFD.
+inline uint32_t decodeUtf8(const std::string& text, size_t& i) {
+    uint8_t lead = static_cast<uint8_t>(text[i++]);
+    uint32_t length = lead < 0x80 ? 0 : lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : 4;
+    if (length == 4 || i + length > text.size()) {
+        return 0xfffd;
+    }
+
+    uint32_t codepoint = length == 0 ? lead : lead & (0x3f >> length);
+    for (uint32_t n = 0; n < length; n++) {
+        codepoint = (codepoint << 6) | (static_cast<uint8_t>(text[i++]) & 0x3f);
+    }
+    return codepoint;
+}
+
+// Screen space text for frame stats. Glyphs are rasterized by stb_truetype the first time they are
+// used, as coverage or as signed distance fields that stay sharp when scaled up, and packed into an
+// R8 cache atlas with stb_rect_pack. Every string of a frame goes into one per-frame instance buffer
+// that draw() renders with a single instanced draw call.
+//
+// Per frame: beginFrame(), addText() for every string, flush() before the render pass begins, then
+// draw() inside it.
+class TextRenderer {
+public:
+    void create(const VulkanContext& context, VkRenderPass renderPass, VkSampleCountFlagBits msaaSamples, uint32_t frameCount, const std::string& fontFile,
+        float pixelHeight, bool distanceField = false, uint32_t atlasSize = 512, uint32_t maxGlyphsPerFrame = 8192) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->distanceField = distanceField;
+        this->atlasSize = atlasSize;
+        this->maxGlyphsPerFrame = maxGlyphsPerFrame;
+
+        fontData = readFile(fontFile);
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(fontData.data());
+        if (!stbtt_InitFont(&font, data, stbtt_GetFontOffsetForIndex(data, 0))) {
+            throw std::runtime_error("failed to load font!");
+        }
+
+        fontScale = stbtt_ScaleForPixelHeight(&font, pixelHeight);
+        int ascent, descent, lineGap;
+        stbtt_GetFontVMetrics(&font, &ascent, &descent, &lineGap);
+        this->ascent = ascent * fontScale;
+        lineHeight = (ascent - descent + lineGap) * fontScale;
+
+        atlasPixels.assign(static_cast<size_t>(atlasSize) * atlasSize, 0);
+        packerNodes.resize(atlasSize);
+        stbrp_init_target(&packer, static_cast<int>(atlasSize), static_cast<int>(atlasSize), packerNodes.data(), static_cast<int>(atlasSize));
+        dirtyMin = atlasSize;
+        dirtyMax = 0;
+
+        createAtlas();
+        createDescriptorSet();
+        createPipeline(renderPass, msaaSamples);
+        createFrameResources(frameCount);
+    }
+
+    void cleanup() {
+        frames.clear();
+        timestampPool.reset();
+
+        pipeline.reset();
+        pipelineLayout.reset();
+        descriptorPool.reset();
+        descriptorSetLayout.reset();
+
+        atlasSampler.reset();
+        atlasView.reset();
+        atlasImage.reset();
+        atlasMemory.reset();
+        stagingBuffer.reset();
+        stagingBufferMemory.reset();
+    }
+
+    float getLineHeight() const { return lineHeight; }
+
+    // Call after the frame's fence was waited on; picks up the GPU time of its previous use.
+    void beginFrame(uint32_t currentFrame) {
+        this->currentFrame = currentFrame;
+
+        FrameResources& frame = frames[currentFrame];
+        if (frame.timestampsWritten) {
+            uint64_t timestamps[2];
+            if (vkGetQueryPoolResults(context.device, timestampPool, currentFrame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                stats.gpuMilliseconds = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+            }
+        }
+        frame.glyphCount = 0;
+        cpuTime = std::chrono::duration<double, std::milli>::zero();
+    }
+
+    // Adds text with the top left of its first line at position (in pixels); '\n' starts a new line.
+    // Returns where the next character would go.
+    glm::vec2 addText(const std::string& text, glm::vec2 position, uint32_t color = 0xffffffff, float scale = 1.0f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        FrameResources& frame = frames[currentFrame];
+        GlyphInstance* instances = static_cast<GlyphInstance*>(frame.instanceData);
+
+        glm::vec2 pen(position.x, position.y + ascent * scale);
+        int previousGlyph = 0;
+        for (size_t i = 0; i < text.size();) {
+            uint32_t codepoint = decodeUtf8(text, i);
+            if (codepoint == '\n') {
+                pen = glm::vec2(position.x, pen.y + lineHeight * scale);
+                previousGlyph = 0;
+                continue;
+            }
+
+            const Glyph& glyph = getGlyph(codepoint);
+            if (previousGlyph != 0) {
+                pen.x += stbtt_GetGlyphKernAdvance(&font, previousGlyph, glyph.index) * fontScale * scale;
+            }
+            previousGlyph = glyph.index;
+
+            if (glyph.cached && frame.glyphCount < maxGlyphsPerFrame) {
+                GlyphInstance& instance = instances[frame.glyphCount++];
+                instance.position = pen + glyph.offset * scale;
+                instance.size = glyph.size * scale;
+                instance.uvMin = glyph.uvMin;
+                instance.uvMax = glyph.uvMax;
+                instance.color = color;
+            }
+            pen.x += glyph.advance * scale;
+        }
+
+        cpuTime += std::chrono::high_resolution_clock::now() - start;
+        return glm::vec2(pen.x, pen.y - ascent * scale);
+    }
+
+    // One line per string, e.g. TextureStreamer::getStatsLines().
+    glm::vec2 addLines(const std::vector<std::string>& lines, glm::vec2 position, uint32_t color = 0xffffffff, float scale = 1.0f) {
+        for (const std::string& line : lines) {
+            addText(line, position, color, scale);
+            position.y += lineHeight * scale;
+        }
+        return position;
+    }
+
+    // Records the timestamp reset into the frame's command buffer, outside of any render pass, and
+    // uploads glyphs that were rasterized this frame. That upload waits for the device like the other
+    // single time commands, but only happens while the cache warms up.
+    void flush(VkCommandBuffer commandBuffer) {
+        dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, currentFrame * 2, 2);
+
+        if (dirtyMin < dirtyMax) {
+            uploadAtlasRows(dirtyMin, dirtyMax);
+            dirtyMin = atlasSize;
+            dirtyMax = 0;
+        }
+    }
+
+    void draw(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+        auto start = std::chrono::high_resolution_clock::now();
+        FrameResources& frame = frames[currentFrame];
+
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, currentFrame * 2);
+
+        if (frame.glyphCount > 0) {
+            dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+            VkViewport viewport{};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = static_cast<float>(extent.width);
+            viewport.height = static_cast<float>(extent.height);
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+            dispatch->vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+            VkRect2D scissor{};
+            scissor.offset = {0, 0};
+            scissor.extent = extent;
+            dispatch->vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+            TextPushConstants constants{};
+            constants.screenScale = glm::vec2(2.0f / extent.width, 2.0f / extent.height);
+            constants.distanceField = distanceField ? 1 : 0;
+            dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+
+            dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+            VkDeviceSize offset = 0;
+            dispatch->vkCmdBindVertexBuffers(commandBuffer, 0, 1, frame.instanceBuffer.address(), &offset);
+            dispatch->vkCmdDraw(commandBuffer, 4, frame.glyphCount, 0, 0);
+        }
+
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, currentFrame * 2 + 1);
+        frame.timestampsWritten = true;
+
+        cpuTime += std::chrono::high_resolution_clock::now() - start;
+        stats.glyphCount = frame.glyphCount;
+        stats.cpuMilliseconds = cpuTime.count();
+    }
+
+    const TextStats& getStats() const {
+        return stats;
+    }
+
+    void printStats() const {
+        std::cout << "text: " << stats.glyphCount << " glyphs, " << stats.cachedGlyphs << " cached, " << stats.droppedGlyphs << " dropped, cpu "
+            << stats.cpuMilliseconds << " ms, gpu " << stats.gpuMilliseconds << " ms" << std::endl;
+    }
+
+private:
+    struct Glyph {
+        int index = 0;
+        bool cached = false;   // false for blank glyphs and ones the atlas had no room for
+        glm::vec2 offset;      // from the pen position on the baseline to the top left of the quad
+        glm::vec2 size;
+        glm::vec2 uvMin;
+        glm::vec2 uvMax;
+        float advance = 0.0f;
+    };
+
+    struct FrameResources {
+        UniqueDeviceMemory instanceBufferMemory;
+        UniqueBuffer instanceBuffer;
+        void* instanceData = nullptr;
+        uint32_t glyphCount = 0;
+        bool timestampsWritten = false;
+    };
+
+    // Texels of distance around distance field glyphs; the field covers 128 / SDF_PADDING values per texel.
+    static const int SDF_PADDING = 4;
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    bool distanceField = false;
+    uint32_t atlasSize = 0;
+    uint32_t maxGlyphsPerFrame = 0;
+
+    std::vector<char> fontData;
+    stbtt_fontinfo font;
+    float fontScale = 0.0f;
+    float ascent = 0.0f;
+    float lineHeight = 0.0f;
+
+    std::unordered_map<uint32_t, Glyph> glyphs;
+    stbrp_context packer;
+    std::vector<stbrp_node> packerNodes;
+    std::vector<uint8_t> atlasPixels;
+    uint32_t dirtyMin = 0;
+    uint32_t dirtyMax = 0;
+
+    UniqueDeviceMemory atlasMemory;
+    UniqueImage atlasImage;
+    bool atlasInitialized = false;
+    UniqueImageView atlasView;
+    UniqueSampler atlasSampler;
+    UniqueDeviceMemory stagingBufferMemory;
+    UniqueBuffer stagingBuffer;
+
+    UniqueDescriptorSetLayout descriptorSetLayout;
+    UniqueDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    UniquePipelineLayout pipelineLayout;
+    UniquePipeline pipeline;
+
+    std::vector<FrameResources> frames;
+    uint32_t currentFrame = 0;
+
+    UniqueQueryPool timestampPool;
+    float timestampPeriod = 1.0f;
+    std::chrono::duration<double, std::milli> cpuTime{0};
+    TextStats stats;
+
+    const Glyph& getGlyph(uint32_t codepoint) {
+        auto it = glyphs.find(codepoint);
+        if (it != glyphs.end()) {
+            return it->second;
+        }
+
+        Glyph& glyph = glyphs[codepoint];
+        glyph.index = stbtt_FindGlyphIndex(&font, static_cast<int>(codepoint));
+        int advance, leftSideBearing;
+        stbtt_GetGlyphHMetrics(&font, glyph.index, &advance, &leftSideBearing);
+        glyph.advance = advance * fontScale;
+
+        int width = 0, height = 0, xOffset = 0, yOffset = 0;
+        std::vector<uint8_t> bitmap;
+        if (distanceField) {
+            unsigned char* sdf = stbtt_GetGlyphSDF(&font, fontScale, glyph.index, SDF_PADDING, 128, 128.0f / SDF_PADDING, &width, &height, &xOffset, &yOffset);
+            if (sdf != nullptr) {
+                bitmap.assign(sdf, sdf + static_cast<size_t>(width) * height);
+                stbtt_FreeSDF(sdf, nullptr);
+            }
+        } else {
+            int x1, y1;
+            stbtt_GetGlyphBitmapBox(&font, glyph.index, fontScale, fontScale, &xOffset, &yOffset, &x1, &y1);
+            width = x1 - xOffset;
+            height = y1 - yOffset;
+            if (width > 0 && height > 0) {
+                bitmap.resize(static_cast<size_t>(width) * height);
+                stbtt_MakeGlyphBitmap(&font, bitmap.data(), width, height, width, fontScale, fontScale, glyph.index);
+            }
+        }
+
+        if (bitmap.empty()) {
+            return glyph;
+        }
+
+        // One texel of spacing keeps bilinear filtering from picking up the neighbouring glyph.
+        stbrp_rect rect{};
+        rect.w = static_cast<stbrp_coord>(width + 1);
+        rect.h = static_cast<stbrp_coord>(height + 1);
+        stbrp_pack_rects(&packer, &rect, 1);
+        if (!rect.was_packed) {
+            stats.droppedGlyphs++;
+            return glyph;
+        }
+
+        uint32_t x = static_cast<uint32_t>(rect.x);
+        uint32_t y = static_cast<uint32_t>(rect.y);
+        for (int row = 0; row < height; row++) {
+            memcpy(&atlasPixels[(static_cast<size_t>(y) + row) * atlasSize + x], &bitmap[static_cast<size_t>(row) * width], width);
+        }
+        dirtyMin = std::min(dirtyMin, y);
+        dirtyMax = std::max(dirtyMax, y + height);
+
+        glyph.cached = true;
+        glyph.offset = glm::vec2(static_cast<float>(xOffset), static_cast<float>(yOffset));
+        glyph.size = glm::vec2(static_cast<float>(width), static_cast<float>(height));
+        glyph.uvMin = glm::vec2(x, y) / static_cast<float>(atlasSize);
+        glyph.uvMax = glm::vec2(x + width, y + height) / static_cast<float>(atlasSize);
+        stats.cachedGlyphs++;
+        return glyph;
+    }
+
+    void createAtlas() {
+        createImage(context, atlasSize, atlasSize, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, atlasImage, atlasMemory);
+        atlasView = createUniqueImageView(context.device, atlasImage, VK_FORMAT_R8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        createBuffer(context, atlasPixels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.anisotropyEnable = VK_FALSE;
+        samplerInfo.maxAnisotropy = 1.0f;
+        samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+        samplerInfo.compareEnable = VK_FALSE;
+        samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = 0.0f;
+
+        if (vkCreateSampler(context.device, &samplerInfo, nullptr, atlasSampler.put(context.device)) != VK_SUCCESS) {
+            atlasSampler.release();
+            throw std::runtime_error("failed to create glyph atlas sampler!");
+        }
+
+        // Upload the empty atlas once so it is in a readable layout before any glyph exists.
+        uploadAtlasRows(0, atlasSize);
+    }
+
+    void uploadAtlasRows(uint32_t firstRow, uint32_t endRow) {
+        VkDeviceSize offset = static_cast<VkDeviceSize>(firstRow) * atlasSize;
+        VkDeviceSize size = static_cast<VkDeviceSize>(endRow - firstRow) * atlasSize;
+
+        void* data;
+        vkMapMemory(context.device, stagingBufferMemory, offset, size, 0, &data);
+        memcpy(data, atlasPixels.data() + offset, static_cast<size_t>(size));
+        vkUnmapMemory(context.device, stagingBufferMemory);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = atlasImage;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        // Rows outside the upload have to survive the transition, so only the first upload may discard.
+        if (atlasInitialized) {
+            barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        }
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {0, static_cast<int32_t>(firstRow), 0};
+        region.imageExtent = {atlasSize, endRow - firstRow, 1};
+        dispatch->vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, atlasImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        endSingleTimeCommands(context, commandBuffer);
+        atlasInitialized = true;
+    }
+
+    void createDescriptorSet() {
+        VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+        samplerLayoutBinding.binding = 0;
+        samplerLayoutBinding.descriptorCount = 1;
+        samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        samplerLayoutBinding.pImmutableSamplers = nullptr;
+        samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &samplerLayoutBinding;
+
+        if (vkCreateDescriptorSetLayout(context.device, &layoutInfo, nullptr, descriptorSetLayout.put(context.device)) != VK_SUCCESS) {
+            descriptorSetLayout.release();
+            throw std::runtime_error("failed to create text descriptor set layout!");
+        }
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSize.descriptorCount = 1;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = 1;
+
+        if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, descriptorPool.put(context.device)) != VK_SUCCESS) {
+            descriptorPool.release();
+            throw std::runtime_error("failed to create text descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = descriptorSetLayout.address();
+
+        if (vkAllocateDescriptorSets(context.device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate text descriptor set!");
+        }
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = atlasView;
+        imageInfo.sampler = atlasSampler;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
+
+        vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    void createPipeline(VkRenderPass renderPass, VkSampleCountFlagBits msaaSamples) {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(TextPushConstants);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = descriptorSetLayout.address();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(context.device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(context.device)) != VK_SUCCESS) {
+            pipelineLayout.release();
+            throw std::runtime_error("failed to create text pipeline layout!");
+        }
+
+        UniqueShaderModule vertShaderModule = createUniqueShaderModule(context.device, readFile("res/shaders/text_vert.spv"));
+        UniqueShaderModule fragShaderModule = createUniqueShaderModule(context.device, readFile("res/shaders/text_frag.spv"));
+
+        VkPipelineShaderStageCreateInfo shaderStages[2]{};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertShaderModule;
+        shaderStages[0].pName = "main";
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragShaderModule;
+        shaderStages[1].pName = "main";
+
+        auto bindingDescription = GlyphInstance::getBindingDescription();
+        auto attributeDescriptions = GlyphInstance::getAttributeDescriptions();
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        // Viewport and scissor are dynamic so the pipeline survives swap chain recreation.
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = msaaSamples;
+
+        // Text goes on top of everything, whether or not the render pass has a depth buffer.
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_FALSE;
+        depthStencil.depthWriteEnable = VK_FALSE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        if (vkCreateGraphicsPipelines(context.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, pipeline.put(context.device)) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create text pipeline!");
+        }
+    }
+
+    void createFrameResources(uint32_t frameCount) {
+        VkDeviceSize bufferSize = sizeof(GlyphInstance) * maxGlyphsPerFrame;
+        frames.resize(frameCount);
+        for (FrameResources& frame : frames) {
+            createBuffer(context, bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                frame.instanceBuffer, frame.instanceBufferMemory);
+            vkMapMemory(context.device, frame.instanceBufferMemory, 0, bufferSize, 0, &frame.instanceData);
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo timestampInfo{};
+        timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount = frameCount * 2;
+
+        if (vkCreateQueryPool(context.device, &timestampInfo, nullptr, timestampPool.put(context.device)) != VK_SUCCESS) {
+            timestampPool.release();
+            throw std::runtime_error("failed to create text timestamp query pool!");
+        }
+    }
+};
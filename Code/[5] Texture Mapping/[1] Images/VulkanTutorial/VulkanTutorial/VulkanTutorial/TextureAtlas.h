@@ -0,0 +1,371 @@
+#pragma once
+
+#include "Bindless.h"
+#include "DeviceDispatch.h"
+#include "TextureStreaming.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+// Like stb_image.h, define STB_RECT_PACK_IMPLEMENTATION in exactly one source file before including it.
+#include <stb_rect_pack.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+const uint32_t TEXTURE_ATLAS_MAGIC = 0x534c5441; // "ATLS"
+const uint32_t TEXTURE_ATLAS_VERSION = 1;
+
+struct AtlasImage {
+    const uint8_t* pixels;  // RGBA8
+    uint32_t width;
+    uint32_t height;
+};
+
+struct TextureAtlasOptions {
+    uint32_t pageSize = 2048;
+    // Texels of edge colour around every image that survive down to the last mip.
+    uint32_t padding = 2;
+    // Mips that stay free of bleeding from neighbouring images; the pages have this many levels.
+    // Images are placed on a 2^(mipLevels - 1) grid so that every mip box filters whole images only.
+    uint32_t mipLevels = 4;
+};
+
+struct AtlasRegion {
+    uint32_t page;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    glm::vec2 uvOffset;
+    glm::vec2 uvScale;
+};
+
+struct TextureAtlas {
+    TextureAtlasOptions options;
+    std::vector<std::vector<uint8_t>> pages;  // RGBA8, pageSize x pageSize, mip 0 only
+    std::vector<AtlasRegion> regions;         // in the order of the images
+};
+
+inline uint32_t atlasAlignment(const TextureAtlasOptions& options) {
+    return 1u << (options.mipLevels - 1);
+}
+
+inline uint32_t atlasGutter(const TextureAtlasOptions& options) {
+    return options.padding << (options.mipLevels - 1);
+}
+
+inline void updateAtlasRegionUVs(AtlasRegion& region, uint32_t pageSize) {
+    float size = static_cast<float>(pageSize);
+    region.uvOffset = glm::vec2(region.x / size, region.y / size);
+    region.uvScale = glm::vec2(region.width / size, region.height / size);
+}
+
+// Copies image into the page at (x, y) and repeats its edge texels across the gutter around it.
+inline void blitAtlasImage(std::vector<uint8_t>& page, uint32_t pageSize, const AtlasImage& image, uint32_t x, uint32_t y, uint32_t gutter) {
+    for (uint32_t row = 0; row < image.height + 2 * gutter; row++) {
+        uint32_t sourceRow = std::min(row > gutter ? row - gutter : 0, image.height - 1);
+        for (uint32_t column = 0; column < image.width + 2 * gutter; column++) {
+            uint32_t sourceColumn = std::min(column > gutter ? column - gutter : 0, image.width - 1);
+            memcpy(&page[((static_cast<size_t>(y) + row - gutter) * pageSize + x + column - gutter) * 4],
+                &image.pixels[(static_cast<size_t>(sourceRow) * image.width + sourceColumn) * 4], 4);
+        }
+    }
+}
+
+// Packs images into as many pages as needed with stb_rect_pack. Images should be small compared to
+// the page; one that does not fit an empty page throws.
+inline TextureAtlas buildTextureAtlas(const std::vector<AtlasImage>& images, const TextureAtlasOptions& options = TextureAtlasOptions{}) {
+    if (options.mipLevels == 0 || options.pageSize % atlasAlignment(options) != 0) {
+        throw std::runtime_error("invalid texture atlas options!");
+    }
+
+    TextureAtlas atlas;
+    atlas.options = options;
+    atlas.regions.resize(images.size());
+
+    uint32_t alignment = atlasAlignment(options);
+    uint32_t gutter = atlasGutter(options);
+    // Packing in units of the alignment keeps every block on the mip grid.
+    int pageUnits = static_cast<int>(options.pageSize / alignment);
+
+    std::vector<stbrp_rect> remaining(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        remaining[i] = {};
+        remaining[i].id = static_cast<int>(i);
+        remaining[i].w = static_cast<stbrp_coord>((images[i].width + 2 * gutter + alignment - 1) / alignment);
+        remaining[i].h = static_cast<stbrp_coord>((images[i].height + 2 * gutter + alignment - 1) / alignment);
+    }
+
+    std::vector<stbrp_node> nodes(pageUnits);
+    while (!remaining.empty()) {
+        stbrp_context packer;
+        stbrp_init_target(&packer, pageUnits, pageUnits, nodes.data(), pageUnits);
+        stbrp_pack_rects(&packer, remaining.data(), static_cast<int>(remaining.size()));
+
+        uint32_t page = static_cast<uint32_t>(atlas.pages.size());
+        atlas.pages.emplace_back(static_cast<size_t>(options.pageSize) * options.pageSize * 4, 0);
+
+        std::vector<stbrp_rect> unpacked;
+        for (const stbrp_rect& rect : remaining) {
+            if (!rect.was_packed) {
+                unpacked.push_back(rect);
+                continue;
+            }
+
+            const AtlasImage& image = images[rect.id];
+            AtlasRegion& region = atlas.regions[rect.id];
+            region.page = page;
+            region.x = static_cast<uint32_t>(rect.x) * alignment + gutter;
+            region.y = static_cast<uint32_t>(rect.y) * alignment + gutter;
+            region.width = image.width;
+            region.height = image.height;
+            updateAtlasRegionUVs(region, options.pageSize);
+
+            blitAtlasImage(atlas.pages[page], options.pageSize, image, region.x, region.y, gutter);
+        }
+
+        if (unpacked.size() == remaining.size()) {
+            throw std::runtime_error("image is too large for the texture atlas!");
+        }
+        remaining = unpacked;
+    }
+
+    return atlas;
+}
+
+// Moves texture coordinates of a mesh that sampled its own image into the image's atlas region.
+// Atlased images can't repeat, so coordinates outside [0, 1] are clamped; returns how many were.
+inline uint32_t remapTexCoords(void* vertices, size_t vertexCount, size_t vertexStride, size_t texCoordOffset, const AtlasRegion& region) {
+    uint32_t clamped = 0;
+    for (size_t i = 0; i < vertexCount; i++) {
+        glm::vec2* texCoord = reinterpret_cast<glm::vec2*>(static_cast<char*>(vertices) + i * vertexStride + texCoordOffset);
+        glm::vec2 uv = glm::clamp(*texCoord, 0.0f, 1.0f);
+        if (uv != *texCoord) {
+            clamped++;
+        }
+        *texCoord = region.uvOffset + uv * region.uvScale;
+    }
+    return clamped;
+}
+
+struct TextureAtlasFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t padding;
+    uint32_t mipLevels;
+    uint32_t pageCount;
+    uint32_t regionCount;
+    uint32_t reserved;
+};
+
+struct TextureAtlasFileRegion {
+    uint32_t page;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Offline path: the header, the regions, then mip 0 of every page. Mips are generated at load.
+inline void writeTextureAtlasFile(const std::string& filename, const TextureAtlas& atlas) {
+    TextureAtlasFileHeader header{};
+    header.magic = TEXTURE_ATLAS_MAGIC;
+    header.version = TEXTURE_ATLAS_VERSION;
+    header.pageSize = atlas.options.pageSize;
+    header.padding = atlas.options.padding;
+    header.mipLevels = atlas.options.mipLevels;
+    header.pageCount = static_cast<uint32_t>(atlas.pages.size());
+    header.regionCount = static_cast<uint32_t>(atlas.regions.size());
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const AtlasRegion& region : atlas.regions) {
+        TextureAtlasFileRegion fileRegion{region.page, region.x, region.y, region.width, region.height};
+        file.write(reinterpret_cast<const char*>(&fileRegion), sizeof(fileRegion));
+    }
+    for (const std::vector<uint8_t>& page : atlas.pages) {
+        file.write(reinterpret_cast<const char*>(page.data()), static_cast<std::streamsize>(page.size()));
+    }
+
+    if (!file) {
+        throw std::runtime_error("failed to write texture atlas file!");
+    }
+}
+
+inline TextureAtlas loadTextureAtlasFile(const std::string& filename) {
+    std::vector<char> data = readFile(filename);
+    if (data.size() < sizeof(TextureAtlasFileHeader)) {
+        throw std::runtime_error("invalid texture atlas file!");
+    }
+
+    TextureAtlasFileHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != TEXTURE_ATLAS_MAGIC || header.version != TEXTURE_ATLAS_VERSION || header.mipLevels == 0 || header.mipLevels > 16) {
+        throw std::runtime_error("invalid texture atlas file!");
+    }
+
+    size_t pageBytes = static_cast<size_t>(header.pageSize) * header.pageSize * 4;
+    size_t regionsOffset = sizeof(header);
+    size_t pagesOffset = regionsOffset + static_cast<size_t>(header.regionCount) * sizeof(TextureAtlasFileRegion);
+    if (pagesOffset + pageBytes * header.pageCount != data.size()) {
+        throw std::runtime_error("texture atlas file is truncated!");
+    }
+
+    TextureAtlas atlas;
+    atlas.options.pageSize = header.pageSize;
+    atlas.options.padding = header.padding;
+    atlas.options.mipLevels = header.mipLevels;
+
+    atlas.regions.resize(header.regionCount);
+    for (uint32_t i = 0; i < header.regionCount; i++) {
+        TextureAtlasFileRegion fileRegion;
+        memcpy(&fileRegion, data.data() + regionsOffset + i * sizeof(fileRegion), sizeof(fileRegion));
+        if (fileRegion.page >= header.pageCount) {
+            throw std::runtime_error("invalid texture atlas file!");
+        }
+
+        AtlasRegion& region = atlas.regions[i];
+        region.page = fileRegion.page;
+        region.x = fileRegion.x;
+        region.y = fileRegion.y;
+        region.width = fileRegion.width;
+        region.height = fileRegion.height;
+        updateAtlasRegionUVs(region, header.pageSize);
+    }
+
+    atlas.pages.resize(header.pageCount);
+    for (uint32_t i = 0; i < header.pageCount; i++) {
+        const uint8_t* page = reinterpret_cast<const uint8_t*>(data.data() + pagesOffset + i * pageBytes);
+        atlas.pages[i].assign(page, page + pageBytes);
+    }
+
+    return atlas;
+}
+
+// GPU side of a TextureAtlas: one mipmapped image per page, each registered once in the bindless
+// texture array, so every atlased image shares the page's descriptor.
+class AtlasTextures {
+public:
+    void create(const VulkanContext& context, const TextureAtlas& atlas, BindlessDescriptors& descriptors, VkSampler sampler) {
+        this->context = context;
+        this->descriptors = &descriptors;
+        imageCount = static_cast<uint32_t>(atlas.regions.size());
+        const VulkanDeviceTable* dispatch = &getDeviceTable(context.device);
+
+        uint32_t size = atlas.options.pageSize;
+        uint32_t mipLevels = std::min(atlas.options.mipLevels, mipLevelCount(size, size));
+        VkDeviceSize pageBytes = mipChainSize(size, size, 0, mipLevels);
+
+        UniqueDeviceMemory stagingBufferMemory;
+        UniqueBuffer stagingBuffer;
+        createBuffer(context, pageBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        for (const std::vector<uint8_t>& pixels : atlas.pages) {
+            Page page;
+            createImage(context, size, size, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, page.image, page.memory);
+
+            // The gutters keep the box filter inside each image for the first mipLevels levels.
+            TextureMipChain chain = generateMipChain(pixels.data(), size, size);
+            std::vector<VkBufferImageCopy> regions;
+            void* data;
+            vkMapMemory(context.device, stagingBufferMemory, 0, pageBytes, 0, &data);
+            VkDeviceSize offset = 0;
+            for (uint32_t level = 0; level < mipLevels; level++) {
+                memcpy(static_cast<char*>(data) + offset, chain.levels[level].data(), chain.levels[level].size());
+
+                VkBufferImageCopy region{};
+                region.bufferOffset = offset;
+                region.bufferRowLength = 0;
+                region.bufferImageHeight = 0;
+                region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+                region.imageOffset = {0, 0, 0};
+                region.imageExtent = {mipWidth(size, level), mipWidth(size, level), 1};
+                regions.push_back(region);
+
+                offset += chain.levels[level].size();
+            }
+            vkUnmapMemory(context.device, stagingBufferMemory);
+
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = page.image;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = mipLevels;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = 1;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            dispatch->vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, page.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+            endSingleTimeCommands(context, commandBuffer);
+
+            page.view = createUniqueImageView(context.device, page.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels);
+            page.slot = descriptors.addTexture(page.view, sampler);
+            pages.push_back(std::move(page));
+        }
+    }
+
+    void cleanup() {
+        for (Page& page : pages) {
+            descriptors->removeTexture(page.slot);
+        }
+        pages.clear();
+    }
+
+    // Bindless slot to put in the material of a mesh whose UVs went through remapTexCoords().
+    uint32_t getDescriptorSlot(const AtlasRegion& region) const {
+        return pages[region.page].slot;
+    }
+
+    void printStats(const TextureAtlas& atlas) const {
+        uint64_t usedTexels = 0;
+        for (const AtlasRegion& region : atlas.regions) {
+            usedTexels += static_cast<uint64_t>(region.width) * region.height;
+        }
+        uint64_t pageTexels = static_cast<uint64_t>(atlas.options.pageSize) * atlas.options.pageSize * pages.size();
+
+        std::cout << "texture atlas: " << imageCount << " images in " << pages.size() << " pages of " << atlas.options.pageSize << "x" << atlas.options.pageSize
+            << ", " << (pageTexels ? usedTexels * 100 / pageTexels : 0) << "% occupied, descriptors and image binds " << imageCount << " -> " << pages.size() << std::endl;
+    }
+
+private:
+    struct Page {
+        UniqueDeviceMemory memory;
+        UniqueImage image;
+        UniqueImageView view;
+        uint32_t slot = 0;
+    };
+
+    VulkanContext context;
+    BindlessDescriptors* descriptors = nullptr;
+    uint32_t imageCount = 0;
+    std::vector<Page> pages;
+};
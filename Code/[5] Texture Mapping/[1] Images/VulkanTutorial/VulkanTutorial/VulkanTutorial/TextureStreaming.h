@@ -0,0 +1,633 @@
+#pragma once
+
+#include "Bindless.h"
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Mips whose larger side is at most this many texels form the mip tail, which is uploaded when a
+// texture is added and never evicted.
+const uint32_t STREAMING_MIP_TAIL_SIZE = 64;
+
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+inline uint32_t mipWidth(uint32_t width, uint32_t level) {
+    return std::max(1u, width >> level);
+}
+
+// Bytes of RGBA8 levels [firstMip, mipLevels).
+inline VkDeviceSize mipChainSize(uint32_t width, uint32_t height, uint32_t firstMip, uint32_t mipLevels) {
+    VkDeviceSize size = 0;
+    for (uint32_t level = firstMip; level < mipLevels; level++) {
+        size += static_cast<VkDeviceSize>(mipWidth(width, level)) * mipWidth(height, level) * 4;
+    }
+    return size;
+}
+
+// CPU copy of every RGBA8 mip of a texture, which the streamer uploads levels from.
+struct TextureMipChain {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<std::vector<uint8_t>> levels;
+};
+
+// Box filters pixels down to 1x1.
+inline TextureMipChain generateMipChain(const uint8_t* pixels, uint32_t width, uint32_t height) {
+    TextureMipChain chain;
+    chain.width = width;
+    chain.height = height;
+
+    uint32_t mipLevels = mipLevelCount(width, height);
+    chain.levels.resize(mipLevels);
+    chain.levels[0].assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+
+    for (uint32_t level = 1; level < mipLevels; level++) {
+        uint32_t srcWidth = mipWidth(width, level - 1);
+        uint32_t srcHeight = mipWidth(height, level - 1);
+        uint32_t dstWidth = mipWidth(width, level);
+        uint32_t dstHeight = mipWidth(height, level);
+        const std::vector<uint8_t>& src = chain.levels[level - 1];
+        std::vector<uint8_t>& dst = chain.levels[level];
+        dst.resize(static_cast<size_t>(dstWidth) * dstHeight * 4);
+
+        for (uint32_t y = 0; y < dstHeight; y++) {
+            for (uint32_t x = 0; x < dstWidth; x++) {
+                uint32_t x0 = std::min(x * 2, srcWidth - 1);
+                uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+                uint32_t y0 = std::min(y * 2, srcHeight - 1);
+                uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+                for (uint32_t c = 0; c < 4; c++) {
+                    uint32_t sum = src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c]
+                        + src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+                    dst[(y * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    return chain;
+}
+
+// Diameter in pixels of a bounding sphere (xyz center, w radius) on screen. projScale is proj[1][1].
+inline float projectedSphereSize(const glm::vec4& sphere, const glm::mat4& view, float projScale, float viewportHeight) {
+    glm::vec4 center = view * glm::vec4(sphere.x, sphere.y, sphere.z, 1.0f);
+    float distance = std::max(-center.z, sphere.w);
+    return sphere.w / distance * projScale * viewportHeight;
+}
+
+// The finest mip a texture covering screenSize pixels needs, assuming it is mapped across the object
+// once.
+inline uint32_t mipForScreenSize(uint32_t width, uint32_t height, float screenSize) {
+    float texelsPerPixel = static_cast<float>(std::max(width, height)) / std::max(screenSize, 1.0f);
+    uint32_t mip = texelsPerPixel > 1.0f ? static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel))) : 0;
+    return std::min(mip, mipLevelCount(width, height) - 1);
+}
+
+struct MemoryBudget {
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+    bool fromExtension = false;
+};
+
+// Budget of the largest device local heap. With VK_EXT_memory_budget (which has to be enabled in
+// createLogicalDevice()) that is what the driver grants this process; without it, the heap size.
+// Check for the extension once with hasDeviceExtension(), not every time the budget is read.
+inline MemoryBudget queryDeviceLocalBudget(VkPhysicalDevice physicalDevice, bool hasBudget) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 memoryProperties{};
+    memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    memoryProperties.pNext = hasBudget ? &budgetProperties : nullptr;
+    vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+
+    MemoryBudget result;
+    result.fromExtension = hasBudget;
+    const VkPhysicalDeviceMemoryProperties& properties = memoryProperties.memoryProperties;
+    for (uint32_t i = 0; i < properties.memoryHeapCount; i++) {
+        if ((properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0) {
+            continue;
+        }
+
+        VkDeviceSize budget = hasBudget ? budgetProperties.heapBudget[i] : properties.memoryHeaps[i].size;
+        if (budget > result.budget) {
+            result.budget = budget;
+            result.usage = hasBudget ? budgetProperties.heapUsage[i] : 0;
+        }
+    }
+    return result;
+}
+
+struct TextureStreamingStats {
+    uint32_t textureCount = 0;
+    VkDeviceSize residentBytes = 0;
+    VkDeviceSize requestedBytes = 0;  // what the textures used this frame ask for
+    VkDeviceSize budgetBytes = 0;
+    VkDeviceSize uploadedBytes = 0;   // this frame
+    VkDeviceSize evictedBytes = 0;    // this frame
+    uint32_t pendingTextures = 0;     // textures below their requested mip
+    bool budgetFromExtension = false;
+};
+
+// Streams the mips of RGBA8 textures in and out of device memory. Textures start with only their mip
+// tail resident. Every frame the renderer reports how large each texture appears on screen with
+// requestScreenSize(), and update() moves textures one mip closer to what they need, evicting the
+// top mips of the least recently used textures when the VRAM budget runs out.
+//
+// A texture's image always holds exactly its resident mips, so changing residency recreates the image
+// and copies the levels it keeps; an upgrade takes as many mips at once as the frame's upload limit
+// allows, so it costs one new image rather than one per mip. The image view then starts at the finest
+// resident mip and sampling needs no changes.
+//
+// The copies are recorded into the frame's command buffer ahead of anything that samples the texture.
+// BindlessDescriptors has one set per frame in flight, and a set is only written once its frame's fence
+// has been waited on: the texture's slot in the current frame's set points at the new image right away,
+// and in each other set when update() next runs for that frame, so frames still in flight keep sampling
+// the old image through their own set. The slot number never changes, so materials need no update. The
+// old image is released framesInFlight frames after the last set has switched, the staging buffers
+// framesInFlight frames after the copies. A texture takes no further residency change until every set
+// points at its new image.
+class TextureStreamer {
+public:
+    // budgetBytes of 0 uses budgetFraction of the device local budget, refreshed every update().
+    void create(const VulkanContext& context, BindlessDescriptors& descriptors, VkSampler sampler, uint32_t framesInFlight, VkDeviceSize budgetBytes = 0,
+        float budgetFraction = 0.5f, VkDeviceSize maxUploadBytesPerFrame = 16 * 1024 * 1024) {
+        if (descriptors.getFrameCount() != framesInFlight) {
+            throw std::runtime_error("texture streaming needs one bindless descriptor set per frame in flight!");
+        }
+
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->descriptors = &descriptors;
+        this->sampler = sampler;
+        this->framesInFlight = framesInFlight;
+        this->fixedBudget = budgetBytes;
+        this->budgetFraction = budgetFraction;
+        this->maxUploadBytesPerFrame = maxUploadBytesPerFrame;
+        hasBudgetExtension = hasDeviceExtension(context.physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        frameNumber = 0;
+        refreshBudget();
+    }
+
+    // After vkDeviceWaitIdle().
+    void cleanup() {
+        for (StreamedTexture& texture : textures) {
+            descriptors->removeTexture(texture.slot);
+        }
+        textures.clear();
+        retiredObjects.clear();
+    }
+
+    // Returns the texture id; getDescriptorSlot() gives the slot materials refer to.
+    uint32_t addTexture(const uint8_t* pixels, uint32_t width, uint32_t height) {
+        StreamedTexture texture;
+        texture.source = generateMipChain(pixels, width, height);
+        texture.mipLevels = static_cast<uint32_t>(texture.source.levels.size());
+        texture.tailMip = 0;
+        while (texture.tailMip + 1 < texture.mipLevels && std::max(mipWidth(width, texture.tailMip), mipWidth(height, texture.tailMip)) > STREAMING_MIP_TAIL_SIZE) {
+            texture.tailMip++;
+        }
+        texture.residentMip = texture.mipLevels;
+        texture.wantedMip = texture.tailMip;
+        texture.requestedMip = texture.tailMip;
+
+        textures.push_back(std::move(texture));
+        StreamedTexture& added = textures.back();
+
+        // Textures are added while loading, so the mip tail goes through the single time command
+        // helpers; with no old image there is nothing for frames in flight to keep sampling.
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        {
+            Retired staging{};
+            recordResidencyChange(commandBuffer, added, added.tailMip, staging);
+            endSingleTimeCommands(context, commandBuffer);
+        }
+
+        added.slot = descriptors->addTexture(added.view, sampler);
+        return static_cast<uint32_t>(textures.size() - 1);
+    }
+
+    uint32_t getDescriptorSlot(uint32_t id) const {
+        return textures[id].slot;
+    }
+
+    // May be called any number of times per frame; the finest request wins.
+    void requestMip(uint32_t id, uint32_t mip) {
+        StreamedTexture& texture = textures[id];
+        if (texture.lastUsedFrame != frameNumber) {
+            texture.lastUsedFrame = frameNumber;
+            texture.requestedMip = texture.tailMip;
+        }
+        texture.requestedMip = std::min(texture.requestedMip, mip);
+    }
+
+    void requestScreenSize(uint32_t id, float screenSize) {
+        const StreamedTexture& texture = textures[id];
+        requestMip(id, mipForScreenSize(texture.source.width, texture.source.height, screenSize));
+    }
+
+    // Once per frame, after waiting for the frame's fence, into its command buffer outside a render
+    // pass and before anything that samples the textures. The frame's draws have to bind the
+    // BindlessDescriptors set of currentFrame.
+    void update(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        stats.uploadedBytes = 0;
+        stats.evictedBytes = 0;
+        if (fixedBudget == 0) {
+            refreshBudget();
+        }
+        switchDescriptors(currentFrame);
+        destroyRetiredObjects();
+
+        for (StreamedTexture& texture : textures) {
+            if (texture.lastUsedFrame == frameNumber) {
+                texture.wantedMip = texture.requestedMip;
+            }
+        }
+
+        std::vector<uint32_t> targets(textures.size());
+        VkDeviceSize residentBytes = 0;
+        for (size_t i = 0; i < textures.size(); i++) {
+            targets[i] = textures[i].residentMip;
+            residentBytes += residentSize(textures[i], textures[i].residentMip);
+        }
+
+        // Upgrades in order of recency, then of how far the texture is from what it wants, one mip per
+        // texture per round until the upload limit is reached. A texture whose next mip does not fit
+        // the budget drops out for this frame. Textures that were not requested this frame keep what
+        // they have, so an eviction is not undone as soon as the budget has room again.
+        std::vector<uint32_t> upgrades;
+        for (uint32_t i = 0; i < textures.size(); i++) {
+            if (textures[i].wantedMip < textures[i].residentMip && textures[i].lastUsedFrame == frameNumber && textures[i].staleFrames == 0) {
+                upgrades.push_back(i);
+            }
+        }
+        std::sort(upgrades.begin(), upgrades.end(), [this](uint32_t a, uint32_t b) {
+            if (textures[a].lastUsedFrame != textures[b].lastUsedFrame) {
+                return textures[a].lastUsedFrame > textures[b].lastUsedFrame;
+            }
+            return textures[a].residentMip - textures[a].wantedMip > textures[b].residentMip - textures[b].wantedMip;
+        });
+
+        VkDeviceSize uploadBytes = 0;
+        std::vector<bool> blocked(textures.size(), false);
+        bool progress = true;
+        bool full = false;
+        while (progress && !full) {
+            progress = false;
+            for (uint32_t id : upgrades) {
+                StreamedTexture& texture = textures[id];
+                if (targets[id] <= texture.wantedMip || blocked[id]) {
+                    continue;
+                }
+
+                uint32_t mip = targets[id] - 1;
+                VkDeviceSize levelBytes = mipChainSize(texture.source.width, texture.source.height, mip, mip + 1);
+                if (uploadBytes + levelBytes > maxUploadBytesPerFrame && uploadBytes > 0) {
+                    full = true;
+                    break;
+                }
+
+                while (residentBytes + levelBytes > stats.budgetBytes) {
+                    VkDeviceSize freed = evictLeastRecentlyUsed(texture.lastUsedFrame, id, targets);
+                    if (freed == 0) {
+                        break;
+                    }
+                    residentBytes -= freed;
+                    stats.evictedBytes += freed;
+                }
+                if (residentBytes + levelBytes > stats.budgetBytes) {
+                    blocked[id] = true;
+                    continue;
+                }
+
+                targets[id] = mip;
+                residentBytes += levelBytes;
+                uploadBytes += levelBytes;
+                progress = true;
+            }
+        }
+        stats.uploadedBytes = uploadBytes;
+
+        applyTargets(commandBuffer, currentFrame, targets);
+        updateStats();
+        frameNumber++;
+    }
+
+    void setBudget(VkDeviceSize budgetBytes) {
+        fixedBudget = budgetBytes;
+        refreshBudget();
+    }
+
+    const TextureStreamingStats& getStats() const {
+        return stats;
+    }
+
+    // Lines for a stats overlay, or the console.
+    std::vector<std::string> getStatsLines() const {
+        std::vector<std::string> lines;
+        std::ostringstream line;
+        line << "textures: " << stats.textureCount << " (" << stats.pendingTextures << " streaming)";
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "resident: " << stats.residentBytes / (1024 * 1024) << " MB / requested " << stats.requestedBytes / (1024 * 1024)
+            << " MB / budget " << stats.budgetBytes / (1024 * 1024) << " MB" << (stats.budgetFromExtension ? " (VK_EXT_memory_budget)" : "");
+        lines.push_back(line.str());
+
+        line.str("");
+        line << "uploaded: " << stats.uploadedBytes / 1024 << " KB, evicted: " << stats.evictedBytes / 1024 << " KB";
+        lines.push_back(line.str());
+        return lines;
+    }
+
+    void printStats() const {
+        for (const std::string& line : getStatsLines()) {
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    struct StreamedTexture {
+        TextureMipChain source;
+        uint32_t mipLevels = 0;
+        uint32_t tailMip = 0;
+        uint32_t residentMip = 0;   // finest mip of image, mipLevels while nothing is resident
+        uint32_t wantedMip = 0;
+        uint32_t requestedMip = 0;  // finest mip requested during lastUsedFrame
+        uint64_t lastUsedFrame = 0;
+        UniqueDeviceMemory memory;
+        UniqueImage image;
+        UniqueImageView view;
+        uint32_t slot = 0;
+
+        // Bit i is set while the slot in the set of frame i still holds previousView.
+        uint32_t staleFrames = 0;
+        UniqueDeviceMemory previousMemory;
+        UniqueImage previousImage;
+        UniqueImageView previousView;
+    };
+
+    // Objects the frames recorded up to frame may still use. They are destroyed with the Retired
+    // entry, views and images before the memory bound to them.
+    struct Retired {
+        uint64_t frame;
+        std::vector<UniqueDeviceMemory> memory;
+        std::vector<UniqueBuffer> buffers;
+        std::vector<UniqueImage> images;
+        std::vector<UniqueImageView> views;
+    };
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    BindlessDescriptors* descriptors = nullptr;
+    VkSampler sampler = VK_NULL_HANDLE;
+    uint32_t framesInFlight = 2;
+    bool hasBudgetExtension = false;
+    VkDeviceSize fixedBudget = 0;
+    float budgetFraction = 0.5f;
+    VkDeviceSize maxUploadBytesPerFrame = 0;
+    uint64_t frameNumber = 0;
+    std::vector<StreamedTexture> textures;
+    std::vector<Retired> retiredObjects;
+    TextureStreamingStats stats;
+
+    VkDeviceSize residentSize(const StreamedTexture& texture, uint32_t mip) const {
+        return mipChainSize(texture.source.width, texture.source.height, mip, texture.mipLevels);
+    }
+
+    void refreshBudget() {
+        if (fixedBudget != 0) {
+            stats.budgetBytes = fixedBudget;
+            stats.budgetFromExtension = false;
+            return;
+        }
+
+        MemoryBudget budget = queryDeviceLocalBudget(context.physicalDevice, hasBudgetExtension);
+        stats.budgetBytes = static_cast<VkDeviceSize>(budget.budget * budgetFraction);
+        stats.budgetFromExtension = budget.fromExtension;
+    }
+
+    // Drops the finest planned mip of the least recently used texture that was used before
+    // usedFrame, or that holds more than it wants. Returns the bytes freed, 0 when nothing is left.
+    VkDeviceSize evictLeastRecentlyUsed(uint64_t usedFrame, uint32_t requester, std::vector<uint32_t>& targets) {
+        uint32_t victim = UINT32_MAX;
+        for (uint32_t i = 0; i < textures.size(); i++) {
+            const StreamedTexture& texture = textures[i];
+            if (i == requester || targets[i] >= texture.tailMip || texture.staleFrames != 0) {
+                continue;
+            }
+
+            bool surplus = targets[i] < texture.wantedMip;
+            if (texture.lastUsedFrame >= usedFrame && !surplus) {
+                continue;
+            }
+            if (victim == UINT32_MAX || texture.lastUsedFrame < textures[victim].lastUsedFrame) {
+                victim = i;
+            }
+        }
+
+        if (victim == UINT32_MAX) {
+            return 0;
+        }
+
+        const StreamedTexture& texture = textures[victim];
+        uint32_t mip = targets[victim]++;
+        return mipChainSize(texture.source.width, texture.source.height, mip, mip + 1);
+    }
+
+    // The current frame's set switches to the new image at once, the others in switchDescriptors().
+    void applyTargets(VkCommandBuffer commandBuffer, uint32_t currentFrame, const std::vector<uint32_t>& targets) {
+        Retired staging{};
+        staging.frame = frameNumber;
+        for (uint32_t i = 0; i < textures.size(); i++) {
+            StreamedTexture& texture = textures[i];
+            if (targets[i] == texture.residentMip) {
+                continue;
+            }
+
+            recordResidencyChange(commandBuffer, texture, targets[i], staging);
+            descriptors->writeFrameTexture(currentFrame, texture.slot, texture.view, sampler);
+            texture.staleFrames = ((1u << framesInFlight) - 1) & ~(1u << currentFrame);
+            if (texture.staleFrames == 0) {
+                retirePrevious(texture, staging);
+            }
+        }
+        if (!staging.buffers.empty() || !staging.images.empty()) {
+            retiredObjects.push_back(std::move(staging));
+        }
+    }
+
+    // Points the slots of the current frame's set, which no pending command buffer uses any more, at
+    // the new images. Frames recorded before may sample the old image until the last set has switched.
+    void switchDescriptors(uint32_t currentFrame) {
+        Retired retired{};
+        retired.frame = frameNumber;
+        for (StreamedTexture& texture : textures) {
+            if ((texture.staleFrames & (1u << currentFrame)) == 0) {
+                continue;
+            }
+
+            descriptors->writeFrameTexture(currentFrame, texture.slot, texture.view, sampler);
+            texture.staleFrames &= ~(1u << currentFrame);
+            if (texture.staleFrames == 0) {
+                retirePrevious(texture, retired);
+            }
+        }
+        if (!retired.images.empty()) {
+            retiredObjects.push_back(std::move(retired));
+        }
+    }
+
+    static void retirePrevious(StreamedTexture& texture, Retired& retired) {
+        retired.views.push_back(std::move(texture.previousView));
+        retired.images.push_back(std::move(texture.previousImage));
+        retired.memory.push_back(std::move(texture.previousMemory));
+    }
+
+    void destroyRetiredObjects() {
+        auto expired = std::remove_if(retiredObjects.begin(), retiredObjects.end(), [&](const Retired& retired) {
+            return retired.frame + framesInFlight <= frameNumber;
+        });
+        retiredObjects.erase(expired, retiredObjects.end());
+    }
+
+    // Creates the image for mips [mip, mipLevels), copies the levels the old image already has and
+    // uploads the rest. The old image moves to texture.previousImage and goes back to being sampled;
+    // the staging buffers are added to staging.
+    void recordResidencyChange(VkCommandBuffer commandBuffer, StreamedTexture& texture, uint32_t mip, Retired& staging) {
+        uint32_t width = texture.source.width;
+        uint32_t height = texture.source.height;
+        uint32_t levelCount = texture.mipLevels - mip;
+
+        UniqueDeviceMemory memory;
+        UniqueImage image;
+        createImage(context, mipWidth(width, mip), mipWidth(height, mip), levelCount, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory);
+
+        // The old image's layout change has to wait for the frames before this one to stop sampling it.
+        std::vector<VkImageMemoryBarrier> barriers;
+        barriers.push_back(makeBarrier(image, 0, levelCount, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT));
+        if (texture.image != VK_NULL_HANDLE) {
+            barriers.push_back(makeBarrier(texture.image, 0, texture.mipLevels - texture.residentMip, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0, VK_ACCESS_TRANSFER_READ_BIT));
+        }
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        // Levels both images have are copied on the GPU.
+        std::vector<VkImageCopy> copies;
+        for (uint32_t level = std::max(mip, texture.residentMip); level < texture.mipLevels; level++) {
+            VkImageCopy copy{};
+            copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - texture.residentMip, 0, 1};
+            copy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - mip, 0, 1};
+            copy.extent = {mipWidth(width, level), mipWidth(height, level), 1};
+            copies.push_back(copy);
+        }
+        if (!copies.empty()) {
+            dispatch->vkCmdCopyImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(copies.size()), copies.data());
+        }
+
+        // Levels finer than the old resident mip come from the CPU copy.
+        uint32_t uploadEnd = std::min(texture.residentMip, texture.mipLevels);
+        if (mip < uploadEnd) {
+            VkDeviceSize size = mipChainSize(width, height, mip, uploadEnd);
+            UniqueDeviceMemory bufferMemory;
+            UniqueBuffer buffer;
+            createBuffer(context, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+
+            void* data;
+            vkMapMemory(context.device, bufferMemory, 0, size, 0, &data);
+
+            std::vector<VkBufferImageCopy> regions;
+            VkDeviceSize offset = 0;
+            for (uint32_t level = mip; level < uploadEnd; level++) {
+                const std::vector<uint8_t>& pixels = texture.source.levels[level];
+                memcpy(static_cast<char*>(data) + offset, pixels.data(), pixels.size());
+
+                VkBufferImageCopy region{};
+                region.bufferOffset = offset;
+                region.bufferRowLength = 0;
+                region.bufferImageHeight = 0;
+                region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - mip, 0, 1};
+                region.imageOffset = {0, 0, 0};
+                region.imageExtent = {mipWidth(width, level), mipWidth(height, level), 1};
+                regions.push_back(region);
+
+                offset += pixels.size();
+            }
+            vkUnmapMemory(context.device, bufferMemory);
+
+            dispatch->vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+            staging.buffers.push_back(std::move(buffer));
+            staging.memory.push_back(std::move(bufferMemory));
+        }
+
+        barriers.clear();
+        barriers.push_back(makeBarrier(image, 0, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+        if (texture.image != VK_NULL_HANDLE) {
+            barriers.push_back(makeBarrier(texture.image, 0, texture.mipLevels - texture.residentMip, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT));
+        }
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        texture.previousView = std::move(texture.view);
+        texture.previousImage = std::move(texture.image);
+        texture.previousMemory = std::move(texture.memory);
+        texture.view = createUniqueImageView(context.device, image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount);
+        texture.image = std::move(image);
+        texture.memory = std::move(memory);
+        texture.residentMip = mip;
+    }
+
+    static VkImageMemoryBarrier makeBarrier(VkImage image, uint32_t baseMipLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = baseMipLevel;
+        barrier.subresourceRange.levelCount = levelCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        return barrier;
+    }
+
+    void updateStats() {
+        stats.textureCount = static_cast<uint32_t>(textures.size());
+        stats.residentBytes = 0;
+        stats.requestedBytes = 0;
+        stats.pendingTextures = 0;
+
+        for (const StreamedTexture& texture : textures) {
+            stats.residentBytes += residentSize(texture, texture.residentMip);
+            if (texture.lastUsedFrame == frameNumber) {
+                stats.requestedBytes += residentSize(texture, texture.wantedMip);
+            }
+            if (texture.residentMip > texture.wantedMip) {
+                stats.pendingTextures++;
+            }
+        }
+    }
+};
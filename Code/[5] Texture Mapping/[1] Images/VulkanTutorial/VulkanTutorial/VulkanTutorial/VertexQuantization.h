@@ -0,0 +1,557 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "VulkanHandle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Compact vertex formats. The Vertex struct of the tutorial stores every attribute as 32-bit floats;
+// VertexLayout picks a smaller Vulkan format per attribute, computes offsets, stride and the attribute
+// descriptions for it, and encodeVertices() packs SourceVertex data to match. Attribute locations
+// stay fixed (0 position, 1 color, 2 texCoord, 3 normal) so shaders only change their input types.
+
+enum class PositionEncoding {
+    Float32,
+    Half,       // R16G16(B16A16)_SFLOAT
+    Snorm16,    // R16G16(B16A16)_SNORM relative to the mesh bounds, see getDequantizeMatrix()
+};
+
+enum class NormalEncoding {
+    None,
+    Float32,
+    Octahedral16, // R16G16_SNORM
+    Octahedral8,  // R8G8_SNORM
+};
+
+enum class ColorEncoding {
+    None,
+    Float32,
+    Unorm8,     // R8G8B8A8_UNORM
+};
+
+enum class TexCoordEncoding {
+    None,
+    Float32,
+    Half,       // R16G16_SFLOAT
+};
+
+struct VertexFormat {
+    PositionEncoding position = PositionEncoding::Float32;
+    uint32_t positionComponents = 2;
+    ColorEncoding color = ColorEncoding::Float32;
+    TexCoordEncoding texCoord = TexCoordEncoding::None;
+    NormalEncoding normal = NormalEncoding::None;
+
+    // The layout of the tutorial's Vertex struct.
+    static VertexFormat tutorial() {
+        return VertexFormat{};
+    }
+
+    static VertexFormat compact(uint32_t positionComponents = 3) {
+        VertexFormat format;
+        format.position = PositionEncoding::Snorm16;
+        format.positionComponents = positionComponents;
+        format.color = ColorEncoding::Unorm8;
+        format.texCoord = TexCoordEncoding::Half;
+        format.normal = NormalEncoding::Octahedral16;
+        return format;
+    }
+};
+
+struct SourceVertex {
+    glm::vec3 pos;
+    glm::vec3 color;
+    glm::vec2 texCoord;
+    glm::vec3 normal;
+};
+
+// Octahedral normal encoding: the unit sphere is projected onto the octahedron |x| + |y| + |z| = 1 and
+// the lower half folded over the upper one, giving two components in [-1, 1].
+inline glm::vec2 octahedralEncode(glm::vec3 n) {
+    n = n / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+    if (n.z >= 0.0f) {
+        return glm::vec2(n.x, n.y);
+    }
+    return glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+inline glm::vec3 octahedralDecode(glm::vec2 e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+class VertexLayout {
+public:
+    enum Location {
+        POSITION = 0,
+        COLOR = 1,
+        TEX_COORD = 2,
+        NORMAL = 3,
+    };
+
+    VertexLayout(const VertexFormat& format = VertexFormat::tutorial())
+        : format(format) {
+        if (format.positionComponents < 2 || format.positionComponents > 3) {
+            throw std::runtime_error("vertex positions need 2 or 3 components!");
+        }
+
+        bool position3 = format.positionComponents == 3;
+        switch (format.position) {
+        case PositionEncoding::Float32: add(POSITION, position3 ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R32G32_SFLOAT, position3 ? 12 : 8); break;
+        // Three component 16-bit formats are rarely supported for vertex buffers, so use four.
+        case PositionEncoding::Half: add(POSITION, position3 ? VK_FORMAT_R16G16B16A16_SFLOAT : VK_FORMAT_R16G16_SFLOAT, position3 ? 8 : 4); break;
+        case PositionEncoding::Snorm16: add(POSITION, position3 ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R16G16_SNORM, position3 ? 8 : 4); break;
+        }
+
+        switch (format.color) {
+        case ColorEncoding::None: break;
+        case ColorEncoding::Float32: add(COLOR, VK_FORMAT_R32G32B32_SFLOAT, 12); break;
+        case ColorEncoding::Unorm8: add(COLOR, VK_FORMAT_R8G8B8A8_UNORM, 4); break;
+        }
+
+        switch (format.texCoord) {
+        case TexCoordEncoding::None: break;
+        case TexCoordEncoding::Float32: add(TEX_COORD, VK_FORMAT_R32G32_SFLOAT, 8); break;
+        case TexCoordEncoding::Half: add(TEX_COORD, VK_FORMAT_R16G16_SFLOAT, 4); break;
+        }
+
+        switch (format.normal) {
+        case NormalEncoding::None: break;
+        case NormalEncoding::Float32: add(NORMAL, VK_FORMAT_R32G32B32_SFLOAT, 12); break;
+        case NormalEncoding::Octahedral16: add(NORMAL, VK_FORMAT_R16G16_SNORM, 4); break;
+        case NormalEncoding::Octahedral8: add(NORMAL, VK_FORMAT_R8G8_SNORM, 2); break;
+        }
+
+        stride = align(stride);
+    }
+
+    const VertexFormat& getFormat() const {
+        return format;
+    }
+
+    uint32_t getStride() const {
+        return stride;
+    }
+
+    VkVertexInputBindingDescription getBindingDescription(uint32_t binding = 0) const {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = binding;
+        bindingDescription.stride = stride;
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(uint32_t binding = 0) const {
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions = attributes;
+        for (VkVertexInputAttributeDescription& attributeDescription : attributeDescriptions) {
+            attributeDescription.binding = binding;
+        }
+
+        return attributeDescriptions;
+    }
+
+    // Checks that the physical device can fetch every format of the layout from a vertex buffer.
+    bool isSupported(VkPhysicalDevice physicalDevice) const {
+        for (const VkVertexInputAttributeDescription& attribute : attributes) {
+            VkFormatProperties props;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, attribute.format, &props);
+            if ((props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Snorm16 positions are stored relative to the bounds of the mesh; encodeVertices() sets these and the
+    // model matrix has to be multiplied by getDequantizeMatrix() to undo it (makeQuantizedUniformBuffer()).
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+
+    glm::mat4 getDequantizeMatrix() const {
+        return glm::scale(glm::translate(glm::mat4(1.0f), positionOffset), positionScale);
+    }
+
+    uint32_t getOffset(Location location) const {
+        for (const VkVertexInputAttributeDescription& attribute : attributes) {
+            if (attribute.location == static_cast<uint32_t>(location)) {
+                return attribute.offset;
+            }
+        }
+        return UINT32_MAX;
+    }
+
+private:
+    VertexFormat format;
+    uint32_t stride = 0;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+
+    // Every attribute starts on a 4 byte boundary, which all implementations accept.
+    static uint32_t align(uint32_t offset) {
+        return (offset + 3) & ~3u;
+    }
+
+    void add(Location location, VkFormat attributeFormat, uint32_t size) {
+        VkVertexInputAttributeDescription attribute{};
+        attribute.location = location;
+        attribute.format = attributeFormat;
+        attribute.offset = align(stride);
+        attributes.push_back(attribute);
+
+        stride = attribute.offset + size;
+    }
+};
+
+// UniformBufferObject of quantized.vert. model includes getDequantizeMatrix(), whose scale differs per
+// axis and must not reach the normals, so they get the inverse transpose of the mesh's own model
+// matrix instead (a mat4 to keep the std140 layout of the struct and the block the same).
+struct QuantizedUniformBufferObject {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
+    alignas(16) glm::mat4 normalMatrix;
+};
+
+inline QuantizedUniformBufferObject makeQuantizedUniformBuffer(const VertexLayout& layout, const glm::mat4& model, const glm::mat4& view, const glm::mat4& proj) {
+    QuantizedUniformBufferObject ubo{};
+    ubo.model = model * layout.getDequantizeMatrix();
+    ubo.view = view;
+    ubo.proj = proj;
+    ubo.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+    return ubo;
+}
+
+// Packs vertices into the layout. For Snorm16 positions this also computes layout.positionOffset and
+// layout.positionScale from the bounds of vertices.
+inline std::vector<uint8_t> encodeVertices(VertexLayout& layout, const std::vector<SourceVertex>& vertices) {
+    const VertexFormat& format = layout.getFormat();
+    const uint32_t stride = layout.getStride();
+    std::vector<uint8_t> data(vertices.size() * stride);
+
+    if (format.position == PositionEncoding::Snorm16 && !vertices.empty()) {
+        glm::vec3 minimum = vertices[0].pos;
+        glm::vec3 maximum = vertices[0].pos;
+        for (const SourceVertex& vertex : vertices) {
+            minimum = glm::min(minimum, vertex.pos);
+            maximum = glm::max(maximum, vertex.pos);
+        }
+
+        layout.positionOffset = (minimum + maximum) * 0.5f;
+        layout.positionScale = glm::max((maximum - minimum) * 0.5f, glm::vec3(1e-8f));
+    } else {
+        layout.positionOffset = glm::vec3(0.0f);
+        layout.positionScale = glm::vec3(1.0f);
+    }
+
+    const uint32_t positionOffset = layout.getOffset(VertexLayout::POSITION);
+    const uint32_t colorOffset = layout.getOffset(VertexLayout::COLOR);
+    const uint32_t texCoordOffset = layout.getOffset(VertexLayout::TEX_COORD);
+    const uint32_t normalOffset = layout.getOffset(VertexLayout::NORMAL);
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const SourceVertex& vertex = vertices[i];
+        uint8_t* out = data.data() + i * stride;
+
+        switch (format.position) {
+        case PositionEncoding::Float32: {
+            memcpy(out + positionOffset, &vertex.pos, sizeof(float) * format.positionComponents);
+            break;
+        }
+        case PositionEncoding::Half: {
+            uint64_t packed = glm::packHalf4x16(glm::vec4(vertex.pos, 1.0f));
+            memcpy(out + positionOffset, &packed, format.positionComponents == 3 ? 8 : 4);
+            break;
+        }
+        case PositionEncoding::Snorm16: {
+            glm::vec3 normalized = (vertex.pos - layout.positionOffset) / layout.positionScale;
+            uint64_t packed = glm::packSnorm4x16(glm::vec4(normalized, 1.0f));
+            memcpy(out + positionOffset, &packed, format.positionComponents == 3 ? 8 : 4);
+            break;
+        }
+        }
+
+        switch (format.color) {
+        case ColorEncoding::None:
+            break;
+        case ColorEncoding::Float32:
+            memcpy(out + colorOffset, &vertex.color, sizeof(glm::vec3));
+            break;
+        case ColorEncoding::Unorm8: {
+            uint32_t packed = glm::packUnorm4x8(glm::vec4(vertex.color, 1.0f));
+            memcpy(out + colorOffset, &packed, sizeof(packed));
+            break;
+        }
+        }
+
+        switch (format.texCoord) {
+        case TexCoordEncoding::None:
+            break;
+        case TexCoordEncoding::Float32:
+            memcpy(out + texCoordOffset, &vertex.texCoord, sizeof(glm::vec2));
+            break;
+        case TexCoordEncoding::Half: {
+            uint32_t packed = glm::packHalf2x16(vertex.texCoord);
+            memcpy(out + texCoordOffset, &packed, sizeof(packed));
+            break;
+        }
+        }
+
+        switch (format.normal) {
+        case NormalEncoding::None:
+            break;
+        case NormalEncoding::Float32:
+            memcpy(out + normalOffset, &vertex.normal, sizeof(glm::vec3));
+            break;
+        case NormalEncoding::Octahedral16: {
+            uint32_t packed = glm::packSnorm2x16(octahedralEncode(vertex.normal));
+            memcpy(out + normalOffset, &packed, sizeof(packed));
+            break;
+        }
+        case NormalEncoding::Octahedral8: {
+            glm::vec2 e = octahedralEncode(vertex.normal);
+            int8_t packed[2] = { static_cast<int8_t>(std::round(glm::clamp(e.x, -1.0f, 1.0f) * 127.0f)), static_cast<int8_t>(std::round(glm::clamp(e.y, -1.0f, 1.0f) * 127.0f)) };
+            memcpy(out + normalOffset, packed, sizeof(packed));
+            break;
+        }
+        }
+    }
+
+    return data;
+}
+
+// Reads vertex index back the way the vertex fetch unit would, for error measurements.
+inline SourceVertex decodeVertex(const VertexLayout& layout, const uint8_t* data, size_t index) {
+    const VertexFormat& format = layout.getFormat();
+    const uint8_t* in = data + index * layout.getStride();
+    SourceVertex vertex{};
+
+    const uint8_t* position = in + layout.getOffset(VertexLayout::POSITION);
+    switch (format.position) {
+    case PositionEncoding::Float32: {
+        memcpy(&vertex.pos, position, sizeof(float) * format.positionComponents);
+        break;
+    }
+    case PositionEncoding::Half: {
+        uint64_t packed = 0;
+        memcpy(&packed, position, format.positionComponents == 3 ? 8 : 4);
+        vertex.pos = glm::vec3(glm::unpackHalf4x16(packed));
+        break;
+    }
+    case PositionEncoding::Snorm16: {
+        uint64_t packed = 0;
+        memcpy(&packed, position, format.positionComponents == 3 ? 8 : 4);
+        vertex.pos = glm::vec3(glm::unpackSnorm4x16(packed)) * layout.positionScale + layout.positionOffset;
+        break;
+    }
+    }
+    if (format.positionComponents == 2) {
+        vertex.pos.z = 0.0f;
+    }
+
+    if (format.color == ColorEncoding::Float32) {
+        memcpy(&vertex.color, in + layout.getOffset(VertexLayout::COLOR), sizeof(glm::vec3));
+    } else if (format.color == ColorEncoding::Unorm8) {
+        uint32_t packed;
+        memcpy(&packed, in + layout.getOffset(VertexLayout::COLOR), sizeof(packed));
+        vertex.color = glm::vec3(glm::unpackUnorm4x8(packed));
+    }
+
+    if (format.texCoord == TexCoordEncoding::Float32) {
+        memcpy(&vertex.texCoord, in + layout.getOffset(VertexLayout::TEX_COORD), sizeof(glm::vec2));
+    } else if (format.texCoord == TexCoordEncoding::Half) {
+        uint32_t packed;
+        memcpy(&packed, in + layout.getOffset(VertexLayout::TEX_COORD), sizeof(packed));
+        vertex.texCoord = glm::unpackHalf2x16(packed);
+    }
+
+    if (format.normal == NormalEncoding::Float32) {
+        memcpy(&vertex.normal, in + layout.getOffset(VertexLayout::NORMAL), sizeof(glm::vec3));
+    } else if (format.normal == NormalEncoding::Octahedral16) {
+        uint32_t packed;
+        memcpy(&packed, in + layout.getOffset(VertexLayout::NORMAL), sizeof(packed));
+        vertex.normal = octahedralDecode(glm::unpackSnorm2x16(packed));
+    } else if (format.normal == NormalEncoding::Octahedral8) {
+        int8_t packed[2];
+        memcpy(packed, in + layout.getOffset(VertexLayout::NORMAL), sizeof(packed));
+        vertex.normal = octahedralDecode(glm::vec2(std::max(packed[0] / 127.0f, -1.0f), std::max(packed[1] / 127.0f, -1.0f)));
+    }
+
+    return vertex;
+}
+
+struct VertexFormatReport {
+    uint32_t stride = 0;
+    uint32_t referenceStride = 0;
+    size_t bytes = 0;
+    size_t referenceBytes = 0;
+    float maxPositionError = 0.0f;
+    float maxColorError = 0.0f;
+    float maxTexCoordError = 0.0f;
+    float maxNormalErrorDegrees = 0.0f;
+
+    double getSavedPercent() const {
+        return referenceBytes == 0 ? 0.0 : 100.0 * (1.0 - static_cast<double>(bytes) / static_cast<double>(referenceBytes));
+    }
+
+    // Vertex fetch traffic for drawing the mesh framesPerSecond times per second, assuming every vertex
+    // is fetched once per draw (a perfect post-transform cache).
+    double getFetchGigabytesPerSecond(double framesPerSecond, uint32_t drawsPerFrame = 1) const {
+        return static_cast<double>(bytes) * drawsPerFrame * framesPerSecond / 1e9;
+    }
+};
+
+// Compares the layout with the same attributes stored as 32-bit floats and measures the round trip error.
+inline VertexFormatReport measureVertexFormat(const VertexLayout& layout, const std::vector<SourceVertex>& vertices, const std::vector<uint8_t>& encoded) {
+    const VertexFormat& format = layout.getFormat();
+
+    VertexFormat referenceFormat = format;
+    referenceFormat.position = PositionEncoding::Float32;
+    referenceFormat.color = format.color == ColorEncoding::None ? ColorEncoding::None : ColorEncoding::Float32;
+    referenceFormat.texCoord = format.texCoord == TexCoordEncoding::None ? TexCoordEncoding::None : TexCoordEncoding::Float32;
+    referenceFormat.normal = format.normal == NormalEncoding::None ? NormalEncoding::None : NormalEncoding::Float32;
+    VertexLayout referenceLayout(referenceFormat);
+
+    VertexFormatReport report;
+    report.stride = layout.getStride();
+    report.referenceStride = referenceLayout.getStride();
+    report.bytes = encoded.size();
+    report.referenceBytes = vertices.size() * referenceLayout.getStride();
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        SourceVertex decoded = decodeVertex(layout, encoded.data(), i);
+        glm::vec3 pos = vertices[i].pos;
+        if (format.positionComponents == 2) {
+            pos.z = 0.0f;
+        }
+
+        report.maxPositionError = std::max(report.maxPositionError, glm::length(decoded.pos - pos));
+        if (format.color != ColorEncoding::None) {
+            report.maxColorError = std::max(report.maxColorError, glm::length(decoded.color - vertices[i].color));
+        }
+        if (format.texCoord != TexCoordEncoding::None) {
+            report.maxTexCoordError = std::max(report.maxTexCoordError, glm::length(decoded.texCoord - vertices[i].texCoord));
+        }
+        if (format.normal != NormalEncoding::None) {
+            float cosine = glm::clamp(glm::dot(decoded.normal, glm::normalize(vertices[i].normal)), -1.0f, 1.0f);
+            report.maxNormalErrorDegrees = std::max(report.maxNormalErrorDegrees, glm::degrees(std::acos(cosine)));
+        }
+    }
+
+    return report;
+}
+
+inline void printVertexFormatReport(const VertexFormatReport& report, double framesPerSecond = 60.0) {
+    std::cout << "vertex stride " << report.stride << " bytes (float32: " << report.referenceStride << "), "
+        << report.bytes << " bytes (float32: " << report.referenceBytes << "), " << report.getSavedPercent() << "% saved, "
+        << report.getFetchGigabytesPerSecond(framesPerSecond) << " GB/s fetched at " << framesPerSecond << " fps" << std::endl;
+    std::cout << "max error: position " << report.maxPositionError << ", color " << report.maxColorError
+        << ", texCoord " << report.maxTexCoordError << ", normal " << report.maxNormalErrorDegrees << " degrees" << std::endl;
+}
+
+// Measures what the GPU actually fetches: a pipeline statistics query counts input assembly vertices and
+// vertex shader invocations, timestamps give the time the draws took. Needs the pipelineStatisticsQuery
+// feature.
+class VertexFetchQuery {
+public:
+    void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t frameCount) {
+        this->device = device;
+        dispatch = &getDeviceTable(device);
+        this->frameCount = frameCount;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo statisticsInfo{};
+        statisticsInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        statisticsInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statisticsInfo.queryCount = frameCount;
+        statisticsInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT;
+
+        if (vkCreateQueryPool(device, &statisticsInfo, nullptr, statisticsPool.put(device)) != VK_SUCCESS) {
+            statisticsPool.release();
+            throw std::runtime_error("failed to create query pool!");
+        }
+
+        VkQueryPoolCreateInfo timestampInfo{};
+        timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount = frameCount * 2;
+
+        if (vkCreateQueryPool(device, &timestampInfo, nullptr, timestampPool.put(device)) != VK_SUCCESS) {
+            timestampPool.release();
+            throw std::runtime_error("failed to create query pool!");
+        }
+    }
+
+    void cleanup() {
+        timestampPool.reset();
+        statisticsPool.reset();
+    }
+
+    // Outside a render pass, before vkCmdBeginRenderPass.
+    void reset(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdResetQueryPool(commandBuffer, statisticsPool, frame, 1);
+        dispatch->vkCmdResetQueryPool(commandBuffer, timestampPool, frame * 2, 2);
+    }
+
+    void begin(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, frame * 2);
+        dispatch->vkCmdBeginQuery(commandBuffer, statisticsPool, frame, 0);
+    }
+
+    void end(VkCommandBuffer commandBuffer, uint32_t frame) {
+        dispatch->vkCmdEndQuery(commandBuffer, statisticsPool, frame);
+        dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, frame * 2 + 1);
+    }
+
+    struct Result {
+        uint64_t inputVertices = 0;
+        uint64_t vertexShaderInvocations = 0;
+        double milliseconds = 0.0;
+        double fetchedBytes = 0.0;
+        double gigabytesPerSecond = 0.0;
+    };
+
+    // Call after the frame's fence has signaled. Every vertex shader invocation fetches one vertex of
+    // stride bytes; invocations below inputVertices are post-transform cache hits.
+    Result getResult(uint32_t frame, uint32_t stride) const {
+        uint64_t statistics[2] = {};
+        vkGetQueryPoolResults(device, statisticsPool, frame, 1, sizeof(statistics), statistics, sizeof(statistics), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        uint64_t timestamps[2] = {};
+        vkGetQueryPoolResults(device, timestampPool, frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        Result result;
+        result.inputVertices = statistics[0];
+        result.vertexShaderInvocations = statistics[1];
+        result.milliseconds = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+        result.fetchedBytes = static_cast<double>(result.vertexShaderInvocations) * stride;
+        result.gigabytesPerSecond = result.milliseconds > 0.0 ? result.fetchedBytes / (result.milliseconds * 1e6) : 0.0;
+
+        return result;
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t frameCount = 0;
+    float timestampPeriod = 1.0f;
+    UniqueQueryPool statisticsPool;
+    UniqueQueryPool timestampPool;
+};
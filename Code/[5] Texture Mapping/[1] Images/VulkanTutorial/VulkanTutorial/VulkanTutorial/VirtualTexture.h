@@ -0,0 +1,1106 @@
+#pragma once
+
+#include "DeviceDispatch.h"
+#include "JobSystem.h"
+#include "MeshFile.h"
+#include "TextureStreaming.h"
+#include "VulkanHandle.h"
+#include "VulkanHelpers.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Tiled texture file: a small header followed by every tile of every mip, mip by mip and row by row.
+// Tiles are RGBA8, tileSize + 2 * border texels square, and repeat border texels of their neighbours
+// so the physical texture can filter bilinearly across tile edges. The mip chain stops at the first
+// mip that fits in a single tile.
+const uint32_t VIRTUAL_TEXTURE_MAGIC = 0x58455456; // "VTEX"
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+const uint64_t VIRTUAL_TEXTURE_ALIGNMENT = 4096;
+
+// Cleared into the feedback buffer where no virtual texture was drawn.
+const uint32_t VIRTUAL_PAGE_NONE = 0xffffffff;
+
+struct VirtualTextureFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+    uint32_t border;
+    uint32_t mipLevels;
+    uint32_t tileCount;
+    uint64_t tileDataOffset;
+};
+
+static_assert(sizeof(VirtualTextureFileHeader) == 40, "VirtualTextureFileHeader layout must not change");
+
+// Page ids as written by vt_feedback.frag: x in bits 0-13, y in bits 14-27, mip in bits 28-31.
+inline uint32_t packPageId(uint32_t mip, uint32_t x, uint32_t y) {
+    return (mip << 28) | (y << 14) | x;
+}
+
+inline uint32_t pageMip(uint32_t page) { return page >> 28; }
+inline uint32_t pageX(uint32_t page) { return page & 0x3fff; }
+inline uint32_t pageY(uint32_t page) { return (page >> 14) & 0x3fff; }
+
+inline uint32_t virtualTilesAcross(uint32_t size, uint32_t tileSize, uint32_t mip) {
+    return (mipWidth(size, mip) + tileSize - 1) / tileSize;
+}
+
+inline uint32_t virtualMipLevels(uint32_t width, uint32_t height, uint32_t tileSize) {
+    uint32_t mipLevels = 1;
+    while (std::max(mipWidth(width, mipLevels - 1), mipWidth(height, mipLevels - 1)) > tileSize) {
+        mipLevels++;
+    }
+    return mipLevels;
+}
+
+inline void writeVirtualTextureFile(const std::string& filename, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t tileSize = 128, uint32_t border = 4) {
+    if (width > tileSize * 0x4000 || height > tileSize * 0x4000) {
+        throw std::runtime_error("texture is too large for virtual texture page ids!");
+    }
+
+    TextureMipChain chain = generateMipChain(pixels, width, height);
+
+    VirtualTextureFileHeader header{};
+    header.magic = VIRTUAL_TEXTURE_MAGIC;
+    header.version = VIRTUAL_TEXTURE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.border = border;
+    header.mipLevels = virtualMipLevels(width, height, tileSize);
+    header.tileDataOffset = VIRTUAL_TEXTURE_ALIGNMENT;
+    for (uint32_t mip = 0; mip < header.mipLevels; mip++) {
+        header.tileCount += virtualTilesAcross(width, tileSize, mip) * virtualTilesAcross(height, tileSize, mip);
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+
+    std::vector<char> padding(header.tileDataOffset - sizeof(header), 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+
+    uint32_t paddedSize = tileSize + 2 * border;
+    std::vector<uint8_t> tile(static_cast<size_t>(paddedSize) * paddedSize * 4);
+    for (uint32_t mip = 0; mip < header.mipLevels; mip++) {
+        int32_t levelWidth = static_cast<int32_t>(mipWidth(width, mip));
+        int32_t levelHeight = static_cast<int32_t>(mipWidth(height, mip));
+        const std::vector<uint8_t>& level = chain.levels[mip];
+
+        for (uint32_t tileY = 0; tileY < virtualTilesAcross(height, tileSize, mip); tileY++) {
+            for (uint32_t tileX = 0; tileX < virtualTilesAcross(width, tileSize, mip); tileX++) {
+                for (uint32_t y = 0; y < paddedSize; y++) {
+                    int32_t sourceY = std::clamp(static_cast<int32_t>(tileY * tileSize + y) - static_cast<int32_t>(border), 0, levelHeight - 1);
+                    for (uint32_t x = 0; x < paddedSize; x++) {
+                        int32_t sourceX = std::clamp(static_cast<int32_t>(tileX * tileSize + x) - static_cast<int32_t>(border), 0, levelWidth - 1);
+                        memcpy(&tile[(y * paddedSize + x) * 4], &level[(static_cast<size_t>(sourceY) * levelWidth + sourceX) * 4], 4);
+                    }
+                }
+                file.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+        }
+    }
+
+    if (!file) {
+        throw std::runtime_error("failed to write virtual texture file!");
+    }
+}
+
+// Memory mapped tiled texture file; tiles are read straight from the mapping by the loader jobs.
+class VirtualTextureFile {
+public:
+    void load(const std::string& filename) {
+        file.open(filename);
+
+        if (file.getSize() < sizeof(VirtualTextureFileHeader)) {
+            throw std::runtime_error("invalid virtual texture file!");
+        }
+
+        header = *reinterpret_cast<const VirtualTextureFileHeader*>(file.getData());
+        if (header.magic != VIRTUAL_TEXTURE_MAGIC || header.version != VIRTUAL_TEXTURE_VERSION || header.mipLevels == 0 || header.mipLevels > 16) {
+            throw std::runtime_error("invalid virtual texture file!");
+        }
+
+        mipTileOffsets.resize(header.mipLevels);
+        uint32_t tileCount = 0;
+        for (uint32_t mip = 0; mip < header.mipLevels; mip++) {
+            mipTileOffsets[mip] = tileCount;
+            tileCount += getTilesX(mip) * getTilesY(mip);
+        }
+
+        if (tileCount != header.tileCount || header.tileDataOffset > file.getSize()
+            || static_cast<uint64_t>(tileCount) * getTileBytes() > file.getSize() - header.tileDataOffset) {
+            throw std::runtime_error("virtual texture file is truncated!");
+        }
+    }
+
+    void close() {
+        file.close();
+    }
+
+    const VirtualTextureFileHeader& getHeader() const { return header; }
+    uint32_t getTilesX(uint32_t mip) const { return virtualTilesAcross(header.width, header.tileSize, mip); }
+    uint32_t getTilesY(uint32_t mip) const { return virtualTilesAcross(header.height, header.tileSize, mip); }
+    uint32_t getPaddedTileSize() const { return header.tileSize + 2 * header.border; }
+    VkDeviceSize getTileBytes() const { return static_cast<VkDeviceSize>(getPaddedTileSize()) * getPaddedTileSize() * 4; }
+
+    const uint8_t* getTileData(uint32_t page) const {
+        uint32_t mip = pageMip(page);
+        uint64_t index = mipTileOffsets[mip] + pageY(page) * getTilesX(mip) + pageX(page);
+        return file.getData() + header.tileDataOffset + index * getTileBytes();
+    }
+
+private:
+    MappedFile file;
+    VirtualTextureFileHeader header{};
+    std::vector<uint32_t> mipTileOffsets;
+};
+
+// Low resolution R32_UINT target that the feedback pass renders page ids into with vt_feedback.frag.
+// Render it in a pass that clears to VIRTUAL_PAGE_NONE and ends in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+// then call recordReadback() in the same command buffer and collectRequests() once its fence signaled.
+class VirtualTextureFeedback {
+public:
+    static const VkFormat FORMAT = VK_FORMAT_R32_UINT;
+
+    void create(const VulkanContext& context, uint32_t width, uint32_t height, uint32_t frameCount) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->width = width;
+        this->height = height;
+
+        createImage(context, width, height, 1, VK_SAMPLE_COUNT_1_BIT, FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+        imageView = createUniqueImageView(context.device, image, FORMAT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        VkDeviceSize size = static_cast<VkDeviceSize>(width) * height * sizeof(uint32_t);
+        frames.resize(frameCount);
+        for (FrameResources& frame : frames) {
+            createBuffer(context, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.buffer, frame.memory);
+            vkMapMemory(context.device, frame.memory, 0, size, 0, &frame.mapped);
+        }
+    }
+
+    void cleanup() {
+        frames.clear();
+        imageView.reset();
+        image.reset();
+        imageMemory.reset();
+    }
+
+    VkImageView getImageView() const { return imageView; }
+    VkExtent2D getExtent() const { return {width, height}; }
+
+    void recordReadback(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {width, height, 1};
+
+        dispatch->vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frames[currentFrame].buffer, 1, &region);
+
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = frames[currentFrame].buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // Appends the distinct pages of the frame's feedback to pages.
+    void collectRequests(uint32_t currentFrame, std::vector<uint32_t>& pages) const {
+        const uint32_t* ids = static_cast<const uint32_t*>(frames[currentFrame].mapped);
+        size_t first = pages.size();
+        uint32_t previous = VIRTUAL_PAGE_NONE;
+
+        for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+            // Neighbouring pixels mostly hit the same page, so skip runs before sorting.
+            if (ids[i] != VIRTUAL_PAGE_NONE && ids[i] != previous) {
+                pages.push_back(ids[i]);
+            }
+            previous = ids[i];
+        }
+
+        std::sort(pages.begin() + first, pages.end());
+        pages.erase(std::unique(pages.begin() + first, pages.end()), pages.end());
+    }
+
+private:
+    struct FrameResources {
+        UniqueDeviceMemory memory;
+        UniqueBuffer buffer;
+        void* mapped = nullptr;
+    };
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    UniqueDeviceMemory imageMemory;
+    UniqueImage image;
+    UniqueImageView imageView;
+    std::vector<FrameResources> frames;
+};
+
+// Push constants of vt_feedback.frag, vt_indirection.frag and vt_sparse.frag.
+struct VirtualTextureConstants {
+    glm::vec2 virtualSize;
+    glm::vec2 physicalSize;   // texels of the physical texture, indirection backend only
+    float tileSize;
+    float border;
+    float maxMip;
+    float feedbackBias;       // -log2 of how much smaller the feedback target is than the screen
+};
+
+struct VirtualTextureStats {
+    uint32_t residentPages = 0;
+    uint32_t cacheSize = 0;
+    uint32_t pendingLoads = 0;
+    uint32_t uploadedPages = 0;  // this frame
+    uint32_t evictedPages = 0;   // this frame
+    uint32_t droppedPages = 0;   // this frame, loaded but no cache slot was free
+};
+
+// Virtual texture backed by a VirtualTextureFile. Pages reported by the feedback pass are loaded by
+// JobSystem jobs, which copy the tile from the file mapping into a staging slot, and update() uploads
+// finished tiles into a fixed size tile cache with least recently used replacement.
+//
+// With sparse residency (sparseBinding, sparseResidencyImage2D, shaderResourceResidency and a 128x128
+// sparse block for RGBA8, matching the file's tile size) the cache is a pool of memory pages bound into a sparse image of the
+// full virtual size, and vt_sparse.frag falls back to coarser mips through sparse residency queries.
+// Otherwise tiles go into slots of a physical texture and an R8G8B8A8_UINT page table with one texel per
+// page and mip points every page at the slot and mip of its finest resident ancestor for
+// vt_indirection.frag. The coarsest mip is a single tile and is always resident either way.
+//
+// update() records the uploads into the frame's command buffer. Staging slots and page table staging
+// buffers are only reused once framesInFlight frames have passed, and slots are only evicted when no
+// frame in flight used them, like the retirement in TextureStreamer.
+class VirtualTexture {
+public:
+    enum class Backend {
+        Sparse,
+        Indirection,
+    };
+
+    // sparseQueue has to support VK_QUEUE_SPARSE_BINDING_BIT; pass VK_NULL_HANDLE to always use the
+    // indirection backend.
+    void create(const VulkanContext& context, JobSystem& jobSystem, const std::string& filename, uint32_t cacheSize, uint32_t framesInFlight,
+        VkQueue sparseQueue = VK_NULL_HANDLE, uint32_t maxUploadsPerFrame = 16) {
+        this->context = context;
+        dispatch = &getDeviceTable(context.device);
+        this->jobSystem = &jobSystem;
+        this->sparseQueue = sparseQueue;
+        this->framesInFlight = framesInFlight;
+        this->maxUploadsPerFrame = maxUploadsPerFrame;
+        frameNumber = 1;
+
+        // Page table entries store the slot position in 8 bits per axis.
+        if (cacheSize == 0 || cacheSize > 256 * 256) {
+            throw std::runtime_error("invalid virtual texture cache size!");
+        }
+
+        file.load(filename);
+        const VirtualTextureFileHeader& header = file.getHeader();
+
+        backend = sparseQueue != VK_NULL_HANDLE && supportsSparse() ? Backend::Sparse : Backend::Indirection;
+
+        // Uploaded staging slots stay busy until their frame has finished; one more frame's worth keeps
+        // the loader jobs going meanwhile.
+        stagingSlotCount = maxUploadsPerFrame * (framesInFlight + 1);
+        createBuffer(context, file.getTileBytes() * stagingSlotCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            stagingBuffer, stagingMemory);
+        vkMapMemory(context.device, stagingMemory, 0, file.getTileBytes() * stagingSlotCount, 0, &stagingData);
+        freeStagingSlots.clear();
+        for (uint32_t i = stagingSlotCount; i > 0; i--) {
+            freeStagingSlots.push_back(i - 1);
+        }
+        retiredStagingSlots.clear();
+
+        slots.assign(cacheSize, CacheSlot{});
+        freeSlots.clear();
+        for (uint32_t i = cacheSize; i > 0; i--) {
+            freeSlots.push_back(i - 1);
+        }
+        residentPages.clear();
+
+        if (backend == Backend::Sparse) {
+            createSparseImage();
+        } else {
+            createPhysicalTexture();
+            createPageTable();
+        }
+
+        createSampler();
+        pinCoarsestMip(header);
+    }
+
+    void cleanup() {
+        for (PendingLoad& load : pendingLoads) {
+            jobSystem->wait(load.job);
+        }
+        pendingLoads.clear();
+
+        sampler.reset();
+
+        imageView.reset();
+        image.reset();
+        imageMemory.reset();
+
+        mipTailMemory.reset();
+        bindFence.reset();
+        bindSemaphores.clear();
+
+        pageTableView.reset();
+        pageTableImage.reset();
+        pageTableMemory.reset();
+        pageTableStaging.clear();
+
+        stagingBuffer.reset();
+        stagingMemory.reset();
+        file.close();
+    }
+
+    Backend getBackend() const { return backend; }
+
+    // The sparse image, or the physical texture of the indirection backend.
+    VkImageView getImageView() const { return imageView; }
+    VkSampler getSampler() const { return sampler; }
+
+    // Indirection backend only, sampled as a usampler2D with texelFetch.
+    VkImageView getPageTableView() const { return pageTableView; }
+
+    VirtualTextureConstants getShaderConstants(uint32_t feedbackDivisor = 1) const {
+        const VirtualTextureFileHeader& header = file.getHeader();
+        VirtualTextureConstants constants{};
+        constants.virtualSize = glm::vec2(static_cast<float>(header.width), static_cast<float>(header.height));
+        constants.physicalSize = glm::vec2(static_cast<float>(slotsPerRow * file.getPaddedTileSize()));
+        constants.tileSize = static_cast<float>(header.tileSize);
+        constants.border = backend == Backend::Sparse ? 0.0f : static_cast<float>(header.border);
+        constants.maxMip = static_cast<float>(header.mipLevels - 1);
+        constants.feedbackBias = -std::log2(static_cast<float>(feedbackDivisor));
+        return constants;
+    }
+
+    // Pages from VirtualTextureFeedback::collectRequests(). A page whose parent is not resident yet
+    // loads the parent first, so detail always refines from the coarsest mip down.
+    void requestPages(const std::vector<uint32_t>& pages) {
+        const VirtualTextureFileHeader& header = file.getHeader();
+
+        for (uint32_t page : pages) {
+            uint32_t mip = pageMip(page);
+            if (mip >= header.mipLevels || pageX(page) >= file.getTilesX(mip) || pageY(page) >= file.getTilesY(mip)) {
+                continue;
+            }
+
+            // Walk up to the first resident ancestor, touching it since it is what gets sampled meanwhile.
+            uint32_t wanted = page;
+            uint32_t current = page;
+            while (!touch(current)) {
+                wanted = current;
+                current = parentPage(current);
+            }
+            if (wanted != current && loadingPages.count(wanted) == 0) {
+                loadQueue.push_back(wanted);
+                loadingPages.insert(wanted);
+            }
+        }
+
+        // Coarse pages first, they unblock everything below them.
+        std::stable_sort(loadQueue.begin(), loadQueue.end(), [](uint32_t a, uint32_t b) {
+            return pageMip(a) > pageMip(b);
+        });
+        startLoads();
+    }
+
+    // Once per frame, after waiting for the frame's fence. Records the uploads into commandBuffer, outside
+    // of a render pass and before anything that samples the texture. With the sparse backend the returned
+    // semaphore is signaled by the page binds and the frame's submit has to wait on it at
+    // VK_PIPELINE_STAGE_TRANSFER_BIT; it is VK_NULL_HANDLE when nothing was bound.
+    VkSemaphore update(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        stats.uploadedPages = 0;
+        stats.evictedPages = 0;
+        stats.droppedPages = 0;
+
+        // The frames that copied out of these slots have finished.
+        for (size_t i = 0; i < retiredStagingSlots.size();) {
+            if (retiredStagingSlots[i].frame + framesInFlight <= frameNumber) {
+                freeStagingSlots.push_back(retiredStagingSlots[i].slot);
+                retiredStagingSlots.erase(retiredStagingSlots.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        std::vector<PendingLoad> ready;
+        for (size_t i = 0; i < pendingLoads.size() && ready.size() < maxUploadsPerFrame;) {
+            if (pendingLoads[i].job->finished) {
+                ready.push_back(pendingLoads[i]);
+                pendingLoads.erase(pendingLoads.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        std::vector<TileUpload> uploads;
+        std::vector<uint32_t> evicted;
+        for (const PendingLoad& load : ready) {
+            loadingPages.erase(load.page);
+
+            uint32_t slot = allocateSlot(evicted);
+            if (slot == UINT32_MAX) {
+                freeStagingSlots.push_back(load.stagingSlot);
+                stats.droppedPages++;
+                continue;
+            }
+
+            slots[slot].page = load.page;
+            slots[slot].lastUsedFrame = frameNumber;
+            residentPages[load.page] = slot;
+            uploads.push_back({load.page, slot, load.stagingSlot});
+        }
+
+        VkSemaphore bindSemaphore = VK_NULL_HANDLE;
+        if (!uploads.empty()) {
+            if (backend == Backend::Sparse && bindSparsePages(uploads, evicted, bindSemaphores[currentFrame], VK_NULL_HANDLE)) {
+                bindSemaphore = bindSemaphores[currentFrame];
+            }
+            recordTileUploads(commandBuffer, uploads);
+            if (backend == Backend::Indirection) {
+                recordPageTableUpdate(commandBuffer, currentFrame);
+            }
+            stats.uploadedPages = static_cast<uint32_t>(uploads.size());
+            stats.evictedPages = static_cast<uint32_t>(evicted.size());
+        }
+
+        for (const TileUpload& upload : uploads) {
+            retiredStagingSlots.push_back({frameNumber, upload.stagingSlot});
+        }
+
+        startLoads();
+
+        stats.residentPages = static_cast<uint32_t>(residentPages.size());
+        stats.cacheSize = static_cast<uint32_t>(slots.size());
+        stats.pendingLoads = static_cast<uint32_t>(pendingLoads.size() + loadQueue.size());
+        frameNumber++;
+
+        return bindSemaphore;
+    }
+
+    const VirtualTextureStats& getStats() const {
+        return stats;
+    }
+
+    void printStats() const {
+        std::cout << "virtual texture (" << (backend == Backend::Sparse ? "sparse" : "indirection") << "): " << stats.residentPages << "/" << stats.cacheSize
+            << " pages resident, " << stats.pendingLoads << " pending, " << stats.uploadedPages << " uploaded, " << stats.evictedPages << " evicted, "
+            << stats.droppedPages << " dropped" << std::endl;
+    }
+
+private:
+    struct CacheSlot {
+        uint32_t page = VIRTUAL_PAGE_NONE;
+        uint64_t lastUsedFrame = 0;
+        bool pinned = false;
+    };
+
+    struct PendingLoad {
+        uint32_t page;
+        uint32_t stagingSlot;
+        JobHandle job;
+    };
+
+    struct TileUpload {
+        uint32_t page;
+        uint32_t slot;
+        uint32_t stagingSlot;
+    };
+
+    struct RetiredStagingSlot {
+        uint64_t frame;
+        uint32_t slot;
+    };
+
+    struct PageTableStaging {
+        UniqueDeviceMemory memory;
+        UniqueBuffer buffer;
+    };
+
+    VulkanContext context;
+    const VulkanDeviceTable* dispatch = nullptr;
+    JobSystem* jobSystem = nullptr;
+    VkQueue sparseQueue = VK_NULL_HANDLE;
+    Backend backend = Backend::Indirection;
+    VirtualTextureFile file;
+    uint32_t framesInFlight = 0;
+    uint32_t maxUploadsPerFrame = 0;
+    uint64_t frameNumber = 0;
+    VirtualTextureStats stats;
+
+    std::vector<CacheSlot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<uint32_t, uint32_t> residentPages;
+
+    std::vector<uint32_t> loadQueue;
+    std::unordered_set<uint32_t> loadingPages;
+    std::vector<PendingLoad> pendingLoads;
+
+    uint32_t stagingSlotCount = 0;
+    std::vector<uint32_t> freeStagingSlots;
+    std::vector<RetiredStagingSlot> retiredStagingSlots;
+    UniqueDeviceMemory stagingMemory;
+    UniqueBuffer stagingBuffer;
+    void* stagingData = nullptr;
+
+    UniqueDeviceMemory imageMemory;
+    UniqueImage image;
+    UniqueImageView imageView;
+    UniqueSampler sampler;
+
+    // Sparse backend
+    VkDeviceSize pageSize = 0;
+    uint32_t mipTailFirstLod = 0;
+    UniqueDeviceMemory mipTailMemory;
+    UniqueFence bindFence;                          // create time binds
+    std::vector<UniqueSemaphore> bindSemaphores;    // one per frame in flight
+
+    // Indirection backend
+    uint32_t slotsPerRow = 0;
+    uint32_t pageTableWidth = 0;
+    uint32_t pageTableHeight = 0;
+    std::vector<std::vector<uint8_t>> pageTable;
+    UniqueDeviceMemory pageTableMemory;
+    UniqueImage pageTableImage;
+    UniqueImageView pageTableView;
+    std::vector<PageTableStaging> pageTableStaging;  // one per frame in flight
+    VkDeviceSize pageTableBytes = 0;
+
+    static uint32_t parentPage(uint32_t page) {
+        return packPageId(pageMip(page) + 1, pageX(page) / 2, pageY(page) / 2);
+    }
+
+    bool isResident(uint32_t page) const {
+        return (backend == Backend::Sparse && pageMip(page) >= mipTailFirstLod) || residentPages.count(page) != 0;
+    }
+
+    // Marks a resident page as used this frame. Returns false when it is not resident.
+    bool touch(uint32_t page) {
+        if (backend == Backend::Sparse && pageMip(page) >= mipTailFirstLod) {
+            return true;
+        }
+
+        auto it = residentPages.find(page);
+        if (it == residentPages.end()) {
+            return false;
+        }
+        slots[it->second].lastUsedFrame = frameNumber;
+        return true;
+    }
+
+    void startLoads() {
+        while (!loadQueue.empty() && !freeStagingSlots.empty()) {
+            uint32_t page = loadQueue.front();
+            loadQueue.erase(loadQueue.begin());
+
+            uint32_t stagingSlot = freeStagingSlots.back();
+            freeStagingSlots.pop_back();
+
+            const uint8_t* source = file.getTileData(page);
+            uint8_t* destination = static_cast<uint8_t*>(stagingData) + stagingSlot * file.getTileBytes();
+            size_t size = static_cast<size_t>(file.getTileBytes());
+            // Touching the mapping is what reads the tile from disk, off the main thread.
+            JobHandle job = jobSystem->run([source, destination, size]() {
+                memcpy(destination, source, size);
+            });
+            pendingLoads.push_back({page, stagingSlot, job});
+        }
+    }
+
+    // A free slot, or the least recently used one that no frame in flight needs. Frames still on the GPU
+    // may sample the pages they used, so those keep their memory until the frames have finished.
+    uint32_t allocateSlot(std::vector<uint32_t>& evicted) {
+        if (!freeSlots.empty()) {
+            uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+
+        uint32_t victim = UINT32_MAX;
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (slots[i].pinned || slots[i].lastUsedFrame + framesInFlight > frameNumber) {
+                continue;
+            }
+            if (victim == UINT32_MAX || slots[i].lastUsedFrame < slots[victim].lastUsedFrame) {
+                victim = i;
+            }
+        }
+
+        if (victim != UINT32_MAX) {
+            residentPages.erase(slots[victim].page);
+            evicted.push_back(slots[victim].page);
+            slots[victim].page = VIRTUAL_PAGE_NONE;
+        }
+        return victim;
+    }
+
+    bool supportsSparse() {
+        // vt_sparse.frag needs shaderResourceResidency for its residency queries.
+        VkPhysicalDeviceFeatures features;
+        vkGetPhysicalDeviceFeatures(context.physicalDevice, &features);
+        if (!features.sparseBinding || !features.sparseResidencyImage2D || !features.shaderResourceResidency) {
+            return false;
+        }
+
+        uint32_t propertyCount = 0;
+        vkGetPhysicalDeviceSparseImageFormatProperties(context.physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_TILING_OPTIMAL, &propertyCount, nullptr);
+        if (propertyCount == 0) {
+            return false;
+        }
+
+        std::vector<VkSparseImageFormatProperties> properties(propertyCount);
+        vkGetPhysicalDeviceSparseImageFormatProperties(context.physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, VK_SAMPLE_COUNT_1_BIT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_IMAGE_TILING_OPTIMAL, &propertyCount, properties.data());
+
+        // One page has to be exactly one tile of the file.
+        const VkExtent3D& granularity = properties[0].imageGranularity;
+        return granularity.width == file.getHeader().tileSize && granularity.height == file.getHeader().tileSize;
+    }
+
+    void createSparseImage() {
+        const VirtualTextureFileHeader& header = file.getHeader();
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(context.device, &fenceInfo, nullptr, bindFence.put(context.device)) != VK_SUCCESS) {
+            bindFence.release();
+            throw std::runtime_error("failed to create sparse bind fence!");
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        bindSemaphores.clear();
+        for (uint32_t i = 0; i < framesInFlight; i++) {
+            UniqueSemaphore semaphore;
+            if (vkCreateSemaphore(context.device, &semaphoreInfo, nullptr, semaphore.put(context.device)) != VK_SUCCESS) {
+                semaphore.release();
+                throw std::runtime_error("failed to create sparse bind semaphore!");
+            }
+            bindSemaphores.push_back(std::move(semaphore));
+        }
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.flags = VK_IMAGE_CREATE_SPARSE_BINDING_BIT | VK_IMAGE_CREATE_SPARSE_RESIDENCY_BIT;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = header.width;
+        imageInfo.extent.height = header.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = header.mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateImage(context.device, &imageInfo, nullptr, image.put(context.device)) != VK_SUCCESS) {
+            image.release();
+            throw std::runtime_error("failed to create sparse image!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(context.device, image, &memRequirements);
+        pageSize = memRequirements.alignment;
+
+        uint32_t requirementCount = 0;
+        vkGetImageSparseMemoryRequirements(context.device, image, &requirementCount, nullptr);
+        std::vector<VkSparseImageMemoryRequirements> sparseRequirements(requirementCount);
+        vkGetImageSparseMemoryRequirements(context.device, image, &requirementCount, sparseRequirements.data());
+        if (sparseRequirements.empty()) {
+            throw std::runtime_error("failed to query sparse image memory requirements!");
+        }
+        const VkSparseImageMemoryRequirements& requirements = sparseRequirements[0];
+        mipTailFirstLod = std::min(requirements.imageMipTailFirstLod, header.mipLevels);
+
+        // The cache is one allocation of page sized slots.
+        uint32_t memoryType = findMemoryType(context.physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = pageSize * slots.size();
+        allocInfo.memoryTypeIndex = memoryType;
+
+        if (vkAllocateMemory(context.device, &allocInfo, nullptr, imageMemory.put(context.device)) != VK_SUCCESS) {
+            imageMemory.release();
+            throw std::runtime_error("failed to allocate sparse page memory!");
+        }
+
+        // The mip tail can't be bound per page; it is bound once and filled below with the pinned mips.
+        if (mipTailFirstLod < header.mipLevels) {
+            allocInfo.allocationSize = requirements.imageMipTailSize;
+            if (vkAllocateMemory(context.device, &allocInfo, nullptr, mipTailMemory.put(context.device)) != VK_SUCCESS) {
+                mipTailMemory.release();
+                throw std::runtime_error("failed to allocate sparse mip tail memory!");
+            }
+
+            VkSparseMemoryBind mipTailBind{};
+            mipTailBind.resourceOffset = requirements.imageMipTailOffset;
+            mipTailBind.size = requirements.imageMipTailSize;
+            mipTailBind.memory = mipTailMemory;
+            mipTailBind.memoryOffset = 0;
+
+            VkSparseImageOpaqueMemoryBindInfo opaqueBindInfo{};
+            opaqueBindInfo.image = image;
+            opaqueBindInfo.bindCount = 1;
+            opaqueBindInfo.pBinds = &mipTailBind;
+
+            VkBindSparseInfo bindInfo{};
+            bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+            bindInfo.imageOpaqueBindCount = 1;
+            bindInfo.pImageOpaqueBinds = &opaqueBindInfo;
+
+            if (vkQueueBindSparse(sparseQueue, 1, &bindInfo, bindFence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to bind sparse mip tail!");
+            }
+            waitForBindFence();
+        }
+
+        imageView = createUniqueImageView(context.device, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 0, header.mipLevels);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        VkImageMemoryBarrier barrier = makeBarrier(image, header.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        endSingleTimeCommands(context, commandBuffer);
+    }
+
+    void createPhysicalTexture() {
+        slotsPerRow = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(slots.size()))));
+        uint32_t size = slotsPerRow * file.getPaddedTileSize();
+
+        createImage(context, size, size, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+        imageView = createUniqueImageView(context.device, image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        VkImageMemoryBarrier barrier = makeBarrier(image, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        endSingleTimeCommands(context, commandBuffer);
+    }
+
+    // Level m of the page table has a texel for every page of mip m. The base size is rounded up to a
+    // power of two so every level is at least as large as the page grid of its mip.
+    void createPageTable() {
+        const VirtualTextureFileHeader& header = file.getHeader();
+        pageTableWidth = 1;
+        while (pageTableWidth < file.getTilesX(0)) {
+            pageTableWidth *= 2;
+        }
+        pageTableHeight = 1;
+        while (pageTableHeight < file.getTilesY(0)) {
+            pageTableHeight *= 2;
+        }
+
+        pageTable.resize(header.mipLevels);
+        pageTableBytes = 0;
+        for (uint32_t mip = 0; mip < header.mipLevels; mip++) {
+            pageTable[mip].assign(static_cast<size_t>(mipWidth(pageTableWidth, mip)) * mipWidth(pageTableHeight, mip) * 4, 0);
+            pageTableBytes += pageTable[mip].size();
+        }
+
+        createImage(context, pageTableWidth, pageTableHeight, header.mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pageTableImage, pageTableMemory);
+        pageTableView = createUniqueImageView(context.device, pageTableImage, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_ASPECT_COLOR_BIT, 0, header.mipLevels);
+
+        // Each frame in flight copies out of its own staging buffer.
+        pageTableStaging.resize(framesInFlight);
+        for (PageTableStaging& staging : pageTableStaging) {
+            createBuffer(context, pageTableBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                staging.buffer, staging.memory);
+        }
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+        VkImageMemoryBarrier barrier = makeBarrier(pageTableImage, header.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        endSingleTimeCommands(context, commandBuffer);
+    }
+
+    void createSampler() {
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.anisotropyEnable = VK_FALSE;
+        samplerInfo.maxAnisotropy = 1.0f;
+        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+        samplerInfo.compareEnable = VK_FALSE;
+        samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.minLod = 0.0f;
+        samplerInfo.maxLod = static_cast<float>(file.getHeader().mipLevels);
+
+        if (vkCreateSampler(context.device, &samplerInfo, nullptr, sampler.put(context.device)) != VK_SUCCESS) {
+            sampler.release();
+            throw std::runtime_error("failed to create virtual texture sampler!");
+        }
+    }
+
+    // Loads the single tile of the coarsest mip into a slot that is never evicted, so every page has a
+    // resident ancestor. The sparse backend already has it in the mip tail when the tail covers it.
+    // This runs at load time, so it waits for the binds and uploads instead of going through a frame.
+    void pinCoarsestMip(const VirtualTextureFileHeader& header) {
+        std::vector<uint32_t> pinned;
+        if (backend == Backend::Sparse) {
+            for (uint32_t mip = mipTailFirstLod; mip < header.mipLevels; mip++) {
+                for (uint32_t y = 0; y < file.getTilesY(mip); y++) {
+                    for (uint32_t x = 0; x < file.getTilesX(mip); x++) {
+                        pinned.push_back(packPageId(mip, x, y));
+                    }
+                }
+            }
+            if (pinned.empty()) {
+                pinned.push_back(packPageId(header.mipLevels - 1, 0, 0));
+            }
+        } else {
+            pinned.push_back(packPageId(header.mipLevels - 1, 0, 0));
+        }
+
+        for (uint32_t page : pinned) {
+            if (freeStagingSlots.empty()) {
+                throw std::runtime_error("not enough staging slots for the virtual texture mip tail!");
+            }
+            uint32_t stagingSlot = freeStagingSlots.back();
+            freeStagingSlots.pop_back();
+            memcpy(static_cast<uint8_t*>(stagingData) + stagingSlot * file.getTileBytes(), file.getTileData(page), static_cast<size_t>(file.getTileBytes()));
+
+            std::vector<TileUpload> uploads;
+            std::vector<uint32_t> evicted;
+            if (backend == Backend::Sparse && pageMip(page) >= mipTailFirstLod) {
+                uploads.push_back({page, UINT32_MAX, stagingSlot});
+            } else {
+                uint32_t slot = allocateSlot(evicted);
+                if (slot == UINT32_MAX) {
+                    throw std::runtime_error("virtual texture cache is too small!");
+                }
+                slots[slot].page = page;
+                slots[slot].pinned = true;
+                residentPages[page] = slot;
+                uploads.push_back({page, slot, stagingSlot});
+            }
+            if (backend == Backend::Sparse && bindSparsePages(uploads, evicted, VK_NULL_HANDLE, bindFence)) {
+                waitForBindFence();
+            }
+
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(context);
+            recordTileUploads(commandBuffer, uploads);
+            if (backend == Backend::Indirection) {
+                recordPageTableUpdate(commandBuffer, 0);
+            }
+            endSingleTimeCommands(context, commandBuffer);
+
+            freeStagingSlots.push_back(stagingSlot);
+        }
+    }
+
+    void waitForBindFence() {
+        vkWaitForFences(context.device, 1, bindFence.address(), VK_TRUE, UINT64_MAX);
+        vkResetFences(context.device, 1, bindFence.address());
+    }
+
+    void recordTileUploads(VkCommandBuffer commandBuffer, const std::vector<TileUpload>& uploads) {
+        const VirtualTextureFileHeader& header = file.getHeader();
+        uint32_t paddedSize = file.getPaddedTileSize();
+
+        std::vector<VkBufferImageCopy> regions;
+        for (const TileUpload& upload : uploads) {
+            VkBufferImageCopy region{};
+            region.bufferOffset = upload.stagingSlot * file.getTileBytes();
+            region.bufferImageHeight = 0;
+
+            if (backend == Backend::Sparse) {
+                // Only the interior of the tile, the hardware filters across pages by itself.
+                uint32_t mip = pageMip(upload.page);
+                uint32_t x = pageX(upload.page) * header.tileSize;
+                uint32_t y = pageY(upload.page) * header.tileSize;
+                region.bufferOffset += (static_cast<VkDeviceSize>(header.border) * paddedSize + header.border) * 4;
+                region.bufferRowLength = paddedSize;
+                region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+                region.imageOffset = {static_cast<int32_t>(x), static_cast<int32_t>(y), 0};
+                region.imageExtent = {std::min(header.tileSize, mipWidth(header.width, mip) - x), std::min(header.tileSize, mipWidth(header.height, mip) - y), 1};
+            } else {
+                region.bufferRowLength = 0;
+                region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+                region.imageOffset = {static_cast<int32_t>(upload.slot % slotsPerRow * paddedSize), static_cast<int32_t>(upload.slot / slotsPerRow * paddedSize), 0};
+                region.imageExtent = {paddedSize, paddedSize, 1};
+            }
+            regions.push_back(region);
+        }
+
+        uint32_t levelCount = backend == Backend::Sparse ? header.mipLevels : 1;
+
+        VkImageMemoryBarrier toTransfer = makeBarrier(image, levelCount, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        if (!regions.empty()) {
+            dispatch->vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+        }
+
+        VkImageMemoryBarrier toShader = makeBarrier(image, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toShader);
+    }
+
+    // Evicted pages lose their memory before the slot is bound to its new page, in one batch that
+    // signals signalSemaphore and fence. Returns false when there was nothing to bind.
+    bool bindSparsePages(const std::vector<TileUpload>& uploads, const std::vector<uint32_t>& evicted, VkSemaphore signalSemaphore, VkFence fence) {
+        const VirtualTextureFileHeader& header = file.getHeader();
+        std::vector<VkSparseImageMemoryBind> binds;
+
+        auto pageBind = [&](uint32_t page, VkDeviceMemory memory, VkDeviceSize memoryOffset) {
+            uint32_t mip = pageMip(page);
+            uint32_t x = pageX(page) * header.tileSize;
+            uint32_t y = pageY(page) * header.tileSize;
+
+            VkSparseImageMemoryBind bind{};
+            bind.subresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0};
+            bind.offset = {static_cast<int32_t>(x), static_cast<int32_t>(y), 0};
+            bind.extent = {std::min(header.tileSize, mipWidth(header.width, mip) - x), std::min(header.tileSize, mipWidth(header.height, mip) - y), 1};
+            bind.memory = memory;
+            bind.memoryOffset = memoryOffset;
+            binds.push_back(bind);
+        };
+
+        for (uint32_t page : evicted) {
+            pageBind(page, VK_NULL_HANDLE, 0);
+        }
+        for (const TileUpload& upload : uploads) {
+            if (upload.slot != UINT32_MAX) {
+                pageBind(upload.page, imageMemory, upload.slot * pageSize);
+            }
+        }
+        if (binds.empty()) {
+            return false;
+        }
+
+        VkSparseImageMemoryBindInfo imageBindInfo{};
+        imageBindInfo.image = image;
+        imageBindInfo.bindCount = static_cast<uint32_t>(binds.size());
+        imageBindInfo.pBinds = binds.data();
+
+        VkBindSparseInfo bindInfo{};
+        bindInfo.sType = VK_STRUCTURE_TYPE_BIND_SPARSE_INFO;
+        bindInfo.imageBindCount = 1;
+        bindInfo.pImageBinds = &imageBindInfo;
+        if (signalSemaphore != VK_NULL_HANDLE) {
+            bindInfo.signalSemaphoreCount = 1;
+            bindInfo.pSignalSemaphores = &signalSemaphore;
+        }
+
+        if (vkQueueBindSparse(sparseQueue, 1, &bindInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to bind sparse pages!");
+        }
+        return true;
+    }
+
+    // Rebuilds the page table from the coarsest mip down: resident pages point at their own slot, the
+    // others inherit the entry of their parent.
+    void recordPageTableUpdate(VkCommandBuffer commandBuffer, uint32_t currentFrame) {
+        const VirtualTextureFileHeader& header = file.getHeader();
+        for (uint32_t level = header.mipLevels; level > 0; level--) {
+            uint32_t mip = level - 1;
+            uint32_t width = mipWidth(pageTableWidth, mip);
+            uint32_t parentWidth = mipWidth(pageTableWidth, mip + 1);
+
+            for (uint32_t y = 0; y < file.getTilesY(mip); y++) {
+                for (uint32_t x = 0; x < file.getTilesX(mip); x++) {
+                    uint8_t* entry = &pageTable[mip][(static_cast<size_t>(y) * width + x) * 4];
+                    auto it = residentPages.find(packPageId(mip, x, y));
+                    if (it != residentPages.end()) {
+                        entry[0] = static_cast<uint8_t>(it->second % slotsPerRow);
+                        entry[1] = static_cast<uint8_t>(it->second / slotsPerRow);
+                        entry[2] = static_cast<uint8_t>(mip);
+                        entry[3] = 255;
+                    } else if (mip + 1 < header.mipLevels) {
+                        memcpy(entry, &pageTable[mip + 1][(static_cast<size_t>(y / 2) * parentWidth + x / 2) * 4], 4);
+                    }
+                }
+            }
+        }
+
+        const PageTableStaging& staging = pageTableStaging[currentFrame];
+        void* data;
+        vkMapMemory(context.device, staging.memory, 0, pageTableBytes, 0, &data);
+        std::vector<VkBufferImageCopy> regions;
+        VkDeviceSize offset = 0;
+        for (uint32_t mip = 0; mip < header.mipLevels; mip++) {
+            memcpy(static_cast<char*>(data) + offset, pageTable[mip].data(), pageTable[mip].size());
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = offset;
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {mipWidth(pageTableWidth, mip), mipWidth(pageTableHeight, mip), 1};
+            regions.push_back(region);
+
+            offset += pageTable[mip].size();
+        }
+        vkUnmapMemory(context.device, staging.memory);
+
+        VkImageMemoryBarrier toTransfer = makeBarrier(pageTableImage, header.mipLevels, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        dispatch->vkCmdCopyBufferToImage(commandBuffer, staging.buffer, pageTableImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+        VkImageMemoryBarrier toShader = makeBarrier(pageTableImage, header.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toShader);
+    }
+
+    static VkImageMemoryBarrier makeBarrier(VkImage image, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = levelCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        return barrier;
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "VulkanHelpers.h"
+
+#include <type_traits>
+#include <utility>
+
+// Move-only ownership of a device-level Vulkan handle: the handle is destroyed when its VulkanHandle
+// goes out of scope or is reset, so an exception or early return between create and cleanup() no
+// longer leaks it, and cleanup() shrinks to the objects that still need a particular order.
+//
+// A VulkanHandle is the handle and its device, nothing more. It converts to the raw handle
+// implicitly, so it drops into the existing vk* calls, and every member is inline, so recording with
+// one compiles to the same code as with the raw handle (asm/vulkan_handle_asm.sh compares the two).
+// It lives wherever the raw handle lived, by value in the owning class, so there is no allocation per
+// wrapper to pool.
+//
+//     UniqueBuffer buffer;
+//     if (vkCreateBuffer(device, &bufferInfo, nullptr, buffer.put(device)) != VK_SUCCESS) {
+//         throw std::runtime_error("failed to create buffer!");
+//     }
+//     vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffer.address(), offsets);
+//
+// The wrapper is keyed on a traits type per object type rather than on the handle type: 32-bit
+// builds define every non-dispatchable handle as uint64_t, so VkBuffer and VkImage would be the same
+// key there.
+
+template <typename Traits>
+class VulkanHandle {
+public:
+    typedef typename Traits::Handle T;
+
+    VulkanHandle() noexcept = default;
+
+    VulkanHandle(VkDevice device, T handle) noexcept : device(device), handle(handle) {
+    }
+
+    VulkanHandle(const VulkanHandle&) = delete;
+    VulkanHandle& operator=(const VulkanHandle&) = delete;
+
+    VulkanHandle(VulkanHandle&& other) noexcept : device(other.device), handle(std::exchange(other.handle, VK_NULL_HANDLE)) {
+    }
+
+    VulkanHandle& operator=(VulkanHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            device = other.device;
+            handle = std::exchange(other.handle, VK_NULL_HANDLE);
+        }
+        return *this;
+    }
+
+    ~VulkanHandle() {
+        reset();
+    }
+
+    T get() const noexcept {
+        return handle;
+    }
+
+    operator T() const noexcept {
+        return handle;
+    }
+
+    explicit operator bool() const noexcept {
+        return handle != VK_NULL_HANDLE;
+    }
+
+    // For the vk* calls that take an array of handles.
+    const T* address() const noexcept {
+        return &handle;
+    }
+
+    // Destroys the current handle and returns where vkCreate* should write the new one.
+    T* put(VkDevice device) noexcept {
+        reset();
+        this->device = device;
+        return &handle;
+    }
+
+    // Gives up ownership without destroying the handle.
+    T release() noexcept {
+        return std::exchange(handle, VK_NULL_HANDLE);
+    }
+
+    void reset() noexcept {
+        if (handle != VK_NULL_HANDLE) {
+            Traits::destroy(device, handle);
+            handle = VK_NULL_HANDLE;
+        }
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    T handle = VK_NULL_HANDLE;
+};
+
+#define VULKAN_HANDLE_TYPE(Name, Type, destroyFunction)                 \
+    struct Name##Traits {                                               \
+        typedef Type Handle;                                            \
+        static void destroy(VkDevice device, Type handle) noexcept {    \
+            destroyFunction(device, handle, nullptr);                   \
+        }                                                               \
+    };                                                                  \
+    typedef VulkanHandle<Name##Traits> Name;
+
+VULKAN_HANDLE_TYPE(UniqueDeviceMemory, VkDeviceMemory, vkFreeMemory)
+VULKAN_HANDLE_TYPE(UniqueBuffer, VkBuffer, vkDestroyBuffer)
+VULKAN_HANDLE_TYPE(UniqueImage, VkImage, vkDestroyImage)
+VULKAN_HANDLE_TYPE(UniqueImageView, VkImageView, vkDestroyImageView)
+VULKAN_HANDLE_TYPE(UniqueSampler, VkSampler, vkDestroySampler)
+VULKAN_HANDLE_TYPE(UniqueShaderModule, VkShaderModule, vkDestroyShaderModule)
+VULKAN_HANDLE_TYPE(UniquePipelineCache, VkPipelineCache, vkDestroyPipelineCache)
+VULKAN_HANDLE_TYPE(UniquePipelineLayout, VkPipelineLayout, vkDestroyPipelineLayout)
+VULKAN_HANDLE_TYPE(UniquePipeline, VkPipeline, vkDestroyPipeline)
+VULKAN_HANDLE_TYPE(UniqueRenderPass, VkRenderPass, vkDestroyRenderPass)
+VULKAN_HANDLE_TYPE(UniqueFramebuffer, VkFramebuffer, vkDestroyFramebuffer)
+VULKAN_HANDLE_TYPE(UniqueDescriptorSetLayout, VkDescriptorSetLayout, vkDestroyDescriptorSetLayout)
+VULKAN_HANDLE_TYPE(UniqueDescriptorPool, VkDescriptorPool, vkDestroyDescriptorPool)
+VULKAN_HANDLE_TYPE(UniqueCommandPool, VkCommandPool, vkDestroyCommandPool)
+VULKAN_HANDLE_TYPE(UniqueFence, VkFence, vkDestroyFence)
+VULKAN_HANDLE_TYPE(UniqueSemaphore, VkSemaphore, vkDestroySemaphore)
+VULKAN_HANDLE_TYPE(UniqueQueryPool, VkQueryPool, vkDestroyQueryPool)
+
+#undef VULKAN_HANDLE_TYPE
+
+// The wrapper has to stay as cheap to hold and pass around as the handle and its device, and it must
+// not be copyable, or two owners would destroy the same handle.
+static_assert(sizeof(UniqueBuffer) == sizeof(VkDevice) + sizeof(VkBuffer), "VulkanHandle must add no state");
+static_assert(std::is_standard_layout<UniqueBuffer>::value, "VulkanHandle must keep the layout of its members");
+static_assert(!std::is_copy_constructible<UniqueBuffer>::value && !std::is_copy_assignable<UniqueBuffer>::value,
+    "VulkanHandle must be move-only");
+static_assert(std::is_nothrow_move_constructible<UniqueBuffer>::value && std::is_nothrow_move_assignable<UniqueBuffer>::value,
+    "VulkanHandle must move without throwing so containers move instead of copy");
+static_assert(std::is_nothrow_destructible<UniqueBuffer>::value, "VulkanHandle must destroy without throwing");
+
+inline UniqueShaderModule createUniqueShaderModule(VkDevice device, const std::vector<char>& code) {
+    return UniqueShaderModule(device, createShaderModule(device, code));
+}
+
+inline UniqueImageView createUniqueImageView(VkDevice device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel = 0, uint32_t levelCount = 1) {
+    return UniqueImageView(device, createImageView(device, image, format, aspectFlags, baseMipLevel, levelCount));
+}
+
+// createBuffer() and createImage() into owned handles. Owners declare the memory before the buffer or
+// image, so it is freed after them.
+inline void createBuffer(const VulkanContext& context, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, UniqueBuffer& buffer, UniqueDeviceMemory& bufferMemory) {
+    VkBuffer rawBuffer;
+    VkDeviceMemory rawMemory;
+    createBuffer(context, size, usage, properties, rawBuffer, rawMemory);
+    buffer = UniqueBuffer(context.device, rawBuffer);
+    bufferMemory = UniqueDeviceMemory(context.device, rawMemory);
+}
+
+inline void createImage(const VulkanContext& context, uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling,
+    VkImageUsageFlags usage, VkMemoryPropertyFlags properties, UniqueImage& image, UniqueDeviceMemory& imageMemory) {
+    VkImage rawImage;
+    VkDeviceMemory rawMemory;
+    createImage(context, width, height, mipLevels, numSamples, format, tiling, usage, properties, rawImage, rawMemory);
+    image = UniqueImage(context.device, rawImage);
+    imageMemory = UniqueDeviceMemory(context.device, rawMemory);
+}
+
+// Runs cleanup when the scope ends, for things without a handle of their own, such as a RenderGraph or
+// a command buffer that goes back to its pool. After dismiss() it does nothing.
+template <typename Cleanup>
+class ScopeExit {
+public:
+    explicit ScopeExit(Cleanup cleanup) : cleanup(std::move(cleanup)) {}
+    ScopeExit(const ScopeExit&) = delete;
+    ScopeExit& operator=(const ScopeExit&) = delete;
+
+    ~ScopeExit() {
+        if (active) {
+            cleanup();
+        }
+    }
+
+    void dismiss() {
+        active = false;
+    }
+
+private:
+    Cleanup cleanup;
+    bool active = true;
+};
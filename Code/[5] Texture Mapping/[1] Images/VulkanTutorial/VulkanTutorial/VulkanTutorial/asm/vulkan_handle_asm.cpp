@@ -0,0 +1,37 @@
+// Compiled by vulkan_handle_asm.sh. drawRaw() and drawWrapped() record the same draw, one from raw
+// handles and one from VulkanHandle members; the script checks their assembly is identical. RawMesh
+// keeps a device next to every handle so both structs have the same layout and field offsets.
+
+#include "VulkanHandle.h"
+
+struct RawMesh {
+    VkDevice pipelineDevice;
+    VkPipeline pipeline;
+    VkDevice vertexDevice;
+    VkBuffer vertexBuffer;
+    VkDevice indexDevice;
+    VkBuffer indexBuffer;
+};
+
+struct WrappedMesh {
+    UniquePipeline pipeline;
+    UniqueBuffer vertexBuffer;
+    UniqueBuffer indexBuffer;
+};
+
+template <typename Mesh, typename VertexBuffers>
+static void recordDraw(VkCommandBuffer commandBuffer, const Mesh& mesh, VertexBuffers vertexBuffers) {
+    VkDeviceSize offset = 0;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh.pipeline);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers(mesh), &offset);
+    vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexed(commandBuffer, 3, 1, 0, 0, 0);
+}
+
+extern "C" void drawRaw(VkCommandBuffer commandBuffer, const RawMesh& mesh) {
+    recordDraw(commandBuffer, mesh, [](const RawMesh& mesh) { return &mesh.vertexBuffer; });
+}
+
+extern "C" void drawWrapped(VkCommandBuffer commandBuffer, const WrappedMesh& mesh) {
+    recordDraw(commandBuffer, mesh, [](const WrappedMesh& mesh) { return mesh.vertexBuffer.address(); });
+}
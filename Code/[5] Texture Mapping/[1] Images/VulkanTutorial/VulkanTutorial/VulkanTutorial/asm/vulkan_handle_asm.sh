@@ -0,0 +1,52 @@
+#!/bin/sh
+# Checks that recording through VulkanHandle compiles to the same code as recording through raw
+# handles: builds vulkan_handle_asm.cpp with -O2 -S, prints the listings of drawRaw() and
+# drawWrapped() and exits non-zero when they differ.
+#
+#     asm/vulkan_handle_asm.sh [compiler] [extra compiler flags...]
+#
+# The compiler defaults to c++ and has to emit ELF assembly (GCC or Clang). The Vulkan headers come
+# from External Libraries unless VULKAN_INCLUDE names another include directory.
+
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+compiler=${1:-c++}
+[ $# -gt 0 ] && shift
+include=${VULKAN_INCLUDE:-"$here/../External Libraries/Vulkan/Include"}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+"$compiler" -std=c++17 -O2 -S -I"$include" -I"$here/.." "$@" \
+    "$here/vulkan_handle_asm.cpp" -o "$work/listing.s"
+
+# The body of one function, without the local labels whose numbers differ between the two.
+extract() {
+    awk -v name="$1" '
+        $0 == name ":" { inside = 1; next }
+        inside && $1 == ".size" { exit }
+        inside && $0 !~ /^\.L(FB|FE)[0-9]+:/ { print }
+    ' "$work/listing.s"
+}
+
+extract drawRaw > "$work/raw.s"
+extract drawWrapped > "$work/wrapped.s"
+
+echo "drawRaw:"
+cat "$work/raw.s"
+echo
+echo "drawWrapped:"
+cat "$work/wrapped.s"
+echo
+
+if [ ! -s "$work/raw.s" ]; then
+    echo "drawRaw not found in the listing" >&2
+    exit 1
+fi
+if diff -u "$work/raw.s" "$work/wrapped.s"; then
+    echo "identical"
+else
+    echo "VulkanHandle changes the recorded code" >&2
+    exit 1
+fi
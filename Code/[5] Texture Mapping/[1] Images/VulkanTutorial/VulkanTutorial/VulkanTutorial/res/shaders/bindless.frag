@@ -0,0 +1,30 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Set 1 is BindlessDescriptors: the material buffer and every texture of the scene.
+struct Material {
+    vec4 baseColorFactor;
+    uint baseColorTexture;
+    uint normalTexture;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer MaterialBuffer {
+    Material materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragMaterialIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    Material material = materials[fragMaterialIndex];
+    // The index can differ between the invocations of a subgroup once draws are batched.
+    vec4 baseColor = texture(textures[nonuniformEXT(material.baseColorTexture)], fragTexCoord);
+    outColor = baseColor * material.baseColorFactor * vec4(fragColor, 1.0);
+}
@@ -0,0 +1,36 @@
+#version 450
+
+// Like indirect.vert, but passes the material of the draw on to bindless.frag.
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+struct DrawData {
+    mat4 model;
+    uint meshIndex;
+    uint materialIndex;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, binding = 1) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterialIndex;
+
+void main() {
+    DrawData draw = draws[gl_InstanceIndex];
+    gl_Position = ubo.proj * ubo.view * draw.model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+    fragTexCoord = inTexCoord;
+    fragMaterialIndex = draw.materialIndex;
+}
@@ -0,0 +1,35 @@
+#version 450
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+struct DrawData {
+    mat4 model;
+    uint meshIndex;
+    uint materialIndex;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, binding = 1) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+// Index of the object drawn by this call when firstInstance can't carry it, 0 otherwise.
+layout(push_constant) uniform IndirectDrawConstants {
+    uint firstDraw;
+} constants;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    // Every indirect command sets firstInstance to its object index, or the index is pushed per draw.
+    gl_Position = ubo.proj * ubo.view * draws[gl_InstanceIndex + constants.firstDraw].model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+}
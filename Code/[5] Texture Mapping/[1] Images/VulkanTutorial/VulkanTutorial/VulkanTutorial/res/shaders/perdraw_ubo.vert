@@ -0,0 +1,26 @@
+#version 450
+
+// Fallback of perdraw.vert for per-draw data larger than maxPushConstantsSize. The same block is read
+// from the UniformRing, bound at set 1 with a dynamic offset per draw.
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(set = 1, binding = 0) uniform PerDrawData {
+    mat4 model;
+    uint materialIndex;
+} draw;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) flat out uint fragMaterialIndex;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * draw.model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+    fragMaterialIndex = draw.materialIndex;
+}
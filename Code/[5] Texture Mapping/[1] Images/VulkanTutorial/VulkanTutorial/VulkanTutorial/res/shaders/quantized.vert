@@ -0,0 +1,34 @@
+#version 450
+
+// Vertex shader for VertexFormat::compact(). The fixed function vertex fetch already turns the snorm,
+// unorm and half formats back into floats; ubo.model includes VertexLayout::getDequantizeMatrix(),
+// ubo.normalMatrix does not (see QuantizedUniformBufferObject).
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 normalMatrix;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec2 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragNormal;
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    fragColor = inColor.rgb;
+    fragTexCoord = inTexCoord;
+    fragNormal = normalize(mat3(ubo.normalMatrix) * octahedralDecode(inNormal));
+}
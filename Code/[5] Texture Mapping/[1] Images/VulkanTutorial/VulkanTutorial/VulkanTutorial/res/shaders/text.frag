@@ -0,0 +1,26 @@
+#version 450
+
+layout(push_constant) uniform TextPushConstants {
+    vec2 screenScale;
+    uint distanceField;
+} text;
+
+layout(binding = 0) uniform sampler2D glyphAtlas;
+
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    float value = texture(glyphAtlas, fragTexCoord).r;
+
+    // Distance fields have the glyph edge at 0.5; antialias across one pixel of screen space.
+    float coverage = value;
+    if (text.distanceField != 0) {
+        float width = max(fwidth(value), 1e-4);
+        coverage = clamp((value - 0.5) / width + 0.5, 0.0, 1.0);
+    }
+
+    outColor = vec4(fragColor.rgb, fragColor.a * coverage);
+}
@@ -0,0 +1,26 @@
+#version 450
+
+// TextRenderer: one instance per glyph, expanded to a quad from a 4 vertex triangle strip.
+layout(push_constant) uniform TextPushConstants {
+    vec2 screenScale;
+    uint distanceField;
+} text;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inSize;
+layout(location = 2) in vec2 inUvMin;
+layout(location = 3) in vec2 inUvMax;
+layout(location = 4) in vec4 inColor;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 pixel = inPosition + corner * inSize;
+
+    // Pixels from the top left corner of the framebuffer, which is where Vulkan puts -1, -1.
+    gl_Position = vec4(pixel * text.screenScale - 1.0, 0.0, 1.0);
+    fragTexCoord = mix(inUvMin, inUvMax, corner);
+    fragColor = inColor;
+}
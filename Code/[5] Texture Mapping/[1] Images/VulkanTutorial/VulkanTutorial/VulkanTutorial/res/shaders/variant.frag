@@ -0,0 +1,48 @@
+#version 450
+
+// One source for every variant; ShaderVariantConstants sets these when the pipeline is created, so
+// the compiler folds the branches and unrolls the light loop instead of testing them per fragment.
+// The constant IDs must stay in sync with ShaderVariantConstants::getMapEntries().
+layout(constant_id = 0) const bool TEXTURED = false;
+layout(constant_id = 1) const bool ALPHA_TEST = false;
+layout(constant_id = 2) const uint LIGHT_COUNT = 0;
+layout(constant_id = 3) const float ALPHA_CUTOFF = 0.5;
+
+const uint MAX_LIGHTS = 8;
+
+layout(binding = 1) uniform sampler2D texSampler;
+
+// xyz position and range, rgb colour and intensity.
+layout(binding = 2) uniform LightBuffer {
+    vec4 positions[MAX_LIGHTS];
+    vec4 colors[MAX_LIGHTS];
+    vec4 ambient;
+} lights;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragWorldPosition;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec4 color = vec4(fragColor, 1.0);
+    if (TEXTURED) {
+        color *= texture(texSampler, fragTexCoord);
+    }
+    if (ALPHA_TEST && color.a < ALPHA_CUTOFF) {
+        discard;
+    }
+
+    if (LIGHT_COUNT > 0) {
+        vec3 light = lights.ambient.rgb;
+        for (uint i = 0; i < min(LIGHT_COUNT, MAX_LIGHTS); i++) {
+            float lightDistance = length(lights.positions[i].xyz - fragWorldPosition);
+            float attenuation = clamp(1.0 - lightDistance / lights.positions[i].w, 0.0, 1.0);
+            light += lights.colors[i].rgb * lights.colors[i].a * attenuation * attenuation;
+        }
+        color.rgb *= light;
+    }
+
+    outColor = color;
+}
@@ -0,0 +1,25 @@
+#version 450
+
+// shader.vert for the specialized variants of variant.frag; passes the world position on for the
+// lights.
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragWorldPosition;
+
+void main() {
+    vec4 worldPosition = ubo.model * vec4(inPosition, 1.0);
+    gl_Position = ubo.proj * ubo.view * worldPosition;
+    fragColor = inColor;
+    fragTexCoord = inTexCoord;
+    fragWorldPosition = worldPosition.xyz;
+}
@@ -0,0 +1,30 @@
+#version 450
+
+// Writes the virtual texture page every pixel needs into VirtualTextureFeedback's R32_UINT target.
+layout(push_constant) uniform VirtualTextureConstants {
+    vec2 virtualSize;
+    vec2 physicalSize;
+    float tileSize;
+    float border;
+    float maxMip;
+    float feedbackBias;
+} vt;
+
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out uint outPage;
+
+void main() {
+    vec2 texel = fragTexCoord * vt.virtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    // The feedback target is smaller than the screen, which makes the derivatives larger by the same factor.
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt.feedbackBias;
+    uint mip = uint(clamp(floor(lod), 0.0, vt.maxMip));
+
+    uvec2 mipSize = max(uvec2(vt.virtualSize) >> mip, uvec2(1));
+    uvec2 lastPage = (mipSize - 1) / uint(vt.tileSize);
+    uvec2 page = min(uvec2(clamp(fragTexCoord, 0.0, 1.0) * vec2(mipSize)) / uint(vt.tileSize), lastPage);
+
+    outPage = (mip << 28) | (page.y << 14) | page.x;
+}
@@ -0,0 +1,39 @@
+#version 450
+
+// Indirection backend of VirtualTexture: the page table points every page at the physical texture
+// slot of its finest resident ancestor, whose border texels make bilinear filtering seamless.
+layout(push_constant) uniform VirtualTextureConstants {
+    vec2 virtualSize;
+    vec2 physicalSize;
+    float tileSize;
+    float border;
+    float maxMip;
+    float feedbackBias;
+} vt;
+
+layout(binding = 1) uniform usampler2D pageTable;
+layout(binding = 2) uniform sampler2D physicalTexture;
+
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec2 uv = clamp(fragTexCoord, 0.0, 1.0);
+    vec2 texel = uv * vt.virtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    uint mip = uint(clamp(floor(lod), 0.0, vt.maxMip));
+
+    uvec2 mipSize = max(uvec2(vt.virtualSize) >> mip, uvec2(1));
+    uvec2 page = min(uvec2(uv * vec2(mipSize)) / uint(vt.tileSize), (mipSize - 1) / uint(vt.tileSize));
+    uvec4 entry = texelFetch(pageTable, ivec2(page), int(mip));
+
+    // The entry may belong to a coarser mip than the one asked for.
+    vec2 residentTexel = uv * vec2(max(uvec2(vt.virtualSize) >> entry.z, uvec2(1)));
+    vec2 inTile = residentTexel - floor(residentTexel / vt.tileSize) * vt.tileSize;
+    vec2 physical = vec2(entry.xy) * (vt.tileSize + 2.0 * vt.border) + vt.border + inTile;
+
+    outColor = textureLod(physicalTexture, physical / vt.physicalSize, 0.0);
+}
@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_sparse_texture2 : require
+
+// Sparse backend of VirtualTexture: non resident pages fail the residency test and fall back to
+// coarser mips until one is resident. Needs the shaderResourceResidency feature.
+layout(push_constant) uniform VirtualTextureConstants {
+    vec2 virtualSize;
+    vec2 physicalSize;
+    float tileSize;
+    float border;
+    float maxMip;
+    float feedbackBias;
+} vt;
+
+layout(binding = 2) uniform sampler2D virtualTexture;
+
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec2 texel = fragTexCoord * vt.virtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, vt.maxMip);
+
+    vec4 color;
+    int residency = sparseTextureLodARB(virtualTexture, fragTexCoord, lod, color);
+    while (!sparseTexelsResidentARB(residency) && lod < vt.maxMip) {
+        lod = min(floor(lod) + 1.0, vt.maxMip);
+        residency = sparseTextureLodARB(virtualTexture, fragTexCoord, lod, color);
+    }
+
+    outColor = color;
+}